@@ -10,16 +10,633 @@
 #include <regex> 
 #include <cstdlib>  
 #include <ctime>
-#include <conio.h>
-#include <windows.h>
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <random>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <condition_variable>
+#include <coroutine>
+#include <memory>
+#include <set>
+#include <unordered_set>
+#if defined(_WIN32)
+#include <conio.h>
+#include <windows.h>
+#include <psapi.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#else
+#define HAVE_SSE2 0
+#endif
 using namespace std;
 
+// Timers and posted tasks run on the console thread while it waits for the
+// user, so orders keep moving while a screen is open. Any thread may post a
+// task; a wake-up pipe (an event on Windows) interrupts the wait for it.
+// Waiting for input returns once a whole line is ready: on a POSIX
+// terminal that is when the line is entered, in a Windows console when the
+// first key is pressed, as its line editor only runs inside the read.
+class EventLoop {
+public:
+    using Task = function<void()>;
+private:
+    struct Timer {
+        chrono::steady_clock::time_point due;
+        chrono::milliseconds period;
+        Task task;
+    };
+    map<int, Timer> timers;         // a handful, so a scan beats a heap
+    int nextTimer = 1;
+    mutex postedLock;
+    vector<Task> posted;
+    bool inside = false;            // a task is running; no nested waits
+    bool inputIsTerminal;
+#if defined(_WIN32)
+    HANDLE wakeEvent;
+#else
+    int wakePipe[2] = {-1, -1};
+#endif
+
+    static EventLoop*& attachedLoop() {
+        static EventLoop* loop = nullptr;
+        return loop;
+    }
+    void drainWakeups() {
+#if !defined(_WIN32)
+        char buffer[64];
+        while (read(wakePipe[0], buffer, sizeof(buffer)) > 0) {}
+#endif
+    }
+    // Blocks until input, a wake-up or `deadline`; true if input is ready.
+    bool block(chrono::steady_clock::time_point deadline, bool watchInput) {
+        auto left = deadline - chrono::steady_clock::now();
+        // Whole milliseconds, rounded up so timers are never early.
+        long long wait = max<long long>(0, chrono::ceil<chrono::milliseconds>(left).count());
+        int timeout = static_cast<int>(min<long long>(wait, numeric_limits<int>::max()));
+#if defined(_WIN32)
+        HANDLE handles[2] = {wakeEvent, GetStdHandle(STD_INPUT_HANDLE)};
+        DWORD result = WaitForMultipleObjects(watchInput ? 2 : 1, handles, FALSE, static_cast<DWORD>(timeout));
+        // _kbhit consumes focus and mouse records, leaving only key presses.
+        return result == WAIT_OBJECT_0 + 1 && _kbhit();
+#else
+        pollfd fds[2] = {{wakePipe[0], POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+#if defined(__linux__)
+        // ppoll takes the wait in nanoseconds, so timers aren't held to the next millisecond.
+        long long nanos = max<long long>(0, chrono::duration_cast<chrono::nanoseconds>(left).count());
+        if (timeout < numeric_limits<int>::max()) {
+            timespec span = {static_cast<time_t>(nanos / 1000000000), static_cast<long>(nanos % 1000000000)};
+            if (ppoll(fds, watchInput ? 2 : 1, &span, nullptr) <= 0) return false;
+        } else if (poll(fds, watchInput ? 2 : 1, timeout) <= 0) {
+            return false;
+        }
+#else
+        if (poll(fds, watchInput ? 2 : 1, timeout) <= 0) return false;
+#endif
+        if (fds[0].revents & POLLIN) drainWakeups();
+        return watchInput && (fds[1].revents & (POLLIN | POLLHUP | POLLERR));
+#endif
+    }
+    // Runs posted tasks and due timers; returns when the next timer is due.
+    chrono::steady_clock::time_point runDue() {
+        inside = true;
+        vector<Task> tasks;
+        {
+            lock_guard<mutex> guard(postedLock);
+            tasks.swap(posted);
+        }
+        for (Task& task : tasks) task();
+        auto now = chrono::steady_clock::now();
+        vector<int> due;
+        for (const auto& entry : timers) {
+            if (entry.second.due <= now) due.push_back(entry.first);
+        }
+        for (int id : due) {
+            auto it = timers.find(id);
+            if (it == timers.end()) continue;   // cancelled by an earlier task
+            Task task = it->second.task;
+            if (it->second.period.count() > 0) {
+                it->second.due = max(it->second.due + it->second.period, now);
+            } else {
+                timers.erase(it);
+            }
+            task();
+        }
+        inside = false;
+        now = chrono::steady_clock::now();
+        auto next = now + chrono::hours(1);
+        for (const auto& entry : timers) next = min(next, entry.second.due);
+        lock_guard<mutex> guard(postedLock);
+        return posted.empty() ? next : now;
+    }
+
+public:
+    EventLoop() {
+#if defined(_WIN32)
+        inputIsTerminal = _isatty(_fileno(stdin)) != 0;
+        wakeEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+#else
+        inputIsTerminal = isatty(STDIN_FILENO) != 0;
+        if (pipe(wakePipe) == 0) {
+            for (int fd : wakePipe) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+#endif
+    }
+    ~EventLoop() {
+        detach();
+#if defined(_WIN32)
+        CloseHandle(wakeEvent);
+#else
+        for (int fd : wakePipe) if (fd >= 0) close(fd);
+#endif
+    }
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    static EventLoop* attached() { return attachedLoop(); }
+    // Console input waits in this loop until detach.
+    void attach() { attachedLoop() = this; }
+    void detach() {
+        if (attachedLoop() == this) attachedLoop() = nullptr;
+    }
+
+    // Runs `task` every `period`, first after one period; returns its id.
+    int every(chrono::milliseconds period, Task task) {
+        int id = nextTimer++;
+        timers[id] = Timer{chrono::steady_clock::now() + period, period, move(task)};
+        return id;
+    }
+    int after(chrono::milliseconds delay, Task task) {
+        int id = nextTimer++;
+        timers[id] = Timer{chrono::steady_clock::now() + delay, chrono::milliseconds(0), move(task)};
+        return id;
+    }
+    void cancel(int id) { timers.erase(id); }
+    // Safe from any thread.
+    void post(Task task) {
+        {
+            lock_guard<mutex> guard(postedLock);
+            posted.push_back(move(task));
+        }
+#if defined(_WIN32)
+        SetEvent(wakeEvent);
+#else
+        ssize_t written = write(wakePipe[1], "", 1);   // a full pipe already means "wake up"
+        (void)written;
+#endif
+    }
+    // Runs the loop until the user has entered something. Input that is
+    // not a terminal is always ready, so due work runs once and it returns.
+    void waitForInput() {
+        if (inside) return;
+        do {
+            chrono::steady_clock::time_point next = runDue();
+            if (!inputIsTerminal) return;
+            if (block(next, true)) return;
+        } while (true);
+    }
+    // Runs the loop without watching input, for `duration`.
+    void runFor(chrono::milliseconds duration) {
+        auto end = chrono::steady_clock::now() + duration;
+        while (chrono::steady_clock::now() < end) {
+            chrono::steady_clock::time_point next = runDue();
+            block(min(next, end), false);
+        }
+    }
+};
+
+// Screens are drawn into an in-memory frame of character cells instead of
+// straight to the console. When the program next waits for input the frame
+// is compared with what the terminal shows and only the changed cells go
+// out, as ANSI escapes in a single write. While attached it stands in for
+// cout's buffer; cin is wrapped so echoed input lands in the frame too.
+class ConsoleRenderer : public streambuf {
+    struct Cell {
+        char ch;
+        uint8_t attribute;          // console colour: low nibble text, high nibble background
+        bool operator==(const Cell& other) const { return ch == other.ch && attribute == other.attribute; }
+        bool operator!=(const Cell& other) const { return !(*this == other); }
+    };
+    // Hands cin's characters through, drawing the frame before blocking.
+    class Input : public streambuf {
+    public:
+        Input(ConsoleRenderer& screen, streambuf* source, bool echoes)
+            : screen(screen), source(source), echoes(echoes) {}
+        streambuf* original() const { return source; }
+    protected:
+        int_type underflow() override {
+            screen.present();
+            // Mid-line the rest is already buffered, so only wait at line starts.
+            if (lineStart) {
+                if (EventLoop* loop = EventLoop::attached()) loop->waitForInput();
+            }
+            int_type c = source->sbumpc();
+            if (traits_type::eq_int_type(c, traits_type::eof())) return c;
+            size_t n = 0;
+            buffer[n++] = traits_type::to_char_type(c);
+            while (buffer[n - 1] != '\n' && n < sizeof(buffer) && source->in_avail() > 0) {
+                buffer[n++] = traits_type::to_char_type(source->sbumpc());
+            }
+            if (echoes) screen.echo(buffer, n);
+            lineStart = buffer[n - 1] == '\n';
+            setg(buffer, buffer, buffer + n);
+            return traits_type::to_int_type(buffer[0]);
+        }
+    private:
+        ConsoleRenderer& screen;
+        streambuf* source;
+        bool echoes;                // the terminal shows what is typed
+        bool lineStart = true;
+        char buffer[256];
+    };
+
+    static const Cell blank;
+    static ConsoleRenderer*& attachedRenderer() {
+        static ConsoleRenderer* renderer = nullptr;
+        return renderer;
+    }
+
+    function<void(const string&)> write;
+    int width, height;
+    vector<Cell> back;              // frame being built, rows of `width` cells, may outgrow the screen
+    vector<Cell> front;             // what the terminal shows, height * width
+    int frontTop = 0;               // frame row shown on the top screen row
+    int row = 0, column = 0;        // where the next character goes
+    uint8_t attribute = 7;
+    bool redrawAll = true;
+    bool pending = false;           // frame has changes not yet written
+    chrono::steady_clock::time_point pendingSince;
+    int shownRow = -1, shownColumn = -1, shownAttribute = -1;
+    int shownRows = 0;              // screen rows the last frame covered
+    string status;                  // kept on the bottom row when the frame leaves it free
+    streambuf* originalOutput = nullptr;
+    unique_ptr<Input> input;
+    recursive_mutex lock;           // worker threads print too
+
+    static bool terminalSize(int& columns, int& rows) {
+#if defined(_WIN32)
+        CONSOLE_SCREEN_BUFFER_INFO info;
+        if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) return false;
+        columns = info.srWindow.Right - info.srWindow.Left + 1;
+        rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+#else
+        winsize size;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 || size.ws_col == 0) return false;
+        columns = size.ws_col;
+        rows = size.ws_row;
+#endif
+        return columns > 0 && rows > 0;
+    }
+    static bool isTerminal(FILE* stream) {
+#if defined(_WIN32)
+        return _isatty(_fileno(stream)) != 0;
+#else
+        return isatty(fileno(stream)) != 0;
+#endif
+    }
+public:
+    // SGR for a console colour byte; its bits are intensity, red, green, blue.
+    static void appendAttribute(string& out, uint8_t value) {
+        static const int ansi[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+        int text = value & 15, background = value >> 4;
+        out += "\x1b[0;";
+        out += to_string((text & 8 ? 90 : 30) + ansi[text & 7]);
+        if (background) {
+            out += ';';
+            out += to_string((background & 8 ? 100 : 40) + ansi[background & 7]);
+        }
+        out += 'm';
+    }
+private:
+    static void appendMove(string& out, int screenRow, int screenColumn) {
+        out += "\x1b[" + to_string(screenRow + 1) + ";" + to_string(screenColumn + 1) + "H";
+    }
+    void appendCells(string& out, const Cell* cells, int count, int& current) {
+        for (int i = 0; i < count; i++) {
+            if (cells[i].attribute != current) {
+                appendAttribute(out, cells[i].attribute);
+                current = cells[i].attribute;
+            }
+            out += cells[i].ch;
+        }
+    }
+    // Brings one screen row up to `cells`.
+    void appendRow(string& out, int screenRow, const Cell* cells, int& current) {
+        Cell* shown = &front[static_cast<size_t>(screenRow) * width];
+        int first = 0, last = width - 1;
+        while (first < width && cells[first] == shown[first]) first++;
+        if (first == width) return;
+        while (cells[last] == shown[last]) last--;
+        int ink = width;
+        while (ink > first && cells[ink - 1] == blank) ink--;
+        appendMove(out, screenRow, first);
+        if (ink <= last) {
+            appendCells(out, cells + first, ink - first, current);
+            out += "\x1b[0m\x1b[K";
+            current = -1;
+        } else {
+            appendCells(out, cells + first, last - first + 1, current);
+        }
+        copy(cells + first, cells + last + 1, shown + first);
+    }
+    vector<Cell> statusCells() const {
+        vector<Cell> cells(width, blank);
+        for (size_t i = 0; i < status.size() && i < cells.size(); i++) cells[i] = Cell{status[i], 8};
+        return cells;
+    }
+    Cell* cellAt(int r) {
+        if (back.size() < static_cast<size_t>(r + 1) * width) back.resize(static_cast<size_t>(r + 1) * width, blank);
+        return &back[static_cast<size_t>(r) * width];
+    }
+    int frameRows() const { return max(static_cast<int>(back.size() / width), row + 1); }
+    void put(char c) {
+        switch (c) {
+        case '\n':
+            row++;
+            column = 0;
+            break;
+        case '\r':
+            column = 0;
+            break;
+        case '\t':
+            do put(' '); while (column % 8 != 0 && column < width);
+            break;
+        case '\b':
+            if (column > 0) column--;
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 32) break;
+            if (column >= width) {
+                row++;
+                column = 0;
+            }
+            cellAt(row)[column++] = Cell{c, attribute};
+        }
+    }
+    // Input the terminal has already shown: into the frame and the screen copy.
+    void echo(const char* text, size_t n) {
+        lock_guard<recursive_mutex> guard(lock);
+        for (size_t i = 0; i < n; i++) {
+            int r = row, c = column >= width ? 0 : column;
+            if (column >= width && text[i] != '\n') r++;
+            put(text[i]);
+            int screenRow = r - frontTop;
+            if (text[i] >= 32 && screenRow >= 0 && screenRow < height) {
+                front[static_cast<size_t>(screenRow) * width + c] = cellAt(r)[c];
+            }
+        }
+        shownRow = row;
+        shownColumn = column;
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+        char ch = traits_type::to_char_type(c);
+        xsputn(&ch, 1);
+        return c;
+    }
+    streamsize xsputn(const char* text, streamsize n) override {
+        lock_guard<recursive_mutex> guard(lock);
+        if (!pending) {
+            pending = true;
+            pendingSince = chrono::steady_clock::now();
+        }
+        for (streamsize i = 0; i < n; i++) put(text[i]);
+        return n;
+    }
+    // endl and flush land here; a screen built in one go is only drawn when
+    // input is awaited, but long-running output still shows progress.
+    int sync() override {
+        lock_guard<recursive_mutex> guard(lock);
+        if (pending && chrono::steady_clock::now() - pendingSince >= chrono::milliseconds(50)) present();
+        return 0;
+    }
+
+public:
+    ConsoleRenderer(int width, int height, function<void(const string&)> write)
+        : write(move(write)), width(max(width, 1)), height(max(height, 1)),
+          front(static_cast<size_t>(this->width) * this->height, blank) {}
+    // Sized to the terminal, writing to stdout.
+    ConsoleRenderer() : ConsoleRenderer(80, 25, [](const string& bytes) {
+        fwrite(bytes.data(), 1, bytes.size(), stdout);
+        fflush(stdout);
+    }) {
+        terminalSize(width, height);
+        front.assign(static_cast<size_t>(width) * height, blank);
+    }
+    ~ConsoleRenderer() { detach(); }
+    ConsoleRenderer(const ConsoleRenderer&) = delete;
+    ConsoleRenderer& operator=(const ConsoleRenderer&) = delete;
+
+    // True when stdout is a terminal that understands ANSI escapes;
+    // switches a Windows console into that mode.
+    static bool enableAnsi() {
+        if (!isTerminal(stdout)) return false;
+#if defined(_WIN32)
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+        HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD mode = 0;
+        if (!GetConsoleMode(console, &mode)) return false;
+        return SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING) != 0;
+#else
+        return true;
+#endif
+    }
+    static ConsoleRenderer* attached() { return attachedRenderer(); }
+    // Routes cout and cin through this renderer until detach.
+    void attach() {
+        if (attachedRenderer()) attachedRenderer()->detach();
+        cout.flush();
+        originalOutput = cout.rdbuf(this);
+        input.reset(new Input(*this, cin.rdbuf(), isTerminal(stdin)));
+        cin.rdbuf(input.get());
+        attachedRenderer() = this;
+        redrawAll = true;
+    }
+    void detach() {
+        if (attachedRenderer() != this) return;
+        present();
+        write("\x1b[0m");
+        cout.rdbuf(originalOutput);
+        cin.rdbuf(input->original());
+        attachedRenderer() = nullptr;
+        input.reset();
+    }
+    // Starts a new screen; nothing is written until the next present.
+    void clear() {
+        lock_guard<recursive_mutex> guard(lock);
+        back.clear();
+        row = column = 0;
+        pending = true;
+        pendingSince = chrono::steady_clock::now();
+        if (write && attachedRenderer() == this) {
+            int columns = width, rows = height;
+            if (terminalSize(columns, rows) && (columns != width || rows != height)) {
+                width = columns;
+                height = rows;
+                redrawAll = true;
+            }
+        }
+    }
+    void setAttribute(int color) {
+        lock_guard<recursive_mutex> guard(lock);
+        attribute = static_cast<uint8_t>(color);
+    }
+    int getAttribute() const { return attribute; }
+    // Replaces the status row and redraws just that row, leaving the cursor
+    // where the user is typing.
+    void setStatus(const string& text) {
+        lock_guard<recursive_mutex> guard(lock);
+        if (text == status) return;
+        status = text;
+        if (redrawAll || shownRows >= height) return;
+        string out;
+        int current = -1;
+        vector<Cell> statusRow = statusCells();
+        appendRow(out, height - 1, statusRow.data(), current);
+        if (out.empty()) return;
+        write("\x1b[?25l\0337" + out + "\0338\x1b[?25h");   // restoring also brings back the colour
+    }
+    // Writes the difference between the frame and the screen, returning the
+    // number of bytes sent.
+    size_t present() {
+        lock_guard<recursive_mutex> guard(lock);
+        int rows = frameRows();
+        cellAt(rows - 1);
+        int top = max(0, rows - height);
+        string out;
+        int current = shownAttribute;
+        if (redrawAll || top != frontTop) {
+            front.assign(static_cast<size_t>(width) * height, blank);
+            out += "\x1b[0m\x1b[H\x1b[2J";
+            current = -1;
+            if (top > 0) {
+                // Taller than the screen: print it all and let the terminal
+                // scroll, so earlier lines stay in its scrollback.
+                for (int r = 0; r < rows; r++) {
+                    const Cell* cells = &back[static_cast<size_t>(r) * width];
+                    int ink = width;
+                    while (ink > 0 && cells[ink - 1] == blank) ink--;
+                    appendCells(out, cells, ink, current);
+                    if (r + 1 < rows) out += "\r\n";
+                }
+                copy(back.begin() + static_cast<ptrdiff_t>(top) * width, back.end(), front.begin());
+            }
+        }
+        if (front.size() != static_cast<size_t>(width) * height) front.assign(static_cast<size_t>(width) * height, blank);
+        vector<Cell> empty(width, blank), statusRow = statusCells();
+        for (int screenRow = 0; screenRow < height; screenRow++) {
+            const Cell* cells = top + screenRow < rows ? &back[static_cast<size_t>(top + screenRow) * width]
+                                : screenRow == height - 1 ? statusRow.data() : empty.data();
+            appendRow(out, screenRow, cells, current);
+        }
+        int cursorColumn = min(column, width - 1);
+        if (!out.empty() || row != shownRow || cursorColumn != shownColumn) {
+            appendMove(out, row - top, cursorColumn);
+        }
+        if (current != attribute) appendAttribute(out, attribute);
+        redrawAll = false;
+        pending = false;
+        frontTop = top;
+        shownRows = rows - top;
+        shownRow = row;
+        shownColumn = cursorColumn;
+        shownAttribute = attribute;
+        if (out.empty()) return 0;
+        out = "\x1b[?25l" + out + "\x1b[?25h";
+        write(out);
+        return out.size();
+    }
+};
+const ConsoleRenderer::Cell ConsoleRenderer::blank = {' ', 7};
+
 void setcolor(int color){
+    if (ConsoleRenderer* screen = ConsoleRenderer::attached()) {
+        screen->setAttribute(color);
+        return;
+    }
+#if defined(_WIN32)
     HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
     SetConsoleTextAttribute(hConsole, color);
+#else
+    // The same colour byte as an SGR sequence, left out when output is piped.
+    static const bool terminal = isatty(STDOUT_FILENO) != 0;
+    if (!terminal) return;
+    string sequence;
+    ConsoleRenderer::appendAttribute(sequence, static_cast<uint8_t>(color));
+    cout << sequence;
+#endif
+}
+
+// Starts a new screen: in the frame when one is attached, otherwise the
+// console is cleared the old way.
+void clearScreen() {
+    if (ConsoleRenderer* screen = ConsoleRenderer::attached()) {
+        screen->clear();
+        return;
+    }
+#if defined(_WIN32)
+    system("cls");
+#else
+    if (isatty(STDOUT_FILENO)) cout << "\x1b[2J\x1b[H" << flush;
+#endif
+}
+
+// Draws any pending frame before blocking on a key press.
+int readKey() {
+    if (ConsoleRenderer* screen = ConsoleRenderer::attached()) screen->present();
+#if defined(_WIN32)
+    if (EventLoop* loop = EventLoop::attached()) loop->waitForInput();
+    return _getch();
+#else
+    // One key without echo or Enter, as _getch reads it: the terminal leaves
+    // line mode first, so the loop's wait also ends on a single key.
+    termios saved;
+    bool raw = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved) == 0;
+    if (raw) {
+        termios keys = saved;
+        keys.c_lflag &= ~(ICANON | ECHO);
+        keys.c_cc[VMIN] = 1;
+        keys.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &keys);
+    }
+    if (EventLoop* loop = EventLoop::attached()) loop->waitForInput();
+    int key = getchar();
+    if (raw) tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    return key;
+#endif
 }
 
 class MenuItem;
@@ -38,9 +655,19 @@ public:
     Address(string street, string c, string zip)
         : streetAddress(street), city(c), zipCode(zip) {}
     
+    string getStreet() const { return streetAddress; }
+    string getCity() const { return city; }
+    string getZipCode() const { return zipCode; }
+
     string getFullAddress() const {
         return streetAddress + ", " + city +  " " + zipCode;
     }
+    bool operator==(const Address& other) const {
+        return streetAddress == other.streetAddress && city == other.city && zipCode == other.zipCode;
+    }
+    size_t memoryBytes() const {
+        return sizeof(Address) + streetAddress.capacity() + city.capacity() + zipCode.capacity();
+    }
 
     // For serialization
     string serialize() const {
@@ -92,9 +719,20 @@ public:
         if (number[0] == '6') return "Discover";
         return "Unknown";
     }
+    string getCardNumber() const { return cardNumber; }
+    string getCardType() const { return cardType; }
+    string getExpiryDate() const { return expiryDate; }
+    string getCvv() const { return cvv; }
     string getMaskedCardNumber() const {
         return "****-****-****-" + cardNumber.substr(12);
     }
+    bool operator==(const Payment& other) const {
+        return cardNumber == other.cardNumber && cardType == other.cardType && expiryDate == other.expiryDate &&
+               cvv == other.cvv;
+    }
+    size_t memoryBytes() const {
+        return sizeof(Payment) + cardNumber.capacity() + cardType.capacity() + expiryDate.capacity() + cvv.capacity();
+    }
     // For serialization
     string serialize() const {
         // Store cardNumber, cardType, expiryDate, cvv separated by '|'
@@ -111,6 +749,90 @@ public:
     }
 };
 
+// Hash-consed immutable values. Equal values share one heap copy, found by
+// a hash of their serialized form and deleted with the last reference.
+// Orders keep their address and payment here, so a repeat customer's card
+// and address are held once however many orders carry them.
+template<typename T>
+class ValueStore {
+private:
+    // The shared copy with its bookkeeping; callers only see the T part.
+    struct Entry : T {
+        size_t hash;
+        size_t refs = 1;
+        Entry(const T& value, size_t h) : T(value), hash(h) {}
+    };
+    mutable mutex lock;
+    unordered_multimap<size_t, Entry*> entries;
+    size_t references = 0;
+
+public:
+    ValueStore() = default;
+    ValueStore(const ValueStore&) = delete;
+    ValueStore& operator=(const ValueStore&) = delete;
+
+    // Takes ownership of `fresh` and returns the shared copy of its value.
+    const T* intern(T* fresh) {
+        if (!fresh) return nullptr;
+        const T* shared = intern(*fresh);
+        delete fresh;
+        return shared;
+    }
+    const T* intern(const T& value) {
+        size_t hash = std::hash<string>()(value.serialize());
+        lock_guard<mutex> guard(lock);
+        references++;
+        auto range = entries.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (*it->second == value) {
+                it->second->refs++;
+                return it->second;
+            }
+        }
+        Entry* entry = new Entry(value, hash);
+        entries.emplace(hash, entry);
+        return entry;
+    }
+    void release(const T* value) {
+        if (!value) return;
+        Entry* entry = static_cast<Entry*>(const_cast<T*>(value));
+        lock_guard<mutex> guard(lock);
+        references--;
+        if (--entry->refs > 0) return;
+        auto range = entries.equal_range(entry->hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == entry) {
+                entries.erase(it);
+                break;
+            }
+        }
+        delete entry;
+    }
+
+    size_t size() const {
+        lock_guard<mutex> guard(lock);
+        return entries.size();
+    }
+    size_t referenceCount() const {
+        lock_guard<mutex> guard(lock);
+        return references;
+    }
+    size_t memoryBytes() const {
+        lock_guard<mutex> guard(lock);
+        size_t bytes = entries.bucket_count() * sizeof(void*);
+        for (const auto& entry : entries) {
+            bytes += entry.second->memoryBytes() + sizeof(Entry) - sizeof(T) + sizeof(entry) + sizeof(void*);
+        }
+        return bytes;
+    }
+
+    // Never destroyed, so orders that outlive main's locals can still let go.
+    static ValueStore& shared() {
+        static ValueStore* store = new ValueStore();
+        return *store;
+    }
+};
+
 class MenuItem {
 private:
     string id;
@@ -118,10 +840,13 @@ private:
     double price;
     string category;
     int preparationTime; 
+    int menuIndex = -1;   // position in the restaurant's catalogue
 public:
     MenuItem(string i, string n, double p, string c, int pt)
         : id(i), name(n), price(p), category(c), preparationTime(pt) {}
     string getId() const { return id; }
+    int getIndex() const { return menuIndex; }
+    void setIndex(int index) { menuIndex = index; }
     string getName() const { return name; }
     double getPrice() const { return price; }
     string getCategory() const { return category; }
@@ -151,8 +876,17 @@ private:
         items.push_back(node->data);
         inorderTraversal(node->right, items);
     }
+    void destroy(Node* node) {
+        if (!node) return;
+        destroy(node->left);
+        destroy(node->right);
+        delete node;
+    }
 public:
     BST() : root(nullptr) {}
+    BST(const BST&) = delete;
+    BST& operator=(const BST&) = delete;
+    ~BST() { destroy(root); }
     void insert(const T& item) {
         root = insert(root, item);
     }
@@ -162,174 +896,5642 @@ public:
         return items;
     }
 };
+// Highest priority first; equal priorities leave in the order they came.
+// A binary heap on (priority, arrival), so admitting an order is O(log n)
+// however many are waiting.
 template<typename T>
 class OrderQueue {
 private:
     struct Node {
         T data;
         int priority;
-        Node* next;
-        Node(T d, int p) : data(d), priority(p), next(nullptr) {}
+        uint64_t arrival;
+        bool operator<(const Node& other) const {
+            if (priority != other.priority) return priority < other.priority;
+            return arrival > other.arrival;
+        }
     };
-    Node* head; 
+    vector<Node> heap;
+    uint64_t arrivals = 0;
 public:
-    OrderQueue() : head(nullptr) {}
     void push(T item, int priority) {
-        Node* newNode = new Node(item, priority);
-        
-        if (!head || priority > head->priority) {
-            newNode->next = head;
-            head = newNode;
-        } else {
-            Node* current = head;
-            while (current->next && current->next->priority >= priority) {
-                current = current->next;
-            }
-            newNode->next = current->next;
-            current->next = newNode;
-        }
+        heap.push_back(Node{item, priority, arrivals++});
+        push_heap(heap.begin(), heap.end());
     }
     T pop() {
-        if (!head) throw runtime_error("Queue is empty");
-        Node* temp = head;
-        T item = temp->data;
-        head = head->next;
-        delete temp;
+        if (heap.empty()) throw runtime_error("Queue is empty");
+        pop_heap(heap.begin(), heap.end());
+        T item = heap.back().data;
+        heap.pop_back();
         return item;
     }
-    bool empty() const { return head == nullptr; }
+    bool empty() const { return heap.empty(); }
+    size_t size() const { return heap.size(); }
 };
 
-class Order {
+// Vector that keeps its first N elements inside the object and only goes to
+// the heap past that. Meant for small trivially copyable values.
+template<typename T, size_t N>
+class SmallVector {
 private:
-    string orderId;
-    vector<MenuItem*> items;
-    double totalAmount;
-    string customerName;
-    string status;
-    chrono::system_clock::time_point orderTime;
-    Address* deliveryAddress;
-    Payment* paymentInfo;
-    string phoneNumber;
-    string specialInstructions;
+    T inlineData[N];
+    T* heapData;
+    uint32_t count;
+    uint32_t capacity;
+
+    T* data() { return heapData ? heapData : inlineData; }
+    const T* data() const { return heapData ? heapData : inlineData; }
 public:
-    Order(string id, string name, Address* addr, Payment* payment, string phone) 
-        : orderId(id), customerName(name), totalAmount(0.0), 
-          status("Pending"), orderTime(chrono::system_clock::now()),
-          deliveryAddress(addr), paymentInfo(payment), phoneNumber(phone) {}
-    
-    void addItem(MenuItem* item) {
-        items.push_back(item);
-        totalAmount += item->getPrice();
+    SmallVector() : heapData(nullptr), count(0), capacity(N) {}
+    SmallVector(const SmallVector& other) : heapData(nullptr), count(0), capacity(N) {
+        *this = other;
     }
-    string getId() const { return orderId; }
-    double getTotal() const { return totalAmount; }
-    string getStatus() const { return status; }
-    void setStatus(string s) { status = s; }
-    string getCustomerName() const { return customerName; }
-    const vector<MenuItem*>& getItems() const { return items; }
-    void setSpecialInstructions(const string& instructions) {
-        specialInstructions = instructions;
+    SmallVector& operator=(const SmallVector& other) {
+        if (this == &other) return *this;
+        count = 0;
+        for (const T& value : other) push_back(value);
+        return *this;
     }
-    string getDeliveryAddress() const {
-        return deliveryAddress ? deliveryAddress->getFullAddress() : "No address provided";
+    ~SmallVector() { delete[] heapData; }
+
+    void push_back(const T& value) {
+        if (count == capacity) {
+            T* grown = new T[capacity * 2];
+            copy(begin(), end(), grown);
+            delete[] heapData;
+            heapData = grown;
+            capacity *= 2;
+        }
+        data()[count++] = value;
     }
-    string getPaymentInfo() const {
-        return paymentInfo ? paymentInfo->getMaskedCardNumber() : "No payment info";
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    bool onHeap() const { return heapData != nullptr; }
+    T& operator[](size_t i) { return data()[i]; }
+    const T& operator[](size_t i) const { return data()[i]; }
+    T* begin() { return data(); }
+    T* end() { return data() + count; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + count; }
+};
+
+// One line of an order: which menu item (by catalogue index) and how many.
+struct OrderLine {
+    uint16_t menuIndex;
+    uint16_t quantity;
+};
+
+// Fixed part of the menu. Lives in the binary as a constexpr table so the
+// catalogue needs no allocation and its ids can be hashed at compile time.
+struct CatalogEntry {
+    const char* id;
+    const char* name;
+    double price;
+    const char* category;
+    int prepTime;
+};
+
+constexpr CatalogEntry baseMenu[] = {
+    {"CH1", "Kung Pao Chicken", 15.99, "Chinese Food", 25},
+    {"CH2", "Sweet & Sour Pork", 16.99, "Chinese Food", 25},
+    {"CH3", "Chow Mein", 13.99, "Chinese Food", 20},
+    {"CH4", "Spring Rolls", 7.99, "Chinese Food", 15},
+    {"CH5", "Fried Rice", 11.99, "Chinese Food", 20},
+    {"IT1", "Spaghetti Carbonara", 14.99, "Italian Food", 25},
+    {"IT2", "Fettuccine Alfredo", 15.99, "Italian Food", 25},
+    {"IT3", "Lasagna", 16.99, "Italian Food", 30},
+    {"IT4", "Risotto", 17.99, "Italian Food", 30},
+    {"IT5", "Tiramisu", 8.99, "Italian Dessert", 10},
+    {"MX1", "Beef Tacos", 12.99, "Mexican Food", 20},
+    {"MX2", "Chicken Quesadilla", 13.99, "Mexican Food", 20},
+    {"MX3", "Beef Burrito", 14.99, "Mexican Food", 25},
+    {"MX4", "Nachos Supreme", 11.99, "Mexican Food", 15},
+    {"MX5", "Guacamole & Chips", 8.99, "Mexican Food", 10},
+    {"SF1", "Grilled Salmon", 19.99, "Seafood", 25},
+    {"SF2", "Fish & Chips", 16.99, "Seafood", 20},
+    {"SF3", "Shrimp Scampi", 18.99, "Seafood", 25},
+    {"SF4", "Lobster Tail", 29.99, "Seafood", 35},
+    {"SF5", "Calamari", 13.99, "Seafood", 20},
+    {"DF1", "Chicken Biryani", 16.99, "Desi Food", 25},
+    {"DF2", "Beef Karahi", 18.99, "Desi Food", 30},
+    {"DF3", "Chicken Tikka", 14.99, "Desi Food", 20},
+    {"DF4", "Seekh Kabab", 12.99, "Desi Food", 15},
+    {"DF5", "Nihari", 17.99, "Desi Food", 35},
+    {"DF6", "Butter Naan", 2.99, "Desi Food", 10},
+    {"DFD1", "Gulab Jamun", 5.99, "Desi Food Dessert", 5},
+    {"DFD2", "Kheer", 6.99, "Desi Food Dessert", 15},
+    {"DFB1", "Lassi", 4.99, "Desi Food Beverage", 5},
+    {"DFB2", "Chai", 2.99, "Desi Food Beverage", 5},
+    {"P1", "Margherita Pizza", 12.99, "Pizza", 20},
+    {"P2", "Pepperoni Pizza", 14.99, "Pizza", 20},
+    {"P3", "BBQ Chicken Pizza", 15.99, "Pizza", 20},
+    {"P4", "Vegetarian Pizza", 13.99, "Pizza", 20},
+    {"B1", "Classic Burger", 9.99, "Burger", 15},
+    {"B2", "Cheese Burger", 11.99, "Burger", 15},
+    {"B3", "Veggie Burger", 10.99, "Burger", 15},
+    {"S1", "Caesar Salad", 8.99, "Salad", 10},
+    {"S2", "Greek Salad", 9.99, "Salad", 10},
+    {"D1", "Chocolate Cake", 6.99, "Dessert", 5},
+    {"D2", "Ice Cream", 4.99, "Dessert", 5},
+    {"D3", "Apple Pie", 5.99, "Dessert", 5},
+    {"BV1", "Mango Juice", 6.99, "Beverage", 5},
+    {"BV2", "Lemonade", 4.99, "Beverage", 5},
+    {"BV3", "Water", 2.99, "Beverage", 5},
+    {"BV4", "Soda", 3.99, "Beverage", 5}
+};
+constexpr size_t baseMenuSize = sizeof(baseMenu) / sizeof(baseMenu[0]);
+
+// Seeded FNV-1a, usable both at compile time and at run time.
+constexpr uint32_t menuIdHash(const char* s, size_t len, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        h ^= static_cast<unsigned char>(s[i]);
+        h *= 16777619u;
     }
-    string getPhoneNumber() const { return phoneNumber; }
-    string getSpecialInstructions() const { return specialInstructions; }
+    return h ^ (h >> 15);
+}
 
-    // Serialization for file
-    string serialize() const {
-        stringstream ss;
-        ss << orderId << ",";
-        ss << customerName << ",";
-        ss << phoneNumber << ",";
-        ss << deliveryAddress->serialize() << ",";
-        ss << paymentInfo->serialize() << ",";
-        ss << fixed << setprecision(2) << totalAmount << ",";
-        ss << status << ",";
-        // serialize items as semicolon separated item ids
-        for (size_t i = 0; i < items.size(); ++i) {
-            ss << items[i]->getId();
-            if (i != items.size() - 1) ss << ";";
+constexpr size_t constLength(const char* s) {
+    size_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+// Slot table for the base menu: slot holds base index + 1, 0 for empty.
+struct PerfectHash {
+    static constexpr uint32_t slotCount = 256;
+    uint32_t seed;
+    uint8_t slots[slotCount];
+};
+
+// Tries seeds until every base id lands in its own slot. Seed 0 means none
+// was found (also the result when two entries share an id).
+constexpr PerfectHash buildMenuHash() {
+    PerfectHash table{};
+    for (uint32_t seed = 1; seed < 100000; seed++) {
+        for (uint32_t s = 0; s < PerfectHash::slotCount; s++) table.slots[s] = 0;
+        bool clash = false;
+        for (size_t i = 0; i < baseMenuSize && !clash; i++) {
+            const char* id = baseMenu[i].id;
+            uint32_t slot = menuIdHash(id, constLength(id), seed) % PerfectHash::slotCount;
+            if (table.slots[slot]) clash = true;
+            else table.slots[slot] = static_cast<uint8_t>(i + 1);
         }
-        ss << ",";
-        // serialize special instructions, escape commas by replacing them with \,
-        string escapedInstructions = specialInstructions;
-        size_t pos = 0;
-        while ((pos = escapedInstructions.find(',', pos)) != string::npos) {
-            escapedInstructions.replace(pos, 1, "\\,");
-            pos += 2;
+        if (!clash) {
+            table.seed = seed;
+            return table;
         }
-        ss << escapedInstructions;
-        return ss.str();
     }
+    table.seed = 0;
+    return table;
+}
 
-    static Order* deserialize(const string& data, const map<string, MenuItem*>& menuItems) {
-        stringstream ss(data);
-        string orderId, customerName, phoneNumber, addressStr, paymentStr, totalStr, status, itemsStr, specialInstr;
-        getline(ss, orderId, ',');
-        getline(ss, customerName, ',');
-        getline(ss, phoneNumber, ',');
-        getline(ss, addressStr, ',');
-        getline(ss, paymentStr, ',');
-        getline(ss, totalStr, ',');
-        getline(ss, status, ',');
-        getline(ss, itemsStr, ',');
-        getline(ss, specialInstr);
+constexpr PerfectHash menuHash = buildMenuHash();
+static_assert(baseMenuSize < 255, "base menu index must fit a hash slot");
+static_assert(menuHash.seed != 0, "base menu ids must be unique");
 
-        Address* address = Address::deserialize(addressStr);
-        Payment* payment = Payment::deserialize(paymentStr);
-        Order* order = new Order(orderId, customerName, address, payment, phoneNumber);
-        order->setStatus(status);
+// Epoch-based reclamation for data that is read without locks. A reader
+// announces the epoch it started in; a retired object is deleted only once
+// every active reader started after it was retired.
+class Rcu {
+public:
+    static constexpr int maxReaders = 128;
 
-        // Convert totalStr to double and set totalAmount directly (to avoid double adding)
-        double totalAmount = 0.0;
-        try {
-            totalAmount = stod(totalStr);
-        } catch(...) {}
-        order->totalAmount = totalAmount;
+    // Held while reading; guards nest within one thread.
+    class Guard {
+    public:
+        Guard() { enter(); }
+        ~Guard() { leave(); }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
 
-        // Parse item ids and resolve MenuItem pointers
-        stringstream ssItems(itemsStr);
-        string itemId;
-        while (getline(ssItems, itemId, ';')) {
-            if (menuItems.count(itemId)) {
-                order->items.push_back(menuItems.at(itemId));
-            }
+    // Starts a new epoch and returns it; objects retired now carry it.
+    static uint64_t advance() { return globalEpoch().fetch_add(1) + 1; }
+
+    // Oldest epoch any reader is still in, or UINT64_MAX when none are.
+    static uint64_t oldestActive() {
+        uint64_t oldest = UINT64_MAX;
+        for (int i = 0; i < maxReaders; i++) {
+            uint64_t e = slots()[i].epoch.load();
+            if (e != 0 && e < oldest) oldest = e;
         }
-        // Special instructions unescape
-        size_t pos = 0;
-        while ((pos = specialInstr.find("\\,", pos)) != string::npos) {
-            specialInstr.replace(pos, 2, ",");
-            pos += 1;
+        return oldest;
+    }
+private:
+    struct alignas(64) Slot {
+        atomic<uint64_t> epoch{0};
+        atomic<bool> used{false};
+    };
+    // One slot per thread, claimed on first read and freed when the thread ends.
+    struct Registration {
+        int slot = -1;
+        int depth = 0;
+        ~Registration() {
+            if (slot >= 0) slots()[slot].used.store(false);
         }
-        order->setSpecialInstructions(specialInstr);
+    };
 
-        return order;
+    static Slot* slots() {
+        static Slot table[maxReaders];
+        return table;
+    }
+    static atomic<uint64_t>& globalEpoch() {
+        static atomic<uint64_t> epoch{1};
+        return epoch;
+    }
+    static Registration& self() {
+        thread_local Registration registration;
+        return registration;
     }
 
-    ~Order() {
-        delete deliveryAddress;
-        delete paymentInfo;
+    static void enter() {
+        Registration& r = self();
+        if (r.depth++ > 0) return;
+        if (r.slot < 0) {
+            for (int i = 0; i < maxReaders && r.slot < 0; i++) {
+                bool expected = false;
+                if (slots()[i].used.compare_exchange_strong(expected, true)) r.slot = i;
+            }
+            if (r.slot < 0) {
+                r.depth--;
+                throw runtime_error("Too many reader threads");
+            }
+        }
+        slots()[r.slot].epoch.store(globalEpoch().load());
+    }
+    static void leave() {
+        Registration& r = self();
+        if (--r.depth == 0) slots()[r.slot].epoch.store(0);
     }
 };
 
-class Restaurant {
+// Pointer to an immutable object that readers load without locking. Writers
+// (serialised by the caller) publish a replacement; the old object is
+// deleted once no reader can still see it.
+template<typename T>
+class RcuPointer {
 private:
-    void quickSort(vector<Order*>& orders, int low, int high) {
-        if (low < high) {
-            // Use median-of-three pivot selection
-            int mid = low + (high - low) / 2;
-            if (orders[low]->getTotal() > orders[mid]->getTotal()) 
-                swap(orders[low], orders[mid]);
-            if (orders[mid]->getTotal() > orders[high]->getTotal())
-                swap(orders[mid], orders[high]);
-            if (orders[low]->getTotal() > orders[mid]->getTotal())
-                swap(orders[low], orders[mid]);
-            
+    struct Retired {
+        T* object;
+        uint64_t epoch;
+    };
+    atomic<T*> current;
+    vector<Retired> retired;   // writer side only
+public:
+    // Keeps the object it was created with alive for its whole lifetime.
+    class ReadGuard {
+    private:
+        Rcu::Guard guard;
+        const T* object;
+    public:
+        explicit ReadGuard(const atomic<T*>& source) : object(source.load()) {}
+        const T* get() const { return object; }
+        const T* operator->() const { return object; }
+        const T& operator*() const { return *object; }
+    };
+
+    explicit RcuPointer(T* initial) : current(initial) {}
+    RcuPointer(const RcuPointer&) = delete;
+    RcuPointer& operator=(const RcuPointer&) = delete;
+
+    ReadGuard read() const { return ReadGuard(current); }
+
+    void publish(T* next) {
+        T* old = current.exchange(next);
+        retired.push_back({old, Rcu::advance()});
+        reclaim();
+    }
+
+    // Deletes retired objects no reader can still hold. Returns how many remain.
+    size_t reclaim() {
+        uint64_t oldest = Rcu::oldestActive();
+        size_t kept = 0;
+        for (const Retired& r : retired) {
+            if (r.epoch <= oldest) delete r.object;
+            else retired[kept++] = r;
+        }
+        retired.resize(kept);
+        return kept;
+    }
+
+    ~RcuPointer() {
+        for (const Retired& r : retired) delete r.object;
+        delete current.load();
+    }
+};
+
+// The menu at one moment: which version of each item is on sale, the price
+// tree used for display, and id lookup. Never changed once published.
+struct MenuSnapshot {
+    uint64_t version = 0;
+    vector<MenuItem*> items;              // on sale, catalogue order
+    BST<MenuItem*> priceTree;
+    vector<MenuItem*> byPrice;            // priceTree in order, walked once
+    MenuItem* base[baseMenuSize] = {};    // base menu slot -> current version
+    unordered_map<string, MenuItem*> extra; // ids outside the base menu
+
+    MenuSnapshot() = default;
+    MenuSnapshot(const MenuSnapshot&) = delete;
+    MenuSnapshot& operator=(const MenuSnapshot&) = delete;
+
+    MenuItem* find(const string& id) const {
+        uint32_t slot = menuIdHash(id.data(), id.size(), menuHash.seed) % PerfectHash::slotCount;
+        int b = menuHash.slots[slot];
+        if (b && id == baseMenu[b - 1].id) return base[b - 1];
+        if (extra.empty()) return nullptr;
+        auto it = extra.find(id);
+        return it == extra.end() ? nullptr : it->second;
+    }
+};
+
+// Every version of every menu item, by menu index, plus the snapshot of what
+// is currently on sale. Versions are only ever appended, so an order keeps
+// pointing at the item (and price) it was placed with after a reload. The
+// base menu comes from the constexpr table and is found with one hash and
+// one compare. Reads take no lock; writers serialise on a mutex.
+// Versions past the base menu can be kept in a file and put back in their
+// places on the next start, so the indices the journal and the archive
+// store still name the same items.
+class MenuCatalog {
+private:
+    static constexpr size_t chunkBits = 10;
+    static constexpr size_t chunkSize = size_t(1) << chunkBits;
+    static constexpr size_t maxVersions = size_t(UINT16_MAX) + 1;  // OrderLine index range
+
+    vector<MenuItem> baseItems;                           // never resized
+    atomic<MenuItem**> chunks[maxVersions / chunkSize];   // menu index -> version
+    atomic<size_t> versionCount;
+    RcuPointer<MenuSnapshot> snapshot;
+    mutex writeLock;
+    unordered_map<string, MenuItem*> latest;              // id -> newest version; writer lock
+    string versionFile;                                   // empty until restoreVersions
+    atomic<size_t> savedVersions{0};
+
+    // Appends a version; writer lock held. Returns false when indices run out.
+    bool appendVersion(MenuItem* item) {
+        size_t index = versionCount.load();
+        if (index >= maxVersions) return false;
+        MenuItem** chunk = chunks[index >> chunkBits].load();
+        if (!chunk) {
+            chunk = new MenuItem*[chunkSize];
+            chunks[index >> chunkBits].store(chunk);
+        }
+        item->setIndex(static_cast<int>(index));
+        chunk[index & (chunkSize - 1)] = item;
+        latest[item->getId()] = item;
+        versionCount.store(index + 1);
+        return true;
+    }
+    static bool sameItem(const MenuItem* a, const MenuItem* b) {
+        return a->getName() == b->getName() && a->getPrice() == b->getPrice() &&
+               a->getCategory() == b->getCategory() && a->getPrepTime() == b->getPrepTime();
+    }
+
+    // Builds a snapshot selling exactly `items`. Ids must be unique.
+    MenuSnapshot* buildSnapshot(const vector<MenuItem*>& items, uint64_t version) const {
+        MenuSnapshot* next = new MenuSnapshot();
+        next->version = version;
+        next->items = items;
+        for (MenuItem* item : items) {
+            next->priceTree.insert(item);
+            const string& id = item->getId();
+            uint32_t slot = menuIdHash(id.data(), id.size(), menuHash.seed) % PerfectHash::slotCount;
+            int b = menuHash.slots[slot];
+            if (b && id == baseMenu[b - 1].id) next->base[b - 1] = item;
+            else next->extra[id] = item;
+        }
+        next->byPrice = next->priceTree.getInorder();
+        return next;
+    }
+
+    static MenuSnapshot* initialSnapshot() { return new MenuSnapshot(); }
+public:
+    typedef RcuPointer<MenuSnapshot>::ReadGuard View;
+
+    MenuCatalog() : versionCount(0), snapshot(initialSnapshot()) {
+        for (auto& chunk : chunks) chunk.store(nullptr);
+        baseItems.reserve(baseMenuSize);
+        for (const CatalogEntry& e : baseMenu) {
+            baseItems.emplace_back(e.id, e.name, e.price, e.category, e.prepTime);
+        }
+        vector<MenuItem*> onSale;
+        lock_guard<mutex> lock(writeLock);
+        for (MenuItem& item : baseItems) {
+            appendVersion(&item);
+            onSale.push_back(&item);
+        }
+        snapshot.publish(buildSnapshot(onSale, 1));
+    }
+    MenuCatalog(const MenuCatalog&) = delete;
+    MenuCatalog& operator=(const MenuCatalog&) = delete;
+
+    // What is on sale now. Hold the view for as long as its contents are used;
+    // item pointers stay valid after it is released.
+    View current() const { return snapshot.read(); }
+
+    MenuItem* find(const string& id) const { return current()->find(id); }
+
+    // Any version ever published, by menu index; nullptr past the last one.
+    MenuItem* operator[](size_t index) const {
+        if (index >= versionCount.load()) return nullptr;
+        return chunks[index >> chunkBits].load()[index & (chunkSize - 1)];
+    }
+    size_t size() const { return versionCount.load(); }
+
+    // Appends the versions kept in `filename` (index,id,name,price,category,
+    // prepTime) at the indices they had, and from then on saveVersions adds
+    // new ones there. Call before anything else appends a version. Returns
+    // how many were restored, or -1 with `error` set, keeping those before
+    // the bad line.
+    int restoreVersions(const string& filename, string& error) {
+        lock_guard<mutex> lock(writeLock);
+        versionFile = filename;
+        savedVersions.store(size());
+        ifstream inFile(filename);
+        string line;
+        int restored = 0;
+        bool complete = true;
+        while (inFile && getline(inFile, line)) {
+            if (line.empty()) continue;
+            stringstream ss(line);
+            string indexStr, id, name, priceStr, category, prepStr;
+            getline(ss, indexStr, ',');
+            getline(ss, id, ',');
+            getline(ss, name, ',');
+            getline(ss, priceStr, ',');
+            getline(ss, category, ',');
+            getline(ss, prepStr);
+            MenuItem* item = nullptr;
+            try {
+                if (stoul(indexStr) == size() && !id.empty()) {
+                    item = new MenuItem(id, name, stod(priceStr), category, stoi(prepStr));
+                }
+            } catch (...) {}
+            if (!item || !appendVersion(item)) {
+                delete item;
+                error = filename + " does not follow the menu at index " + to_string(size());
+                versionFile.clear();    // nothing appended after a line that can't be read back
+                complete = false;
+                break;
+            }
+            restored++;
+        }
+        savedVersions.store(size());
+        return complete ? restored : -1;
+    }
+    // Writes versions added since the last call to the file given to
+    // restoreVersions; before a record naming them is journaled.
+    void saveVersions() {
+        if (versionFile.empty() || savedVersions.load() == size()) return;
+        lock_guard<mutex> lock(writeLock);
+        size_t count = size();
+        ofstream out(versionFile, ios::app);
+        out << setprecision(15);
+        for (size_t i = savedVersions.load(); i < count; i++) {
+            const MenuItem* item = (*this)[i];
+            out << i << ',' << item->getId() << ',' << item->getName() << ',' << item->getPrice() << ','
+                << item->getCategory() << ',' << item->getPrepTime() << '\n';
+        }
+        out.flush();
+        if (out) savedVersions.store(count);
+    }
+
+    // Puts a new item on sale. Takes ownership; returns false (keeping
+    // nothing) for an id already on sale or when menu indices run out.
+    bool add(MenuItem* item) {
+        lock_guard<mutex> lock(writeLock);
+        View now = current();
+        if (now->find(item->getId()) || !appendVersion(item)) {
+            delete item;
+            return false;
+        }
+        vector<MenuItem*> onSale = now->items;
+        onSale.push_back(item);
+        snapshot.publish(buildSnapshot(onSale, now->version + 1));
+        return true;
+    }
+
+    // Replaces what is on sale with the lines of `filename`
+    // (id,name,price,category,prepTime). Unchanged items keep their version.
+    // Returns the number of items on sale afterwards, or -1 with `error` set.
+    int reload(const string& filename, string& error) {
+        ifstream inFile(filename);
+        if (!inFile) {
+            error = "cannot open " + filename;
+            return -1;
+        }
+        vector<MenuItem*> parsed;
+        unordered_map<string, bool> seen;
+        string line;
+        int lineNo = 0;
+        while (getline(inFile, line)) {
+            lineNo++;
+            if (line.empty() || line[0] == '#') continue;
+            stringstream ss(line);
+            string id, name, priceStr, category, prepStr;
+            getline(ss, id, ',');
+            getline(ss, name, ',');
+            getline(ss, priceStr, ',');
+            getline(ss, category, ',');
+            getline(ss, prepStr);
+            try {
+                double price = stod(priceStr);
+                int prep = stoi(prepStr);
+                if (id.empty() || seen[id] || price < 0 || prep < 0) throw invalid_argument("entry");
+                seen[id] = true;
+                parsed.push_back(new MenuItem(id, name, price, category, prep));
+            } catch (...) {
+                for (MenuItem* item : parsed) delete item;
+                error = filename + " line " + to_string(lineNo) + " is not a valid menu entry";
+                return -1;
+            }
+        }
+
+        lock_guard<mutex> lock(writeLock);
+        View now = current();
+        if (size() + parsed.size() > maxVersions) {
+            for (MenuItem* item : parsed) delete item;
+            error = "too many menu versions";
+            return -1;
+        }
+        vector<MenuItem*> onSale;
+        for (MenuItem* item : parsed) {
+            // The version on sale, or failing that the newest one, may already be this entry.
+            MenuItem* old = now->find(item->getId());
+            if (!old || !sameItem(old, item)) {
+                auto it = latest.find(item->getId());
+                old = it == latest.end() ? nullptr : it->second;
+            }
+            if (old && sameItem(old, item)) {
+                delete item;
+                onSale.push_back(old);
+            } else {
+                appendVersion(item);
+                onSale.push_back(item);
+            }
+        }
+        snapshot.publish(buildSnapshot(onSale, now->version + 1));
+        return static_cast<int>(onSale.size());
+    }
+
+    ~MenuCatalog() {
+        size_t count = versionCount.load();
+        for (size_t i = baseItems.size(); i < count; i++) delete (*this)[i];
+        for (auto& chunk : chunks) delete[] chunk.load();
+    }
+};
+
+// Meal suggestions within a budget. Each item may be taken twice: the first
+// portion scores 2 (one more item and one more dish), the second scores 1.
+// A bounded knapsack on whole cents runs over the items in order of prep
+// time, saving the best score for every budget each time the prep time goes
+// up; the answer is every step where the score improves, so each option is
+// the quickest way to reach its score. Tables are kept per menu version and
+// category filter and only rebuilt for a larger budget or a new menu. A
+// table never grows past the cost of taking everything in the filter, so
+// larger budgets all share that one.
+class MealRecommender {
+public:
+    static constexpr double maxBudget = 1000.0;      // dollars; larger budgets count as this
+    struct Option {
+        vector<pair<const MenuItem*, int>> items;   // item, portions
+        double cost = 0.0;
+        int score = 0;
+        int maxPrepTime = 0;                         // minutes, the slowest item
+    };
+private:
+    static constexpr int maxPortions = 2;
+    static constexpr size_t cachedTables = 8;
+    struct Portion {
+        const MenuItem* item;
+        uint32_t cents;
+        uint32_t value;
+    };
+    struct Table {
+        uint64_t version;
+        string categories;                   // filter, sorted and joined
+        uint32_t capacity;                   // cents
+        bool complete = false;               // every portion fits within capacity
+        vector<Portion> portions;            // by prep time
+        vector<size_t> stepEnd;              // portions up to each prep time step
+        vector<int> stepPrep;
+        vector<vector<uint32_t>> stepBest;   // step -> best score for every budget
+        vector<uint64_t> taken;              // portion x budget bits
+
+        bool took(size_t portion, uint32_t budget) const {
+            size_t bit = portion * (capacity + 1) + budget;
+            return (taken[bit >> 6] >> (bit & 63)) & 1;
+        }
+    };
+    struct Cached {
+        shared_ptr<const Table> table;
+        uint64_t lastUsed;
+    };
+    mutable mutex lock;
+    vector<Cached> tables;
+    uint64_t uses = 0;
+    size_t builds = 0;
+
+    static shared_ptr<const Table> build(const MenuSnapshot& menu, const vector<string>& categories,
+                                         const string& key, uint32_t capacity) {
+        shared_ptr<Table> table = make_shared<Table>();
+        table->version = menu.version;
+        table->categories = key;
+        vector<const MenuItem*> items;
+        uint64_t everything = 0;
+        for (const MenuItem* item : menu.byPrice) {
+            if (!categories.empty() && find(categories.begin(), categories.end(), item->getCategory()) == categories.end()) {
+                continue;
+            }
+            items.push_back(item);
+            everything += static_cast<uint64_t>(llround(item->getPrice() * 100)) * maxPortions;
+        }
+        if (everything <= capacity) {
+            capacity = static_cast<uint32_t>(everything);
+            table->complete = true;
+        }
+        table->capacity = capacity;
+        items.erase(remove_if(items.begin(), items.end(),
+                              [&](const MenuItem* item) { return llround(item->getPrice() * 100) > capacity; }),
+                    items.end());
+        stable_sort(items.begin(), items.end(),
+                    [](const MenuItem* a, const MenuItem* b) { return a->getPrepTime() < b->getPrepTime(); });
+        for (const MenuItem* item : items) {
+            uint32_t cents = static_cast<uint32_t>(llround(item->getPrice() * 100));
+            for (int p = 0; p < maxPortions; p++) table->portions.push_back({item, cents, p == 0 ? 2u : 1u});
+        }
+        size_t width = capacity + 1;
+        table->taken.assign((table->portions.size() * width + 63) / 64, 0);
+        vector<uint32_t> best(width, 0);
+        for (size_t i = 0; i < table->portions.size(); i++) {
+            const Portion& portion = table->portions[i];
+            size_t row = i * width;
+            for (uint32_t b = capacity + 1; b-- > portion.cents;) {
+                uint32_t with = best[b - portion.cents] + portion.value;
+                if (with > best[b]) {
+                    best[b] = with;
+                    table->taken[(row + b) >> 6] |= uint64_t(1) << ((row + b) & 63);
+                }
+            }
+            bool stepDone = i + 1 == table->portions.size() ||
+                            table->portions[i + 1].item->getPrepTime() != portion.item->getPrepTime();
+            if (stepDone) {
+                table->stepEnd.push_back(i + 1);
+                table->stepPrep.push_back(portion.item->getPrepTime());
+                table->stepBest.push_back(best);
+            }
+        }
+        return table;
+    }
+
+    shared_ptr<const Table> tableFor(const MenuSnapshot& menu, const vector<string>& categories, uint32_t budget) {
+        vector<string> sorted = categories;
+        sort(sorted.begin(), sorted.end());
+        string key;
+        for (const string& category : sorted) key += category + '\n';
+        lock_guard<mutex> guard(lock);
+        uses++;
+        tables.erase(remove_if(tables.begin(), tables.end(),
+                               [&](const Cached& c) { return c.table->version != menu.version; }),
+                     tables.end());
+        for (Cached& cached : tables) {
+            if (cached.table->categories == key && (cached.table->capacity >= budget || cached.table->complete)) {
+                cached.lastUsed = uses;
+                return cached.table;
+            }
+        }
+        // Round up so nearby budgets share the table.
+        uint32_t capacity = min<uint32_t>((budget / 2500 + 1) * 2500, static_cast<uint32_t>(maxBudget * 100));
+        shared_ptr<const Table> table = build(menu, sorted, key, capacity);
+        builds++;
+        tables.erase(remove_if(tables.begin(), tables.end(), [&](const Cached& c) { return c.table->categories == key; }),
+                     tables.end());
+        if (tables.size() >= cachedTables) {
+            tables.erase(min_element(tables.begin(), tables.end(),
+                                     [](const Cached& a, const Cached& b) { return a.lastUsed < b.lastUsed; }));
+        }
+        tables.push_back({table, uses});
+        return table;
+    }
+public:
+    // Up to `count` options within `budget`, best score first; an empty
+    // category list means the whole menu. A budget over maxBudget counts as
+    // maxBudget, and one that is not a positive number gets no options.
+    vector<Option> recommend(const MenuSnapshot& menu, double budget, const vector<string>& categories, int count) {
+        vector<Option> options;
+        if (!isfinite(budget) || budget <= 0 || count <= 0) return options;
+        uint32_t cents = static_cast<uint32_t>(llround(floor(min(budget, maxBudget) * 100 + 1e-6)));
+        shared_ptr<const Table> table = tableFor(menu, categories, cents);
+        cents = min(cents, table->capacity);   // past a complete table every budget buys the same
+        vector<size_t> steps;      // where the score goes up, quickest first
+        uint32_t bestSoFar = 0;
+        for (size_t s = 0; s < table->stepBest.size(); s++) {
+            if (table->stepBest[s][cents] > bestSoFar) {
+                bestSoFar = table->stepBest[s][cents];
+                steps.push_back(s);
+            }
+        }
+        for (size_t k = steps.size(); k-- > 0 && static_cast<int>(options.size()) < count;) {
+            size_t s = steps[k];
+            Option option;
+            option.score = static_cast<int>(table->stepBest[s][cents]);
+            uint32_t b = cents;
+            for (size_t i = table->stepEnd[s]; i-- > 0;) {
+                if (!table->took(i, b)) continue;
+                const Portion& portion = table->portions[i];
+                b -= portion.cents;
+                option.cost += portion.cents / 100.0;
+                option.maxPrepTime = max(option.maxPrepTime, portion.item->getPrepTime());
+                if (!option.items.empty() && option.items.back().first == portion.item) option.items.back().second++;
+                else option.items.emplace_back(portion.item, 1);
+            }
+            options.push_back(option);
+        }
+        return options;
+    }
+
+    size_t tableBuilds() const {
+        lock_guard<mutex> guard(lock);
+        return builds;
+    }
+};
+
+class Order {
+private:
+    string orderId;
+    SmallVector<OrderLine, 4> items;
+    double totalAmount;
+    string customerName;
+    string status;
+    chrono::system_clock::time_point orderTime;
+    const Address* deliveryAddress;     // shared through ValueStore
+    const Payment* paymentInfo;
+    string phoneNumber;
+    string specialInstructions;
+    DeliveryDriver* driver = nullptr;
+    friend class OrderArchive;
+
+    // Returns how many were added once the line is held to maxQuantity.
+    int mergeLine(uint16_t menuIndex, int quantity) {
+        for (OrderLine& line : items) {
+            if (line.menuIndex == menuIndex) {
+                int added = max(0, min(quantity, maxQuantity - line.quantity));
+                line.quantity = static_cast<uint16_t>(line.quantity + added);
+                return added;
+            }
+        }
+        int added = max(0, min(quantity, maxQuantity));
+        if (added > 0) items.push_back({menuIndex, static_cast<uint16_t>(added)});
+        return added;
+    }
+public:
+    static constexpr int maxQuantity = 99;      // of one item in one order
+    // Takes ownership of addr and payment, keeping the shared copies of their values instead.
+    Order(string id, string name, Address* addr, Payment* payment, string phone) 
+        : orderId(id), customerName(name), totalAmount(0.0), 
+          status("Pending"), orderTime(chrono::system_clock::now()),
+          deliveryAddress(ValueStore<Address>::shared().intern(addr)),
+          paymentInfo(ValueStore<Payment>::shared().intern(payment)), phoneNumber(phone) {}
+    Order(const Order&) = delete;
+    Order& operator=(const Order&) = delete;
+    
+    // Adding an item already in the order raises its quantity, up to maxQuantity.
+    void addItem(MenuItem* item, int quantity = 1) {
+        totalAmount += item->getPrice() * mergeLine(static_cast<uint16_t>(item->getIndex()), quantity);
+    }
+    string getId() const { return orderId; }
+    double getTotal() const { return totalAmount; }
+    void setTotal(double amount) { totalAmount = amount; }
+    string getStatus() const { return status; }
+    void setStatus(string s) { status = s; }
+    string getCustomerName() const { return customerName; }
+    chrono::system_clock::time_point getOrderTime() const { return orderTime; }
+    void setOrderTime(chrono::system_clock::time_point t) { orderTime = t; }
+    const SmallVector<OrderLine, 4>& getLines() const { return items; }
+    int getItemCount() const {
+        int n = 0;
+        for (const OrderLine& line : items) n += line.quantity;
+        return n;
+    }
+    void setSpecialInstructions(const string& instructions) {
+        specialInstructions = instructions;
+    }
+    const Address* getAddress() const { return deliveryAddress; }
+    const Payment* getPayment() const { return paymentInfo; }
+    DeliveryDriver* getDriver() const { return driver; }
+    void setDriver(DeliveryDriver* d) { driver = d; }
+    string getDeliveryAddress() const {
+        return deliveryAddress ? deliveryAddress->getFullAddress() : "No address provided";
+    }
+    string getPaymentInfo() const {
+        return paymentInfo ? paymentInfo->getMaskedCardNumber() : "No payment info";
+    }
+    string getPhoneNumber() const { return phoneNumber; }
+    string getSpecialInstructions() const { return specialInstructions; }
+
+    // Serialization for file
+    string serialize() const {
+        stringstream ss;
+        ss << orderId << ",";
+        ss << customerName << ",";
+        ss << phoneNumber << ",";
+        ss << deliveryAddress->serialize() << ",";
+        ss << paymentInfo->serialize() << ",";
+        ss << fixed << setprecision(2) << totalAmount << ",";
+        ss << status << ",";
+        // serialize items as '#' then semicolon separated menu indices, with
+        // "*quantity" when more than one
+        if (!items.empty()) ss << "#";
+        for (size_t i = 0; i < items.size(); ++i) {
+            ss << items[i].menuIndex;
+            if (items[i].quantity > 1) ss << "*" << items[i].quantity;
+            if (i != items.size() - 1) ss << ";";
+        }
+        ss << ",";
+        // serialize special instructions, escape commas by replacing them with \,
+        string escapedInstructions = specialInstructions;
+        size_t pos = 0;
+        while ((pos = escapedInstructions.find(',', pos)) != string::npos) {
+            escapedInstructions.replace(pos, 1, "\\,");
+            pos += 2;
+        }
+        ss << escapedInstructions;
+        return ss.str();
+    }
+
+    static Order* deserialize(const string& data, const MenuCatalog& menu) {
+        stringstream ss(data);
+        string orderId, customerName, phoneNumber, addressStr, paymentStr, totalStr, status, itemsStr, specialInstr;
+        getline(ss, orderId, ',');
+        getline(ss, customerName, ',');
+        getline(ss, phoneNumber, ',');
+        getline(ss, addressStr, ',');
+        getline(ss, paymentStr, ',');
+        getline(ss, totalStr, ',');
+        getline(ss, status, ',');
+        getline(ss, itemsStr, ',');
+        getline(ss, specialInstr);
+
+        Address* address = Address::deserialize(addressStr);
+        Payment* payment = Payment::deserialize(paymentStr);
+        Order* order = new Order(orderId, customerName, address, payment, phoneNumber);
+        order->setStatus(status);
+
+        // Convert totalStr to double and set totalAmount directly (to avoid double adding)
+        double totalAmount = 0.0;
+        try {
+            totalAmount = stod(totalStr);
+        } catch(...) {}
+        order->totalAmount = totalAmount;
+
+        // Parse menu indices, or item ids in files written before indices.
+        // A quantity no order could hold makes the whole record invalid.
+        bool dense = !itemsStr.empty() && itemsStr[0] == '#';
+        stringstream ssItems(dense ? itemsStr.substr(1) : itemsStr);
+        string itemId;
+        while (getline(ssItems, itemId, ';')) {
+            if (dense) {
+                size_t star = itemId.find('*');
+                int index = -1, quantity = 0;
+                try {
+                    index = stoi(itemId.substr(0, star));
+                    quantity = star == string::npos ? 1 : stoi(itemId.substr(star + 1));
+                } catch (...) {}
+                if (quantity < 1 || quantity > maxQuantity) {
+                    delete order;
+                    return nullptr;
+                }
+                if (index >= 0 && index < static_cast<int>(menu.size())) {
+                    order->mergeLine(static_cast<uint16_t>(index), quantity);
+                }
+            } else if (MenuItem* item = menu.find(itemId)) {
+                order->mergeLine(static_cast<uint16_t>(item->getIndex()), 1);
+            }
+        }
+        // Special instructions unescape
+        size_t pos = 0;
+        while ((pos = specialInstr.find("\\,", pos)) != string::npos) {
+            specialInstr.replace(pos, 2, ",");
+            pos += 1;
+        }
+        order->setSpecialInstructions(specialInstr);
+
+        return order;
+    }
+
+    ~Order() {
+        ValueStore<Address>::shared().release(deliveryAddress);
+        ValueStore<Payment>::shared().release(paymentInfo);
+    }
+};
+
+// One promotion or fee from pricing.txt:
+//   kind,name,applies to,effect[,hours[,minimum]]
+// kind is item (a menu id), category, combo (menu ids joined by '+'; a set
+// is one of each) or fee (a delivery city, or * for any). The effect is
+// "15%" off, or an amount off each item or combo set; for a fee it is the
+// fee. Hours like 16-19 hold the rule to that local time (22-2 wraps past
+// midnight) and the minimum is the subtotal it needs.
+struct PricingRule {
+    enum Kind { Item, Category, Combo, Fee };
+    Kind kind = Item;
+    string name;
+    string target;
+    vector<string> comboItems;
+    double percent = 0.0;
+    double amount = 0.0;
+    int fromHour = 0;
+    int toHour = 24;
+    double minimum = 0.0;
+
+    bool activeAt(int hour) const {
+        if (fromHour <= toHour) return hour >= fromHour && hour < toHour;
+        return hour >= fromHour || hour < toHour;
+    }
+    // Off `units` of something costing `price` each (combos pass sets and the set price).
+    double discountFor(double price, int units) const {
+        return min(price * units, units * amount + price * units * percent / 100.0);
+    }
+
+    // False when the line is not a valid rule.
+    static bool parse(const string& line, PricingRule& rule) {
+        vector<string> fields;
+        stringstream ss(line);
+        string field;
+        while (getline(ss, field, ',')) fields.push_back(field);
+        if (fields.size() < 4 || fields.size() > 6) return false;
+        const string& kind = fields[0];
+        if (kind == "item") rule.kind = Item;
+        else if (kind == "category") rule.kind = Category;
+        else if (kind == "combo") rule.kind = Combo;
+        else if (kind == "fee") rule.kind = Fee;
+        else return false;
+        rule.name = fields[1];
+        rule.target = fields[2];
+        if (rule.name.empty() || rule.target.empty()) return false;
+        if (rule.kind == Combo) {
+            stringstream items(rule.target);
+            string id;
+            while (getline(items, id, '+')) {
+                if (id.empty()) return false;
+                rule.comboItems.push_back(id);
+            }
+            if (rule.comboItems.size() < 2) return false;
+        }
+        if (rule.kind == Fee) transform(rule.target.begin(), rule.target.end(), rule.target.begin(), ::tolower);
+        try {
+            size_t used = 0;
+            string effect = fields[3];
+            bool percentOff = !effect.empty() && effect.back() == '%';
+            if (percentOff) effect.pop_back();
+            double value = stod(effect, &used);
+            if (used != effect.size() || value < 0 || (percentOff && (rule.kind == Fee || value > 100))) return false;
+            if (percentOff) rule.percent = value;
+            else rule.amount = value;
+            if (fields.size() >= 5 && !fields[4].empty()) {
+                size_t dash = fields[4].find('-');
+                if (dash == string::npos) return false;
+                rule.fromHour = stoi(fields[4].substr(0, dash));
+                rule.toHour = stoi(fields[4].substr(dash + 1));
+                if (rule.fromHour < 0 || rule.fromHour > 23 || rule.toHour < 1 || rule.toHour > 24 ||
+                    rule.fromHour == rule.toHour) return false;
+            }
+            if (fields.size() == 6 && !fields[5].empty()) {
+                rule.minimum = stod(fields[5], &used);
+                if (used != fields[5].size() || rule.minimum < 0) return false;
+            }
+        } catch (...) {
+            return false;
+        }
+        return true;
+    }
+};
+
+// What one order pays under a PricingPlan.
+struct PriceQuote {
+    struct Applied {
+        uint32_t rule;
+        double amount;          // off, or the fee
+    };
+    double subtotal = 0.0;
+    double discount = 0.0;
+    double fee = 0.0;
+    SmallVector<Applied, 4> applied;
+
+    double total() const { return subtotal - discount + fee; }
+};
+
+// Pricing rules compiled against the menu catalogue. Each menu index gets
+// the item and category rules that can apply to it, combos are listed under
+// every item they need, and fees are found by city, so an order is only
+// checked against the rules for what it holds and where it goes. Combos are
+// taken first, in file order; each remaining item gets its best item or
+// category rule; the first fee that applies, in file order, is charged.
+// Never changed once built, so any number of threads can quote from it.
+class PricingPlan {
+private:
+    struct ComboPart {
+        uint32_t key;           // dense number of the item id
+        uint16_t count;
+    };
+    const MenuCatalog* menu = nullptr;
+    vector<PricingRule> rules;
+    size_t menuSize = 0;                          // indices past this have no rules
+    vector<uint32_t> itemKey;                     // menu index -> dense number of its id
+    vector<uint32_t> lineStart, lineRules;        // menu index -> item and category rules
+    vector<uint32_t> comboStart, comboRules;      // item key -> combos that need it
+    vector<vector<ComboPart>> comboParts;         // by rule
+    unordered_map<string, vector<uint32_t>> feesByCity;   // lower-cased
+    vector<uint32_t> anyCityFees;
+    long utcOffset = 0;                           // seconds, taken when the plan is built
+
+    // Packs per-slot rule lists into one array with start offsets.
+    static void flatten(const vector<vector<uint32_t>>& lists, vector<uint32_t>& start, vector<uint32_t>& flat) {
+        start.assign(lists.size() + 1, 0);
+        for (size_t i = 0; i < lists.size(); i++) start[i + 1] = start[i] + static_cast<uint32_t>(lists[i].size());
+        flat.clear();
+        flat.reserve(start.back());
+        for (const vector<uint32_t>& list : lists) flat.insert(flat.end(), list.begin(), list.end());
+    }
+    static void addApplied(PriceQuote& quote, uint32_t rule, double amount) {
+        for (PriceQuote::Applied& applied : quote.applied) {
+            if (applied.rule == rule) {
+                applied.amount += amount;
+                return;
+            }
+        }
+        quote.applied.push_back({rule, amount});
+    }
+public:
+    PricingPlan(const PricingPlan&) = delete;
+    PricingPlan& operator=(const PricingPlan&) = delete;
+
+    PricingPlan(const vector<PricingRule>& ruleList, const MenuCatalog& catalog) : menu(&catalog), rules(ruleList) {
+        menuSize = catalog.size();
+        unordered_map<string, uint32_t> keys;
+        itemKey.resize(menuSize);
+        for (size_t i = 0; i < menuSize; i++) {
+            itemKey[i] = keys.emplace(catalog[i]->getId(), static_cast<uint32_t>(keys.size())).first->second;
+        }
+        unordered_map<string, vector<uint32_t>> byItem, byCategory;
+        vector<vector<uint32_t>> combosByKey(keys.size());
+        comboParts.resize(rules.size());
+        for (uint32_t r = 0; r < rules.size(); r++) {
+            const PricingRule& rule = rules[r];
+            if (rule.kind == PricingRule::Item) {
+                byItem[rule.target].push_back(r);
+            } else if (rule.kind == PricingRule::Category) {
+                byCategory[rule.target].push_back(r);
+            } else if (rule.kind == PricingRule::Fee) {
+                if (rule.target == "*") anyCityFees.push_back(r);
+                else feesByCity[rule.target].push_back(r);
+            } else {
+                vector<ComboPart> parts;
+                bool known = true;
+                for (const string& id : rule.comboItems) {
+                    auto key = keys.find(id);
+                    if (key == keys.end()) {
+                        known = false;   // not on any menu, can never apply
+                        break;
+                    }
+                    auto part = find_if(parts.begin(), parts.end(),
+                                        [&](const ComboPart& p) { return p.key == key->second; });
+                    if (part == parts.end()) parts.push_back({key->second, 1});
+                    else part->count++;
+                }
+                if (!known) continue;
+                for (const ComboPart& part : parts) combosByKey[part.key].push_back(r);
+                comboParts[r] = parts;
+            }
+        }
+        vector<vector<uint32_t>> byIndex(menuSize);
+        for (size_t i = 0; i < menuSize; i++) {
+            const MenuItem* item = catalog[i];
+            auto a = byItem.find(item->getId());
+            auto b = byCategory.find(item->getCategory());
+            if (a != byItem.end()) byIndex[i] = a->second;
+            if (b != byCategory.end()) byIndex[i].insert(byIndex[i].end(), b->second.begin(), b->second.end());
+        }
+        flatten(byIndex, lineStart, lineRules);
+        flatten(combosByKey, comboStart, comboRules);
+
+        time_t now = time(nullptr);
+        tm local{}, utc{};
+#if defined(_WIN32)
+        localtime_s(&local, &now);
+        gmtime_s(&utc, &now);
+#else
+        localtime_r(&now, &local);
+        gmtime_r(&now, &utc);
+#endif
+        utc.tm_isdst = local.tm_isdst;
+        utcOffset = static_cast<long>(difftime(mktime(&local), mktime(&utc)));
+    }
+
+    size_t ruleCount() const { return rules.size(); }
+    const PricingRule& rule(uint32_t index) const { return rules[index]; }
+
+    // Local hour of `when`, by the offset in force when the plan was built.
+    int hourOf(chrono::system_clock::time_point when) const {
+        long long seconds = chrono::duration_cast<chrono::seconds>(when.time_since_epoch()).count() + utcOffset;
+        return static_cast<int>(((seconds / 3600) % 24 + 24) % 24);
+    }
+
+    PriceQuote quote(const Order& order) const { return quote(order, hourOf(order.getOrderTime())); }
+    PriceQuote quote(const Order& order, int hour) const {
+        PriceQuote result;
+        const SmallVector<OrderLine, 4>& lines = order.getLines();
+        SmallVector<double, 8> prices;
+        SmallVector<int, 8> left;          // units not yet in a combo
+        for (const OrderLine& line : lines) {
+            double price = line.menuIndex < menu->size() ? (*menu)[line.menuIndex]->getPrice() : 0.0;
+            prices.push_back(price);
+            left.push_back(line.quantity);
+            result.subtotal += price * line.quantity;
+        }
+        if (rules.empty()) return result;
+
+        SmallVector<uint32_t, 8> combos;
+        for (const OrderLine& line : lines) {
+            if (line.menuIndex >= menuSize) continue;
+            uint32_t key = itemKey[line.menuIndex];
+            for (uint32_t c = comboStart[key]; c < comboStart[key + 1]; c++) {
+                if (find(combos.begin(), combos.end(), comboRules[c]) == combos.end()) combos.push_back(comboRules[c]);
+            }
+        }
+        sort(combos.begin(), combos.end());
+        for (uint32_t r : combos) {
+            const PricingRule& rule = rules[r];
+            if (!rule.activeAt(hour) || result.subtotal < rule.minimum) continue;
+            int sets = INT32_MAX;
+            for (const ComboPart& part : comboParts[r]) {
+                int units = 0;
+                for (size_t i = 0; i < lines.size(); i++) {
+                    if (lines[i].menuIndex < menuSize && itemKey[lines[i].menuIndex] == part.key) units += left[i];
+                }
+                sets = min(sets, units / part.count);
+            }
+            if (sets <= 0) continue;
+            double setsPrice = 0.0;
+            for (const ComboPart& part : comboParts[r]) {
+                int needed = sets * part.count;
+                for (size_t i = 0; i < lines.size() && needed > 0; i++) {
+                    if (lines[i].menuIndex >= menuSize || itemKey[lines[i].menuIndex] != part.key) continue;
+                    int taken = min(needed, left[i]);
+                    left[i] -= taken;
+                    needed -= taken;
+                    setsPrice += prices[i] * taken;
+                }
+            }
+            double off = rule.discountFor(setsPrice / sets, sets);
+            result.discount += off;
+            addApplied(result, r, off);
+        }
+
+        for (size_t i = 0; i < lines.size(); i++) {
+            uint16_t index = lines[i].menuIndex;
+            if (left[i] == 0 || index >= menuSize) continue;
+            double best = 0.0;
+            uint32_t bestRule = 0;
+            for (uint32_t k = lineStart[index]; k < lineStart[index + 1]; k++) {
+                const PricingRule& rule = rules[lineRules[k]];
+                if (!rule.activeAt(hour) || result.subtotal < rule.minimum) continue;
+                double off = rule.discountFor(prices[i], left[i]);
+                if (off > best) {
+                    best = off;
+                    bestRule = lineRules[k];
+                }
+            }
+            if (best > 0.0) {
+                result.discount += best;
+                addApplied(result, bestRule, best);
+            }
+        }
+        result.discount = round(result.discount * 100.0) / 100.0;
+
+        const vector<uint32_t>* cityFees = nullptr;
+        if (!feesByCity.empty() && order.getAddress()) {
+            string city = order.getAddress()->getCity();
+            transform(city.begin(), city.end(), city.begin(), ::tolower);
+            auto it = feesByCity.find(city);
+            if (it != feesByCity.end()) cityFees = &it->second;
+        }
+        // First fee in file order from the city's list and the any-city list.
+        size_t a = 0, b = 0, cityCount = cityFees ? cityFees->size() : 0;
+        while (a < cityCount || b < anyCityFees.size()) {
+            uint32_t r;
+            if (b == anyCityFees.size() || (a < cityCount && (*cityFees)[a] < anyCityFees[b])) r = (*cityFees)[a++];
+            else r = anyCityFees[b++];
+            const PricingRule& rule = rules[r];
+            if (!rule.activeAt(hour) || result.subtotal - result.discount < rule.minimum) continue;
+            result.fee = rule.amount;
+            addApplied(result, r, rule.amount);
+            break;
+        }
+        return result;
+    }
+
+    // Totals for many orders, on up to `threads` threads (0 for one per
+    // core). A thread only pays for itself with a core of its own and a few
+    // milliseconds of work, so the first orders are priced here and timed,
+    // and the rest is split no further than that cost makes worthwhile.
+    // `used` receives the number of threads that ran.
+    vector<double> totals(const vector<const Order*>& orders, unsigned threads = 0, unsigned* used = nullptr) const {
+        static constexpr size_t sample = 1024;
+        static constexpr double microsPerThread = 2000.0;
+        vector<double> result(orders.size());
+        auto priceRange = [&](size_t from, size_t to) {
+            for (size_t i = from; i < to; i++) result[i] = quote(*orders[i]).total();
+        };
+        unsigned cores = max(1u, thread::hardware_concurrency());
+        threads = threads == 0 ? cores : min(threads, cores);
+        size_t n = orders.size(), done = min(n, sample);
+        auto start = chrono::steady_clock::now();
+        priceRange(0, done);
+        double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        double rest = done ? micros / done * (n - done) : 0.0;
+        threads = static_cast<unsigned>(max(1.0, min<double>(threads, rest / microsPerThread)));
+        if (threads > 1) {
+            vector<thread> workers;
+            size_t chunk = (n - done + threads - 1) / threads;
+            for (unsigned t = 0; t < threads; t++) {
+                size_t from = done + t * chunk, to = min(n, from + chunk);
+                if (from < to) workers.emplace_back(priceRange, from, to);
+            }
+            for (thread& w : workers) w.join();
+        } else {
+            priceRange(done, n);
+        }
+        if (used) *used = threads;
+        return result;
+    }
+};
+
+// Reference to an order in the OrderStore. The generation changes every time
+// a slot is reused, so a handle to a released order stops resolving instead
+// of pointing at whatever took its place.
+struct OrderHandle {
+    uint32_t index = 0;
+    uint32_t generation = 0;   // 0 never names a live order
+
+    bool valid() const { return generation != 0; }
+    bool operator==(const OrderHandle& other) const {
+        return index == other.index && generation == other.generation;
+    }
+    bool operator!=(const OrderHandle& other) const { return !(*this == other); }
+};
+
+// Owns every order in memory. Queue, history and dispatch all hold handles
+// into it, so an order exists once and is deleted in one place.
+class OrderStore {
+private:
+    struct Slot {
+        Order* order;
+        uint32_t generation;
+    };
+    vector<Slot> slots;
+    vector<uint32_t> freeSlots;
+    mutable shared_mutex lock;
+public:
+    OrderStore() = default;
+    OrderStore(const OrderStore&) = delete;
+    OrderStore& operator=(const OrderStore&) = delete;
+
+    // Takes ownership of `order`, reusing a released slot when there is one.
+    OrderHandle adopt(Order* order) {
+        unique_lock<shared_mutex> guard(lock);
+        uint32_t index;
+        if (!freeSlots.empty()) {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            index = static_cast<uint32_t>(slots.size());
+            slots.push_back({nullptr, 0});
+        }
+        Slot& slot = slots[index];
+        if (++slot.generation == 0) slot.generation = 1;
+        slot.order = order;
+        return {index, slot.generation};
+    }
+
+    // The order, or nullptr for a handle whose order has been released.
+    Order* get(OrderHandle handle) const {
+        shared_lock<shared_mutex> guard(lock);
+        if (handle.index >= slots.size()) return nullptr;
+        const Slot& slot = slots[handle.index];
+        return slot.generation == handle.generation ? slot.order : nullptr;
+    }
+
+    // Deletes the order and frees its slot. False for a stale handle.
+    bool release(OrderHandle handle) {
+        Order* order = nullptr;
+        {
+            unique_lock<shared_mutex> guard(lock);
+            if (handle.index >= slots.size()) return false;
+            Slot& slot = slots[handle.index];
+            if (slot.generation != handle.generation || !slot.order) return false;
+            order = slot.order;
+            slot.order = nullptr;
+            if (++slot.generation == 0) slot.generation = 1;
+            freeSlots.push_back(handle.index);
+        }
+        delete order;
+        return true;
+    }
+
+    size_t liveCount() const {
+        shared_lock<shared_mutex> guard(lock);
+        return slots.size() - freeSlots.size();
+    }
+    size_t slotCount() const {
+        shared_lock<shared_mutex> guard(lock);
+        return slots.size();
+    }
+
+    ~OrderStore() {
+        for (const Slot& slot : slots) delete slot.order;
+    }
+};
+
+// Position on a flat km grid centred on the restaurant (see ZipGeocoder).
+struct GeoPoint {
+    double x = 0.0;   // km east
+    double y = 0.0;   // km north
+    double distanceTo(const GeoPoint& other) const {
+        return hypot(x - other.x, y - other.y);
+    }
+};
+
+// Local zip code table loaded from zipcodes.txt (zip,city,latitude,longitude).
+// Coordinates are projected onto a km grid around the first entry, which is the
+// restaurant's own zip. Unknown zips fall back to the centre of their city.
+class ZipGeocoder {
+private:
+    struct CityCentre {
+        double x = 0.0, y = 0.0;
+        int count = 0;
+    };
+    unordered_map<string, GeoPoint> byZip;
+    unordered_map<string, CityCentre> byCity;
+    double refLat = 0.0, refLon = 0.0;
+    bool hasReference = false;
+
+    static string normalize(const string& s) {
+        size_t b = s.find_first_not_of(' '), e = s.find_last_not_of(' ');
+        if (b == string::npos) return "";
+        string out = s.substr(b, e - b + 1);
+        transform(out.begin(), out.end(), out.begin(), ::tolower);
+        return out;
+    }
+public:
+    GeoPoint project(double lat, double lon) const {
+        const double kmPerDegree = 111.32;
+        const double pi = 3.14159265358979323846;
+        GeoPoint p;
+        p.x = (lon - refLon) * kmPerDegree * cos(refLat * pi / 180.0);
+        p.y = (lat - refLat) * kmPerDegree;
+        return p;
+    }
+    void add(const string& zip, const string& city, double lat, double lon) {
+        if (!hasReference) {
+            refLat = lat;
+            refLon = lon;
+            hasReference = true;
+        }
+        GeoPoint p = project(lat, lon);
+        byZip[normalize(zip)] = p;
+        CityCentre& c = byCity[normalize(city)];
+        c.x += p.x;
+        c.y += p.y;
+        c.count++;
+    }
+    int loadFromFile(const string& filename) {
+        ifstream inFile(filename);
+        if (!inFile) return 0;
+        int loaded = 0;
+        string line;
+        while (getline(inFile, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            stringstream ss(line);
+            string zip, city, lat, lon;
+            getline(ss, zip, ',');
+            getline(ss, city, ',');
+            getline(ss, lat, ',');
+            getline(ss, lon);
+            try {
+                add(zip, city, stod(lat), stod(lon));
+                loaded++;
+            } catch (...) {}
+        }
+        return loaded;
+    }
+    // Returns false (and the restaurant's position) when neither the zip nor
+    // the city is in the table.
+    bool geocode(const string& zip, const string& city, GeoPoint& out) const {
+        auto z = byZip.find(normalize(zip));
+        if (z != byZip.end()) {
+            out = z->second;
+            return true;
+        }
+        auto c = byCity.find(normalize(city));
+        if (c != byCity.end()) {
+            out.x = c->second.x / c->second.count;
+            out.y = c->second.y / c->second.count;
+            return true;
+        }
+        out = GeoPoint();
+        return false;
+    }
+    bool geocode(const Address& address, GeoPoint& out) const {
+        return geocode(address.getZipCode(), address.getCity(), out);
+    }
+    GeoPoint locate(const string& zip) const {
+        GeoPoint p;
+        geocode(zip, "", p);
+        return p;
+    }
+};
+
+class DeliveryDriver {
+private:
+    string driverId;
+    string name;
+    GeoPoint position;
+    int capacity;
+    vector<Order*> assignedOrders;
+    bool online;
+    // Bookkeeping for DriverGrid: which cell the driver sits in and where.
+    long long cellKey;
+    int cellSlot;
+    friend class DriverGrid;
+public:
+    DeliveryDriver(string id, string n, GeoPoint pos, int cap = 3)
+        : driverId(id), name(n), position(pos), capacity(cap), online(true),
+          cellKey(0), cellSlot(-1) {}
+
+    string getId() const { return driverId; }
+    string getName() const { return name; }
+    GeoPoint getPosition() const { return position; }
+    int getCapacity() const { return capacity; }
+    int getLoad() const { return static_cast<int>(assignedOrders.size()); }
+    const vector<Order*>& getAssignedOrders() const { return assignedOrders; }
+    bool isOnline() const { return online; }
+    void setOnline(bool o) { online = o; }
+    bool isAvailable() const { return online && getLoad() < capacity; }
+    string getState() const {
+        if (!online) return "Offline";
+        if (assignedOrders.empty()) return "Available";
+        return isAvailable() ? "Delivering" : "Full";
+    }
+    void assignOrder(Order* order) { assignedOrders.push_back(order); }
+    void completeOrder(Order* order) {
+        assignedOrders.erase(remove(assignedOrders.begin(), assignedOrders.end(), order),
+                             assignedOrders.end());
+    }
+};
+
+// Uniform grid over the km plane holding the drivers that can take another
+// order. Insert, remove and position updates are O(1); nearest() searches
+// rings of cells outwards from the query point and stops as soon as no
+// unvisited cell can beat the k-th best driver found so far.
+class DriverGrid {
+private:
+    double cellSize;
+    unordered_map<long long, vector<DeliveryDriver*>> cells;
+    int minCx = 0, maxCx = -1, minCy = 0, maxCy = -1;
+    size_t count = 0;
+
+    int cellOf(double v) const { return static_cast<int>(floor(v / cellSize)); }
+    // Shifted as unsigned, as negative cells would make a signed shift undefined.
+    static long long keyOf(int cx, int cy) {
+        return static_cast<long long>(static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32 | static_cast<uint32_t>(cy));
+    }
+    void visitCell(int cx, int cy, const GeoPoint& p, size_t k, double maxKm,
+                   priority_queue<pair<double, DeliveryDriver*>>& best) const {
+        auto it = cells.find(keyOf(cx, cy));
+        if (it == cells.end()) return;
+        for (DeliveryDriver* d : it->second) {
+            double dist = p.distanceTo(d->position);
+            if (dist > maxKm) continue;
+            if (best.size() < k) {
+                best.push({dist, d});
+            } else if (dist < best.top().first) {
+                best.pop();
+                best.push({dist, d});
+            }
+        }
+    }
+public:
+    DriverGrid(double cellKm = 2.0) : cellSize(cellKm) {}
+
+    bool contains(const DeliveryDriver* d) const { return d->cellSlot >= 0; }
+    size_t size() const { return count; }
+
+    void insert(DeliveryDriver* d) {
+        if (contains(d)) return;
+        int cx = cellOf(d->position.x), cy = cellOf(d->position.y);
+        if (count == 0 && maxCx < minCx) {
+            minCx = maxCx = cx;
+            minCy = maxCy = cy;
+        }
+        minCx = min(minCx, cx); maxCx = max(maxCx, cx);
+        minCy = min(minCy, cy); maxCy = max(maxCy, cy);
+        vector<DeliveryDriver*>& cell = cells[keyOf(cx, cy)];
+        d->cellKey = keyOf(cx, cy);
+        d->cellSlot = static_cast<int>(cell.size());
+        cell.push_back(d);
+        count++;
+    }
+    void remove(DeliveryDriver* d) {
+        if (!contains(d)) return;
+        vector<DeliveryDriver*>& cell = cells[d->cellKey];
+        DeliveryDriver* last = cell.back();
+        cell[d->cellSlot] = last;
+        last->cellSlot = d->cellSlot;
+        cell.pop_back();
+        d->cellSlot = -1;
+        count--;
+    }
+    // Moves a driver; only touches the index when the driver changes cell.
+    void update(DeliveryDriver* d, const GeoPoint& pos) {
+        if (!contains(d)) {
+            d->position = pos;
+            return;
+        }
+        if (keyOf(cellOf(pos.x), cellOf(pos.y)) == d->cellKey) {
+            d->position = pos;
+            return;
+        }
+        remove(d);
+        d->position = pos;
+        insert(d);
+    }
+
+    // Up to k indexed drivers within maxKm of p, closest first.
+    vector<DeliveryDriver*> nearest(const GeoPoint& p, size_t k,
+                                    double maxKm = numeric_limits<double>::infinity()) const {
+        vector<DeliveryDriver*> result;
+        if (count == 0 || k == 0) return result;
+        priority_queue<pair<double, DeliveryDriver*>> best;
+        int cx = cellOf(p.x), cy = cellOf(p.y);
+        double ox = p.x - cx * cellSize, oy = p.y - cy * cellSize;
+        double edge = min(min(ox, cellSize - ox), min(oy, cellSize - oy));
+        int maxRing = max(max(abs(cx - minCx), abs(maxCx - cx)), max(abs(cy - minCy), abs(maxCy - cy)));
+        for (int r = 0; r <= maxRing; r++) {
+            double lowerBound = r == 0 ? 0.0 : edge + (r - 1) * cellSize;
+            if (lowerBound > maxKm) break;
+            if (best.size() == k && lowerBound > best.top().first) break;
+            if (r == 0) {
+                visitCell(cx, cy, p, k, maxKm, best);
+                continue;
+            }
+            int x0 = max(cx - r, minCx), x1 = min(cx + r, maxCx);
+            for (int side : {cy - r, cy + r}) {
+                if (side < minCy || side > maxCy) continue;
+                for (int x = x0; x <= x1; x++) visitCell(x, side, p, k, maxKm, best);
+            }
+            int y0 = max(cy - r + 1, minCy), y1 = min(cy + r - 1, maxCy);
+            for (int side : {cx - r, cx + r}) {
+                if (side < minCx || side > maxCx) continue;
+                for (int y = y0; y <= y1; y++) visitCell(side, y, p, k, maxKm, best);
+            }
+        }
+        result.resize(best.size());
+        for (size_t i = best.size(); i-- > 0; ) {
+            result[i] = best.top().second;
+            best.pop();
+        }
+        return result;
+    }
+};
+
+// Road graph loaded from a local edge list (roads.txt) and preprocessed into a
+// contraction hierarchy, so travel times are answered by two small upward
+// searches instead of a Dijkstra over the whole map. File format:
+//   node,<id>,<latitude>,<longitude>
+//   edge,<from>,<to>,<seconds>[,oneway]
+//   place,<zip>,<street>,<node>      (street may be empty for a whole zip)
+// Queries reuse scratch buffers and are not safe to run from several threads.
+class RoadNetwork {
+private:
+    struct Arc {
+        int to;
+        int seconds;
+    };
+    struct WorkArc {
+        int from, to, seconds;
+    };
+    vector<GeoPoint> positions;
+    unordered_map<long long, int> nodeIndex;
+    vector<vector<Arc>> outArcs;
+    unordered_map<string, int> places;
+
+    // Hierarchy in CSR form: arcs to higher-ranked nodes for the forward
+    // search, and reversed arcs from higher-ranked nodes for the backward one.
+    vector<int> rank;
+    vector<int> byRank;             // nodes, highest rank first
+    vector<int> upStart, downStart;
+    vector<Arc> upArcs, downArcs;
+    bool built = false;
+
+    // Snapping points to nodes.
+    double cellSize = 1.0;
+    unordered_map<long long, vector<int>> cells;
+    int minCx = 0, maxCx = -1, minCy = 0, maxCy = -1;
+
+    mutable vector<int> distForward, distBackward;
+    mutable vector<int> touchedForward, touchedBackward;
+
+    // Many-to-many buckets: what each backward search left at a node.
+    struct BucketEntry {
+        int node, target, seconds;
+    };
+    mutable vector<BucketEntry> found, buckets; // as the searches left them, then grouped by node
+    mutable vector<int> bucketFirst;            // node -> first entry, -1 for none
+    mutable vector<int> bucketNodes;
+
+    static string placeKey(const string& zip, const string& street) {
+        string key = zip + "|" + street;
+        key.erase(remove(key.begin(), key.end(), ' '), key.end());
+        transform(key.begin(), key.end(), key.begin(), ::tolower);
+        return key;
+    }
+    static long long cellKey(int cx, int cy) {
+        return static_cast<long long>(static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32 | static_cast<uint32_t>(cy));
+    }
+    int cellOf(double v) const { return static_cast<int>(floor(v / cellSize)); }
+
+    // Dijkstra over arcs leading to higher-ranked nodes. A node is not expanded
+    // ("stalled") when some higher node already reached offers a shorter way in
+    // through the opposite arcs, since it cannot then lie on a shortest path.
+    void upwardSearch(int source, const vector<int>& start, const vector<Arc>& arcs,
+                      const vector<int>& stallStart, const vector<Arc>& stallArcs,
+                      vector<int>& dist, vector<int>& touched) const {
+        priority_queue<pair<int, int>, vector<pair<int, int>>, greater<pair<int, int>>> pq;
+        dist[source] = 0;
+        touched.push_back(source);
+        pq.push({0, source});
+        while (!pq.empty()) {
+            int d = pq.top().first, u = pq.top().second;
+            pq.pop();
+            if (d > dist[u]) continue;
+            bool stalled = false;
+            for (int a = stallStart[u]; a < stallStart[u + 1] && !stalled; a++) {
+                int v = stallArcs[a].to;
+                stalled = dist[v] != unreachable && dist[v] + stallArcs[a].seconds < d;
+            }
+            if (stalled) continue;
+            for (int a = start[u]; a < start[u + 1]; a++) {
+                int v = arcs[a].to, nd = d + arcs[a].seconds;
+                if (nd < dist[v]) {
+                    if (dist[v] == unreachable) touched.push_back(v);
+                    dist[v] = nd;
+                    pq.push({nd, v});
+                }
+            }
+        }
+    }
+    static void reset(vector<int>& dist, vector<int>& touched) {
+        for (int v : touched) dist[v] = unreachable;
+        touched.clear();
+    }
+    // Times from `node` to every node (or from every node to it when not
+    // `outward`): the upward search, then one sweep down the ranks that
+    // settles each node from the higher ones it hangs off (PHAST).
+    vector<int> sweep(int node, bool outward) const {
+        vector<int>& dist = outward ? distForward : distBackward;
+        vector<int>& touched = outward ? touchedForward : touchedBackward;
+        if (outward) upwardSearch(node, upStart, upArcs, downStart, downArcs, dist, touched);
+        else upwardSearch(node, downStart, downArcs, upStart, upArcs, dist, touched);
+        vector<int> all = dist;
+        reset(dist, touched);
+        const vector<int>& start = outward ? downStart : upStart;
+        const vector<Arc>& arcs = outward ? downArcs : upArcs;
+        for (int v : byRank) {
+            for (int a = start[v]; a < start[v + 1]; a++) {
+                int u = arcs[a].to;
+                if (all[u] != unreachable) all[v] = min(all[v], all[u] + arcs[a].seconds);
+            }
+        }
+        return all;
+    }
+    int meet() const {
+        int best = unreachable;
+        for (int v : touchedForward) {
+            if (distBackward[v] != unreachable) best = min(best, distForward[v] + distBackward[v]);
+        }
+        return best;
+    }
+
+    // Working graph used while contracting.
+    struct Builder {
+        vector<vector<Arc>> out, in;
+        vector<bool> contracted;
+        vector<WorkArc> allArcs;
+        vector<int> witnessDist;
+        vector<int> witnessTouched;
+
+        void addArc(int u, int v, int w) {
+            allArcs.push_back({u, v, w});
+            for (Arc& a : out[u]) {
+                if (a.to == v) {
+                    if (w < a.seconds) {
+                        a.seconds = w;
+                        for (Arc& b : in[v]) if (b.to == u) b.seconds = w;
+                    }
+                    return;
+                }
+            }
+            out[u].push_back({v, w});
+            in[v].push_back({u, w});
+        }
+        // Bounded Dijkstra from u that ignores v and contracted nodes.
+        void witnessSearch(int u, int v, int limit) {
+            for (int x : witnessTouched) witnessDist[x] = unreachable;
+            witnessTouched.clear();
+            priority_queue<pair<int, int>, vector<pair<int, int>>, greater<pair<int, int>>> pq;
+            witnessDist[u] = 0;
+            witnessTouched.push_back(u);
+            pq.push({0, u});
+            int settled = 0;
+            while (!pq.empty() && settled < 500) {
+                int d = pq.top().first, x = pq.top().second;
+                pq.pop();
+                if (d > witnessDist[x]) continue;
+                if (d > limit) break;
+                settled++;
+                for (const Arc& a : out[x]) {
+                    if (a.to == v || contracted[a.to]) continue;
+                    int nd = d + a.seconds;
+                    if (nd < witnessDist[a.to]) {
+                        if (witnessDist[a.to] == unreachable) witnessTouched.push_back(a.to);
+                        witnessDist[a.to] = nd;
+                        pq.push({nd, a.to});
+                    }
+                }
+            }
+        }
+        // Number of shortcuts contracting v needs; adds them when apply is set.
+        int contract(int v, bool apply) {
+            int shortcuts = 0;
+            vector<WorkArc> pending;
+            for (const Arc& a : in[v]) {
+                int u = a.to;
+                if (contracted[u]) continue;
+                int limit = -1;     // no way on through v
+                for (const Arc& b : out[v]) {
+                    if (!contracted[b.to] && b.to != u) limit = max(limit, a.seconds + b.seconds);
+                }
+                if (limit < 0) continue;
+                witnessSearch(u, v, limit);
+                for (const Arc& b : out[v]) {
+                    int x = b.to;
+                    if (contracted[x] || x == u) continue;
+                    if (witnessDist[x] > a.seconds + b.seconds) {
+                        shortcuts++;
+                        if (apply) pending.push_back({u, x, a.seconds + b.seconds});
+                    }
+                }
+            }
+            for (const WorkArc& s : pending) addArc(s.from, s.to, s.seconds);
+            return shortcuts;
+        }
+        int degree(int v) const {
+            int d = 0;
+            for (const Arc& a : out[v]) if (!contracted[a.to]) d++;
+            for (const Arc& a : in[v]) if (!contracted[a.to]) d++;
+            return d;
+        }
+    };
+
+public:
+    static constexpr int unreachable = numeric_limits<int>::max();
+
+    bool empty() const { return positions.empty(); }
+    bool isBuilt() const { return built; }
+    size_t nodeCount() const { return positions.size(); }
+    size_t arcCount() const { return built ? upArcs.size() + downArcs.size() : 0; }
+
+    int addNode(long long id, const GeoPoint& p) {
+        auto it = nodeIndex.find(id);
+        if (it != nodeIndex.end()) return it->second;
+        int v = static_cast<int>(positions.size());
+        nodeIndex[id] = v;
+        positions.push_back(p);
+        outArcs.emplace_back();
+        int cx = cellOf(p.x), cy = cellOf(p.y);
+        if (maxCx < minCx) {
+            minCx = maxCx = cx;
+            minCy = maxCy = cy;
+        }
+        minCx = min(minCx, cx); maxCx = max(maxCx, cx);
+        minCy = min(minCy, cy); maxCy = max(maxCy, cy);
+        cells[cellKey(cx, cy)].push_back(v);
+        built = false;
+        return v;
+    }
+    // Roads take at least a second; contraction relies on every arc having a length.
+    bool addRoad(long long from, long long to, int seconds, bool oneWay = false) {
+        auto a = nodeIndex.find(from), b = nodeIndex.find(to);
+        if (a == nodeIndex.end() || b == nodeIndex.end() || seconds <= 0) return false;
+        outArcs[a->second].push_back({b->second, seconds});
+        if (!oneWay) outArcs[b->second].push_back({a->second, seconds});
+        built = false;
+        return true;
+    }
+    void addPlace(const string& zip, const string& street, long long node) {
+        auto it = nodeIndex.find(node);
+        if (it != nodeIndex.end()) places[placeKey(zip, street)] = it->second;
+    }
+
+    int loadFromFile(const string& filename, const ZipGeocoder& geocoder) {
+        ifstream inFile(filename);
+        if (!inFile) return 0;
+        string line;
+        while (getline(inFile, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            stringstream ss(line);
+            string kind, a, b, c, d;
+            getline(ss, kind, ',');
+            getline(ss, a, ',');
+            getline(ss, b, ',');
+            getline(ss, c, ',');
+            getline(ss, d);
+            try {
+                if (kind == "node") {
+                    addNode(stoll(a), geocoder.project(stod(b), stod(c)));
+                } else if (kind == "edge") {
+                    addRoad(stoll(a), stoll(b), stoi(c), d == "oneway");
+                } else if (kind == "place") {
+                    addPlace(a, b, stoll(c));
+                }
+            } catch (...) {}
+        }
+        return static_cast<int>(positions.size());
+    }
+
+    void buildHierarchy() {
+        int n = static_cast<int>(positions.size());
+        Builder g;
+        g.out.resize(n);
+        g.in.resize(n);
+        g.contracted.assign(n, false);
+        g.witnessDist.assign(n, unreachable);
+        for (int u = 0; u < n; u++) {
+            for (const Arc& a : outArcs[u]) {
+                if (a.to != u) g.addArc(u, a.to, a.seconds);
+            }
+        }
+
+        // Contract cheapest nodes first (edge difference, already contracted
+        // neighbours and hierarchy depth), re-checking priorities lazily as
+        // they go stale.
+        vector<int> contractedNeighbours(n, 0), level(n, 0);
+        byRank.clear();
+        auto priority = [&](int v) {
+            return 2 * (g.contract(v, false) - g.degree(v)) + contractedNeighbours[v] + level[v];
+        };
+        priority_queue<pair<int, int>, vector<pair<int, int>>, greater<pair<int, int>>> pq;
+        for (int v = 0; v < n; v++) pq.push({priority(v), v});
+        rank.assign(n, 0);
+        int next = 0;
+        while (!pq.empty()) {
+            int v = pq.top().second;
+            pq.pop();
+            if (g.contracted[v]) continue;
+            int p = priority(v);
+            if (!pq.empty() && p > pq.top().first) {
+                pq.push({p, v});
+                continue;
+            }
+            g.contract(v, true);
+            g.contracted[v] = true;
+            rank[v] = next++;
+            byRank.push_back(v);
+            for (const vector<Arc>* arcs : {&g.out[v], &g.in[v]}) {
+                for (const Arc& a : *arcs) {
+                    contractedNeighbours[a.to]++;
+                    level[a.to] = max(level[a.to], level[v] + 1);
+                }
+            }
+        }
+
+        // Arcs were recorded every time they were added or shortened; keep the
+        // final (shortest) version of each.
+        sort(g.allArcs.begin(), g.allArcs.end(), [](const WorkArc& a, const WorkArc& b) {
+            if (a.from != b.from) return a.from < b.from;
+            if (a.to != b.to) return a.to < b.to;
+            return a.seconds < b.seconds;
+        });
+        vector<vector<Arc>> up(n), down(n);
+        for (size_t i = 0; i < g.allArcs.size(); i++) {
+            const WorkArc& a = g.allArcs[i];
+            if (i > 0 && g.allArcs[i - 1].from == a.from && g.allArcs[i - 1].to == a.to) continue;
+            if (rank[a.from] < rank[a.to]) up[a.from].push_back({a.to, a.seconds});
+            else down[a.to].push_back({a.from, a.seconds});
+        }
+        auto flatten = [n](const vector<vector<Arc>>& lists, vector<int>& start, vector<Arc>& arcs) {
+            start.assign(n + 1, 0);
+            arcs.clear();
+            for (int v = 0; v < n; v++) {
+                start[v] = static_cast<int>(arcs.size());
+                arcs.insert(arcs.end(), lists[v].begin(), lists[v].end());
+            }
+            start[n] = static_cast<int>(arcs.size());
+        };
+        flatten(up, upStart, upArcs);
+        flatten(down, downStart, downArcs);
+        reverse(byRank.begin(), byRank.end());
+        distForward.assign(n, unreachable);
+        distBackward.assign(n, unreachable);
+        bucketFirst.assign(n, -1);
+        built = true;
+    }
+
+    int nearestNode(const GeoPoint& p) const {
+        if (positions.empty()) return -1;
+        int cx = cellOf(p.x), cy = cellOf(p.y);
+        int maxRing = max(max(abs(cx - minCx), abs(maxCx - cx)), max(abs(cy - minCy), abs(maxCy - cy)));
+        int best = -1;
+        double bestDist = numeric_limits<double>::infinity();
+        for (int r = 0; r <= maxRing; r++) {
+            if (best >= 0 && (r - 1) * cellSize > bestDist) break;
+            for (int x = cx - r; x <= cx + r; x++) {
+                for (int y = cy - r; y <= cy + r; y++) {
+                    if (max(abs(x - cx), abs(y - cy)) != r) continue;
+                    auto it = cells.find(cellKey(x, y));
+                    if (it == cells.end()) continue;
+                    for (int v : it->second) {
+                        double d = p.distanceTo(positions[v]);
+                        if (d < bestDist) {
+                            bestDist = d;
+                            best = v;
+                        }
+                    }
+                }
+            }
+        }
+        return best;
+    }
+    // Street entry first, then the zip, then the node closest to the fallback point.
+    int nodeForAddress(const string& zip, const string& street, const GeoPoint& fallback) const {
+        auto it = places.find(placeKey(zip, street));
+        if (it == places.end()) it = places.find(placeKey(zip, ""));
+        if (it != places.end()) return it->second;
+        return nearestNode(fallback);
+    }
+
+    int travelTime(int from, int to) const {
+        if (!built || from < 0 || to < 0) return unreachable;
+        upwardSearch(from, upStart, upArcs, downStart, downArcs, distForward, touchedForward);
+        upwardSearch(to, downStart, downArcs, upStart, upArcs, distBackward, touchedBackward);
+        int best = meet();
+        reset(distForward, touchedForward);
+        reset(distBackward, touchedBackward);
+        return best;
+    }
+    // Every source to every target, result[source][target]. One backward
+    // search per target leaves (target, seconds) in a bucket at each node it
+    // reaches; one forward search per source then reads the buckets of the
+    // nodes it reaches. That is sources + targets searches instead of their
+    // product, and the meeting is found without comparing search spaces.
+    vector<vector<int>> travelTimeTable(const vector<int>& sources, const vector<int>& targets) const {
+        vector<vector<int>> result(sources.size(), vector<int>(targets.size(), unreachable));
+        if (!built) return result;
+        // From one node to many (or many to one) a sweep over the whole graph
+        // wins once there are enough of them: on street grids one sweep cost
+        // about as much as 6 searches at 6k nodes and 10 at 22k.
+        size_t sweepFrom = max<size_t>(8, positions.size() / 2048);
+        if (sources.size() == 1 && targets.size() >= sweepFrom && sources[0] >= 0) {
+            vector<int> all = sweep(sources[0], true);
+            for (size_t t = 0; t < targets.size(); t++) if (targets[t] >= 0) result[0][t] = all[targets[t]];
+            return result;
+        }
+        if (targets.size() == 1 && sources.size() >= sweepFrom && targets[0] >= 0) {
+            vector<int> all = sweep(targets[0], false);
+            for (size_t s = 0; s < sources.size(); s++) if (sources[s] >= 0) result[s][0] = all[sources[s]];
+            return result;
+        }
+        found.clear();
+        for (size_t t = 0; t < targets.size(); t++) {
+            if (targets[t] < 0) continue;
+            upwardSearch(targets[t], downStart, downArcs, upStart, upArcs, distBackward, touchedBackward);
+            for (int v : touchedBackward) found.push_back({v, static_cast<int>(t), distBackward[v]});
+            reset(distBackward, touchedBackward);
+        }
+        // Group by node with a counting pass; bucketFirst holds the counts, then
+        // where each node's entries go, and finally where they start.
+        bucketNodes.clear();
+        for (const BucketEntry& entry : found) {
+            int& first = bucketFirst[entry.node];
+            if (first < 0) {
+                first = 0;
+                bucketNodes.push_back(entry.node);
+            }
+            first++;
+        }
+        int next = 0;
+        for (int v : bucketNodes) {
+            int count = bucketFirst[v];
+            bucketFirst[v] = next;
+            next += count;
+        }
+        buckets.resize(found.size());
+        for (const BucketEntry& entry : found) buckets[bucketFirst[entry.node]++] = entry;
+        for (size_t e = buckets.size(); e-- > 0;) bucketFirst[buckets[e].node] = static_cast<int>(e);
+        for (size_t s = 0; s < sources.size(); s++) {
+            if (sources[s] < 0) continue;
+            upwardSearch(sources[s], upStart, upArcs, downStart, downArcs, distForward, touchedForward);
+            vector<int>& row = result[s];
+            for (int v : touchedForward) {
+                for (int e = bucketFirst[v]; e >= 0 && e < static_cast<int>(buckets.size()) && buckets[e].node == v; e++) {
+                    row[buckets[e].target] = min(row[buckets[e].target], distForward[v] + buckets[e].seconds);
+                }
+            }
+            reset(distForward, touchedForward);
+        }
+        for (int v : bucketNodes) bucketFirst[v] = -1;
+        return result;
+    }
+    vector<int> travelTimes(int from, const vector<int>& targets) const {
+        return travelTimeTable({from}, targets)[0];
+    }
+    vector<int> travelTimesTo(const vector<int>& sources, int to) const {
+        vector<vector<int>> table = travelTimeTable(sources, {to});
+        vector<int> result(sources.size());
+        for (size_t i = 0; i < sources.size(); i++) result[i] = table[i][0];
+        return result;
+    }
+    // Plain Dijkstra on the original graph, used to check the hierarchy.
+    int dijkstra(int from, int to) const {
+        vector<int> dist(positions.size(), unreachable);
+        priority_queue<pair<int, int>, vector<pair<int, int>>, greater<pair<int, int>>> pq;
+        dist[from] = 0;
+        pq.push({0, from});
+        while (!pq.empty()) {
+            int d = pq.top().first, u = pq.top().second;
+            pq.pop();
+            if (u == to) return d;
+            if (d > dist[u]) continue;
+            for (const Arc& a : outArcs[u]) {
+                if (d + a.seconds < dist[a.to]) {
+                    dist[a.to] = d + a.seconds;
+                    pq.push({dist[a.to], a.to});
+                }
+            }
+        }
+        return unreachable;
+    }
+};
+
+// Min-cost assignment of bidders (orders) to objects (driver slots) over a
+// sparse cost matrix, solved with Bertsekas' auction algorithm and epsilon
+// scaling. Every bidder also owns a private "unassigned" object priced at
+// unassignedCost, so the auction always terminates even when an order has no
+// candidate driver. Bids of one round are computed in parallel (Jacobi
+// auction) once enough bidders are waiting.
+class AuctionSolver {
+public:
+    struct Edge {
+        int slot;
+        long long cost;
+    };
+private:
+    struct Bid {
+        int object;
+        long long price;
+    };
+public:
+    // Returns the slot won by each bidder, or -1 if it stays unassigned.
+    static vector<int> solve(int slotCount, const vector<vector<Edge>>& edges,
+                             long long unassignedCost, unsigned threads = 0) {
+        int n = static_cast<int>(edges.size());
+        int objects = slotCount + n;
+        if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+        // Costs are in metres; finishing at epsilon = 1 puts the total within
+        // one metre per order of the optimum. Scaling costs by n + 1 would make
+        // it exact at the price of much longer final bidding rounds.
+        long long scale = 1;
+        vector<long long> price(objects, 0);
+        vector<int> owner(objects, -1), assigned(n, -1), roundWinner(objects, -1);
+        long long eps = max(1LL, unassignedCost * scale / 8);
+        while (true) {
+            // Objects nobody won last phase start again from price 0. Prices only
+            // rise within a phase, so at the end every unassigned object is at
+            // the minimum price, which keeps the result optimal even though
+            // there are more objects than bidders.
+            for (int obj = 0; obj < objects; obj++) {
+                if (owner[obj] < 0) price[obj] = 0;
+                owner[obj] = -1;
+            }
+            fill(assigned.begin(), assigned.end(), -1);
+            vector<int> unassigned(n);
+            for (int i = 0; i < n; i++) unassigned[i] = i;
+            vector<Bid> bids;
+            while (!unassigned.empty()) {
+                bids.assign(unassigned.size(), {0, 0});
+                auto computeBids = [&](size_t from, size_t to) {
+                    for (size_t u = from; u < to; u++) {
+                        int i = unassigned[u];
+                        int bestObject = slotCount + i;
+                        long long best = -unassignedCost * scale - price[bestObject];
+                        long long second = numeric_limits<long long>::min();
+                        for (const Edge& e : edges[i]) {
+                            long long value = -e.cost * scale - price[e.slot];
+                            if (value > best) {
+                                second = best;
+                                best = value;
+                                bestObject = e.slot;
+                            } else if (value > second) {
+                                second = value;
+                            }
+                        }
+                        if (second == numeric_limits<long long>::min()) second = best;
+                        bids[u] = {bestObject, price[bestObject] + (best - second) + eps};
+                    }
+                };
+                if (threads > 1 && unassigned.size() >= 4096) {
+                    vector<thread> workers;
+                    size_t chunk = (unassigned.size() + threads - 1) / threads;
+                    for (unsigned t = 0; t < threads; t++) {
+                        size_t from = t * chunk, to = min(unassigned.size(), from + chunk);
+                        if (from < to) workers.emplace_back(computeBids, from, to);
+                    }
+                    for (thread& w : workers) w.join();
+                } else {
+                    computeBids(0, unassigned.size());
+                }
+
+                vector<int> touched;
+                for (size_t u = 0; u < bids.size(); u++) {
+                    int obj = bids[u].object;
+                    if (roundWinner[obj] < 0) {
+                        roundWinner[obj] = static_cast<int>(u);
+                        touched.push_back(obj);
+                    } else if (bids[u].price > bids[roundWinner[obj]].price) {
+                        roundWinner[obj] = static_cast<int>(u);
+                    }
+                }
+                vector<bool> won(bids.size(), false);
+                vector<int> nextUnassigned;
+                for (int obj : touched) {
+                    int u = roundWinner[obj];
+                    roundWinner[obj] = -1;
+                    won[u] = true;
+                    if (owner[obj] >= 0) {
+                        assigned[owner[obj]] = -1;
+                        nextUnassigned.push_back(owner[obj]);
+                    }
+                    owner[obj] = unassigned[u];
+                    assigned[unassigned[u]] = obj;
+                    price[obj] = bids[u].price;
+                }
+                for (size_t u = 0; u < bids.size(); u++) {
+                    if (!won[u]) nextUnassigned.push_back(unassigned[u]);
+                }
+                unassigned.swap(nextUnassigned);
+            }
+            if (eps == 1) break;
+            eps = max(1LL, eps / 8);
+        }
+        for (int& a : assigned) {
+            if (a >= slotCount) a = -1;
+        }
+        return assigned;
+    }
+};
+
+// Batch dispatch over one window of ready orders. Each order is connected to
+// its nearest available drivers (found through the grid), one edge per free
+// seat of that driver, and the auction picks the assignment with the least
+// total cost. Cost is the straight-line distance in metres unless a travelCost
+// callback supplies something better, e.g. road travel times; it returns one
+// cost per candidate driver, negative when the driver cannot reach the order.
+// When seatsNeeded is given, each entry is a multi-drop route that needs that
+// many free seats and a driver takes at most one route per batch.
+class BatchDispatcher {
+public:
+    struct Result {
+        vector<DeliveryDriver*> driverFor;   // per order, nullptr if unassigned
+        double totalKm = 0.0;
+        int assigned = 0;
+    };
+    typedef function<vector<long long>(size_t order, const vector<DeliveryDriver*>& candidates)> CostFunction;
+
+    static Result assign(const vector<GeoPoint>& dropoffs, const DriverGrid& grid,
+                         size_t candidates = 16, double maxKm = 30.0,
+                         const CostFunction& travelCost = nullptr,
+                         const vector<int>* seatsNeeded = nullptr) {
+        size_t n = dropoffs.size();
+        Result result;
+        result.driverFor.assign(n, nullptr);
+        if (n == 0) return result;
+
+        vector<vector<DeliveryDriver*>> nearby(n);
+        unsigned threads = max(1u, thread::hardware_concurrency());
+        auto findCandidates = [&](size_t from, size_t to) {
+            for (size_t i = from; i < to; i++) nearby[i] = grid.nearest(dropoffs[i], candidates, maxKm);
+        };
+        if (threads > 1 && n >= 4096) {
+            vector<thread> workers;
+            size_t chunk = (n + threads - 1) / threads;
+            for (unsigned t = 0; t < threads; t++) {
+                size_t from = t * chunk, to = min(n, from + chunk);
+                if (from < to) workers.emplace_back(findCandidates, from, to);
+            }
+            for (thread& w : workers) w.join();
+        } else {
+            findCandidates(0, n);
+        }
+
+        unordered_map<DeliveryDriver*, int> firstSlot;
+        vector<DeliveryDriver*> slotDriver;
+        vector<vector<AuctionSolver::Edge>> edges(n);
+        for (size_t i = 0; i < n; i++) {
+            vector<long long> costs;
+            if (travelCost) costs = travelCost(i, nearby[i]);
+            for (size_t c = 0; c < nearby[i].size(); c++) {
+                DeliveryDriver* d = nearby[i][c];
+                long long cost = travelCost ? costs[c]
+                                            : llround(d->getPosition().distanceTo(dropoffs[i]) * 1000.0);
+                int freeSeats = d->getCapacity() - d->getLoad();
+                if (cost < 0 || (seatsNeeded && freeSeats < (*seatsNeeded)[i])) continue;
+                int slotsOfDriver = seatsNeeded ? 1 : freeSeats;
+                auto it = firstSlot.find(d);
+                if (it == firstSlot.end()) {
+                    it = firstSlot.emplace(d, static_cast<int>(slotDriver.size())).first;
+                    for (int s = 0; s < slotsOfDriver; s++) slotDriver.push_back(d);
+                }
+                for (int s = 0; s < slotsOfDriver; s++) {
+                    edges[i].push_back({it->second + s, cost});
+                }
+            }
+        }
+        // Leaving an order behind costs more than any single trip.
+        long long unassignedCost = llround(maxKm * 1000.0) * 2;
+        vector<int> slot = AuctionSolver::solve(static_cast<int>(slotDriver.size()), edges,
+                                                unassignedCost, threads);
+        unordered_map<DeliveryDriver*, int> seatsUsed;
+        for (size_t i = 0; i < n; i++) {
+            if (slot[i] >= 0) {
+                result.driverFor[i] = slotDriver[slot[i]];
+                seatsUsed[slotDriver[slot[i]]] += seatsNeeded ? (*seatsNeeded)[i] : 1;
+            }
+        }
+        // Orders whose nearest drivers were all taken look further out for
+        // whatever seats are left.
+        for (size_t i = 0; i < n; i++) {
+            int need = seatsNeeded ? (*seatsNeeded)[i] : 1;
+            for (size_t k = candidates * 2; !result.driverFor[i]; k *= 2) {
+                vector<DeliveryDriver*> found = grid.nearest(dropoffs[i], k, maxKm);
+                for (DeliveryDriver* d : found) {
+                    int used = seatsUsed[d];
+                    if ((seatsNeeded && used > 0) || d->getLoad() + used + need > d->getCapacity()) continue;
+                    result.driverFor[i] = d;
+                    seatsUsed[d] += need;
+                    break;
+                }
+                if (found.size() < k) break;
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (!result.driverFor[i]) continue;
+            result.totalKm += result.driverFor[i]->getPosition().distanceTo(dropoffs[i]);
+            result.assigned++;
+        }
+        return result;
+    }
+
+    // One order at a time, each to the nearest driver still free. Drivers that
+    // fill up are taken out of the grid.
+    static Result assignGreedy(const vector<GeoPoint>& dropoffs, DriverGrid& grid, double maxKm = 30.0) {
+        Result result;
+        result.driverFor.assign(dropoffs.size(), nullptr);
+        unordered_map<DeliveryDriver*, int> load;
+        for (size_t i = 0; i < dropoffs.size(); i++) {
+            vector<DeliveryDriver*> found = grid.nearest(dropoffs[i], 1, maxKm);
+            if (found.empty()) continue;
+            DeliveryDriver* d = found[0];
+            result.driverFor[i] = d;
+            result.totalKm += d->getPosition().distanceTo(dropoffs[i]);
+            result.assigned++;
+            if (d->getLoad() + ++load[d] >= d->getCapacity()) grid.remove(d);
+        }
+        return result;
+    }
+};
+
+// Multi-drop routing for one dispatch tick. Ready orders are grouped by
+// delivery area (city, or zip when the city is blank) and by the window their
+// order time falls in; large groups are cut into batches by angle around the
+// restaurant. Each batch becomes routes of at most maxStops drops by cheapest
+// insertion, which 2-opt and or-opt moves then shorten. Routes start and end at
+// the restaurant, and every stop must be reached by its order's promised time
+// (or, if even a direct trip would be late, no later than a direct trip).
+// Batches are solved in parallel and local search stops when the tick's time
+// budget runs out.
+class RoutePlanner {
+public:
+    struct Stop {
+        GeoPoint point;
+        string area;
+        long long orderTime;   // seconds since epoch
+    };
+    struct Route {
+        vector<int> stops;     // indices into the planned stops, in visiting order
+        int seconds = 0;       // restaurant -> stops -> restaurant
+    };
+    struct Plan {
+        vector<Route> routes;
+        long long routeSeconds = 0;
+        long long singleDropSeconds = 0;   // every order as its own round trip
+        bool outOfTime = false;
+    };
+    // Travel time in seconds between two stops, -1 meaning the restaurant.
+    // Returns a negative value when there is no way through.
+    typedef function<int(int from, int to)> TravelFunction;
+    // The same for every `from` stop to every `to` stop at once, one row per
+    // `from`, for callers that answer a whole table faster than its cells.
+    typedef function<vector<vector<int>>(const vector<int>& from, const vector<int>& to)> TravelTableFunction;
+
+private:
+    struct Batch {
+        vector<int> stops;            // global stop index per local index 1..k
+        vector<int> matrix;           // (k+1) x (k+1), local index 0 is the restaurant
+        vector<long long> limit;      // latest arrival per local index, relative to now
+        vector<vector<int>> routes;   // local indices
+        bool outOfTime = false;
+    };
+    int maxStops;
+    int windowMinutes;
+    int promiseMinutes;
+    int budgetMs;
+
+    static int at(const Batch& b, int from, int to) {
+        return b.matrix[from * (b.stops.size() + 1) + to];
+    }
+    static int routeSeconds(const Batch& b, const vector<int>& route, bool& onTime) {
+        long long t = 0;
+        int prev = 0;
+        onTime = true;
+        for (int s : route) {
+            t += at(b, prev, s);
+            if (t > b.limit[s]) onTime = false;
+            prev = s;
+        }
+        t += at(b, prev, 0);
+        return static_cast<int>(min<long long>(t, numeric_limits<int>::max()));
+    }
+    int cheapestInsertion(Batch& b) const {
+        int k = static_cast<int>(b.stops.size());
+        vector<int> seeds(k);
+        for (int i = 0; i < k; i++) seeds[i] = i + 1;
+        sort(seeds.begin(), seeds.end(), [&](int x, int y) { return b.limit[x] < b.limit[y]; });
+        vector<bool> routed(k + 1, false);
+        for (int seed : seeds) {
+            if (routed[seed]) continue;
+            vector<int> route = {seed};
+            routed[seed] = true;
+            while (static_cast<int>(route.size()) < maxStops) {
+                int bestStop = -1, bestPos = 0;
+                long long bestDelta = numeric_limits<long long>::max();
+                for (int s = 1; s <= k; s++) {
+                    if (routed[s]) continue;
+                    long long direct = static_cast<long long>(at(b, 0, s)) + at(b, s, 0);
+                    for (size_t pos = 0; pos <= route.size(); pos++) {
+                        int before = pos == 0 ? 0 : route[pos - 1];
+                        int after = pos == route.size() ? 0 : route[pos];
+                        long long delta = static_cast<long long>(at(b, before, s)) + at(b, s, after)
+                                          - at(b, before, after);
+                        if (delta >= direct || delta >= bestDelta) continue;
+                        vector<int> trial = route;
+                        trial.insert(trial.begin() + pos, s);
+                        bool onTime;
+                        routeSeconds(b, trial, onTime);
+                        if (!onTime) continue;
+                        bestDelta = delta;
+                        bestStop = s;
+                        bestPos = static_cast<int>(pos);
+                    }
+                }
+                if (bestStop < 0) break;
+                route.insert(route.begin() + bestPos, bestStop);
+                routed[bestStop] = true;
+            }
+            b.routes.push_back(route);
+        }
+        return static_cast<int>(b.routes.size());
+    }
+    // Reverses a stretch of one route (2-opt). Returns true on improvement.
+    bool twoOpt(Batch& b, vector<int>& route) const {
+        bool onTime;
+        int current = routeSeconds(b, route, onTime);
+        for (size_t i = 0; i + 1 < route.size(); i++) {
+            for (size_t j = i + 1; j < route.size(); j++) {
+                vector<int> trial = route;
+                reverse(trial.begin() + i, trial.begin() + j + 1);
+                int seconds = routeSeconds(b, trial, onTime);
+                if (onTime && seconds < current) {
+                    route = trial;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    // Moves a run of one or two stops to another place in the same or another
+    // route (or-opt). Returns true on improvement.
+    bool orOpt(Batch& b) const {
+        bool onTime, onTimeB;
+        for (size_t ra = 0; ra < b.routes.size(); ra++) {
+            for (size_t len = 1; len <= 2; len++) {
+                for (size_t i = 0; i + len <= b.routes[ra].size(); i++) {
+                    vector<int> from = b.routes[ra];
+                    vector<int> segment(from.begin() + i, from.begin() + i + len);
+                    from.erase(from.begin() + i, from.begin() + i + len);
+                    for (size_t rb = 0; rb < b.routes.size(); rb++) {
+                        vector<int> base = rb == ra ? from : b.routes[rb];
+                        if (rb != ra && static_cast<int>(base.size() + len) > maxStops) continue;
+                        int before = routeSeconds(b, b.routes[ra], onTime)
+                                     + (rb == ra ? 0 : routeSeconds(b, b.routes[rb], onTime));
+                        for (size_t pos = 0; pos <= base.size(); pos++) {
+                            if (rb == ra && pos == i) continue;
+                            vector<int> to = base;
+                            to.insert(to.begin() + pos, segment.begin(), segment.end());
+                            int after = routeSeconds(b, to, onTimeB);
+                            if (!onTimeB) continue;
+                            if (rb != ra) {
+                                if (!from.empty()) after += routeSeconds(b, from, onTime);
+                                if (!from.empty() && !onTime) continue;
+                            }
+                            if (after < before) {
+                                b.routes[rb] = to;
+                                if (rb != ra) {
+                                    b.routes[ra] = from;
+                                    if (from.empty()) b.routes.erase(b.routes.begin() + ra);
+                                }
+                                return true;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return false;
+    }
+    void solveBatch(Batch& b, chrono::steady_clock::time_point deadline) const {
+        if (chrono::steady_clock::now() >= deadline) {
+            for (size_t i = 1; i <= b.stops.size(); i++) b.routes.push_back({static_cast<int>(i)});
+            b.outOfTime = true;
+            return;
+        }
+        cheapestInsertion(b);
+        bool improved = true;
+        while (improved) {
+            if (chrono::steady_clock::now() >= deadline) {
+                b.outOfTime = true;
+                return;
+            }
+            improved = false;
+            for (vector<int>& route : b.routes) {
+                while (twoOpt(b, route)) improved = true;
+            }
+            if (orOpt(b)) improved = true;
+        }
+    }
+
+public:
+    RoutePlanner(int stops = 3, int window = 15, int promise = 60, int budget = 50)
+        : maxStops(max(1, stops)), windowMinutes(max(1, window)), promiseMinutes(promise),
+          budgetMs(budget) {}
+
+    Plan plan(const vector<Stop>& stops, long long now, const TravelFunction& travel) const {
+        TravelTableFunction table = [&](const vector<int>& from, const vector<int>& to) {
+            vector<vector<int>> seconds(from.size(), vector<int>(to.size(), 0));
+            for (size_t i = 0; i < from.size(); i++) {
+                for (size_t j = 0; j < to.size(); j++) {
+                    if (from[i] != to[j]) seconds[i][j] = travel(from[i], to[j]);
+                }
+            }
+            return seconds;
+        };
+        return plan(stops, now, table);
+    }
+    Plan plan(const vector<Stop>& stops, long long now, const TravelTableFunction& travel) const {
+        auto deadline = chrono::steady_clock::now() + chrono::milliseconds(budgetMs);
+        const size_t batchSize = 48;
+        const int noRoute = 10000000;
+
+        map<string, vector<int>> groups;
+        for (size_t i = 0; i < stops.size(); i++) {
+            long long window = stops[i].orderTime / (windowMinutes * 60LL);
+            groups[stops[i].area + "|" + to_string(window)].push_back(static_cast<int>(i));
+        }
+        vector<Batch> batches;
+        for (auto& group : groups) {
+            vector<int>& members = group.second;
+            sort(members.begin(), members.end(), [&](int x, int y) {
+                return atan2(stops[x].point.y, stops[x].point.x) < atan2(stops[y].point.y, stops[y].point.x);
+            });
+            for (size_t from = 0; from < members.size(); from += batchSize) {
+                Batch b;
+                b.stops.assign(members.begin() + from, members.begin() + min(members.size(), from + batchSize));
+                batches.push_back(b);
+            }
+        }
+        // Travel times are looked up here, on one thread, because the callback
+        // may not be thread-safe (RoadNetwork queries are not). Each batch asks
+        // for its whole matrix in one call until half the budget is gone, so
+        // the rest is left for solving them; batches after that only get the
+        // legs to and from the restaurant, all in one call, which is enough
+        // to send each of their stops on its own.
+        auto matrixDeadline = chrono::steady_clock::now() + chrono::milliseconds(budgetMs) / 2;
+        auto seconds = [noRoute](int t) { return t < 0 ? noRoute : t; };
+        vector<Batch*> late;
+        for (Batch& b : batches) {
+            int k = static_cast<int>(b.stops.size());
+            b.matrix.assign((k + 1) * (k + 1), noRoute);
+            for (int i = 0; i <= k; i++) b.matrix[i * (k + 1) + i] = 0;
+            if (chrono::steady_clock::now() >= matrixDeadline) {
+                b.outOfTime = true;
+                late.push_back(&b);
+                continue;
+            }
+            vector<int> ends = {-1};
+            ends.insert(ends.end(), b.stops.begin(), b.stops.end());
+            vector<vector<int>> table = travel(ends, ends);
+            for (int i = 0; i <= k; i++) {
+                for (int j = 0; j <= k; j++) {
+                    if (i != j) b.matrix[i * (k + 1) + j] = seconds(table[i][j]);
+                }
+            }
+        }
+        if (!late.empty()) {
+            vector<int> lateStops;
+            for (const Batch* b : late) lateStops.insert(lateStops.end(), b->stops.begin(), b->stops.end());
+            vector<vector<int>> out = travel({-1}, lateStops), back = travel(lateStops, {-1});
+            size_t n = 0;
+            for (Batch* b : late) {
+                int k = static_cast<int>(b->stops.size());
+                for (int i = 1; i <= k; i++, n++) {
+                    b->matrix[i] = seconds(out[0][n]);
+                    b->matrix[i * (k + 1)] = seconds(back[n][0]);
+                }
+            }
+        }
+        for (Batch& b : batches) {
+            int k = static_cast<int>(b.stops.size());
+            b.limit.assign(k + 1, 0);
+            for (int i = 1; i <= k; i++) {
+                long long promised = stops[b.stops[i - 1]].orderTime + promiseMinutes * 60LL - now;
+                b.limit[i] = max<long long>(promised, at(b, 0, i));
+            }
+        }
+
+        atomic<size_t> next(0);
+        auto worker = [&]() {
+            for (size_t i = next++; i < batches.size(); i = next++) solveBatch(batches[i], deadline);
+        };
+        unsigned threads = min<size_t>(max(1u, thread::hardware_concurrency()), batches.size());
+        vector<thread> workers;
+        for (unsigned t = 1; t < threads; t++) workers.emplace_back(worker);
+        worker();
+        for (thread& w : workers) w.join();
+
+        Plan result;
+        for (const Batch& b : batches) {
+            result.outOfTime = result.outOfTime || b.outOfTime;
+            for (size_t i = 1; i <= b.stops.size(); i++) {
+                result.singleDropSeconds += at(b, 0, static_cast<int>(i)) + at(b, static_cast<int>(i), 0);
+            }
+            for (const vector<int>& local : b.routes) {
+                Route route;
+                bool onTime;
+                route.seconds = routeSeconds(b, local, onTime);
+                for (int s : local) route.stops.push_back(b.stops[s - 1]);
+                result.routeSeconds += route.seconds;
+                result.routes.push_back(route);
+            }
+        }
+        return result;
+    }
+
+    static double ordersPerHour(size_t orders, long long seconds) {
+        return seconds > 0 ? orders * 3600.0 / seconds : 0.0;
+    }
+};
+
+// Order id stored in place when it is short (every id this system makes is),
+// on the heap otherwise.
+class OrderKey {
+private:
+    static constexpr size_t inlineCapacity = 15;
+    static constexpr uint8_t onHeap = 0xFF;
+    union {
+        char inlineChars[inlineCapacity];
+        struct {
+            char* chars;
+            size_t length;
+        } heap;
+    };
+    uint8_t inlineLength;
+
+    void assign(const char* chars, size_t length) {
+        if (length <= inlineCapacity) {
+            memcpy(inlineChars, chars, length);
+            inlineLength = static_cast<uint8_t>(length);
+        } else {
+            heap.chars = new char[length];
+            memcpy(heap.chars, chars, length);
+            heap.length = length;
+            inlineLength = onHeap;
+        }
+    }
+public:
+    OrderKey(const char* chars, size_t length) { assign(chars, length); }
+    OrderKey(const OrderKey& other) { assign(other.data(), other.size()); }
+    OrderKey(OrderKey&& other) noexcept {
+        memcpy(static_cast<void*>(this), &other, sizeof(OrderKey));
+        other.inlineLength = 0;
+    }
+    OrderKey& operator=(const OrderKey& other) {
+        if (this != &other) {
+            this->~OrderKey();
+            assign(other.data(), other.size());
+        }
+        return *this;
+    }
+    ~OrderKey() {
+        if (inlineLength == onHeap) delete[] heap.chars;
+    }
+
+    const char* data() const { return inlineLength == onHeap ? heap.chars : inlineChars; }
+    size_t size() const { return inlineLength == onHeap ? heap.length : inlineLength; }
+    bool isInline() const { return inlineLength != onHeap; }
+    bool equals(const char* chars, size_t length) const {
+        return size() == length && memcmp(data(), chars, length) == 0;
+    }
+    operator string() const { return string(data(), size()); }
+};
+
+// Open-addressing table from order id to V, laid out like Abseil's
+// SwissTable: one control byte per slot (empty, deleted, or 7 bits of the
+// hash) scanned 16 at a time, with keys and values in a flat slot array.
+// A lookup touches one control group and usually one slot.
+template<typename V>
+class OrderIdTable {
+public:
+    struct Slot {
+        OrderKey first;
+        V second;
+    };
+
+    class iterator {
+    private:
+        const OrderIdTable* table;
+        size_t index;
+        void skipEmpty() {
+            while (index < table->capacity && table->ctrl[index] < 0) index++;
+        }
+        friend class OrderIdTable;
+    public:
+        iterator(const OrderIdTable* t, size_t i) : table(t), index(i) { skipEmpty(); }
+        Slot& operator*() const { return table->slots[index]; }
+        Slot* operator->() const { return &table->slots[index]; }
+        iterator& operator++() {
+            index++;
+            skipEmpty();
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return index == other.index; }
+        bool operator!=(const iterator& other) const { return index != other.index; }
+    };
+    typedef iterator const_iterator;
+
+private:
+    static constexpr int8_t ctrlEmpty = -128;
+    static constexpr int8_t ctrlDeleted = -2;
+    static constexpr size_t groupWidth = 16;
+
+    int8_t* ctrl;
+    Slot* slots;
+    size_t capacity;     // power of two, at least groupWidth
+    size_t count;
+    size_t growthLeft;   // inserts into empty slots before a rehash
+
+    static uint64_t hashOf(const char* s, size_t n) {
+        const uint64_t k = 0x9E3779B97F4A7C15ull;
+        uint64_t h = n * k;
+        while (n >= 8) {
+            uint64_t w;
+            memcpy(&w, s, 8);
+            h = (h ^ w) * k;
+            h ^= h >> 29;
+            s += 8;
+            n -= 8;
+        }
+        uint64_t tail = 0;
+        memcpy(&tail, s, n);
+        h = (h ^ tail) * k;
+        h ^= h >> 32;
+        h *= 0xD6E8FEB86659FD93ull;
+        return h ^ (h >> 32);
+    }
+
+    // Bit i set when control byte i of the group at `pos` equals `value`.
+    static uint32_t matchByte(const int8_t* group, int8_t value) {
+#if HAVE_SSE2
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(value))));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < groupWidth; i++) {
+            if (group[i] == value) mask |= 1u << i;
+        }
+        return mask;
+#endif
+    }
+    // Bit i set when slot i of the group is empty or deleted (high bit set).
+    static uint32_t matchFree(const int8_t* group) {
+#if HAVE_SSE2
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(bytes));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < groupWidth; i++) {
+            if (group[i] < 0) mask |= 1u << i;
+        }
+        return mask;
+#endif
+    }
+    static int lowestBit(uint32_t mask) {
+#if defined(__GNUC__)
+        return __builtin_ctz(mask);
+#else
+        int bit = 0;
+        while (!(mask & 1u)) {
+            mask >>= 1;
+            bit++;
+        }
+        return bit;
+#endif
+    }
+
+    // Slot holding `key`, or capacity when absent.
+    size_t locate(const char* key, size_t length, uint64_t h) const {
+        int8_t tag = static_cast<int8_t>(h & 0x7F);
+        size_t groupMask = capacity / groupWidth - 1;
+        size_t group = (h >> 7) & groupMask;
+        for (size_t step = 1;; step++) {
+            const int8_t* g = ctrl + group * groupWidth;
+            for (uint32_t m = matchByte(g, tag); m; m &= m - 1) {
+                size_t i = group * groupWidth + lowestBit(m);
+                if (slots[i].first.equals(key, length)) return i;
+            }
+            if (matchByte(g, ctrlEmpty)) return capacity;
+            group = (group + step) & groupMask;   // triangular probing visits every group
+        }
+    }
+    // First empty or deleted slot on the probe sequence of `h`.
+    size_t freeSlotFor(uint64_t h) const {
+        size_t groupMask = capacity / groupWidth - 1;
+        size_t group = (h >> 7) & groupMask;
+        for (size_t step = 1;; step++) {
+            uint32_t m = matchFree(ctrl + group * groupWidth);
+            if (m) return group * groupWidth + lowestBit(m);
+            group = (group + step) & groupMask;
+        }
+    }
+
+    void allocate(size_t slotCount) {
+        capacity = slotCount;
+        ctrl = new int8_t[capacity];
+        memset(ctrl, static_cast<unsigned char>(ctrlEmpty), capacity);
+        slots = static_cast<Slot*>(::operator new(capacity * sizeof(Slot)));
+        growthLeft = capacity - capacity / 8;   // keep load at or under 7/8
+    }
+    void release() {
+        for (size_t i = 0; i < capacity; i++) {
+            if (ctrl[i] >= 0) slots[i].~Slot();
+        }
+        delete[] ctrl;
+        ::operator delete(slots);
+    }
+    // Moves every entry into a fresh array of `slotCount` slots, which also
+    // drops deleted markers.
+    void rehash(size_t slotCount) {
+        int8_t* oldCtrl = ctrl;
+        Slot* oldSlots = slots;
+        size_t oldCapacity = capacity;
+        allocate(slotCount);
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (oldCtrl[i] < 0) continue;
+            const OrderKey& key = oldSlots[i].first;
+            uint64_t h = hashOf(key.data(), key.size());
+            size_t j = freeSlotFor(h);
+            ctrl[j] = static_cast<int8_t>(h & 0x7F);
+            new (&slots[j]) Slot(move(oldSlots[i]));
+            oldSlots[i].~Slot();
+        }
+        growthLeft -= count;
+        delete[] oldCtrl;
+        ::operator delete(oldSlots);
+    }
+    size_t insertNew(const char* key, size_t length, uint64_t h, const V& value) {
+        if (growthLeft == 0) {
+            // Mostly deleted markers: clean up in place; otherwise grow.
+            rehash(count * 2 < capacity - capacity / 8 ? capacity : capacity * 2);
+        }
+        size_t i = freeSlotFor(h);
+        if (ctrl[i] == ctrlEmpty) growthLeft--;
+        ctrl[i] = static_cast<int8_t>(h & 0x7F);
+        new (&slots[i]) Slot{OrderKey(key, length), value};
+        count++;
+        return i;
+    }
+public:
+    OrderIdTable() : count(0) { allocate(groupWidth); }
+    OrderIdTable(const OrderIdTable&) = delete;
+    OrderIdTable& operator=(const OrderIdTable&) = delete;
+    ~OrderIdTable() { release(); }
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, capacity); }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    iterator find(const string& key) const {
+        return iterator(this, locate(key.data(), key.size(), hashOf(key.data(), key.size())));
+    }
+
+    // Inserts unless the key is present; like unordered_map::emplace.
+    pair<iterator, bool> emplace(const string& key, const V& value) {
+        uint64_t h = hashOf(key.data(), key.size());
+        size_t i = locate(key.data(), key.size(), h);
+        if (i != capacity) return make_pair(iterator(this, i), false);
+        return make_pair(iterator(this, insertNew(key.data(), key.size(), h, value)), true);
+    }
+    V& operator[](const string& key) {
+        uint64_t h = hashOf(key.data(), key.size());
+        size_t i = locate(key.data(), key.size(), h);
+        if (i == capacity) i = insertNew(key.data(), key.size(), h, V());
+        return slots[i].second;
+    }
+    size_t erase(const string& key) {
+        size_t i = locate(key.data(), key.size(), hashOf(key.data(), key.size()));
+        if (i == capacity) return 0;
+        slots[i].~Slot();
+        ctrl[i] = ctrlDeleted;
+        count--;
+        return 1;
+    }
+    void clear() {
+        release();
+        count = 0;
+        allocate(groupWidth);
+    }
+    void reserve(size_t entries) {
+        size_t slotCount = groupWidth;
+        while (slotCount - slotCount / 8 < entries) slotCount *= 2;
+        if (slotCount > capacity) rehash(slotCount);
+    }
+
+    // Heap bytes owned by the table, including long keys.
+    size_t memoryBytes() const {
+        size_t bytes = capacity * (1 + sizeof(Slot));
+        for (size_t i = 0; i < capacity; i++) {
+            if (ctrl[i] >= 0 && !slots[i].first.isInline()) bytes += slots[i].first.size();
+        }
+        return bytes;
+    }
+};
+
+// Hash map split into independently locked shards so lookups on different
+// keys never wait for each other and writers only block their own shard.
+// Values are never destroyed by the map; the owner frees them.
+template<typename K, typename V, typename Table = unordered_map<K, V>>
+class ShardedMap {
+private:
+    static constexpr size_t shardBits = 6;
+    static constexpr size_t shardCount = size_t(1) << shardBits;
+
+    struct alignas(64) Shard {
+        mutable shared_mutex lock;
+        Table entries;
+    };
+    Shard shards[shardCount];
+
+    // Top bits of a Fibonacci hash, so the shard does not follow the
+    // low bits the shard's own buckets use.
+    static size_t shardOf(const K& key) {
+        uint64_t h = static_cast<uint64_t>(hash<K>()(key));
+        return static_cast<size_t>((h * 0x9E3779B97F4A7C15ull) >> (64 - shardBits));
+    }
+public:
+    bool find(const K& key, V& value) const {
+        const Shard& shard = shards[shardOf(key)];
+        shared_lock<shared_mutex> lock(shard.lock);
+        auto it = shard.entries.find(key);
+        if (it == shard.entries.end()) return false;
+        value = it->second;
+        return true;
+    }
+    bool contains(const K& key) const {
+        V ignored;
+        return find(key, ignored);
+    }
+    void insertOrAssign(const K& key, const V& value) {
+        Shard& shard = shards[shardOf(key)];
+        unique_lock<shared_mutex> lock(shard.lock);
+        shard.entries[key] = value;
+    }
+    // Returns false and leaves the map alone if the key is already present.
+    bool insert(const K& key, const V& value) {
+        Shard& shard = shards[shardOf(key)];
+        unique_lock<shared_mutex> lock(shard.lock);
+        return shard.entries.emplace(key, value).second;
+    }
+    bool erase(const K& key) {
+        Shard& shard = shards[shardOf(key)];
+        unique_lock<shared_mutex> lock(shard.lock);
+        return shard.entries.erase(key) > 0;
+    }
+    // Erases only while the key still maps to `value`.
+    bool erase(const K& key, const V& value) {
+        Shard& shard = shards[shardOf(key)];
+        unique_lock<shared_mutex> lock(shard.lock);
+        auto it = shard.entries.find(key);
+        if (it == shard.entries.end() || !(it->second == value)) return false;
+        shard.entries.erase(key);
+        return true;
+    }
+    void clear() {
+        for (Shard& shard : shards) {
+            unique_lock<shared_mutex> lock(shard.lock);
+            shard.entries.clear();
+        }
+    }
+    size_t size() const {
+        size_t total = 0;
+        forEach([&total](const K&, const V&) { total++; });
+        return total;
+    }
+    bool empty() const { return size() == 0; }
+
+    // Visits every entry with all shards read-locked (always in shard order,
+    // so writers holding one shard cannot deadlock with it). The visit sees
+    // one consistent state; `visit` must not write to this map.
+    template<typename F>
+    void forEach(F visit) const {
+        vector<shared_lock<shared_mutex>> locks;
+        locks.reserve(shardCount);
+        for (const Shard& shard : shards) locks.emplace_back(shard.lock);
+        for (const Shard& shard : shards) {
+            for (const auto& entry : shard.entries) visit(entry.first, entry.second);
+        }
+    }
+    // Consistent copy of every entry, for screens that sort or page through it.
+    vector<pair<K, V>> snapshot() const {
+        vector<pair<K, V>> entries;
+        forEach([&entries](const K& key, const V& value) { entries.emplace_back(key, value); });
+        return entries;
+    }
+};
+
+// Byte-oriented LZ77 in the style of LZ4's block format: each sequence is a
+// token (literal count, match length - 4), the literals, and a 16-bit back
+// offset. Built for speed of decoding, not ratio.
+class LzCodec {
+private:
+    static constexpr int hashBits = 12;
+    static constexpr size_t minMatch = 4;
+
+    static uint32_t read32(const char* p) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+    static void putLength(string& out, size_t extra) {
+        for (; extra >= 255; extra -= 255) out.push_back(static_cast<char>(255));
+        out.push_back(static_cast<char>(extra));
+    }
+    static void putSequence(string& out, const char* literals, size_t literalCount,
+                            size_t offset, size_t matchLength) {
+        size_t matchCode = matchLength ? matchLength - minMatch : 0;
+        uint8_t token = static_cast<uint8_t>((min<size_t>(literalCount, 15) << 4) | min<size_t>(matchCode, 15));
+        out.push_back(static_cast<char>(token));
+        if (literalCount >= 15) putLength(out, literalCount - 15);
+        out.append(literals, literalCount);
+        if (!matchLength) return;
+        out.push_back(static_cast<char>(offset & 0xFF));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (matchCode >= 15) putLength(out, matchCode - 15);
+    }
+public:
+    static string compress(const string& input) {
+        string out;
+        const char* data = input.data();
+        size_t n = input.size();
+        vector<int32_t> table(size_t(1) << hashBits, -1);
+        size_t anchor = 0, pos = 0;
+        while (n >= minMatch && pos + minMatch <= n) {
+            uint32_t h = (read32(data + pos) * 2654435761u) >> (32 - hashBits);
+            int32_t candidate = table[h];
+            table[h] = static_cast<int32_t>(pos);
+            if (candidate < 0 || pos - candidate > 65535 || read32(data + candidate) != read32(data + pos)) {
+                pos++;
+                continue;
+            }
+            size_t length = minMatch;
+            while (pos + length < n && data[candidate + length] == data[pos + length]) length++;
+            putSequence(out, data + anchor, pos - anchor, pos - candidate, length);
+            pos += length;
+            anchor = pos;
+        }
+        putSequence(out, data + anchor, n - anchor, 0, 0);
+        return out;
+    }
+
+    // Throws runtime_error on malformed input.
+    static string decompress(const string& input, size_t rawSize) {
+        string out;
+        out.reserve(rawSize);
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(input.data());
+        const uint8_t* end = p + input.size();
+        auto readLength = [&](size_t base) {
+            size_t length = base;
+            if (base == 15) {
+                uint8_t b;
+                do {
+                    if (p >= end) throw runtime_error("truncated block");
+                    b = *p++;
+                    length += b;
+                } while (b == 255);
+            }
+            return length;
+        };
+        while (p < end) {
+            uint8_t token = *p++;
+            size_t literals = readLength(token >> 4);
+            if (static_cast<size_t>(end - p) < literals) throw runtime_error("truncated block");
+            out.append(reinterpret_cast<const char*>(p), literals);
+            p += literals;
+            if (p >= end) break;   // last sequence has no match
+            if (end - p < 2) throw runtime_error("truncated block");
+            size_t offset = p[0] | (p[1] << 8);
+            p += 2;
+            size_t length = readLength(token & 15) + minMatch;
+            if (offset == 0 || offset > out.size()) throw runtime_error("bad match offset");
+            size_t from = out.size() - offset;
+            for (size_t i = 0; i < length; i++) out.push_back(out[from + i]);
+        }
+        if (out.size() != rawSize) throw runtime_error("block size mismatch");
+        return out;
+    }
+};
+
+void putVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+uint64_t getVarint(const char*& p, const char* end) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p >= end) throw runtime_error("truncated varint");
+        uint8_t b = static_cast<uint8_t>(*p++);
+        value |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if (!(b & 0x80)) return value;
+    }
+    throw runtime_error("varint too long");
+}
+
+// Inverse of gmtime.
+time_t utcTime(tm& parts) {
+#if defined(_WIN32)
+    return _mkgmtime(&parts);
+#else
+    return timegm(&parts);
+#endif
+}
+
+bool equalsIgnoreCase(const string& a, const string& b) {
+    return a.size() == b.size() && equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        return tolower(static_cast<unsigned char>(x)) == tolower(static_cast<unsigned char>(y));
+    });
+}
+
+// Which orders a history screen wants; empty or open-ended fields match
+// anything; status ignores case. Times are seconds since the epoch, placed
+// in [from, to).
+struct HistoryQuery {
+    string id;
+    string status;
+    int64_t from = INT64_MIN;
+    int64_t to = INT64_MAX;
+    uint64_t minCents = 0;
+    uint64_t maxCents = UINT64_MAX;
+    int item = -1;                     // menu index the order must contain
+
+    bool matches(const string& orderId, int64_t placedAt, uint64_t cents, const string& orderStatus,
+                 const SmallVector<OrderLine, 4>& lines) const {
+        if (!id.empty() && orderId != id) return false;
+        if (!status.empty() && !equalsIgnoreCase(orderStatus, status)) return false;
+        if (placedAt < from || placedAt >= to || cents < minCents || cents > maxCents) return false;
+        if (item < 0) return true;
+        for (const OrderLine& line : lines) {
+            if (line.menuIndex == item) return true;
+        }
+        return false;
+    }
+    bool matches(const Order& order) const {
+        return matches(order.getId(), static_cast<int64_t>(chrono::system_clock::to_time_t(order.getOrderTime())),
+                       static_cast<uint64_t>(llround(order.getTotal() * 100)), order.getStatus(), order.getLines());
+    }
+};
+
+// Summary of a batch of orders, kept apart from the orders so a query can
+// tell without reading them that none of them can match: placed-time, total
+// and id ranges, how many orders have each status, and one bit per menu
+// index (taken mod 256, so a set bit means "maybe").
+struct ZoneMap {
+    size_t orders = 0;
+    int64_t firstPlaced = INT64_MAX;
+    int64_t lastPlaced = INT64_MIN;
+    uint64_t minCents = UINT64_MAX;
+    uint64_t maxCents = 0;
+    string minId, maxId;
+    map<string, uint32_t> statusCounts;
+    uint64_t itemBits[4] = {};
+
+    void add(const string& id, int64_t placedAt, uint64_t cents, const string& status,
+             const SmallVector<OrderLine, 4>& lines) {
+        if (orders == 0 || id < minId) minId = id;
+        if (orders == 0 || id > maxId) maxId = id;
+        orders++;
+        firstPlaced = min(firstPlaced, placedAt);
+        lastPlaced = max(lastPlaced, placedAt);
+        minCents = min(minCents, cents);
+        maxCents = max(maxCents, cents);
+        statusCounts[status]++;
+        for (const OrderLine& line : lines) itemBits[(line.menuIndex >> 6) & 3] |= 1ULL << (line.menuIndex & 63);
+    }
+    // False only when no order summarised here can match `q`.
+    bool mayMatch(const HistoryQuery& q) const {
+        if (orders == 0) return false;
+        if (!q.id.empty() && (q.id < minId || q.id > maxId)) return false;
+        if (!q.status.empty() && none_of(statusCounts.begin(), statusCounts.end(), [&q](const pair<const string, uint32_t>& entry) {
+                return equalsIgnoreCase(entry.first, q.status);
+            })) return false;
+        if (lastPlaced < q.from || firstPlaced >= q.to) return false;
+        if (maxCents < q.minCents || minCents > q.maxCents) return false;
+        return q.item < 0 || (itemBits[(q.item >> 6) & 3] >> (q.item & 63) & 1);
+    }
+
+    // One line: orders,firstPlaced,lastPlaced,minCents,maxCents,4 hex item
+    // words,status counts as "status=count;...",minId,maxId. Ids go last as
+    // they may hold anything but a newline; statuses never hold ',', ';' or '='.
+    string serialize() const {
+        stringstream ss;
+        ss << orders << ',' << firstPlaced << ',' << lastPlaced << ',' << minCents << ',' << maxCents << ','
+           << hex << itemBits[0] << ',' << itemBits[1] << ',' << itemBits[2] << ',' << itemBits[3] << dec << ',';
+        bool first = true;
+        for (const auto& entry : statusCounts) {
+            ss << (first ? "" : ";") << entry.first << '=' << entry.second;
+            first = false;
+        }
+        ss << ',' << minId.size() << ',' << minId << maxId;
+        return ss.str();
+    }
+    static bool deserialize(const string& line, ZoneMap& zone) {
+        stringstream ss(line);
+        string field;
+        vector<string> fields;
+        for (int i = 0; i < 11 && getline(ss, field, ','); i++) fields.push_back(field);
+        string ids;
+        getline(ss, ids);
+        if (fields.size() != 11) return false;
+        try {
+            zone.orders = stoull(fields[0]);
+            zone.firstPlaced = stoll(fields[1]);
+            zone.lastPlaced = stoll(fields[2]);
+            zone.minCents = stoull(fields[3]);
+            zone.maxCents = stoull(fields[4]);
+            for (int w = 0; w < 4; w++) zone.itemBits[w] = stoull(fields[5 + w], nullptr, 16);
+            stringstream counts(fields[9]);
+            string entry;
+            while (getline(counts, entry, ';')) {
+                size_t eq = entry.rfind('=');
+                if (eq == string::npos) return false;
+                zone.statusCounts[entry.substr(0, eq)] = static_cast<uint32_t>(stoul(entry.substr(eq + 1)));
+            }
+            size_t minLength = stoull(fields[10]);
+            if (minLength > ids.size()) return false;
+            zone.minId = ids.substr(0, minLength);
+            zone.maxId = ids.substr(minLength);
+        } catch (...) {
+            return false;
+        }
+        return true;
+    }
+};
+
+// Cold storage for delivered orders, rewritten as a sorted table each time
+// staged orders are flushed into it. Text is dictionary-encoded across the
+// whole archive: a customer's name, phone, address and card details form one
+// entry, so a repeat customer costs one reference. Orders are packed 128 to
+// a block, column by column: ids front-coded against the previous id, order
+// times as deltas, dictionary references, totals in cents and items as
+// (menu index, quantity) varints; each block is then LZ-compressed. A sparse
+// index (first id of each block) and the dictionary stay in memory, so
+// fetching one order reads and decodes one block. Card numbers are cut to
+// their last four digits and the CVV is not kept.
+class OrderArchive {
+public:
+    static constexpr size_t ordersPerBlock = 128;
+private:
+    struct Record {
+        string id;
+        int64_t placedAt;      // seconds since the epoch
+        uint32_t customer;     // dictionary: name, phone, street, city, zip, card type, last four, expiry
+        uint32_t status;       // dictionary
+        uint32_t notes;        // dictionary
+        uint64_t cents;
+        SmallVector<OrderLine, 4> lines;
+    };
+    struct BlockInfo {
+        string firstId;
+        uint64_t offset;
+        uint32_t size;
+        uint32_t rawSize;
+    };
+    static constexpr char fieldSeparator = '\x1f';
+    static constexpr size_t footerSize = 24;
+
+    string path;
+    const MenuCatalog* menu;          // lines naming no version of it are dropped on read
+    vector<BlockInfo> index;
+    vector<string> dictionary;
+    unordered_map<string, uint32_t> dictionaryIds;
+    size_t orderTotal = 0;
+    ZoneMap zone;                     // of the file as of the last flush
+    vector<Record> staged;
+    mutable shared_mutex lock;        // everything above vs. flush and stage
+    mutable mutex readLock;           // reader and the one-block cache
+    mutable ifstream reader;
+    mutable size_t cachedBlock = SIZE_MAX;
+    mutable shared_ptr<const vector<Record>> cachedRecords;
+
+    // Caller holds `lock` exclusively.
+    uint32_t intern(const string& text) {
+        auto it = dictionaryIds.find(text);
+        if (it != dictionaryIds.end()) return it->second;
+        uint32_t id = static_cast<uint32_t>(dictionary.size());
+        dictionary.push_back(text);
+        dictionaryIds.emplace(text, id);
+        return id;
+    }
+    static vector<string> splitFields(const string& joined) {
+        vector<string> fields;
+        stringstream ss(joined);
+        string field;
+        while (getline(ss, field, fieldSeparator)) fields.push_back(field);
+        while (fields.size() < 8) fields.push_back("");
+        return fields;
+    }
+    Order* toOrder(const Record& r) const {
+        vector<string> f = splitFields(dictionary[r.customer]);
+        Order* order = new Order(r.id, f[0], new Address(f[2], f[3], f[4]),
+                                 new Payment(string(12, '*') + f[6], f[5], f[7], ""), f[1]);
+        order->orderTime = chrono::system_clock::from_time_t(static_cast<time_t>(r.placedAt));
+        order->status = dictionary[r.status];
+        order->specialInstructions = dictionary[r.notes];
+        order->totalAmount = r.cents / 100.0;
+        for (const OrderLine& line : r.lines) {
+            if (!menu || line.menuIndex < menu->size()) order->items.push_back(line);
+        }
+        return order;
+    }
+
+    static string encodeBlock(const vector<Record>& records, size_t from, size_t to) {
+        string raw;
+        putVarint(raw, to - from);
+        for (size_t i = from; i < to; i++) {
+            const string& id = records[i].id;
+            size_t shared = 0;
+            if (i > from) {
+                const string& previous = records[i - 1].id;
+                while (shared < id.size() && shared < previous.size() && id[shared] == previous[shared]) shared++;
+            }
+            putVarint(raw, shared);
+            putVarint(raw, id.size() - shared);
+            raw.append(id, shared, string::npos);
+        }
+        int64_t previousTime = 0;
+        for (size_t i = from; i < to; i++) {
+            int64_t delta = records[i].placedAt - previousTime;
+            putVarint(raw, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+            previousTime = records[i].placedAt;
+        }
+        for (size_t i = from; i < to; i++) putVarint(raw, records[i].customer);
+        for (size_t i = from; i < to; i++) putVarint(raw, records[i].status);
+        for (size_t i = from; i < to; i++) putVarint(raw, records[i].notes);
+        for (size_t i = from; i < to; i++) putVarint(raw, records[i].cents);
+        for (size_t i = from; i < to; i++) putVarint(raw, records[i].lines.size());
+        for (size_t i = from; i < to; i++) {
+            for (const OrderLine& line : records[i].lines) {
+                putVarint(raw, line.menuIndex);
+                putVarint(raw, line.quantity);
+            }
+        }
+        return raw;
+    }
+    static vector<Record> decodeBlock(const string& raw, size_t dictionarySize) {
+        const char* p = raw.data();
+        const char* end = p + raw.size();
+        size_t count = getVarint(p, end);
+        if (count > ordersPerBlock) throw runtime_error("bad block size");
+        vector<Record> records(count);
+        for (size_t i = 0; i < count; i++) {
+            size_t shared = getVarint(p, end);
+            size_t rest = getVarint(p, end);
+            if (shared > (i ? records[i - 1].id.size() : 0) || static_cast<size_t>(end - p) < rest) {
+                throw runtime_error("bad order id");
+            }
+            if (i) records[i].id.assign(records[i - 1].id, 0, shared);
+            records[i].id.append(p, rest);
+            p += rest;
+        }
+        int64_t previousTime = 0;
+        for (Record& r : records) {
+            uint64_t zigzag = getVarint(p, end);
+            previousTime += static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+            r.placedAt = previousTime;
+        }
+        auto reference = [&]() {
+            uint64_t ref = getVarint(p, end);
+            if (ref >= dictionarySize) throw runtime_error("bad dictionary reference");
+            return static_cast<uint32_t>(ref);
+        };
+        for (Record& r : records) r.customer = reference();
+        for (Record& r : records) r.status = reference();
+        for (Record& r : records) r.notes = reference();
+        for (Record& r : records) r.cents = getVarint(p, end);
+        vector<size_t> lineCounts(count);
+        for (size_t& n : lineCounts) n = getVarint(p, end);
+        for (size_t i = 0; i < count; i++) {
+            for (size_t k = 0; k < lineCounts[i]; k++) {
+                uint64_t menuIndex = getVarint(p, end);
+                uint64_t quantity = getVarint(p, end);
+                if (menuIndex > UINT16_MAX || quantity < 1 || quantity > Order::maxQuantity) {
+                    throw runtime_error("bad order line");
+                }
+                OrderLine line;
+                line.menuIndex = static_cast<uint16_t>(menuIndex);
+                line.quantity = static_cast<uint16_t>(quantity);
+                records[i].lines.push_back(line);
+            }
+        }
+        return records;
+    }
+
+    // Decoded block `b` through a one-block cache. Caller holds `lock`.
+    shared_ptr<const vector<Record>> loadBlock(size_t b) const {
+        lock_guard<mutex> guard(readLock);
+        if (cachedBlock == b) return cachedRecords;
+        if (!reader.is_open()) reader.open(path, ios::binary);
+        reader.clear();
+        string packed(index[b].size, '\0');
+        reader.seekg(static_cast<streamoff>(index[b].offset));
+        if (!reader.read(&packed[0], packed.size())) throw runtime_error("archive block unreadable");
+        cachedRecords = make_shared<const vector<Record>>(
+            decodeBlock(LzCodec::decompress(packed, index[b].rawSize), dictionary.size()));
+        cachedBlock = b;
+        return cachedRecords;
+    }
+    // Block that would hold `id`, or SIZE_MAX. Caller holds `lock`.
+    size_t blockFor(const string& id) const {
+        auto it = upper_bound(index.begin(), index.end(), id,
+                              [](const string& key, const BlockInfo& block) { return key < block.firstId; });
+        return it == index.begin() ? SIZE_MAX : static_cast<size_t>(it - index.begin() - 1);
+    }
+    bool findRecord(const string& id, Record& found) const {
+        size_t b = blockFor(id);
+        if (b == SIZE_MAX) return false;
+        shared_ptr<const vector<Record>> records = loadBlock(b);
+        auto it = lower_bound(records->begin(), records->end(), id,
+                              [](const Record& r, const string& key) { return r.id < key; });
+        if (it == records->end() || it->id != id) return false;
+        found = *it;
+        return true;
+    }
+
+    // Footer: dictionary offset, index offset (8 bytes each), block count, "FDSA".
+    void readIndex() {
+        ifstream in(path, ios::binary | ios::ate);
+        if (!in) return;
+        streamoff fileSize = in.tellg();
+        if (fileSize < static_cast<streamoff>(footerSize)) return;
+        string footer(footerSize, '\0');
+        in.seekg(fileSize - static_cast<streamoff>(footerSize));
+        in.read(&footer[0], footerSize);
+        if (footer.compare(20, 4, "FDSA") != 0) return;
+        uint64_t dictionaryOffset, indexOffset;
+        uint32_t blockCount;
+        memcpy(&dictionaryOffset, footer.data(), 8);
+        memcpy(&indexOffset, footer.data() + 8, 8);
+        memcpy(&blockCount, footer.data() + 16, 4);
+        if (dictionaryOffset > indexOffset || indexOffset > static_cast<uint64_t>(fileSize) - footerSize) return;
+        string raw(static_cast<size_t>(static_cast<uint64_t>(fileSize) - footerSize - dictionaryOffset), '\0');
+        in.seekg(static_cast<streamoff>(dictionaryOffset));
+        in.read(&raw[0], raw.size());
+        try {
+            const char* p = raw.data();
+            const char* end = p + (indexOffset - dictionaryOffset);
+            size_t packedRaw = getVarint(p, end);
+            string words = LzCodec::decompress(string(p, end), packedRaw);
+            const char* w = words.data();
+            const char* wordsEnd = w + words.size();
+            size_t count = getVarint(w, wordsEnd);
+            for (size_t i = 0; i < count; i++) {
+                size_t length = getVarint(w, wordsEnd);
+                if (static_cast<size_t>(wordsEnd - w) < length) throw runtime_error("truncated dictionary");
+                intern(string(w, length));
+                w += length;
+            }
+            p = end;
+            end = raw.data() + raw.size();
+            orderTotal = getVarint(p, end);
+            for (uint32_t b = 0; b < blockCount; b++) {
+                BlockInfo info;
+                info.offset = getVarint(p, end);
+                info.size = static_cast<uint32_t>(getVarint(p, end));
+                info.rawSize = static_cast<uint32_t>(getVarint(p, end));
+                size_t length = getVarint(p, end);
+                if (static_cast<size_t>(end - p) < length) throw runtime_error("truncated index");
+                info.firstId.assign(p, length);
+                p += length;
+                index.push_back(info);
+            }
+        } catch (const exception& e) {
+            cerr << "Ignoring damaged archive " << path << ": " << e.what() << endl;
+            index.clear();
+            dictionary.clear();
+            dictionaryIds.clear();
+            orderTotal = 0;
+        }
+    }
+public:
+    explicit OrderArchive(const string& file, const MenuCatalog* menu = nullptr) : path(file), menu(menu) { readIndex(); }
+    OrderArchive(const OrderArchive&) = delete;
+    OrderArchive& operator=(const OrderArchive&) = delete;
+
+    // Copies the order for the next flush; the caller keeps the Order.
+    void stage(const Order& order) {
+        const Address* a = order.deliveryAddress;
+        const Payment* p = order.paymentInfo;
+        string card = p ? p->getCardNumber() : "";
+        string customer = order.customerName + fieldSeparator + order.phoneNumber + fieldSeparator +
+                          (a ? a->getStreet() : "") + fieldSeparator + (a ? a->getCity() : "") + fieldSeparator +
+                          (a ? a->getZipCode() : "") + fieldSeparator + (p ? p->getCardType() : "") + fieldSeparator +
+                          (card.size() >= 4 ? card.substr(card.size() - 4) : card) + fieldSeparator +
+                          (p ? p->getExpiryDate() : "");
+        Record r;
+        r.id = order.orderId;
+        r.placedAt = static_cast<int64_t>(chrono::system_clock::to_time_t(order.orderTime));
+        r.cents = static_cast<uint64_t>(llround(order.totalAmount * 100));
+        r.lines = order.items;
+        unique_lock<shared_mutex> guard(lock);
+        r.customer = intern(customer);
+        r.status = intern(order.status);
+        r.notes = intern(order.specialInstructions);
+        staged.push_back(move(r));
+    }
+    size_t stagedCount() const {
+        shared_lock<shared_mutex> guard(lock);
+        return staged.size();
+    }
+
+    // Rewrites the archive with the staged orders merged in (a staged order
+    // replaces an archived one with the same id). Returns false on I/O error.
+    bool flush() {
+        unique_lock<shared_mutex> guard(lock);
+        if (staged.empty()) return true;
+        vector<Record> all;
+        try {
+            for (size_t b = 0; b < index.size(); b++) {
+                shared_ptr<const vector<Record>> records = loadBlock(b);
+                all.insert(all.end(), records->begin(), records->end());
+            }
+        } catch (const exception& e) {
+            // Staged orders stay staged; rewriting without the old blocks would lose them.
+            cerr << "Archive flush failed: " << e.what() << endl;
+            return false;
+        }
+        stable_sort(staged.begin(), staged.end(), [](const Record& x, const Record& y) { return x.id < y.id; });
+        vector<Record> merged;
+        merged.reserve(all.size() + staged.size());
+        size_t i = 0, j = 0;
+        while (i < all.size() || j < staged.size()) {
+            if (j == staged.size() || (i < all.size() && all[i].id < staged[j].id)) {
+                merged.push_back(move(all[i++]));
+            } else {
+                // The last staged copy of an id wins over earlier ones and the archive.
+                while (j + 1 < staged.size() && staged[j + 1].id == staged[j].id) j++;
+                if (i < all.size() && all[i].id == staged[j].id) i++;
+                merged.push_back(move(staged[j++]));
+            }
+        }
+
+        string temp = path + ".tmp";
+        vector<BlockInfo> blocks;
+        {
+            ofstream out(temp, ios::binary | ios::trunc);
+            uint64_t offset = 0;
+            for (size_t from = 0; from < merged.size(); from += ordersPerBlock) {
+                size_t to = min(merged.size(), from + ordersPerBlock);
+                string raw = encodeBlock(merged, from, to);
+                string packed = LzCodec::compress(raw);
+                out.write(packed.data(), packed.size());
+                blocks.push_back({merged[from].id, offset, static_cast<uint32_t>(packed.size()),
+                                  static_cast<uint32_t>(raw.size())});
+                offset += packed.size();
+            }
+            uint64_t dictionaryOffset = offset;
+            string words;
+            putVarint(words, dictionary.size());
+            for (const string& word : dictionary) {
+                putVarint(words, word.size());
+                words += word;
+            }
+            string tail;
+            putVarint(tail, words.size());
+            tail += LzCodec::compress(words);
+            uint64_t indexOffset = dictionaryOffset + tail.size();
+            putVarint(tail, merged.size());
+            for (const BlockInfo& info : blocks) {
+                putVarint(tail, info.offset);
+                putVarint(tail, info.size);
+                putVarint(tail, info.rawSize);
+                putVarint(tail, info.firstId.size());
+                tail += info.firstId;
+            }
+            uint32_t blockCount = static_cast<uint32_t>(blocks.size());
+            tail.append(reinterpret_cast<const char*>(&dictionaryOffset), 8);
+            tail.append(reinterpret_cast<const char*>(&indexOffset), 8);
+            tail.append(reinterpret_cast<const char*>(&blockCount), 4);
+            tail += "FDSA";
+            out.write(tail.data(), tail.size());
+            if (!out.flush()) return false;
+        }
+        lock_guard<mutex> readGuard(readLock);
+        reader.close();   // Windows will not rename over an open file
+        error_code error;
+        filesystem::rename(temp, path, error);
+        cachedBlock = SIZE_MAX;
+        cachedRecords.reset();
+        if (error) return false;
+        index = blocks;
+        orderTotal = merged.size();
+        zone = ZoneMap();
+        for (const Record& r : merged) zone.add(r.id, r.placedAt, r.cents, dictionary[r.status], r.lines);
+        staged.clear();
+        return true;
+    }
+
+    // A new Order rebuilt from the archive (caller deletes it), or nullptr.
+    Order* fetch(const string& id) const {
+        shared_lock<shared_mutex> guard(lock);
+        Record r;
+        try {
+            if (!findRecord(id, r)) return nullptr;
+        } catch (const exception& e) {
+            cerr << "Archive read failed: " << e.what() << endl;
+            return nullptr;
+        }
+        return toOrder(r);
+    }
+    bool contains(const string& id) const {
+        shared_lock<shared_mutex> guard(lock);
+        Record r;
+        try {
+            return findRecord(id, r);
+        } catch (...) {
+            return false;
+        }
+    }
+
+    // Calls `visit` with a new Order (the visitor's to delete) for every
+    // archived order matching `query`. Returns false if a block is unreadable.
+    bool scan(const HistoryQuery& query, const function<void(Order*)>& visit) const {
+        shared_lock<shared_mutex> guard(lock);
+        try {
+            for (size_t b = 0; b < index.size(); b++) {
+                if (!query.id.empty() && b != blockFor(query.id)) continue;
+                shared_ptr<const vector<Record>> records = loadBlock(b);
+                for (const Record& r : *records) {
+                    if (query.matches(r.id, r.placedAt, r.cents, dictionary[r.status], r.lines)) visit(toOrder(r));
+                }
+            }
+        } catch (const exception& e) {
+            cerr << "Archive read failed: " << e.what() << endl;
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() const {
+        shared_lock<shared_mutex> guard(lock);
+        return orderTotal;
+    }
+    ZoneMap zoneMap() const {
+        shared_lock<shared_mutex> guard(lock);
+        return zone;
+    }
+    size_t fileBytes() const {
+        error_code error;
+        uintmax_t bytes = filesystem::file_size(path, error);
+        return error ? 0 : static_cast<size_t>(bytes);
+    }
+};
+
+// Archived orders split into one OrderArchive per time range (a day by
+// default) of when they were placed, under `directory`. Each partition's
+// zone map lives in directory/zones.txt, so a query opens only the
+// partitions whose zone maps admit it; a query over the last week of a
+// year-long archive reads about seven files. Partitions are opened on first
+// use and at most maxOpenPartitions stay open.
+class PartitionedArchive {
+public:
+    static constexpr size_t maxOpenPartitions = 16;
+private:
+    struct Partition {
+        ZoneMap zone;
+        shared_ptr<OrderArchive> file;   // null while closed
+        uint64_t lastUsed = 0;
+        bool dirty = false;              // has staged orders
+    };
+    string directory;
+    int64_t secondsPerPartition;
+    mutable mutex lock;                  // everything below
+    const MenuCatalog* menu = nullptr;   // handed to each partition file
+    mutable map<int64_t, Partition> partitions;   // by start time
+    mutable uint64_t useClock = 0;
+    mutable size_t openCount = 0;
+    size_t stagedTotal = 0;
+
+    string partitionPath(int64_t start) const {
+        time_t t = static_cast<time_t>(start);
+        stringstream ss;
+        ss << directory << "/orders." << put_time(gmtime(&t), "%Y%m%d-%H") << ".archive";
+        return ss.str();
+    }
+    string manifestPath() const { return directory + "/zones.txt"; }
+    int64_t partitionStart(const Order& order) const {
+        int64_t placed = static_cast<int64_t>(chrono::system_clock::to_time_t(order.getOrderTime()));
+        int64_t start = placed / secondsPerPartition * secondsPerPartition;
+        return start > placed ? start - secondsPerPartition : start;
+    }
+
+    // Caller holds `lock`. Closes the least recently used clean partitions
+    // once too many are open.
+    OrderArchive& open(int64_t start, Partition& partition) const {
+        partition.lastUsed = ++useClock;
+        if (!partition.file) {
+            partition.file = make_shared<OrderArchive>(partitionPath(start), menu);
+            openCount++;
+        }
+        while (openCount > maxOpenPartitions) {
+            Partition* victim = nullptr;
+            for (auto& entry : partitions) {
+                Partition& p = entry.second;
+                if (p.file && !p.dirty && &p != &partition && (!victim || p.lastUsed < victim->lastUsed)) victim = &p;
+            }
+            if (!victim) break;
+            victim->file.reset();
+            openCount--;
+        }
+        return *partition.file;
+    }
+
+    // Caller holds `lock`.
+    bool writeManifest() const {
+        string temp = manifestPath() + ".tmp";
+        {
+            ofstream out(temp, ios::trunc);
+            for (const auto& entry : partitions) {
+                if (entry.second.zone.orders) out << entry.first << ',' << entry.second.zone.serialize() << '\n';
+            }
+            if (!out.flush()) return false;
+        }
+        error_code error;
+        filesystem::rename(temp, manifestPath(), error);
+        return !error;
+    }
+
+    // A crash between writing a partition and the manifest leaves it with no
+    // zone map, or with the one from before its last flush. Any partition
+    // whose zone map doesn't count what its footer says gets it rebuilt by
+    // reading the partition.
+    void recoverPartitions() {
+        bool recovered = false;
+        error_code error;
+        for (filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+            string name = it->path().filename().string();
+            if (name.size() != 26 || name.compare(0, 7, "orders.") != 0 || name.compare(18, 8, ".archive") != 0) continue;
+            tm parts = {};
+            stringstream ss(name.substr(7, 11));
+            ss >> get_time(&parts, "%Y%m%d-%H");
+            if (ss.fail()) continue;
+            int64_t start = static_cast<int64_t>(utcTime(parts));
+            Partition& partition = partitions[start];
+            OrderArchive& file = open(start, partition);
+            if (partition.zone.orders == file.size()) continue;
+            partition.zone = ZoneMap();
+            file.scan(HistoryQuery(), [&](Order* order) {
+                partition.zone.add(order->getId(), static_cast<int64_t>(chrono::system_clock::to_time_t(order->getOrderTime())),
+                                   static_cast<uint64_t>(llround(order->getTotal() * 100)), order->getStatus(), order->getLines());
+                delete order;
+            });
+            recovered = true;
+        }
+        if (recovered) writeManifest();
+    }
+public:
+    // Orders from a single-file archive at `legacy` are moved into partitions.
+    explicit PartitionedArchive(const string& dir, const string& legacy = "", int64_t partitionSeconds = 86400)
+        : directory(dir), secondsPerPartition(max<int64_t>(partitionSeconds, 1)) {
+        error_code error;
+        filesystem::create_directories(directory, error);
+        ifstream in(manifestPath());
+        string line;
+        while (getline(in, line)) {
+            size_t comma = line.find(',');
+            ZoneMap zone;
+            if (comma == string::npos || !ZoneMap::deserialize(line.substr(comma + 1), zone)) continue;
+            try {
+                partitions[stoll(line.substr(0, comma))].zone = zone;
+            } catch (...) {}
+        }
+        recoverPartitions();
+        if (!legacy.empty() && filesystem::exists(legacy, error)) {
+            {
+                OrderArchive old(legacy);
+                old.scan(HistoryQuery(), [this](Order* order) {
+                    stage(*order);
+                    delete order;
+                });
+            }
+            if (flush()) remove(legacy.c_str());
+        }
+    }
+    PartitionedArchive(const PartitionedArchive&) = delete;
+    PartitionedArchive& operator=(const PartitionedArchive&) = delete;
+
+    // Orders read back from now on drop lines this menu has no version for.
+    // Partitions already open with staged orders keep what they had.
+    void useMenu(const MenuCatalog* catalog) {
+        lock_guard<mutex> guard(lock);
+        menu = catalog;
+        for (auto& entry : partitions) {
+            Partition& partition = entry.second;
+            if (partition.file && !partition.dirty) {
+                partition.file.reset();
+                openCount--;
+            }
+        }
+    }
+    // Copies the order for the next flush; the caller keeps the Order.
+    void stage(const Order& order) {
+        lock_guard<mutex> guard(lock);
+        int64_t start = partitionStart(order);
+        Partition& partition = partitions[start];
+        partition.dirty = true;
+        open(start, partition).stage(order);
+        stagedTotal++;
+    }
+    size_t stagedCount() const {
+        lock_guard<mutex> guard(lock);
+        return stagedTotal;
+    }
+
+    // Flushes every partition with staged orders, then the manifest.
+    bool flush() {
+        lock_guard<mutex> guard(lock);
+        if (stagedTotal == 0) return true;
+        bool ok = true;
+        for (auto& entry : partitions) {
+            Partition& partition = entry.second;
+            if (!partition.dirty) continue;
+            if (partition.file->flush()) {
+                partition.zone = partition.file->zoneMap();
+                partition.dirty = false;
+            } else {
+                ok = false;
+            }
+        }
+        ok = writeManifest() && ok;
+        if (ok) stagedTotal = 0;
+        return ok;
+    }
+
+    // Visits every archived order matching `query`, oldest partition first,
+    // as a new Order the visitor deletes. Returns how many partitions were read.
+    size_t query(const HistoryQuery& q, const function<void(Order*)>& visit) const {
+        lock_guard<mutex> guard(lock);
+        size_t read = 0;
+        for (auto& entry : partitions) {
+            if (!entry.second.zone.mayMatch(q)) continue;
+            open(entry.first, entry.second).scan(q, visit);
+            read++;
+        }
+        return read;
+    }
+
+    // A new Order rebuilt from the archive (caller deletes it), or nullptr.
+    // Newest partitions are tried first.
+    Order* fetch(const string& id) const {
+        lock_guard<mutex> guard(lock);
+        HistoryQuery q;
+        q.id = id;
+        for (auto it = partitions.rbegin(); it != partitions.rend(); ++it) {
+            if (!it->second.zone.mayMatch(q)) continue;
+            if (Order* order = open(it->first, it->second).fetch(id)) return order;
+        }
+        return nullptr;
+    }
+    bool contains(const string& id) const {
+        lock_guard<mutex> guard(lock);
+        HistoryQuery q;
+        q.id = id;
+        for (auto it = partitions.rbegin(); it != partitions.rend(); ++it) {
+            if (it->second.zone.mayMatch(q) && open(it->first, it->second).contains(id)) return true;
+        }
+        return false;
+    }
+
+    size_t size() const {
+        lock_guard<mutex> guard(lock);
+        size_t total = 0;
+        for (const auto& entry : partitions) total += entry.second.zone.orders;
+        return total;
+    }
+    size_t partitionCount() const {
+        lock_guard<mutex> guard(lock);
+        size_t count = 0;
+        for (const auto& entry : partitions) count += entry.second.zone.orders ? 1 : 0;
+        return count;
+    }
+};
+
+// Columnar copy of order history for QueryPlan: one array per field, with
+// strings replaced by dictionary codes so a filter compares small integers
+// many rows at a time. Placed times are int32 seconds after timeBase.
+class HistoryColumns {
+public:
+    static constexpr int64_t timeBase = 1600000000;
+
+    // Codes for one string field, matched case-insensitively; a name keeps
+    // the spelling it was first seen with. Past `capacity` names, new ones
+    // share the last code.
+    struct Dictionary {
+        uint32_t capacity;
+        vector<string> names;
+        vector<size_t> rows;           // rows holding each code, for the planner
+        unordered_map<string, uint32_t> codes;
+
+        explicit Dictionary(uint32_t limit) : capacity(limit) {}
+        static string key(const string& name) {
+            string k = name;
+            transform(k.begin(), k.end(), k.begin(), ::tolower);
+            return k;
+        }
+        uint32_t intern(const string& name) {
+            string k = key(name);
+            auto it = codes.find(k);
+            uint32_t code;
+            if (it != codes.end()) {
+                code = it->second;
+            } else if (names.size() < capacity) {
+                code = static_cast<uint32_t>(names.size());
+                names.push_back(name);
+                rows.push_back(0);
+                codes.emplace(k, code);
+            } else {
+                code = capacity - 1;
+            }
+            rows[code]++;
+            return code;
+        }
+        bool lookup(const string& name, uint32_t& code) const {
+            auto it = codes.find(key(name));
+            if (it == codes.end()) return false;
+            code = it->second;
+            return true;
+        }
+    };
+
+    string idChars;
+    vector<uint32_t> idStart;          // row r's id is idChars[idStart[r], idStart[r + 1])
+    vector<int32_t> placed;
+    vector<int32_t> cents;
+    vector<uint8_t> status;
+    vector<uint16_t> city;
+    vector<uint32_t> customer;
+    vector<uint64_t> itemMask;         // bit (menu index % 64) per item in the order
+    vector<uint32_t> lineStart;        // row r's lines are [lineStart[r], lineStart[r + 1])
+    vector<uint16_t> lineItems;
+    vector<uint16_t> lineQuantities;
+    Dictionary statuses{UINT8_MAX + 1};
+    Dictionary cities{UINT16_MAX + 1};
+    Dictionary customers{UINT32_MAX};
+    vector<size_t> itemRows;           // rows holding each menu index
+    int32_t minPlaced = INT32_MAX, maxPlaced = INT32_MIN;
+    int32_t minCents = INT32_MAX, maxCents = INT32_MIN;
+
+    HistoryColumns() : idStart(1, 0), lineStart(1, 0) {}
+
+    size_t size() const { return placed.size(); }
+    string id(size_t row) const { return idChars.substr(idStart[row], idStart[row + 1] - idStart[row]); }
+
+    void reserve(size_t rows) {
+        idStart.reserve(rows + 1);
+        placed.reserve(rows);
+        cents.reserve(rows);
+        status.reserve(rows);
+        city.reserve(rows);
+        customer.reserve(rows);
+        itemMask.reserve(rows);
+        lineStart.reserve(rows + 1);
+    }
+    void addRow(const string& orderId, int64_t placedAt, uint64_t totalCents, const string& orderStatus,
+                const string& orderCity, const string& customerName, const SmallVector<OrderLine, 4>& lines) {
+        idChars += orderId;
+        idStart.push_back(static_cast<uint32_t>(idChars.size()));
+        int32_t t = static_cast<int32_t>(max<int64_t>(INT32_MIN, min<int64_t>(INT32_MAX, placedAt - timeBase)));
+        int32_t c = static_cast<int32_t>(min<uint64_t>(totalCents, INT32_MAX));
+        placed.push_back(t);
+        cents.push_back(c);
+        minPlaced = min(minPlaced, t);
+        maxPlaced = max(maxPlaced, t);
+        minCents = min(minCents, c);
+        maxCents = max(maxCents, c);
+        status.push_back(static_cast<uint8_t>(statuses.intern(orderStatus)));
+        city.push_back(static_cast<uint16_t>(cities.intern(orderCity)));
+        customer.push_back(customers.intern(customerName));
+        uint64_t mask = 0;
+        for (const OrderLine& line : lines) {
+            mask |= 1ULL << (line.menuIndex & 63);
+            lineItems.push_back(line.menuIndex);
+            lineQuantities.push_back(line.quantity);
+            if (itemRows.size() <= line.menuIndex) itemRows.resize(line.menuIndex + 1, 0);
+            itemRows[line.menuIndex]++;
+        }
+        itemMask.push_back(mask);
+        lineStart.push_back(static_cast<uint32_t>(lineItems.size()));
+    }
+    void add(const Order& order) {
+        const Address* address = order.getAddress();
+        addRow(order.getId(), static_cast<int64_t>(chrono::system_clock::to_time_t(order.getOrderTime())),
+               static_cast<uint64_t>(llround(order.getTotal() * 100)), order.getStatus(),
+               address ? address->getCity() : "", order.getCustomerName(), order.getLines());
+    }
+    size_t memoryBytes() const {
+        return idChars.capacity() + idStart.capacity() * 4 + placed.capacity() * 4 + cents.capacity() * 4 +
+               status.capacity() + city.capacity() * 2 + customer.capacity() * 4 + itemMask.capacity() * 8 +
+               lineStart.capacity() * 4 + lineItems.capacity() * 2 + lineQuantities.capacity() * 2;
+    }
+};
+
+// A history query as typed: space-separated key=value terms, values with
+// spaces in double quotes.
+//   status=Delivered  city=islamabad  customer="Ali Khan"  item=CH3
+//   total=10..50  days=7  since=2024-01-01  until=2024-02-01
+//   select=id,customer,city,status,total,placed,items  order=-total  limit=20
+struct OrderQuery {
+    string status, city, customer, item;
+    int64_t minCents = INT64_MIN, maxCents = INT64_MAX;
+    int64_t from = INT64_MIN, to = INT64_MAX;     // placed in [from, to)
+    vector<string> columns{"id", "customer", "total", "status"};
+    string orderBy;                               // empty: history order
+    bool descending = false;
+    size_t limit = 20;                            // 0: every row
+
+    static bool isColumn(const string& name) {
+        static const char* names[] = {"id", "customer", "city", "status", "total", "placed", "items"};
+        return find(begin(names), end(names), name) != end(names);
+    }
+    static bool parseDate(const string& text, int64_t& seconds) {
+        tm parts = {};
+        stringstream ss(text);
+        ss >> get_time(&parts, "%Y-%m-%d");
+        if (ss.fail()) return false;
+        seconds = static_cast<int64_t>(utcTime(parts));
+        return true;
+    }
+    static bool parseCents(const string& text, int64_t& cents) {
+        try {
+            size_t used;
+            double value = stod(text, &used);
+            if (used != text.size()) return false;
+            cents = llround(value * 100);
+            return true;
+        } catch (...) {
+            return false;
+        }
+    }
+
+    static bool parse(const string& text, OrderQuery& q, string& error) {
+        size_t pos = 0;
+        while (pos < text.size()) {
+            if (isspace(static_cast<unsigned char>(text[pos]))) {
+                pos++;
+                continue;
+            }
+            size_t eq = text.find('=', pos);
+            size_t space = text.find(' ', pos);
+            if (eq == string::npos || (space != string::npos && space < eq)) {
+                error = "expected key=value at \"" + text.substr(pos, space == string::npos ? string::npos : space - pos) + "\"";
+                return false;
+            }
+            string key = text.substr(pos, eq - pos);
+            string value;
+            pos = eq + 1;
+            if (pos < text.size() && text[pos] == '"') {
+                size_t close = text.find('"', pos + 1);
+                if (close == string::npos) {
+                    error = "unclosed quote after " + key + "=";
+                    return false;
+                }
+                value = text.substr(pos + 1, close - pos - 1);
+                pos = close + 1;
+            } else {
+                size_t end = text.find(' ', pos);
+                value = text.substr(pos, end == string::npos ? string::npos : end - pos);
+                pos = end == string::npos ? text.size() : end;
+            }
+
+            if (key == "status") q.status = value;
+            else if (key == "city") q.city = value;
+            else if (key == "customer") q.customer = value;
+            else if (key == "item") q.item = value;
+            else if (key == "total") {
+                size_t dots = value.find("..");
+                if (dots == string::npos) {
+                    error = "total wants a range like 10..50, 10.. or ..50";
+                    return false;
+                }
+                string lo = value.substr(0, dots), hi = value.substr(dots + 2);
+                if ((!lo.empty() && !parseCents(lo, q.minCents)) || (!hi.empty() && !parseCents(hi, q.maxCents))) {
+                    error = "bad amount in total=" + value;
+                    return false;
+                }
+            } else if (key == "days") {
+                if (!all_of(value.begin(), value.end(), ::isdigit) || value.empty() || value.size() > 6) {
+                    error = "days wants a whole number";
+                    return false;
+                }
+                q.from = static_cast<int64_t>(time(nullptr)) - stoll(value) * 86400;
+            } else if (key == "since" || key == "until") {
+                int64_t seconds;
+                if (!parseDate(value, seconds)) {
+                    error = key + " wants a date like 2024-01-31";
+                    return false;
+                }
+                (key == "since" ? q.from : q.to) = seconds;
+            } else if (key == "select") {
+                q.columns.clear();
+                stringstream ss(value);
+                string column;
+                while (getline(ss, column, ',')) {
+                    if (!isColumn(column)) {
+                        error = "unknown column " + column;
+                        return false;
+                    }
+                    q.columns.push_back(column);
+                }
+                if (q.columns.empty()) {
+                    error = "select needs at least one column";
+                    return false;
+                }
+            } else if (key == "order") {
+                q.descending = !value.empty() && value[0] == '-';
+                q.orderBy = q.descending ? value.substr(1) : value;
+                if (!isColumn(q.orderBy) || q.orderBy == "items") {
+                    error = "cannot order by " + q.orderBy;
+                    return false;
+                }
+            } else if (key == "limit") {
+                if (!all_of(value.begin(), value.end(), ::isdigit) || value.empty() || value.size() > 9) {
+                    error = "limit wants a whole number";
+                    return false;
+                }
+                q.limit = stoul(value);
+            } else {
+                error = "unknown key " + key;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The part of the query archive zone maps understand.
+    HistoryQuery prefilter() const {
+        HistoryQuery h;
+        h.status = status;
+        h.from = from;
+        h.to = to;
+        h.minCents = minCents < 0 ? 0 : static_cast<uint64_t>(minCents);
+        h.maxCents = maxCents < 0 ? 0 : static_cast<uint64_t>(maxCents);
+        return h;
+    }
+};
+
+// An OrderQuery compiled against one HistoryColumns: names resolved to
+// dictionary codes, bounds to the column types, and the filters ordered by
+// estimated selectivity. The first filter scans its whole column with SSE2
+// compares (16 rows per movemask) and writes the matching row numbers to a
+// selection vector; each later filter compacts that vector in place, so it
+// only looks at rows still in play.
+class QueryPlan {
+private:
+    enum class Filter { Status, City, Customer, Placed, Total, Item };
+    struct Step {
+        Filter filter;
+        uint32_t code = 0;
+        int32_t lo = 0, hi = 0;
+        uint64_t mask = 0;                // Item: bits of every wanted menu index
+        vector<uint16_t> items;           // Item: every version of the item
+        double selectivity = 1;
+        string text;
+    };
+    const HistoryColumns& columns;
+    const OrderQuery& query;
+    vector<Step> steps;
+    bool matchesNothing = false;
+    string emptyReason;
+
+    static int lowestBit(uint32_t mask) {
+#if defined(__GNUC__)
+        return __builtin_ctz(mask);
+#else
+        int bit = 0;
+        while (!(mask & 1u)) {
+            mask >>= 1;
+            bit++;
+        }
+        return bit;
+#endif
+    }
+    static size_t emit(uint32_t mask, size_t base, uint32_t* out, size_t k) {
+        while (mask) {
+            out[k++] = static_cast<uint32_t>(base + lowestBit(mask));
+            mask &= mask - 1;
+        }
+        return k;
+    }
+
+    static size_t scanEqual8(const uint8_t* v, size_t n, uint8_t value, uint32_t* out) {
+        size_t k = 0, r = 0;
+#if HAVE_SSE2
+        __m128i want = _mm_set1_epi8(static_cast<char>(value));
+        for (; r + 16 <= n; r += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + r));
+            k = emit(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, want))), r, out, k);
+        }
+#endif
+        for (; r < n; r++) {
+            out[k] = static_cast<uint32_t>(r);
+            k += v[r] == value;
+        }
+        return k;
+    }
+    static size_t scanEqual16(const uint16_t* v, size_t n, uint16_t value, uint32_t* out) {
+        size_t k = 0, r = 0;
+#if HAVE_SSE2
+        __m128i want = _mm_set1_epi16(static_cast<short>(value));
+        for (; r + 16 <= n; r += 16) {
+            __m128i a = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v + r)), want);
+            __m128i b = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v + r + 8)), want);
+            k = emit(static_cast<uint32_t>(_mm_movemask_epi8(_mm_packs_epi16(a, b))), r, out, k);
+        }
+#endif
+        for (; r < n; r++) {
+            out[k] = static_cast<uint32_t>(r);
+            k += v[r] == value;
+        }
+        return k;
+    }
+#if HAVE_SSE2
+    // Packs four 4-lane compare results (all ones or zero) into a 16-bit mask.
+    static uint32_t packMask(__m128i a, __m128i b, __m128i c, __m128i d) {
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d))));
+    }
+#endif
+    static size_t scanEqual32(const uint32_t* v, size_t n, uint32_t value, uint32_t* out) {
+        size_t k = 0, r = 0;
+#if HAVE_SSE2
+        __m128i want = _mm_set1_epi32(static_cast<int>(value));
+        for (; r + 16 <= n; r += 16) {
+            const __m128i* p = reinterpret_cast<const __m128i*>(v + r);
+            k = emit(packMask(_mm_cmpeq_epi32(_mm_loadu_si128(p), want), _mm_cmpeq_epi32(_mm_loadu_si128(p + 1), want),
+                              _mm_cmpeq_epi32(_mm_loadu_si128(p + 2), want), _mm_cmpeq_epi32(_mm_loadu_si128(p + 3), want)),
+                     r, out, k);
+        }
+#endif
+        for (; r < n; r++) {
+            out[k] = static_cast<uint32_t>(r);
+            k += v[r] == value;
+        }
+        return k;
+    }
+    static size_t scanRange32(const int32_t* v, size_t n, int32_t lo, int32_t hi, uint32_t* out) {
+        size_t k = 0, r = 0;
+#if HAVE_SSE2
+        __m128i low = _mm_set1_epi32(lo), high = _mm_set1_epi32(hi);
+        auto outside = [&](const __m128i* p) {
+            __m128i x = _mm_loadu_si128(p);
+            return _mm_or_si128(_mm_cmplt_epi32(x, low), _mm_cmpgt_epi32(x, high));
+        };
+        for (; r + 16 <= n; r += 16) {
+            const __m128i* p = reinterpret_cast<const __m128i*>(v + r);
+            uint32_t miss = packMask(outside(p), outside(p + 1), outside(p + 2), outside(p + 3));
+            k = emit(~miss & 0xFFFF, r, out, k);
+        }
+#endif
+        for (; r < n; r++) {
+            out[k] = static_cast<uint32_t>(r);
+            k += v[r] >= lo && v[r] <= hi;
+        }
+        return k;
+    }
+
+    bool hasItem(const Step& step, uint32_t row) const {
+        if (!(columns.itemMask[row] & step.mask)) return false;
+        for (uint32_t i = columns.lineStart[row]; i < columns.lineStart[row + 1]; i++) {
+            if (find(step.items.begin(), step.items.end(), columns.lineItems[i]) != step.items.end()) return true;
+        }
+        return false;
+    }
+    bool keeps(const Step& step, uint32_t row) const {
+        switch (step.filter) {
+            case Filter::Status: return columns.status[row] == step.code;
+            case Filter::City: return columns.city[row] == step.code;
+            case Filter::Customer: return columns.customer[row] == step.code;
+            case Filter::Placed: return columns.placed[row] >= step.lo && columns.placed[row] <= step.hi;
+            case Filter::Total: return columns.cents[row] >= step.lo && columns.cents[row] <= step.hi;
+            case Filter::Item: return hasItem(step, row);
+        }
+        return false;
+    }
+    size_t scan(const Step& step, uint32_t* out) const {
+        size_t n = columns.size();
+        switch (step.filter) {
+            case Filter::Status: return scanEqual8(columns.status.data(), n, static_cast<uint8_t>(step.code), out);
+            case Filter::City: return scanEqual16(columns.city.data(), n, static_cast<uint16_t>(step.code), out);
+            case Filter::Customer: return scanEqual32(columns.customer.data(), n, step.code, out);
+            case Filter::Placed: return scanRange32(columns.placed.data(), n, step.lo, step.hi, out);
+            case Filter::Total: return scanRange32(columns.cents.data(), n, step.lo, step.hi, out);
+            case Filter::Item: break;
+        }
+        size_t k = 0;
+        for (size_t r = 0; r < n; r++) {
+            out[k] = static_cast<uint32_t>(r);
+            k += hasItem(step, static_cast<uint32_t>(r));
+        }
+        return k;
+    }
+
+    void addEquality(Filter filter, const HistoryColumns::Dictionary& dictionary, const string& value, const char* name) {
+        Step step;
+        step.filter = filter;
+        if (!dictionary.lookup(value, step.code)) {
+            matchesNothing = true;
+            emptyReason = string("no order has ") + name + " " + value;
+            return;
+        }
+        step.selectivity = static_cast<double>(dictionary.rows[step.code]) / max<size_t>(columns.size(), 1);
+        step.text = string(name) + " = " + dictionary.names[step.code];
+        steps.push_back(step);
+    }
+    // Bounds clamped to int32; the estimate assumes values spread evenly
+    // between the column's minimum and maximum.
+    void addRange(Filter filter, int64_t lo, int64_t hi, int32_t columnMin, int32_t columnMax, const string& text) {
+        Step step;
+        step.filter = filter;
+        lo = max<int64_t>(lo, INT32_MIN);
+        hi = min<int64_t>(hi, INT32_MAX);
+        if (lo > hi) {
+            matchesNothing = true;
+            emptyReason = text + " is an empty range";
+            return;
+        }
+        step.lo = static_cast<int32_t>(lo);
+        step.hi = static_cast<int32_t>(hi);
+        double span = static_cast<double>(columnMax) - columnMin + 1;
+        double overlap = static_cast<double>(min<int64_t>(hi, columnMax)) - max<int64_t>(lo, columnMin) + 1;
+        step.selectivity = span > 0 ? max(0.0, min(1.0, overlap / span)) : 1;
+        step.text = text;
+        steps.push_back(step);
+    }
+public:
+    QueryPlan(const OrderQuery& q, const HistoryColumns& history, const MenuCatalog& menu)
+        : columns(history), query(q) {
+        if (!q.status.empty()) addEquality(Filter::Status, history.statuses, q.status, "status");
+        if (!q.city.empty()) addEquality(Filter::City, history.cities, q.city, "city");
+        if (!q.customer.empty()) addEquality(Filter::Customer, history.customers, q.customer, "customer");
+        if (q.from != INT64_MIN || q.to != INT64_MAX) {
+            int64_t lo = q.from == INT64_MIN ? INT64_MIN : q.from - HistoryColumns::timeBase;
+            int64_t hi = q.to == INT64_MAX ? INT64_MAX : q.to - 1 - HistoryColumns::timeBase;
+            addRange(Filter::Placed, lo, hi, history.minPlaced, history.maxPlaced, "placed in range");
+        }
+        if (q.minCents != INT64_MIN || q.maxCents != INT64_MAX) {
+            stringstream text;
+            text << "total in [" << fixed << setprecision(2) << max<int64_t>(q.minCents, 0) / 100.0 << ", ";
+            if (q.maxCents == INT64_MAX) text << "inf)"; else text << q.maxCents / 100.0 << "]";
+            addRange(Filter::Total, q.minCents, q.maxCents, history.minCents, history.maxCents, text.str());
+        }
+        if (!q.item.empty()) {
+            Step step;
+            step.filter = Filter::Item;
+            size_t rows = 0;
+            for (size_t i = 0; i < menu.size(); i++) {
+                const MenuItem* item = menu[i];
+                if (!item || HistoryColumns::Dictionary::key(item->getId()) != HistoryColumns::Dictionary::key(q.item)) continue;
+                step.items.push_back(static_cast<uint16_t>(i));
+                step.mask |= 1ULL << (i & 63);
+                if (i < history.itemRows.size()) rows += history.itemRows[i];
+            }
+            if (step.items.empty()) {
+                matchesNothing = true;
+                emptyReason = "no menu item " + q.item;
+            } else {
+                step.selectivity = static_cast<double>(rows) / max<size_t>(history.size(), 1);
+                step.text = "contains item " + q.item;
+                steps.push_back(step);
+            }
+        }
+        stable_sort(steps.begin(), steps.end(), [](const Step& a, const Step& b) { return a.selectivity < b.selectivity; });
+    }
+
+    // Rows matching every filter, in history order.
+    vector<uint32_t> filter() const {
+        vector<uint32_t> selection;
+        if (matchesNothing) return selection;
+        selection.resize(columns.size());
+        size_t k;
+        if (steps.empty()) {
+            for (size_t r = 0; r < selection.size(); r++) selection[r] = static_cast<uint32_t>(r);
+            k = selection.size();
+        } else {
+            k = scan(steps[0], selection.data());
+        }
+        for (size_t s = 1; s < steps.size(); s++) {
+            size_t kept = 0;
+            for (size_t i = 0; i < k; i++) {
+                uint32_t row = selection[i];
+                selection[kept] = row;
+                kept += keeps(steps[s], row);
+            }
+            k = kept;
+        }
+        selection.resize(k);
+        return selection;
+    }
+
+    // Sorts `rows` by the query's order column and cuts them to its limit.
+    void order(vector<uint32_t>& rows) const {
+        size_t keep = query.limit && query.limit < rows.size() ? query.limit : rows.size();
+        if (!query.orderBy.empty()) {
+            const HistoryColumns& c = columns;
+            const string& by = query.orderBy;
+            function<bool(uint32_t, uint32_t)> less;
+            if (by == "total") less = [&c](uint32_t a, uint32_t b) { return c.cents[a] < c.cents[b]; };
+            else if (by == "placed") less = [&c](uint32_t a, uint32_t b) { return c.placed[a] < c.placed[b]; };
+            else if (by == "id") less = [&c](uint32_t a, uint32_t b) { return c.id(a) < c.id(b); };
+            else if (by == "customer") less = [&c](uint32_t a, uint32_t b) { return c.customers.names[c.customer[a]] < c.customers.names[c.customer[b]]; };
+            else if (by == "city") less = [&c](uint32_t a, uint32_t b) { return c.cities.names[c.city[a]] < c.cities.names[c.city[b]]; };
+            else less = [&c](uint32_t a, uint32_t b) { return c.statuses.names[c.status[a]] < c.statuses.names[c.status[b]]; };
+            bool descending = query.descending;
+            auto compare = [&](uint32_t a, uint32_t b) { return descending ? less(b, a) : less(a, b); };
+            partial_sort(rows.begin(), rows.begin() + keep, rows.end(), compare);
+        }
+        rows.resize(keep);
+    }
+
+    string explain() const {
+        stringstream ss;
+        if (matchesNothing) {
+            ss << "Plan: nothing to scan, " << emptyReason << endl;
+            return ss.str();
+        }
+        if (steps.empty()) ss << "Plan: every row" << endl;
+        for (size_t s = 0; s < steps.size(); s++) {
+            ss << (s == 0 ? "Plan: scan   " : "      refine ") << steps[s].text << "  (~" << fixed << setprecision(1)
+               << steps[s].selectivity * 100 << "% of rows)" << endl;
+        }
+        if (!query.orderBy.empty()) ss << "      order by " << query.orderBy << (query.descending ? " desc" : "") << endl;
+        return ss.str();
+    }
+};
+
+// Order journal split into numbered segment files (<prefix>.000001.log, ...).
+// Every change to an order appends one serialized record to the active
+// segment; when it passes segmentBytes it is sealed and a new one started.
+// A background thread merges sealed segments into one that keeps only the
+// latest record per order id, writes it beside them and renames it over the
+// newest input, so a reader always sees either the old files or the new one.
+// Records are read oldest first and the last one for an id wins. The old
+// single-file history (orders.txt) is read first and never rewritten.
+// Within a segment each distinct address and payment is written once, on a
+// "=<n>,<value>" line, and records after it carry "=<n>" in that field.
+// Real values always contain '|', so a field without one is a reference.
+class OrderLog {
+private:
+    // A segment's values, numbered in the order they were first written.
+    struct SegmentValues {
+        unordered_map<string, uint32_t> ids;   // writing
+        vector<string> values;                 // reading
+
+        // Writes `record` with its address and payment fields as references,
+        // defining any value the segment hasn't had yet. Returns the bytes written.
+        size_t write(ostream& out, const string& record) {
+            size_t commas[5];
+            size_t found = 0;
+            for (size_t i = 0; i < record.size() && found < 5; i++) {
+                if (record[i] == ',') commas[found++] = i;
+            }
+            if (found < 5) {
+                out << record << '\n';
+                return record.size() + 1;
+            }
+            size_t bytes = 0;
+            string line = record.substr(0, commas[2] + 1);
+            for (int field = 2; field < 4; field++) {
+                string value = record.substr(commas[field] + 1, commas[field + 1] - commas[field] - 1);
+                if (value.find('|') == string::npos) {
+                    line += value;
+                } else {
+                    auto it = ids.find(value);
+                    if (it == ids.end()) {
+                        it = ids.emplace(value, static_cast<uint32_t>(ids.size())).first;
+                        string definition = "=" + to_string(it->second) + "," + value;
+                        out << definition << '\n';
+                        bytes += definition.size() + 1;
+                    }
+                    line += "=" + to_string(it->second);
+                }
+                line += ',';
+            }
+            line.append(record, commas[4] + 1, string::npos);
+            out << line << '\n';
+            return bytes + line.size() + 1;
+        }
+        // Takes in a definition line and returns false, or puts the full
+        // record for `line` in `record` and returns true.
+        bool read(const string& line, string& record) {
+            if (line[0] == '=') {
+                size_t comma = line.find(',');
+                if (comma != string::npos) values.push_back(line.substr(comma + 1));
+                return false;
+            }
+            if (values.empty() || line.find(",=") == string::npos) {
+                record = line;
+                return true;
+            }
+            record.clear();
+            size_t start = 0;
+            for (int field = 0; start != string::npos; field++) {
+                size_t end = line.find(',', start);
+                size_t length = (end == string::npos ? line.size() : end) - start;
+                uint32_t id = 0;
+                bool reference = (field == 3 || field == 4) && length > 1 && line[start] == '=';
+                for (size_t i = start + 1; reference && i < start + length; i++) {
+                    if (!isdigit(static_cast<unsigned char>(line[i]))) reference = false;
+                    else id = id * 10 + (line[i] - '0');
+                }
+                if (reference && id < values.size()) record += values[id];
+                else record.append(line, start, length);
+                if (field >= 4 || end == string::npos) {
+                    if (end != string::npos) record.append(line, end, string::npos);
+                    break;
+                }
+                record += ',';
+                start = end + 1;
+            }
+            return true;
+        }
+    };
+
+    string prefix;
+    string legacyFile;
+    size_t segmentBytes;
+    bool background;                  // compact sealed segments on a thread
+
+    mutable mutex stateLock;          // everything below up to filesLock
+    vector<int> sealed;               // oldest first
+    int active = 0;                   // 0 until the first append
+    ofstream activeOut;
+    size_t activeBytes = 0;
+    SegmentValues activeValues;
+    size_t compactions = 0;
+    mutable shared_mutex filesLock;   // readers vs. the compaction swap
+
+    function<bool(const string&)> dropFilter;   // records compaction may drop
+
+    thread compactor;
+    condition_variable wake;
+    bool stopping = false;
+    bool compacting = false;
+    size_t failedAt = 0;              // sealed count when a compaction last failed
+
+    string segmentPath(int number) const {
+        stringstream ss;
+        ss << prefix << "." << setw(6) << setfill('0') << number << ".log";
+        return ss.str();
+    }
+    static string recordId(const string& record) { return record.substr(0, record.find(',')); }
+
+    // Caller holds stateLock.
+    void openNextSegment() {
+        if (active) {
+            activeOut.close();
+            sealed.push_back(active);
+            wake.notify_one();
+        }
+        active = sealed.empty() ? 1 : sealed.back() + 1;
+        activeOut.open(segmentPath(active), ios::app);
+        activeBytes = 0;
+        activeValues = SegmentValues();
+        if (background && !compactor.joinable()) compactor = thread(&OrderLog::compactLoop, this);
+    }
+
+    void compactLoop() {
+        unique_lock<mutex> lock(stateLock);
+        while (!stopping) {
+            wake.wait(lock, [this]() { return stopping || (sealed.size() >= 2 && sealed.size() != failedAt); });
+            if (stopping) break;
+            lock.unlock();
+            compact();
+            lock.lock();
+        }
+    }
+public:
+    explicit OrderLog(const string& filePrefix, const string& legacy = "",
+                      size_t bytesPerSegment = 1 << 20, bool compactInBackground = true)
+        : prefix(filePrefix), legacyFile(legacy), segmentBytes(bytesPerSegment),
+          background(compactInBackground) {
+        // Pick up segments left by earlier runs; they are all sealed now.
+        filesystem::path base(prefix);
+        filesystem::path dir = base.has_parent_path() ? base.parent_path() : filesystem::path(".");
+        string stem = base.filename().string() + ".";
+        error_code error;
+        for (filesystem::directory_iterator it(dir, error), end; !error && it != end; it.increment(error)) {
+            string name = it->path().filename().string();
+            if (name.size() != stem.size() + 10 || name.compare(0, stem.size(), stem) != 0 ||
+                name.compare(name.size() - 4, 4, ".log") != 0) continue;
+            string digits = name.substr(stem.size(), 6);
+            if (all_of(digits.begin(), digits.end(), ::isdigit)) sealed.push_back(stoi(digits));
+        }
+        sort(sealed.begin(), sealed.end());
+    }
+    OrderLog(const OrderLog&) = delete;
+    OrderLog& operator=(const OrderLog&) = delete;
+
+    // Latest records for which `filter` is true are left out of compacted
+    // segments (set before the first append; called on the compaction thread).
+    void setDropFilter(const function<bool(const string&)>& filter) { dropFilter = filter; }
+
+    void append(const string& record) {
+        lock_guard<mutex> lock(stateLock);
+        if (!active || activeBytes >= segmentBytes) openNextSegment();
+        activeBytes += activeValues.write(activeOut, record);
+        activeOut.flush();
+    }
+    // Many records with a single flush at the end.
+    void appendBatch(const vector<string>& records) {
+        if (records.empty()) return;
+        lock_guard<mutex> lock(stateLock);
+        for (const string& record : records) {
+            if (!active || activeBytes >= segmentBytes) openNextSegment();
+            activeBytes += activeValues.write(activeOut, record);
+        }
+        activeOut.flush();
+    }
+
+    // Visits every complete record, oldest first. A line still being
+    // written at the end of the active segment is skipped.
+    void forEachRecord(const function<void(const string&)>& visit) const {
+        shared_lock<shared_mutex> files(filesLock);
+        vector<string> paths;
+        if (!legacyFile.empty()) paths.push_back(legacyFile);
+        {
+            lock_guard<mutex> lock(stateLock);
+            for (int number : sealed) paths.push_back(segmentPath(number));
+            if (active) paths.push_back(segmentPath(active));
+        }
+        string line, record;
+        for (const string& path : paths) {
+            ifstream in(path);
+            SegmentValues values;
+            while (getline(in, line)) {
+                if (in.eof()) break;   // no newline yet
+                if (!line.empty() && values.read(line, record)) visit(record);
+            }
+        }
+    }
+
+    // Merges every sealed segment into one. Returns the bytes saved.
+    size_t compact() {
+        vector<int> inputs;
+        {
+            lock_guard<mutex> lock(stateLock);
+            if (compacting || sealed.size() < 2) return 0;
+            compacting = true;
+            inputs = sealed;
+        }
+        unordered_map<string, size_t> latest;   // id -> index into records
+        vector<string> records;
+        size_t before = 0;
+        string line, record;
+        for (int number : inputs) {
+            ifstream in(segmentPath(number));
+            SegmentValues values;
+            while (getline(in, line)) {
+                if (line.empty()) continue;
+                before += line.size() + 1;
+                if (!values.read(line, record)) continue;
+                auto it = latest.find(recordId(record));
+                if (it == latest.end()) {
+                    latest.emplace(recordId(record), records.size());
+                    records.push_back(record);
+                } else {
+                    records[it->second] = record;
+                }
+            }
+        }
+        string target = segmentPath(inputs.back());
+        string temp = prefix + ".compact.tmp";
+        size_t after = 0;
+        {
+            ofstream out(temp, ios::trunc);
+            SegmentValues values;
+            for (const string& record : records) {
+                if (dropFilter && dropFilter(record)) continue;
+                after += values.write(out, record);
+            }
+            if (!out.flush()) {
+                lock_guard<mutex> lock(stateLock);
+                compacting = false;
+                failedAt = sealed.size();
+                return 0;
+            }
+        }
+        {
+            unique_lock<shared_mutex> files(filesLock);
+            error_code error;
+            filesystem::rename(temp, target, error);
+            if (!error) {
+                for (size_t i = 0; i + 1 < inputs.size(); i++) remove(segmentPath(inputs[i]).c_str());
+            }
+            lock_guard<mutex> lock(stateLock);
+            if (!error) {
+                sealed.erase(sealed.begin(), sealed.begin() + (inputs.size() - 1));
+                compactions++;
+            }
+            compacting = false;
+            if (error) {
+                failedAt = sealed.size();
+                return 0;
+            }
+        }
+        return before - after;
+    }
+
+    // Stops taking writes into the current segment so it can be compacted.
+    void seal() {
+        lock_guard<mutex> lock(stateLock);
+        if (active && activeBytes > 0) {
+            activeOut.close();
+            sealed.push_back(active);
+            active = 0;
+            wake.notify_one();
+        }
+    }
+
+    size_t diskBytes() const {
+        shared_lock<shared_mutex> files(filesLock);
+        lock_guard<mutex> lock(stateLock);
+        size_t total = 0;
+        error_code error;
+        for (int number : sealed) total += filesystem::file_size(segmentPath(number), error);
+        if (active) total += activeBytes;
+        return total;
+    }
+    size_t segmentCount() const {
+        lock_guard<mutex> lock(stateLock);
+        return sealed.size() + (active ? 1 : 0);
+    }
+    size_t compactionCount() const {
+        lock_guard<mutex> lock(stateLock);
+        return compactions;
+    }
+
+    ~OrderLog() {
+        {
+            lock_guard<mutex> lock(stateLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (compactor.joinable()) compactor.join();
+    }
+};
+
+// Approximate counts for a stream of keys in fixed memory: `depth` rows of
+// `width` counters, each key adding to one counter per row and reading back
+// the smallest. Estimates never undercount, and overcount by more than
+// e/width of the total only with probability e^-depth.
+class CountMinSketch {
+private:
+    size_t width;
+    size_t depth;
+    vector<uint32_t> counters;         // row-major, depth x width
+    uint64_t total = 0;
+
+    // Row r uses h1 + r*h2 (Kirsch-Mitzenmacher), from one 64-bit hash.
+    size_t column(uint64_t h, size_t row) const {
+        uint32_t h1 = static_cast<uint32_t>(h), h2 = static_cast<uint32_t>(h >> 32) | 1;
+        return (h1 + row * h2) % width;
+    }
+public:
+    CountMinSketch(size_t w, size_t d) : width(w), depth(d), counters(w * d, 0) {}
+
+    void add(uint64_t keyHash, uint32_t count = 1) {
+        for (size_t r = 0; r < depth; r++) counters[r * width + column(keyHash, r)] += count;
+        total += count;
+    }
+    uint64_t estimate(uint64_t keyHash) const {
+        uint32_t best = UINT32_MAX;
+        for (size_t r = 0; r < depth; r++) best = min(best, counters[r * width + column(keyHash, r)]);
+        return best;
+    }
+    // Overcount that estimates stay within with probability confidence().
+    uint64_t errorBound() const { return static_cast<uint64_t>(ceil(exp(1.0) / width * total)); }
+    double confidence() const { return 1 - exp(-static_cast<double>(depth)); }
+    uint64_t totalCount() const { return total; }
+
+    // Both sketches must have the same shape.
+    void merge(const CountMinSketch& other) {
+        for (size_t i = 0; i < counters.size(); i++) counters[i] += other.counters[i];
+        total += other.total;
+    }
+    void clear() {
+        fill(counters.begin(), counters.end(), 0);
+        total = 0;
+    }
+    size_t memoryBytes() const { return counters.size() * sizeof(uint32_t); }
+};
+
+// The most frequent keys of a stream in `capacity` entries (space-saving):
+// a key not yet tracked takes over the entry with the smallest count and
+// inherits that count as its error, so count - error <= true count <= count,
+// and every key seen more than total/capacity times is tracked.
+class SpaceSaving {
+public:
+    struct Entry {
+        string key;
+        uint64_t count;
+        uint64_t error;
+    };
+private:
+    size_t capacity;
+    vector<Entry> entries;
+    unordered_map<string, size_t> slots;
+public:
+    explicit SpaceSaving(size_t k) : capacity(k) {}
+
+    void add(const string& key, uint64_t count = 1) {
+        auto it = slots.find(key);
+        if (it != slots.end()) {
+            entries[it->second].count += count;
+            return;
+        }
+        if (entries.size() < capacity) {
+            slots.emplace(key, entries.size());
+            entries.push_back({key, count, 0});
+            return;
+        }
+        size_t smallest = 0;
+        for (size_t i = 1; i < entries.size(); i++) {
+            if (entries[i].count < entries[smallest].count) smallest = i;
+        }
+        Entry& victim = entries[smallest];
+        slots.erase(victim.key);
+        slots.emplace(key, smallest);
+        victim.error = victim.count;
+        victim.count += count;
+        victim.key = key;
+    }
+    // Smallest tracked count once full: the most an untracked key can have.
+    uint64_t floor() const {
+        if (entries.size() < capacity) return 0;
+        uint64_t least = UINT64_MAX;
+        for (const Entry& e : entries) least = min(least, e.count);
+        return least;
+    }
+
+    // Keys missing from one side are taken to have up to that side's floor.
+    void merge(const SpaceSaving& other) {
+        uint64_t mine = floor(), theirs = other.floor();
+        unordered_map<string, Entry> combined;
+        for (const Entry& e : entries) combined[e.key] = {e.key, e.count + theirs, e.error + theirs};
+        for (const Entry& e : other.entries) {
+            auto it = combined.find(e.key);
+            if (it == combined.end()) {
+                combined[e.key] = {e.key, e.count + mine, e.error + mine};
+            } else {
+                it->second.count += e.count - theirs;
+                it->second.error += e.error - theirs;
+            }
+        }
+        entries.clear();
+        slots.clear();
+        for (auto& entry : combined) entries.push_back(entry.second);
+        sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.count > b.count; });
+        if (entries.size() > capacity) entries.resize(capacity);
+        for (size_t i = 0; i < entries.size(); i++) slots.emplace(entries[i].key, i);
+    }
+    vector<Entry> top(size_t n) const {
+        vector<Entry> sorted = entries;
+        sort(sorted.begin(), sorted.end(), [](const Entry& a, const Entry& b) { return a.count > b.count; });
+        if (sorted.size() > n) sorted.resize(n);
+        return sorted;
+    }
+    void clear() {
+        entries.clear();
+        slots.clear();
+    }
+    size_t memoryBytes() const {
+        return capacity * (sizeof(Entry) + sizeof(pair<const string, size_t>) + 2 * sizeof(void*) + 16);
+    }
+};
+
+// Item popularity and frequently-bought-together pairs over every order
+// recorded, in fixed memory. Each counts orders, not quantities. Count-min
+// sketches answer "how many orders had X" or "X and Y" for any item or pair
+// within a stated bound; space-saving lists keep the heaviest items and
+// pairs. A recording thread uses one of a few shards picked by its id, so
+// concurrent intake rarely contends; queries merge the shards.
+class ItemAnalytics {
+public:
+    static constexpr size_t shardCount = 4;
+    static constexpr size_t itemWidth = 1024;
+    static constexpr size_t pairWidth = 8192;
+    static constexpr size_t sketchDepth = 4;
+    static constexpr size_t trackedItems = 64;
+    static constexpr size_t trackedPairs = 256;
+
+    // True count lies in [low, count] (low is exact; count may overcount).
+    struct Estimate {
+        string key;
+        uint64_t count;
+        uint64_t low;
+    };
+private:
+    struct alignas(64) Shard {
+        mutable mutex lock;
+        CountMinSketch items{itemWidth, sketchDepth};
+        CountMinSketch pairs{pairWidth, sketchDepth};
+        SpaceSaving heavyItems{trackedItems};
+        SpaceSaving heavyPairs{trackedPairs};
+        uint64_t orders = 0;
+    };
+    Shard shards[shardCount];
+
+    static uint64_t keyHash(const string& key) {
+        uint64_t h = 1469598103934665603ULL;
+        for (char c : key) h = (h ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+        return h ^ (h >> 29);
+    }
+    static string pairKey(const string& a, const string& b) { return a < b ? a + "+" + b : b + "+" + a; }
+
+    // Everything merged into one shard's worth of state.
+    void mergeInto(Shard& out) const {
+        for (const Shard& shard : shards) {
+            lock_guard<mutex> guard(shard.lock);
+            out.items.merge(shard.items);
+            out.pairs.merge(shard.pairs);
+            out.heavyItems.merge(shard.heavyItems);
+            out.heavyPairs.merge(shard.heavyPairs);
+            out.orders += shard.orders;
+        }
+    }
+    static vector<Estimate> heaviest(const SpaceSaving& heavy, const CountMinSketch& sketch, size_t n) {
+        vector<Estimate> result;
+        for (const SpaceSaving::Entry& e : heavy.top(n)) {
+            result.push_back({e.key, min(e.count, sketch.estimate(keyHash(e.key))), e.count - e.error});
+        }
+        return result;
+    }
+public:
+    // Counts the distinct items of one order, and each pair of them.
+    void record(const SmallVector<OrderLine, 4>& lines, const MenuCatalog& menu) {
+        vector<string> ids;
+        for (const OrderLine& line : lines) {
+            const MenuItem* item = menu[line.menuIndex];
+            if (item && find(ids.begin(), ids.end(), item->getId()) == ids.end()) ids.push_back(item->getId());
+        }
+        hash<thread::id> threadHash;
+        Shard& shard = shards[threadHash(this_thread::get_id()) % shardCount];
+        lock_guard<mutex> guard(shard.lock);
+        shard.orders++;
+        for (size_t i = 0; i < ids.size(); i++) {
+            shard.items.add(keyHash(ids[i]));
+            shard.heavyItems.add(ids[i]);
+            for (size_t j = i + 1; j < ids.size(); j++) {
+                string key = pairKey(ids[i], ids[j]);
+                shard.pairs.add(keyHash(key));
+                shard.heavyPairs.add(key);
+            }
+        }
+    }
+    void record(const Order& order, const MenuCatalog& menu) { record(order.getLines(), menu); }
+    void clear() {
+        for (Shard& shard : shards) {
+            lock_guard<mutex> guard(shard.lock);
+            shard.items.clear();
+            shard.pairs.clear();
+            shard.heavyItems.clear();
+            shard.heavyPairs.clear();
+            shard.orders = 0;
+        }
+    }
+
+    uint64_t orderCount() const {
+        uint64_t total = 0;
+        for (const Shard& shard : shards) {
+            lock_guard<mutex> guard(shard.lock);
+            total += shard.orders;
+        }
+        return total;
+    }
+    vector<Estimate> topItems(size_t n) const {
+        Shard merged;
+        mergeInto(merged);
+        return heaviest(merged.heavyItems, merged.items, n);
+    }
+    vector<Estimate> topPairs(size_t n) const {
+        Shard merged;
+        mergeInto(merged);
+        return heaviest(merged.heavyPairs, merged.pairs, n);
+    }
+    // Items most often ordered together with `itemId`, from the pair sketch
+    // over every current menu item; `low` is the estimate less the bound.
+    vector<Estimate> alsoBought(const string& itemId, const MenuCatalog& menu, size_t n) const {
+        Shard merged;
+        mergeInto(merged);
+        uint64_t bound = merged.pairs.errorBound();
+        vector<Estimate> result;
+        MenuCatalog::View view = menu.current();
+        for (const MenuItem* item : view->items) {
+            if (item->getId() == itemId) continue;
+            uint64_t count = merged.pairs.estimate(keyHash(pairKey(itemId, item->getId())));
+            if (count > 0) result.push_back({item->getId(), count, count > bound ? count - bound : 0});
+        }
+        sort(result.begin(), result.end(), [](const Estimate& a, const Estimate& b) { return a.count > b.count; });
+        if (result.size() > n) result.resize(n);
+        return result;
+    }
+    uint64_t itemEstimate(const string& itemId) const {
+        Shard merged;
+        mergeInto(merged);
+        return merged.items.estimate(keyHash(itemId));
+    }
+    // Sketch error bounds for single items and pairs, and their confidence.
+    uint64_t itemErrorBound() const {
+        Shard merged;
+        mergeInto(merged);
+        return merged.items.errorBound();
+    }
+    uint64_t pairErrorBound() const {
+        Shard merged;
+        mergeInto(merged);
+        return merged.pairs.errorBound();
+    }
+    double confidence() const { return shards[0].items.confidence(); }
+    size_t memoryBytes() const {
+        const Shard& s = shards[0];
+        return shardCount * (s.items.memoryBytes() + s.pairs.memoryBytes() + s.heavyItems.memoryBytes() +
+                             s.heavyPairs.memoryBytes());
+    }
+};
+
+// Distinct-count estimate in a few KB (HyperLogLog: 2^14 six-bit registers,
+// about 0.8% standard error). A small set is kept as a sorted list of
+// (register, value) entries and switches to the 12 KB of packed registers
+// once the list could outgrow them. Adding a value again changes nothing, and two
+// sketches merge by keeping each register's maximum.
+class HyperLogLog {
+public:
+    static constexpr int precision = 14;
+    static constexpr size_t registerCount = size_t(1) << precision;
+    static constexpr size_t denseBytes = registerCount * 6 / 8;
+    static constexpr size_t sparseLimit = denseBytes / sizeof(uint32_t) / 2;   // vector growth may double it
+private:
+    vector<uint32_t> sparse;           // (register << 6) | value, sorted, one per register
+    string dense;                      // packed registers plus a pad byte; empty while sparse
+
+    uint8_t get(size_t r) const {
+        size_t bit = r * 6;
+        uint16_t word = static_cast<uint8_t>(dense[bit / 8]) | static_cast<uint16_t>(static_cast<uint8_t>(dense[bit / 8 + 1]) << 8);
+        return (word >> (bit % 8)) & 63;
+    }
+    void set(size_t r, uint8_t value) {
+        size_t bit = r * 6;
+        uint16_t word = static_cast<uint8_t>(dense[bit / 8]) | static_cast<uint16_t>(static_cast<uint8_t>(dense[bit / 8 + 1]) << 8);
+        word = static_cast<uint16_t>((word & ~(63u << (bit % 8))) | (static_cast<unsigned>(value) << (bit % 8)));
+        dense[bit / 8] = static_cast<char>(word & 0xFF);
+        dense[bit / 8 + 1] = static_cast<char>(word >> 8);
+    }
+    void raise(size_t r, uint8_t value) {
+        if (!dense.empty()) {
+            if (get(r) < value) set(r, value);
+            return;
+        }
+        uint32_t entry = static_cast<uint32_t>(r << 6 | value);
+        auto it = lower_bound(sparse.begin(), sparse.end(), static_cast<uint32_t>(r << 6));
+        if (it != sparse.end() && (*it >> 6) == r) {
+            *it = max(*it, entry);
+            return;
+        }
+        sparse.insert(it, entry);
+        if (sparse.size() > sparseLimit) {
+            dense.assign(denseBytes + 1, '\0');
+            for (uint32_t e : sparse) set(e >> 6, e & 63);
+            sparse.clear();
+            sparse.shrink_to_fit();
+        }
+    }
+public:
+    static uint64_t hashOf(const string& value) {
+        uint64_t h = 1469598103934665603ULL;
+        for (char c : value) h = (h ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+        h ^= h >> 33;                  // splitmix64 finish, so every bit depends on every byte
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        return h ^ (h >> 33);
+    }
+    void add(const string& value) {
+        uint64_t h = hashOf(value);
+        size_t r = static_cast<size_t>(h >> (64 - precision));
+        uint64_t rest = h << precision;
+        uint8_t rank = 1;
+        while (rank <= 64 - precision && !(rest & (1ULL << 63))) {
+            rest <<= 1;
+            rank++;
+        }
+        raise(r, rank);
+    }
+    void merge(const HyperLogLog& other) {
+        if (other.dense.empty()) {
+            for (uint32_t e : other.sparse) raise(e >> 6, e & 63);
+            return;
+        }
+        if (dense.empty()) {
+            vector<uint32_t> mine;
+            mine.swap(sparse);
+            dense = other.dense;
+            for (uint32_t e : mine) raise(e >> 6, e & 63);
+            return;
+        }
+        for (size_t r = 0; r < registerCount; r++) {
+            uint8_t value = other.get(r);
+            if (get(r) < value) set(r, value);
+        }
+    }
+    double estimate() const {
+        double m = static_cast<double>(registerCount);
+        size_t zeros = registerCount;
+        double sum = 0;
+        if (dense.empty()) {
+            zeros -= sparse.size();
+            sum = static_cast<double>(zeros);
+            for (uint32_t e : sparse) sum += ldexp(1.0, -static_cast<int>(e & 63));
+        } else {
+            zeros = 0;
+            for (size_t r = 0; r < registerCount; r++) {
+                uint8_t value = get(r);
+                zeros += value == 0;
+                sum += ldexp(1.0, -value);
+            }
+        }
+        double raw = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+        if (raw <= 2.5 * m && zeros > 0) return m * log(m / zeros);   // linear counting for small sets
+        return raw;
+    }
+    bool empty() const { return sparse.empty() && dense.empty(); }
+    size_t memoryBytes() const { return sparse.capacity() * sizeof(uint32_t) + dense.capacity(); }
+
+    // Sparse: 0, entry count, then entries as deltas. Dense: 1, registers.
+    void serialize(string& out) const {
+        if (dense.empty()) {
+            out.push_back(0);
+            putVarint(out, sparse.size());
+            uint32_t previous = 0;
+            for (uint32_t e : sparse) {
+                putVarint(out, e - previous);
+                previous = e;
+            }
+        } else {
+            out.push_back(1);
+            out.append(dense, 0, denseBytes);
+        }
+    }
+    void deserialize(const char*& p, const char* end) {
+        if (p >= end) throw runtime_error("truncated sketch");
+        sparse.clear();
+        dense.clear();
+        char kind = *p++;
+        if (kind == 0) {
+            size_t count = getVarint(p, end);
+            if (count > sparseLimit) throw runtime_error("bad sketch size");
+            uint64_t value = 0;
+            for (size_t i = 0; i < count; i++) {
+                uint64_t delta = getVarint(p, end);
+                if (delta > registerCount << 6) throw runtime_error("bad sketch entry");
+                value += delta;
+                // One entry per register, registers in order, ranks 1..51.
+                size_t r = static_cast<size_t>(value >> 6);
+                uint32_t rank = value & 63;
+                if (r >= registerCount || rank == 0 || rank > 64 - precision + 1 ||
+                    (!sparse.empty() && r <= sparse.back() >> 6)) {
+                    throw runtime_error("bad sketch entry");
+                }
+                sparse.push_back(static_cast<uint32_t>(value));
+            }
+        } else if (kind == 1) {
+            if (static_cast<size_t>(end - p) < denseBytes) throw runtime_error("truncated sketch");
+            dense.assign(denseBytes + 1, '\0');
+            memcpy(&dense[0], p, denseBytes);
+            p += denseBytes;
+        } else {
+            throw runtime_error("bad sketch kind");
+        }
+    }
+};
+
+// Distinct customers (by name) and phone numbers per city and day, as
+// HyperLogLog sketches in `directory`/customers.YYYYMMDD.hll beside the
+// archive partitions. A day is loaded when first touched and written back
+// by flush(); any span of days and set of cities merges into one estimate.
+class CustomerCardinality {
+public:
+    struct Count {
+        double customers = 0;
+        double phones = 0;
+        size_t buckets = 0;
+        size_t bytes = 0;
+    };
+private:
+    struct Bucket {
+        HyperLogLog customers;
+        HyperLogLog phones;
+    };
+    struct Day {
+        map<string, Bucket> cities;
+        bool dirty = false;
+    };
+    string directory;
+    mutable mutex lock;                // everything below
+    mutable map<int64_t, Day> days;    // loaded so far
+    set<int64_t> known;                // days with a file or loaded
+
+    static string normalized(const string& text) {
+        string out;
+        for (char c : text) {
+            if (!isspace(static_cast<unsigned char>(c)) || (!out.empty() && out.back() != ' ')) {
+                out.push_back(isspace(static_cast<unsigned char>(c)) ? ' ' : static_cast<char>(tolower(static_cast<unsigned char>(c))));
+            }
+        }
+        while (!out.empty() && out.back() == ' ') out.pop_back();
+        return out;
+    }
+    string dayPath(int64_t day) const {
+        time_t t = static_cast<time_t>(day * 86400);
+        stringstream ss;
+        ss << directory << "/customers." << put_time(gmtime(&t), "%Y%m%d") << ".hll";
+        return ss.str();
+    }
+    // Caller holds `lock`.
+    Day& load(int64_t day) const {
+        auto it = days.find(day);
+        if (it != days.end()) return it->second;
+        Day& loaded = days[day];
+        ifstream in(dayPath(day), ios::binary);
+        if (!in) return loaded;
+        string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        try {
+            const char* p = data.data();
+            const char* end = p + data.size();
+            if (data.compare(0, 4, "HLL1") != 0) throw runtime_error("not a sketch file");
+            p += 4;
+            size_t count = getVarint(p, end);
+            for (size_t i = 0; i < count; i++) {
+                size_t length = getVarint(p, end);
+                if (static_cast<size_t>(end - p) < length) throw runtime_error("truncated city");
+                Bucket& bucket = loaded.cities[string(p, length)];
+                p += length;
+                bucket.customers.deserialize(p, end);
+                bucket.phones.deserialize(p, end);
+            }
+        } catch (const exception& e) {
+            cerr << "Ignoring damaged " << dayPath(day) << ": " << e.what() << endl;
+            loaded.cities.clear();
+        }
+        return loaded;
+    }
+public:
+    explicit CustomerCardinality(const string& dir) : directory(dir) {
+        error_code error;
+        for (filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+            string name = it->path().filename().string();
+            if (name.size() != 22 || name.compare(0, 10, "customers.") != 0 || name.compare(18, 4, ".hll") != 0) continue;
+            tm parts = {};
+            stringstream ss(name.substr(10, 8));
+            ss >> get_time(&parts, "%Y%m%d");
+            if (!ss.fail()) known.insert(static_cast<int64_t>(utcTime(parts)) / 86400);
+        }
+    }
+
+    static int64_t dayOf(chrono::system_clock::time_point t) {
+        int64_t seconds = static_cast<int64_t>(chrono::system_clock::to_time_t(t));
+        return seconds >= 0 ? seconds / 86400 : (seconds - 86399) / 86400;
+    }
+    // Last day with a sketch on disk or in memory, or INT64_MIN.
+    int64_t lastDay() const {
+        lock_guard<mutex> guard(lock);
+        return known.empty() ? INT64_MIN : *known.rbegin();
+    }
+
+    void record(const Order& order) {
+        const Address* address = order.getAddress();
+        string city = normalized(address ? address->getCity() : "");
+        string phone;
+        for (char c : order.getPhoneNumber()) {
+            if (isdigit(static_cast<unsigned char>(c))) phone.push_back(c);
+        }
+        int64_t day = dayOf(order.getOrderTime());
+        lock_guard<mutex> guard(lock);
+        Day& d = load(day);
+        Bucket& bucket = d.cities[city];
+        bucket.customers.add(normalized(order.getCustomerName()));
+        if (!phone.empty()) bucket.phones.add(phone);
+        d.dirty = true;
+        known.insert(day);
+    }
+
+    // Days [fromDay, toDay]; an empty city means every city.
+    Count count(int64_t fromDay, int64_t toDay, const string& city) const {
+        string wanted = normalized(city);
+        Bucket merged;
+        Count result;
+        lock_guard<mutex> guard(lock);
+        for (auto it = known.lower_bound(fromDay); it != known.end() && *it <= toDay; ++it) {
+            for (const auto& entry : load(*it).cities) {
+                if (!wanted.empty() && entry.first != wanted) continue;
+                merged.customers.merge(entry.second.customers);
+                merged.phones.merge(entry.second.phones);
+                result.buckets++;
+                result.bytes += entry.second.customers.memoryBytes() + entry.second.phones.memoryBytes();
+            }
+        }
+        result.customers = merged.customers.estimate();
+        result.phones = merged.phones.estimate();
+        return result;
+    }
+    vector<string> cities(int64_t fromDay, int64_t toDay) const {
+        set<string> names;
+        lock_guard<mutex> guard(lock);
+        for (auto it = known.lower_bound(fromDay); it != known.end() && *it <= toDay; ++it) {
+            for (const auto& entry : load(*it).cities) names.insert(entry.first);
+        }
+        return vector<string>(names.begin(), names.end());
+    }
+
+    // Writes every changed day. Returns false on I/O error.
+    bool flush() {
+        lock_guard<mutex> guard(lock);
+        bool ok = true;
+        for (auto& entry : days) {
+            Day& d = entry.second;
+            if (!d.dirty) continue;
+            string data = "HLL1";
+            putVarint(data, d.cities.size());
+            for (const auto& city : d.cities) {
+                putVarint(data, city.first.size());
+                data += city.first;
+                city.second.customers.serialize(data);
+                city.second.phones.serialize(data);
+            }
+            string path = dayPath(entry.first), temp = path + ".tmp";
+            {
+                ofstream out(temp, ios::binary | ios::trunc);
+                out.write(data.data(), data.size());
+                if (!out.flush()) {
+                    ok = false;
+                    continue;
+                }
+            }
+            error_code error;
+            filesystem::rename(temp, path, error);
+            if (error) ok = false;
+            else d.dirty = false;
+        }
+        return ok;
+    }
+};
+
+// Prefix and typo-tolerant search over names (menu items, customers). A
+// radix trie holds every name, lower-cased, and also each word start within
+// it, so "tik" finds "Chicken Tikka". Every node keeps the highest
+// popularity below it. Autocomplete walks to the prefix and pulls entries
+// best-first from there. Fuzzy search walks the trie with a Levenshtein row
+// and keeps every prefix within one edit of the query. Popularity only
+// grows, so a bump just raises the maxima on the paths above the entry.
+class NameIndex {
+public:
+    struct Match {
+        string key;
+        string name;
+        uint64_t popularity;
+        int distance;                  // edits from the query to a prefix of the name
+    };
+private:
+    static constexpr uint32_t none = UINT32_MAX;
+    struct Node {
+        uint32_t parent;
+        uint32_t labelStart;           // edge label is labels[labelStart, +labelLength)
+        uint32_t labelLength;
+        uint32_t firstChild = none;
+        uint32_t nextSibling = none;
+        uint32_t entryHead = none;     // into entryLinks
+        uint64_t best = 0;
+    };
+    struct Entry {
+        string key;
+        string name;
+        uint64_t popularity;
+        SmallVector<uint32_t, 4> nodes;   // where its name and word starts end
+    };
+    string labels;
+    vector<Node> nodes;
+    vector<pair<uint32_t, uint32_t>> entryLinks;   // (entry, next link)
+    vector<Entry> entries;
+    unordered_map<string, uint32_t> byKey;
+    mutable shared_mutex lock;
+
+    static string normalized(const string& text) {
+        string out;
+        for (char c : text) {
+            unsigned char u = static_cast<unsigned char>(c);
+            if (isspace(u)) {
+                if (!out.empty() && out.back() != ' ') out.push_back(' ');
+            } else {
+                out.push_back(static_cast<char>(tolower(u)));
+            }
+        }
+        while (!out.empty() && out.back() == ' ') out.pop_back();
+        return out;
+    }
+    uint32_t child(uint32_t node, char c) const {
+        for (uint32_t ch = nodes[node].firstChild; ch != none; ch = nodes[ch].nextSibling) {
+            if (labels[nodes[ch].labelStart] == c) return ch;
+        }
+        return none;
+    }
+    uint32_t newNode(uint32_t parent, uint32_t start, uint32_t length) {
+        Node n;
+        n.parent = parent;
+        n.labelStart = start;
+        n.labelLength = length;
+        nodes.push_back(n);
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+    // Node where `text` ends, splitting an edge or adding a leaf as needed.
+    uint32_t insertPath(const string& text) {
+        uint32_t node = 0;
+        size_t i = 0;
+        while (i < text.size()) {
+            uint32_t c = child(node, text[i]);
+            if (c == none) {
+                uint32_t leaf = newNode(node, static_cast<uint32_t>(labels.size()), static_cast<uint32_t>(text.size() - i));
+                labels.append(text, i, string::npos);
+                nodes[leaf].nextSibling = nodes[node].firstChild;
+                nodes[node].firstChild = leaf;
+                return leaf;
+            }
+            uint32_t common = 0;
+            while (common < nodes[c].labelLength && i + common < text.size() &&
+                   labels[nodes[c].labelStart + common] == text[i + common]) common++;
+            if (common < nodes[c].labelLength) {
+                // Split the edge: `mid` takes c's place and c hangs below it.
+                uint32_t mid = newNode(node, nodes[c].labelStart, common);
+                nodes[mid].best = nodes[c].best;
+                nodes[mid].nextSibling = nodes[c].nextSibling;
+                nodes[mid].firstChild = c;
+                if (nodes[node].firstChild == c) {
+                    nodes[node].firstChild = mid;
+                } else {
+                    uint32_t before = nodes[node].firstChild;
+                    while (nodes[before].nextSibling != c) before = nodes[before].nextSibling;
+                    nodes[before].nextSibling = mid;
+                }
+                nodes[c].parent = mid;
+                nodes[c].nextSibling = none;
+                nodes[c].labelStart += common;
+                nodes[c].labelLength -= common;
+                c = mid;
+            }
+            node = c;
+            i += common;
+        }
+        return node;
+    }
+    void raise(uint32_t node, uint64_t popularity) {
+        for (; node != none && nodes[node].best < popularity; node = nodes[node].parent) {
+            nodes[node].best = popularity;
+        }
+    }
+    // Caller holds the unique lock.
+    void attach(uint32_t e, const string& text) {
+        uint32_t node = insertPath(text);
+        for (uint32_t link = nodes[node].entryHead; link != none; link = entryLinks[link].second) {
+            if (entryLinks[link].first == e) return;
+        }
+        entryLinks.push_back({e, nodes[node].entryHead});
+        nodes[node].entryHead = static_cast<uint32_t>(entryLinks.size() - 1);
+        entries[e].nodes.push_back(node);
+        raise(node, entries[e].popularity);
+    }
+
+    // Up to k entries below `start`, most popular first, best-first by the
+    // subtree maxima. Entries in `seen` are skipped and added to it.
+    void topEntries(uint32_t start, size_t k, int distance, vector<Match>& out, unordered_set<uint32_t>& seen) const {
+        priority_queue<pair<uint64_t, int64_t>> frontier;   // (score, node) or (score, -1 - entry)
+        frontier.push({nodes[start].best, start});
+        size_t found = 0;
+        while (!frontier.empty() && found < k) {
+            pair<uint64_t, int64_t> top = frontier.top();
+            frontier.pop();
+            if (top.second < 0) {
+                uint32_t e = static_cast<uint32_t>(-1 - top.second);
+                if (seen.insert(e).second) {
+                    out.push_back({entries[e].key, entries[e].name, entries[e].popularity, distance});
+                    found++;
+                }
+                continue;
+            }
+            const Node& n = nodes[top.second];
+            for (uint32_t link = n.entryHead; link != none; link = entryLinks[link].second) {
+                uint32_t e = entryLinks[link].first;
+                frontier.push({entries[e].popularity, -1 - static_cast<int64_t>(e)});
+            }
+            for (uint32_t ch = n.firstChild; ch != none; ch = nodes[ch].nextSibling) frontier.push({nodes[ch].best, ch});
+        }
+    }
+
+    // Every node whose path is within one edit of a prefix-match for
+    // `query`, with the smallest distance seen on the way in.
+    void fuzzyHits(uint32_t node, const vector<int>& row, const string& query, vector<pair<uint32_t, int>>& hits) const {
+        size_t n = query.size();
+        for (uint32_t ch = nodes[node].firstChild; ch != none; ch = nodes[ch].nextSibling) {
+            vector<int> current = row;
+            int hit = 2;
+            bool alive = true;
+            for (uint32_t i = 0; i < nodes[ch].labelLength && alive; i++) {
+                char c = labels[nodes[ch].labelStart + i];
+                vector<int> next(n + 1);
+                next[0] = current[0] + 1;
+                int smallest = next[0];
+                for (size_t j = 1; j <= n; j++) {
+                    next[j] = min(min(current[j] + 1, next[j - 1] + 1), current[j - 1] + (query[j - 1] != c ? 1 : 0));
+                    smallest = min(smallest, next[j]);
+                }
+                current.swap(next);
+                hit = min(hit, current[n]);
+                alive = smallest <= 1 && hit > 0;
+            }
+            if (hit <= 1) hits.push_back({ch, hit});
+            if (alive) fuzzyHits(ch, current, query, hits);
+        }
+    }
+public:
+    NameIndex() { nodes.push_back(Node{none, 0, 0}); }
+    NameIndex(const NameIndex&) = delete;
+    NameIndex& operator=(const NameIndex&) = delete;
+
+    // A new key, or another name for an existing one.
+    void add(const string& key, const string& name, uint64_t popularity = 0) {
+        string text = normalized(name);
+        if (text.empty()) return;
+        unique_lock<shared_mutex> guard(lock);
+        auto it = byKey.find(key);
+        uint32_t e;
+        if (it == byKey.end()) {
+            e = static_cast<uint32_t>(entries.size());
+            entries.push_back({key, name, popularity, {}});
+            byKey.emplace(key, e);
+        } else {
+            e = it->second;
+        }
+        attach(e, text);
+        for (size_t space = text.find(' '); space != string::npos; space = text.find(' ', space + 1)) {
+            attach(e, text.substr(space + 1));
+        }
+    }
+    void bump(const string& key, uint64_t by = 1) {
+        unique_lock<shared_mutex> guard(lock);
+        auto it = byKey.find(key);
+        if (it == byKey.end()) return;
+        Entry& entry = entries[it->second];
+        entry.popularity += by;
+        for (uint32_t node : entry.nodes) raise(node, entry.popularity);
+    }
+
+    // Most popular names with a word starting with `prefix`.
+    vector<Match> complete(const string& prefix, size_t k) const {
+        string text = normalized(prefix);
+        shared_lock<shared_mutex> guard(lock);
+        vector<Match> out;
+        uint32_t node = 0;
+        size_t i = 0;
+        while (i < text.size()) {
+            node = child(node, text[i]);
+            if (node == none) return out;
+            uint32_t j = 0;
+            while (j < nodes[node].labelLength && i < text.size()) {
+                if (labels[nodes[node].labelStart + j] != text[i]) return out;
+                j++;
+                i++;
+            }
+        }
+        unordered_set<uint32_t> seen;
+        topEntries(node, k, 0, out, seen);
+        return out;
+    }
+    // Like complete(), but also taking names one typo away: exact prefix
+    // matches come first, then by popularity.
+    vector<Match> search(const string& query, size_t k) const {
+        string text = normalized(query);
+        shared_lock<shared_mutex> guard(lock);
+        vector<pair<uint32_t, int>> hits;
+        vector<int> row(text.size() + 1);
+        for (size_t j = 0; j <= text.size(); j++) row[j] = static_cast<int>(j);
+        if (text.size() <= 1) hits.push_back({0, static_cast<int>(text.size())});
+        fuzzyHits(0, row, text, hits);
+        stable_sort(hits.begin(), hits.end(), [](const pair<uint32_t, int>& a, const pair<uint32_t, int>& b) {
+            return a.second < b.second;
+        });
+        vector<Match> out;
+        unordered_set<uint32_t> seen;
+        for (const pair<uint32_t, int>& hit : hits) topEntries(hit.first, k, hit.second, out, seen);
+        stable_sort(out.begin(), out.end(), [](const Match& a, const Match& b) {
+            return a.distance != b.distance ? a.distance < b.distance : a.popularity > b.popularity;
+        });
+        if (out.size() > k) out.resize(k);
+        return out;
+    }
+
+    size_t size() const {
+        shared_lock<shared_mutex> guard(lock);
+        return entries.size();
+    }
+    size_t memoryBytes() const {
+        shared_lock<shared_mutex> guard(lock);
+        size_t bytes = labels.capacity() + nodes.capacity() * sizeof(Node) + entryLinks.capacity() * 8;
+        for (const Entry& e : entries) bytes += sizeof(Entry) + e.key.capacity() + e.name.capacity();
+        return bytes + byKey.size() * (sizeof(pair<const string, uint32_t>) + 16);
+    }
+};
+
+class Restaurant {
+private:
+    void quickSort(vector<Order*>& orders, int low, int high) {
+        if (low < high) {
+            // Use median-of-three pivot selection
+            int mid = low + (high - low) / 2;
+            if (orders[low]->getTotal() > orders[mid]->getTotal()) 
+                swap(orders[low], orders[mid]);
+            if (orders[mid]->getTotal() > orders[high]->getTotal())
+                swap(orders[mid], orders[high]);
+            if (orders[low]->getTotal() > orders[mid]->getTotal())
+                swap(orders[low], orders[mid]);
+            
             double pivot = orders[mid]->getTotal();
             int i = low - 1;
             int j = high + 1;
@@ -347,380 +6549,4425 @@ private:
                 
                 swap(orders[i], orders[j]);
             }
-            
-            quickSort(orders, low, j);
-            quickSort(orders, j + 1, high);
+            
+            quickSort(orders, low, j);
+            quickSort(orders, j + 1, high);
+        }
+    }
+
+    void mergeSort(vector<Order*>& orders, int left, int right) {
+        if (left < right) {
+            int mid = left + (right - left) / 2;
+            mergeSort(orders, left, mid);
+            mergeSort(orders, mid + 1, right);
+            merge(orders, left, mid, right);
+        }
+    }
+    void merge(vector<Order*>& orders, int left, int mid, int right) {
+        vector<Order*> temp(right - left + 1);
+        int i = left, j = mid + 1, k = 0;
+        while (i <= mid && j <= right) {
+            if (orders[i]->getTotal() <= orders[j]->getTotal())
+                temp[k++] = orders[i++];
+            else
+                temp[k++] = orders[j++];
+        }      
+        while (i <= mid) temp[k++] = orders[i++];
+        while (j <= right) temp[k++] = orders[j++];      
+        for (i = 0; i < k; i++)
+            orders[left + i] = temp[i];
+    }
+    Order* binarySearch(const vector<Order*>& orders, const string& id) {
+        int left = 0, right = orders.size() - 1;       
+        while (left <= right) {
+            int mid = left + (right - left) / 2;
+            if (orders[mid]->getId() == id)
+                return orders[mid];
+            if (orders[mid]->getId() < id)
+                left = mid + 1;
+            else
+                right = mid - 1;
+        }
+        return nullptr;
+    }  
+    Order* linearSearch(const vector<Order*>& orders, const string& id) {
+        for (Order* order : orders) {
+            if (order->getId() == id)
+                return order;
+        }
+        return nullptr;
+    }
+
+    // Keeps the newest record for each id we don't already hold in memory.
+    // Orders in memory are the live copies (the queue and drivers point at
+    // them), so history only fills in the rest.
+    void collectRecord(const string& line, unordered_map<string, string>& latest) const {
+        if (line.empty()) return;
+        string id = line.substr(0, line.find(','));
+        if (!orderHistory.contains(id)) latest[id] = line;
+    }
+    void adoptRecords(const unordered_map<string, string>& latest) {
+        for (const auto& record : latest) {
+            try {
+                Order* order = Order::deserialize(record.second, menuCatalog);
+                if (!order) continue;
+                orderHistory.insertOrAssign(order->getId(), orders.adopt(order));
+                if (itemStatsSeeded) itemStats.record(*order, menuCatalog);
+                customerCounts.record(*order);
+                if (namesSeeded) indexOrderNames(*order);
+            } catch (const exception& e) {
+                cerr << "Error loading order " << record.first << ": " << e.what() << endl;
+            }
+        }
+    }
+    // Appends the order's current state to the order log.
+    void recordOrder(const Order* order) {
+        if (!journalOrders) return;
+        menuCatalog.saveVersions();
+        orderLog.append(order->serialize());
+    }
+
+public:
+    void loadOrdersFromFile(const string& filename) {
+        ifstream inFile(filename);
+        if (!inFile) return;
+        unordered_map<string, string> latest;
+        string line;
+        while (getline(inFile, line)) collectRecord(line, latest);
+        adoptRecords(latest);
+    }
+    void loadOrderHistory() {
+        unordered_map<string, string> latest;
+        orderLog.forEachRecord([&](const string& line) { collectRecord(line, latest); });
+        adoptRecords(latest);
+    }
+
+    bool validateInput(const string& input, const string& type) {
+        if (input.empty()) return false;
+        
+        if (type == "name") {
+            return all_of(input.begin(), input.end(), [](char c) {
+                return isalpha(c) || c == ' ' || c == '-';
+            });
+        }
+        else if (type == "zip") {
+            return all_of(input.begin(), input.end(), ::isdigit) && input.length() == 5;
+        }
+        else if (type == "expiry") {
+            regex pattern("^(0[1-9]|1[0-2])/([0-9]{2})$");
+            return regex_match(input, pattern);
+        }
+        else if (type == "cvv") {
+            return all_of(input.begin(), input.end(), ::isdigit) && input.length() == 3;
+        }
+        return true;
+    }
+
+    OrderStore orders;                 // owns every order in memory
+    OrderQueue<OrderHandle> orderQueue;
+    ShardedMap<string, OrderHandle, OrderIdTable<OrderHandle>> orderHistory;  // safe from any thread
+    deque<OrderHandle> deliveredOrders; // oldest first, trimmed to deliveredRetention
+    PartitionedArchive archive{"archive", "orders.archive"};  // delivered orders released from memory, by day
+    OrderLog orderLog{"orders", "orders.txt"};  // every order change, compacted in the background
+    bool journalOrders = true;
+    vector<DeliveryDriver*> drivers;   // every driver, owned by the restaurant
+    DriverGrid availableDrivers;       // drivers with room for another order
+    ZipGeocoder geocoder;
+    RoadNetwork roads;
+    vector<OrderHandle> readyOrders;   // cooked, waiting for a driver
+    // Orders out for delivery by when they reach the door, soonest first.
+    struct DropOff {
+        chrono::steady_clock::time_point due;
+        OrderHandle handle;
+        bool operator>(const DropOff& other) const { return due > other.due; }
+    };
+    priority_queue<DropOff, vector<DropOff>, greater<DropOff>> dropOffs;
+    double deliverySpeedup = 1.0;      // >1 plays deliveries out faster than the roads take
+    size_t deliveredCount = 0;         // handed over since start-up
+    MenuCatalog menuCatalog;           // on-sale snapshot + every item version
+    vector<PricingRule> pricingRules;  // from pricing.txt
+    RcuPointer<PricingPlan> pricing{new PricingPlan(pricingRules, menuCatalog)};  // rules compiled against the menu
+    MealRecommender meals;             // knapsack tables per menu version
+    ItemAnalytics itemStats;           // item and pair popularity, fixed size
+    bool itemStatsSeeded = false;      // itemStats has seen the history so far
+    CustomerCardinality customerCounts{"archive"};  // distinct customers per city and day
+    bool customerCountsSeeded = false;
+    NameIndex menuNames;               // item id -> name, popularity = orders with it
+    NameIndex customerNames;           // lower-cased name -> name, popularity = orders
+    bool namesSeeded = false;          // popularities cover the history so far
+    bool running = true;
+    static constexpr size_t deliveredRetention = 1000;
+    static constexpr size_t dispatchWindow = 512;     // oldest ready orders planned per round
+    static constexpr size_t kitchenSlice = 2048;      // orders cooked per background round
+
+    Restaurant() {
+        // Initialize RNG for generating order ids
+        srand(static_cast<unsigned int>(time(nullptr)));
+        string error;
+        // Menu versions the journal and archive refer to, kept beside the journal.
+        if (menuCatalog.restoreVersions("orders.menu", error) < 0) cerr << "Menu versions not restored: " << error << endl;
+        archive.useMenu(&menuCatalog);
+        geocoder.loadFromFile("zipcodes.txt");
+        if (roads.loadFromFile("roads.txt", geocoder) > 0) roads.buildHierarchy();
+        if (loadPricing("pricing.txt", error) < 0) cerr << "Pricing rules not loaded: " << error << endl;
+        // Once a delivered order is in the archive its journal records can go.
+        orderLog.setDropFilter([this](const string& record) {
+            stringstream ss(record);
+            string field;
+            for (int i = 0; i <= 6; i++) getline(ss, field, ',');   // 7th field is the status
+            return field == "Delivered" && archive.contains(record.substr(0, record.find(',')));
+        });
+        indexMenuNames();
+    }
+    // Items beyond the base menu; the catalogue takes ownership.
+    bool addMenuItem(MenuItem* item) {
+        string id = item->getId(), name = item->getName();
+        if (!menuCatalog.add(item)) return false;
+        menuNames.add(id, name);
+        compilePricing();
+        return true;
+    }
+    void indexMenuNames() {
+        MenuCatalog::View menu = menuCatalog.current();
+        for (const MenuItem* item : menu->items) menuNames.add(item->getId(), item->getName());
+    }
+    // Swaps in the menu from `filename`; orders already placed keep their prices.
+    void reloadMenu(const string& filename) {
+        string error;
+        int count = menuCatalog.reload(filename, error);
+        if (count < 0) {
+            setcolor(12);
+            cout << "Menu not reloaded: " << error << endl;
+        } else {
+            setcolor(10);
+            cout << "Menu reloaded from " << filename << ": " << count << " items." << endl;
+            indexMenuNames();
+            compilePricing();
+        }
+        setcolor(7);
+    }
+    // Replaces the pricing rules with those in `filename`; no file means no
+    // rules. Returns how many there are now, or -1 with `error` set and the
+    // old rules kept.
+    int loadPricing(const string& filename, string& error) {
+        vector<PricingRule> loaded;
+        ifstream inFile(filename);
+        string line;
+        int lineNo = 0;
+        while (inFile && getline(inFile, line)) {
+            lineNo++;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line[0] == '#') continue;
+            PricingRule rule;
+            if (!PricingRule::parse(line, rule)) {
+                error = filename + " line " + to_string(lineNo) + " is not a valid pricing rule";
+                return -1;
+            }
+            loaded.push_back(rule);
+        }
+        pricingRules = loaded;
+        compilePricing();
+        return static_cast<int>(pricingRules.size());
+    }
+    void reloadPricing(const string& filename) {
+        string error;
+        int count = loadPricing(filename, error);
+        if (count < 0) {
+            setcolor(12);
+            cout << "Pricing not reloaded: " << error << endl;
+        } else {
+            setcolor(10);
+            cout << "Pricing reloaded from " << filename << ": " << count << " rules." << endl;
+        }
+        setcolor(7);
+    }
+    // The same rules against the menu as it is now.
+    void compilePricing() { pricing.publish(new PricingPlan(pricingRules, menuCatalog)); }
+    // Sets the order's total under the current rules and returns the breakdown.
+    PriceQuote priceOrder(Order& order) const {
+        PriceQuote quote = pricing.read()->quote(order);
+        order.setTotal(quote.total());
+        return quote;
+    }
+    void displayPriceBreakdown(const PriceQuote& quote) const {
+        RcuPointer<PricingPlan>::ReadGuard plan = pricing.read();
+        cout << fixed << setprecision(2) << "Subtotal: $" << quote.subtotal << endl;
+        for (const PriceQuote::Applied& applied : quote.applied) {
+            if (applied.rule >= plan->ruleCount()) continue;
+            const PricingRule& rule = plan->rule(applied.rule);
+            bool fee = rule.kind == PricingRule::Fee;
+            setcolor(fee ? 7 : 10);
+            cout << (fee ? "  + " : "  - ") << left << setw(30) << rule.name << right << "$" << applied.amount << endl;
+        }
+        setcolor(14);
+        cout << "Total: $" << quote.total() << endl;
+        setcolor(7);
+    }
+    struct RepriceSummary {
+        size_t orders = 0;
+        size_t changed = 0;       // would cost something else now
+        size_t applied = 0;       // pending ones that took the new total
+        double before = 0.0;
+        double after = 0.0;
+        double seconds = 0.0;     // quoting only
+        unsigned threads = 1;
+    };
+    // Quotes every order in history under the current rules, in parallel.
+    // With `apply`, orders still pending take their new total and are
+    // journaled again; the rest keep what they were charged.
+    RepriceSummary repriceHistory(unsigned threads, bool apply) {
+        RepriceSummary summary;
+        vector<Order*> history;
+        orderHistory.forEach([&](const string&, const OrderHandle& handle) {
+            if (Order* order = orders.get(handle)) history.push_back(order);
+        });
+        vector<const Order*> view(history.begin(), history.end());
+        auto start = chrono::steady_clock::now();
+        vector<double> totals = pricing.read()->totals(view, threads, &summary.threads);
+        summary.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        vector<string> records;
+        summary.orders = history.size();
+        for (size_t i = 0; i < history.size(); i++) {
+            summary.before += history[i]->getTotal();
+            summary.after += totals[i];
+            if (fabs(totals[i] - history[i]->getTotal()) < 0.005) continue;
+            summary.changed++;
+            if (apply && history[i]->getStatus() == "Pending") {
+                history[i]->setTotal(totals[i]);
+                if (journalOrders) records.push_back(history[i]->serialize());
+                summary.applied++;
+            }
+        }
+        journalRecords(records);
+        return summary;
+    }
+    MenuItem* findMenuItem(const string& id) const { return menuCatalog.find(id); }  
+    // Meals within `budget` from the menu on sale now, best score first.
+    vector<MealRecommender::Option> recommendMeals(double budget, const vector<string>& categories, int count) {
+        MenuCatalog::View menu = menuCatalog.current();
+        return meals.recommend(*menu, budget, categories, count);
+    }
+    void displayMealOptions(const vector<MealRecommender::Option>& options) const {
+        if (options.empty()) {
+            setcolor(12);
+            cout << "Nothing on the menu fits that budget." << endl;
+            setcolor(7);
+            return;
+        }
+        for (size_t i = 0; i < options.size(); i++) {
+            const MealRecommender::Option& option = options[i];
+            setcolor(14);
+            cout << "\nOption " << i + 1 << ": $" << fixed << setprecision(2) << option.cost << ", ready in "
+                 << option.maxPrepTime << " mins (" << option.score << " points)" << endl;
+            setcolor(7);
+            for (const auto& entry : option.items) {
+                cout << setw(6) << entry.first->getId() << "  " << entry.first->getName();
+                if (entry.second > 1) cout << " x" << entry.second;
+                cout << " ($" << entry.first->getPrice() << ")" << endl;
+            }
+        }
+    }
+    void addDriver(DeliveryDriver* driver) {
+        drivers.push_back(driver);
+        if (driver->isAvailable()) availableDrivers.insert(driver);
+    }
+    void moveDriver(DeliveryDriver* driver, const GeoPoint& position) {
+        availableDrivers.update(driver, position);
+    }
+    GeoPoint locateOrder(const Order* order) const {
+        GeoPoint p;
+        if (order->getAddress()) geocoder.geocode(*order->getAddress(), p);
+        return p;
+    }
+    int roadNodeForOrder(const Order* order) const {
+        const Address* address = order->getAddress();
+        if (!address) return roads.nearestNode(GeoPoint());
+        return roads.nodeForAddress(address->getZipCode(), address->getStreet(), locateOrder(order));
+    }
+    // Road travel time in minutes to the order's address, from its driver if it
+    // has one and from the restaurant otherwise; -1 without a road graph.
+    int estimateMinutes(const Order* order) const {
+        if (!roads.isBuilt()) return -1;
+        int from = order->getDriver() ? roads.nearestNode(order->getDriver()->getPosition())
+                                      : roads.nearestNode(GeoPoint());
+        int seconds = roads.travelTime(from, roadNodeForOrder(order));
+        return seconds == RoadNetwork::unreachable ? -1 : (seconds + 59) / 60;
+    }
+    vector<DeliveryDriver*> findNearestDrivers(const GeoPoint& p, size_t k) const {
+        return availableDrivers.nearest(p, k);
+    }
+    // Hands a finished order to the closest driver with spare capacity.
+    DeliveryDriver* dispatchOrder(Order* order) {
+        vector<DeliveryDriver*> found = availableDrivers.nearest(locateOrder(order), 1);
+        if (found.empty()) return nullptr;
+        DeliveryDriver* driver = found[0];
+        driver->assignOrder(order);
+        order->setDriver(driver);
+        order->setStatus("Out for Delivery");
+        recordOrder(order);
+        if (!driver->isAvailable()) availableDrivers.remove(driver);
+        return driver;
+    }
+    // The driver ends up at the drop-off point and is offered new orders again.
+    void completeDelivery(Order* order) {
+        DeliveryDriver* driver = order->getDriver();
+        if (!driver) return;
+        driver->completeOrder(order);
+        order->setStatus("Delivered");
+        recordOrder(order);
+        deliveredCount++;
+        availableDrivers.update(driver, locateOrder(order));
+        if (driver->isAvailable()) availableDrivers.insert(driver);
+        OrderHandle handle;
+        if (orderHistory.find(order->getId(), handle) && orders.get(handle) == order) {
+            retireDelivered(handle);
+        }
+    }
+    // Keeps the latest deliveries in memory; older ones are released and
+    // only remain in the archive, so memory stays flat however long we run.
+    void retireDelivered(OrderHandle handle) {
+        deliveredOrders.push_back(handle);
+        while (deliveredOrders.size() > deliveredRetention) {
+            OrderHandle old = deliveredOrders.front();
+            deliveredOrders.pop_front();
+            if (const Order* order = orders.get(old)) {
+                if (journalOrders) {
+                    menuCatalog.saveVersions();
+                    archive.stage(*order);
+                }
+                orderHistory.erase(order->getId(), old);
+                orders.release(old);
+            }
+        }
+        if (archive.stagedCount() >= 4 * OrderArchive::ordersPerBlock) {
+            archive.flush();
+            customerCounts.flush();
+        }
+    }
+    void displayMenu() const {
+        clearScreen();
+        MenuCatalog::View menu = menuCatalog.current();
+        const vector<MenuItem*>& items = menu->byPrice;
+        setcolor(14); // Yellow
+        cout << "\nMenu Items (Sorted by Price):" << endl;
+        setcolor(11); // Light cyan
+        cout << setw(5) << "ID" 
+             << setw(20) << "Name"
+             << setw(10) << "Price"
+             << setw(15) << "Category"
+             << setw(15) << "Prep Time" << endl;
+        setcolor(7); // White
+        cout << string(65, '-') << endl;       
+        for (const MenuItem* item : items) {
+            cout << setw(5) << item->getId()
+                 << setw(20) << item->getName()
+                 << setw(10) << fixed << setprecision(2) << item->getPrice()
+                 << setw(15) << item->getCategory()
+                 << setw(15) << item->getPrepTime() << " mins" << endl;
+        }
+    }
+    // Takes ownership of the order and queues it for the kitchen.
+    OrderHandle intakeOrder(Order* order) {
+        OrderHandle handle = admitOrder(order);
+        recordOrder(order);
+        return handle;
+    }
+    // Takes ownership of every order; they are journaled in one write.
+    void intakeOrders(const vector<Order*>& batch) {
+        vector<string> records;
+        for (Order* order : batch) {
+            admitOrder(order);
+            if (journalOrders) records.push_back(order->serialize());
+        }
+        journalRecords(records);
+    }
+    // Already serialized records, in one write.
+    void journalRecords(const vector<string>& records) {
+        if (!journalOrders || records.empty()) return;
+        menuCatalog.saveVersions();
+        orderLog.appendBatch(records);
+    }
+    OrderHandle admitOrder(Order* order) {
+        OrderHandle handle = orders.adopt(order);
+        int priority = static_cast<int>(order->getTotal() * 10);
+        orderQueue.push(handle, priority);
+        orderHistory.insertOrAssign(order->getId(), handle);
+        if (itemStatsSeeded) itemStats.record(*order, menuCatalog);
+        if (journalOrders) customerCounts.record(*order);
+        if (namesSeeded) indexOrderNames(*order);
+        return handle;
+    }
+    // Why an order that came from outside the console can't be taken, or
+    // an empty string if it can. The same rules as the order form.
+    string checkIncomingOrder(const Order& order) {
+        const string& id = order.getId();
+        if (id.empty() || id.size() > 32 || !all_of(id.begin(), id.end(), [](char c) {
+                return isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_';
+            })) return "bad id";
+        if (orderHistory.contains(id)) return "duplicate id";
+        if (!validateInput(order.getCustomerName(), "name")) return "bad name";
+        if (!validatePhoneNumber(order.getPhoneNumber())) return "bad phone";
+        const Address* address = order.getAddress();
+        if (!address || address->getStreet().empty() || !validateInput(address->getZipCode(), "zip")) {
+            return "bad address";
+        }
+        const Payment* payment = order.getPayment();
+        if (!payment || !Payment::validateCardNumber(payment->getCardNumber())) return "bad card";
+        if (order.getLines().empty()) return "no items";
+        for (const OrderLine& line : order.getLines()) {
+            if (line.menuIndex >= menuCatalog.size() || line.quantity == 0 || line.quantity > Order::maxQuantity) return "bad item";
+        }
+        return "";
+    }
+    void placeOrder(Order* order) {
+        if (!order) return;
+        
+        clearScreen();
+        intakeOrder(order);
+
+        setcolor(10);
+        cout << "Order placed successfully. Order ID: " << order->getId() << endl;
+        setcolor(7);
+    }   
+    void displayOrderDetails(const Order* order) {
+        clearScreen();
+        setcolor(11);
+        cout << "\nOrder Details:" << endl;
+        cout << string(50, '-') << endl;
+        cout << "Order ID: " << order->getId() << endl;
+        cout << "Customer Name: " << order->getCustomerName() << endl;
+        cout << "Phone Number: " << order->getPhoneNumber() << endl;
+        cout << "Delivery Address: " << order->getDeliveryAddress() << endl;
+        cout << "Payment Method: " << order->getPaymentInfo() << endl;
+        setcolor(7);      
+        if (!order->getSpecialInstructions().empty()) {
+            cout << "Special Instructions: " << order->getSpecialInstructions() << endl;
+        }      
+        cout << "\nOrdered Items:" << endl;
+        for (const OrderLine& line : order->getLines()) {
+            const MenuItem* item = menuCatalog[line.menuIndex];
+            cout << "- " << (item ? item->getName() : "?");
+            if (line.quantity > 1) cout << " x" << line.quantity;
+            if (item) cout << " ($" << fixed << setprecision(2) << item->getPrice() << ")";
+            cout << endl;
+        }      
+        cout << "\nTotal Amount: $" << order->getTotal() << endl;
+        cout << "Status: " << order->getStatus() << endl;
+    }    
+    // XXX-XXX-XXXX; checked by hand, a regex per call was the slow part of intake.
+    bool validatePhoneNumber(const string& phone) {
+        if (phone.size() != 12) return false;
+        for (size_t i = 0; i < phone.size(); i++) {
+            bool dash = i == 3 || i == 7;
+            if (dash ? phone[i] != '-' : !isdigit(static_cast<unsigned char>(phone[i]))) return false;
+        }
+        return true;
+    }
+    void trackOrder(const string& orderId) {
+        OrderHandle handle;
+        Order* order = orderHistory.find(orderId, handle) ? orders.get(handle) : nullptr;
+        Order* archived = order ? nullptr : archive.fetch(orderId);   // ours to delete
+        if (archived) order = archived;
+        if (order) {
+            clearScreen();
+            setcolor(11);
+            cout << "\nOrder Tracking Information" << endl; 
+            cout << string(50, '-') << endl;
+            cout << "Order ID: " << order->getId() << endl;
+            cout << "Customer Name: " << order->getCustomerName() << endl;
+            cout << "Status: " << order->getStatus() << endl;
+            cout << "Delivery Address: " << order->getDeliveryAddress() << endl;
+            if (order->getDriver()) {
+                cout << "Driver: " << order->getDriver()->getName() << endl;
+            }
+            int eta = estimateMinutes(order);
+            if (eta >= 0 && order->getStatus() != "Delivered") {
+                cout << "Estimated travel time: " << eta << " min" << endl;
+            }
+            setcolor(7);
+            if (!order->getSpecialInstructions().empty()) {
+                cout << "\nSpecial Instructions: " << order->getSpecialInstructions() << endl;
+            }
+            cout << "\nPress ESC to return to main menu..." << endl;
+            int key = readKey();
+            if (key == 27) {
+                clearScreen();
+                setcolor(2);
+                cout << "Returning to main menu..." << endl;
+                setcolor(7);
+            }
+            delete archived;
+        } else {
+            setcolor(12);
+            cout << "\nOrder not found!" << endl;
+            cout << "Press ESC to return to main menu or SPACE to try again..." << endl;
+            setcolor(7);           
+            int key = readKey();
+            if (key == 27) {
+                clearScreen();
+                setcolor(2);
+                cout << "Returning to main menu..." << endl; 
+                setcolor(7);
+            } else if (key == 32) {
+                clearScreen();
+                string newOrderId;
+                setcolor(15);
+                cout << "Enter order ID to track: ";
+                setcolor(7);
+                cin >> newOrderId;
+                trackOrder(newOrderId);
+            }
+        }
+    }
+    void displayAllOrders() {
+        clearScreen();
+        loadOrderHistory(); // Auto load before displaying
+        if(orderHistory.empty()){
+            setcolor(12);
+            cout << "No orders in history" << endl;
+            cout<<"Press ESC to return to main menu."<<endl;
+            setcolor(7);
+            int key = readKey();
+            if(key == 27){
+                setcolor(2);
+                cout << "Returning to main menu..." << endl;
+                setcolor(7);
+                running = false;
+            } else {
+                setcolor(12);
+                cout << "Invalid input" << endl;
+            }
+        } else {
+            setcolor(11);
+            cout << "Displaying all orders..." << endl;
+            setcolor(7);
+            for (const auto& pair : orderHistory.snapshot()) {
+                const Order* order = orders.get(pair.second);
+                if (!order) continue;
+                cout << "Order ID: " << pair.first << endl;
+                cout << "Customer Name: " << order->getCustomerName() << endl;
+                cout << "Total Amount: $" << fixed << setprecision(2) << order->getTotal() << endl;
+                cout << "Status: " << order->getStatus() << endl;
+                cout << "-------------------------------" << endl;
+            }
+        }
+    }
+    void searchOrderById() {   
+        clearScreen();
+        loadOrderHistory(); // Auto load before searching
+        cout << "Searching for order by ID..." << endl;
+        string orderId;
+        cout << "Enter order ID: ";
+        cin >> orderId;
+        OrderHandle handle;
+        Order* order = orderHistory.find(orderId, handle) ? orders.get(handle) : nullptr;
+        if (order) {
+            displayOrderDetails(order);
+        }
+        else if (Order* archived = archive.fetch(orderId)) {
+            displayOrderDetails(archived);
+            delete archived;
+        }
+        else{
+            setcolor(12);
+            cout << "Order not found, try again." << endl;
+            cout << "\nEscape to return to main menu, Space to try again" << endl;
+            setcolor(7);
+            int key = readKey();
+            if(key == 27){
+                setcolor(2);
+                cout << "Returning to main menu..." << endl;
+                setcolor(7);
+                running = false;
+            }
+            else if(key == 32){
+                searchOrderById();
+            }
+            else{
+                setcolor(12);
+                cout << "Invalid input" << endl;
+            }   
+        }
+    }
+    // In-memory orders matching `query`, then archived ones from the
+    // partitions whose zone maps admit it. Archived orders are new copies,
+    // also listed in `archived` for the caller to delete.
+    vector<Order*> queryHistory(const HistoryQuery& query, vector<Order*>& archived, size_t& partitionsRead) {
+        loadOrderHistory();
+        vector<Order*> found;
+        for (Order* order : getOrders()) {
+            if (query.matches(*order)) found.push_back(order);
+        }
+        partitionsRead = archive.query(query, [&](Order* order) {
+            if (orderHistory.contains(order->getId())) {   // the copy in memory is newer
+                delete order;
+                return;
+            }
+            archived.push_back(order);
+            found.push_back(order);
+        });
+        return found;
+    }
+    // Start of the window the user asks for, in seconds since the epoch.
+    int64_t askHistoryWindow() {
+        cout << "Days of history to include (0 for all): ";
+        int days;
+        if (!(cin >> days) || days < 0) {
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            days = 0;
+        }
+        if (days == 0) return INT64_MIN;
+        return static_cast<int64_t>(time(nullptr)) - static_cast<int64_t>(days) * 86400;
+    }
+    void printOrderList(const vector<Order*>& list, size_t partitionsRead) {
+        for (Order* order : list) {
+            cout << "Order ID: " << order->getId() << endl;
+            cout << "Customer Name: " << order->getCustomerName() << endl;
+            cout << "Total Amount: $" << fixed << setprecision(2) << order->getTotal() << endl;
+            cout << "Status: " << order->getStatus() << endl;
+            cout << "--------------------------" << endl;
+        }
+        setcolor(8);
+        cout << list.size() << " orders; " << partitionsRead << " of " << archive.partitionCount()
+             << " archive partitions read" << endl;
+        setcolor(7);
+    }
+    vector<Order*> getOrders() {
+        vector<Order*> orders;
+        orderHistory.forEach([&](const string&, OrderHandle handle) {
+            if (Order* order = this->orders.get(handle)) orders.push_back(order);
+        });
+        return orders;
+    }
+    void sortOrdersByTotalAmount() {
+        clearScreen();
+        HistoryQuery query;
+        query.from = askHistoryWindow();
+        cout << "Sorting orders by total amount..." << endl;
+        vector<Order*> archived;
+        size_t partitionsRead;
+        vector<Order*> orders = queryHistory(query, archived, partitionsRead);
+        sort(orders.begin(), orders.end(), [](Order* a, Order* b) {
+            return a->getTotal() < b->getTotal();
+        });
+        printOrderList(orders, partitionsRead);
+        for (Order* order : archived) delete order;
+    }
+    void filterOrdersByStatus() {
+        clearScreen();
+        HistoryQuery query;
+        cout << "Status (e.g. Pending, Delivered): ";
+        cin >> ws;
+        getline(cin, query.status);
+        query.from = askHistoryWindow();
+        vector<Order*> archived;
+        size_t partitionsRead;
+        vector<Order*> orders = queryHistory(query, archived, partitionsRead);
+        sort(orders.begin(), orders.end(), [](Order* a, Order* b) {
+            return a->getOrderTime() < b->getOrderTime();
+        });
+        printOrderList(orders, partitionsRead);
+        for (Order* order : archived) delete order;
+    }
+    // Runs an OrderQuery over the orders in memory plus the archive
+    // partitions its status, time and total filters admit, and prints the
+    // plan and the selected columns.
+    void runQuery(const string& text) {
+        OrderQuery query;
+        string error;
+        if (!OrderQuery::parse(text, query, error)) {
+            setcolor(12);
+            cout << "Bad query: " << error << endl;
+            setcolor(7);
+            return;
+        }
+        loadOrderHistory();
+        HistoryColumns history;
+        orderHistory.forEach([&](const string&, OrderHandle handle) {
+            if (const Order* order = orders.get(handle)) history.add(*order);
+        });
+        size_t partitionsRead = archive.query(query.prefilter(), [&](Order* order) {
+            if (!orderHistory.contains(order->getId())) history.add(*order);
+            delete order;
+        });
+
+        auto start = chrono::steady_clock::now();
+        QueryPlan plan(query, history, menuCatalog);
+        vector<uint32_t> rows = plan.filter();
+        size_t matched = rows.size();
+        plan.order(rows);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        setcolor(8);
+        cout << plan.explain();
+        setcolor(11);
+        for (const string& column : query.columns) {
+            if (column == "total") cout << right << setw(10) << "Total" << "  ";
+            else if (column == "items") cout << "  " << left << "Items";
+            else cout << left << setw(column == "customer" || column == "placed" ? 20 : 14)
+                      << string(1, static_cast<char>(toupper(column[0]))) + column.substr(1);
+        }
+        cout << endl;
+        setcolor(7);
+        for (uint32_t row : rows) {
+            for (const string& column : query.columns) {
+                if (column == "id") cout << left << setw(14) << history.id(row);
+                else if (column == "customer") cout << left << setw(20) << history.customers.names[history.customer[row]];
+                else if (column == "city") cout << left << setw(14) << history.cities.names[history.city[row]];
+                else if (column == "status") cout << left << setw(14) << history.statuses.names[history.status[row]];
+                else if (column == "total") cout << right << setw(10) << fixed << setprecision(2) << history.cents[row] / 100.0 << "  ";
+                else if (column == "placed") {
+                    time_t t = static_cast<time_t>(history.placed[row] + HistoryColumns::timeBase);
+                    stringstream when;
+                    when << put_time(localtime(&t), "%Y-%m-%d %H:%M");
+                    cout << left << setw(20) << when.str();
+                } else {
+                    cout << "  ";
+                    for (uint32_t i = history.lineStart[row]; i < history.lineStart[row + 1]; i++) {
+                        const MenuItem* item = menuCatalog[history.lineItems[i]];
+                        cout << (i == history.lineStart[row] ? "" : ", ") << (item ? item->getName() : "?");
+                        if (history.lineQuantities[i] > 1) cout << " x" << history.lineQuantities[i];
+                    }
+                }
+            }
+            cout << endl;
+        }
+        cout << right;
+        setcolor(8);
+        cout << rows.size() << " of " << matched << " matching orders shown; " << history.size() << " scanned in "
+             << fixed << setprecision(2) << ms << " ms; " << partitionsRead << " of " << archive.partitionCount()
+             << " archive partitions read" << endl;
+        setcolor(7);
+    }
+    void queryOrders() {
+        clearScreen();
+        cout << "Query terms: status= city= customer=\"..\" item= total=10..50 days= since=YYYY-MM-DD" << endl;
+        cout << "             until= select=id,customer,city,status,total,placed,items order=[-]column limit=" << endl;
+        cout << "Query: ";
+        string text;
+        cin >> ws;
+        getline(cin, text);
+        runQuery(text);
+    }
+    // Counts the whole history into itemStats the first time it is needed;
+    // from then on orders are counted as they are taken or loaded.
+    void seedItemStats() {
+        if (itemStatsSeeded) return;
+        loadOrderHistory();
+        itemStats.clear();
+        orderHistory.forEach([&](const string&, OrderHandle handle) {
+            if (const Order* order = orders.get(handle)) itemStats.record(*order, menuCatalog);
+        });
+        archive.query(HistoryQuery(), [&](Order* order) {
+            if (!orderHistory.contains(order->getId())) itemStats.record(*order, menuCatalog);
+            delete order;
+        });
+        itemStatsSeeded = true;
+    }
+    string itemLabel(const string& key) const {
+        size_t plus = key.find('+');
+        if (plus != string::npos) return itemLabel(key.substr(0, plus)) + " + " + itemLabel(key.substr(plus + 1));
+        const MenuItem* item = menuCatalog.find(key);
+        return item ? item->getName() + " (" + key + ")" : key;
+    }
+    // Top items and pairs; with `itemId`, what is bought along with it.
+    void showItemStats(const string& itemId) {
+        seedItemStats();
+        uint64_t orderTotal = itemStats.orderCount();
+        setcolor(11);
+        cout << "Most ordered items (" << orderTotal << " orders, true count within the range shown)" << endl;
+        setcolor(7);
+        for (const ItemAnalytics::Estimate& e : itemStats.topItems(10)) {
+            cout << "  " << left << setw(40) << itemLabel(e.key) << right << setw(10) << e.low;
+            if (e.count != e.low) cout << " .. " << e.count;
+            cout << endl;
+        }
+        setcolor(11);
+        cout << "Most ordered together" << endl;
+        setcolor(7);
+        for (const ItemAnalytics::Estimate& e : itemStats.topPairs(10)) {
+            cout << "  " << left << setw(56) << itemLabel(e.key) << right << setw(10) << e.low;
+            if (e.count != e.low) cout << " .. " << e.count;
+            cout << endl;
+        }
+        if (!itemId.empty()) {
+            uint64_t base = itemStats.itemEstimate(itemId);
+            setcolor(11);
+            cout << "Customers who ordered " << itemLabel(itemId) << " (~" << base << " orders) also ordered" << endl;
+            setcolor(7);
+            for (const ItemAnalytics::Estimate& e : itemStats.alsoBought(itemId, menuCatalog, 5)) {
+                cout << "  " << left << setw(40) << itemLabel(e.key) << right << setw(10) << e.count << " orders";
+                if (base) cout << "  (" << fixed << setprecision(0) << 100.0 * e.count / base << "%)";
+                cout << endl;
+            }
+        }
+        setcolor(8);
+        cout << "Sketch bounds: items +" << itemStats.itemErrorBound() << ", pairs +" << itemStats.pairErrorBound()
+             << " with " << fixed << setprecision(1) << itemStats.confidence() * 100 << "% confidence; "
+             << itemStats.memoryBytes() / 1024 << " KB" << endl;
+        setcolor(7);
+    }
+    // Sketches are idempotent, so backfilling can only fill gaps: orders in
+    // memory, and archived orders placed after the last day on disk (all of
+    // them the first time).
+    void seedCustomerCounts() {
+        if (customerCountsSeeded) return;
+        loadOrderHistory();
+        int64_t lastDay = customerCounts.lastDay();
+        orderHistory.forEach([&](const string&, OrderHandle handle) {
+            if (const Order* order = orders.get(handle)) customerCounts.record(*order);
+        });
+        HistoryQuery missing;
+        if (lastDay != INT64_MIN) missing.from = lastDay * 86400;
+        archive.query(missing, [&](Order* order) {
+            customerCounts.record(*order);
+            delete order;
+        });
+        customerCounts.flush();
+        customerCountsSeeded = true;
+    }
+    // Distinct customers and phones over the last `days` days (0 for all),
+    // per city and merged; `city` narrows it to one.
+    void showDistinctCustomers(int days, const string& city) {
+        seedCustomerCounts();
+        int64_t today = CustomerCardinality::dayOf(chrono::system_clock::now());
+        int64_t fromDay = days > 0 ? today - days + 1 : INT64_MIN;
+        vector<string> names = city.empty() ? customerCounts.cities(fromDay, today) : vector<string>{city};
+        setcolor(11);
+        cout << "Distinct customers " << (days > 0 ? "over the last " + to_string(days) + " days" : "in all history")
+             << " (HyperLogLog, ~1% error)" << endl;
+        cout << left << setw(20) << "City" << right << setw(12) << "Customers" << setw(12) << "Phones" << setw(10)
+             << "Buckets" << setw(10) << "KB" << endl;
+        setcolor(7);
+        for (const string& name : names) {
+            CustomerCardinality::Count c = customerCounts.count(fromDay, today, name);
+            cout << left << setw(20) << (name.empty() ? "(no city)" : name) << right << fixed << setprecision(0)
+                 << setw(12) << c.customers << setw(12) << c.phones << setw(10) << c.buckets << setw(10)
+                 << setprecision(1) << c.bytes / 1024.0 << endl;
+        }
+        if (city.empty() && names.size() > 1) {
+            CustomerCardinality::Count all = customerCounts.count(fromDay, today, "");
+            setcolor(14);
+            cout << left << setw(20) << "All cities" << right << fixed << setprecision(0) << setw(12) << all.customers
+                 << setw(12) << all.phones << setw(10) << all.buckets << setw(10) << setprecision(1)
+                 << all.bytes / 1024.0 << endl;
+            setcolor(7);
+        }
+    }
+    void distinctCustomers() {
+        clearScreen();
+        cout << "Days of history to include (0 for all): ";
+        int days;
+        if (!(cin >> days) || days < 0) {
+            cin.clear();
+            days = 0;
+        }
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        cout << "City (Enter for every city): ";
+        string city;
+        getline(cin, city);
+        showDistinctCustomers(days, city);
+    }
+    void indexOrderNames(const Order& order) {
+        string key = order.getCustomerName();
+        transform(key.begin(), key.end(), key.begin(), ::tolower);
+        customerNames.add(key, order.getCustomerName());
+        customerNames.bump(key);
+        vector<string> seen;
+        for (const OrderLine& line : order.getLines()) {
+            const MenuItem* item = menuCatalog[line.menuIndex];
+            if (!item || find(seen.begin(), seen.end(), item->getId()) != seen.end()) continue;
+            seen.push_back(item->getId());
+            menuNames.bump(item->getId());
+        }
+    }
+    // Indexes every customer and counts item popularity over the history
+    // the first time a search needs it; later orders are indexed as taken.
+    void seedNames() {
+        if (namesSeeded) return;
+        loadOrderHistory();
+        orderHistory.forEach([&](const string&, OrderHandle handle) {
+            if (const Order* order = orders.get(handle)) indexOrderNames(*order);
+        });
+        archive.query(HistoryQuery(), [&](Order* order) {
+            if (!orderHistory.contains(order->getId())) indexOrderNames(*order);
+            delete order;
+        });
+        namesSeeded = true;
+    }
+    vector<NameIndex::Match> searchMenu(const string& text, size_t k) {
+        seedNames();
+        return menuNames.search(text, k);
+    }
+    vector<NameIndex::Match> searchCustomers(const string& text, size_t k) {
+        seedNames();
+        return customerNames.search(text, k);
+    }
+    // The item for an id, or for a name picked from the closest matches;
+    // nullptr if nothing was picked.
+    MenuItem* pickMenuItem(const string& text) {
+        if (MenuItem* item = findMenuItem(text)) return item;
+        string upper = text;
+        transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+        if (MenuItem* item = findMenuItem(upper)) return item;
+        vector<NameIndex::Match> matches = searchMenu(text, 5);
+        if (matches.empty()) {
+            setcolor(12);
+            cout << "No item matches \"" << text << "\"." << endl;
+            setcolor(7);
+            return nullptr;
+        }
+        if (matches.size() == 1 || equalsIgnoreCase(matches[0].name, text)) return findMenuItem(matches[0].key);
+        setcolor(11);
+        cout << "Did you mean:" << endl;
+        setcolor(7);
+        for (size_t i = 0; i < matches.size(); i++) {
+            const MenuItem* item = findMenuItem(matches[i].key);
+            cout << "  " << i + 1 << ". " << left << setw(28) << matches[i].name << setw(6) << matches[i].key << right;
+            if (item) cout << " $" << fixed << setprecision(2) << item->getPrice();
+            cout << endl;
+        }
+        cout << "Pick 1-" << matches.size() << " (anything else to skip): ";
+        string choice;
+        getline(cin, choice);
+        if (choice.size() == 1 && choice[0] >= '1' && choice[0] < static_cast<char>('1' + matches.size())) {
+            return findMenuItem(matches[choice[0] - '1'].key);
+        }
+        return nullptr;
+    }
+    void findCustomerOrders() {
+        clearScreen();
+        cout << "Customer name (or part of it): ";
+        string text;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        getline(cin, text);
+        vector<NameIndex::Match> matches = searchCustomers(text, 5);
+        if (matches.empty()) {
+            setcolor(12);
+            cout << "No customer matches \"" << text << "\"." << endl;
+            setcolor(7);
+            return;
+        }
+        for (size_t i = 0; i < matches.size(); i++) {
+            cout << "  " << i + 1 << ". " << left << setw(28) << matches[i].name << right << setw(6)
+                 << matches[i].popularity << " orders" << endl;
+        }
+        cout << "Pick 1-" << matches.size() << ": ";
+        string choice;
+        getline(cin, choice);
+        if (choice.size() != 1 || choice[0] < '1' || choice[0] >= static_cast<char>('1' + matches.size())) return;
+        runQuery("customer=\"" + matches[choice[0] - '1'].name + "\" select=id,status,total,placed order=-placed limit=20");
+    }
+    void itemPopularity() {
+        clearScreen();
+        cout << "Item id for \"also ordered\" (Enter to skip): ";
+        string itemId;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        getline(cin, itemId);
+        showItemStats(itemId);
+    }
+    void viewOrderHistory() {
+        clearScreen();
+        cout << "Order History:" << endl;
+        cout << "1. Display all orders" << endl;
+        cout << "2. Search for an order by ID" << endl;
+        cout << "3. Sort orders by total amount" << endl;
+        cout << "4. Filter orders by status" << endl;
+        cout << "5. Query orders" << endl;
+        cout << "6. Item popularity" << endl;
+        cout << "7. Distinct customers" << endl;
+        cout << "8. Find a customer's orders" << endl;
+        cout << "Enter your choice: ";
+        int choice;
+        cin >> choice;
+        switch (choice) {
+            case 1:
+                displayAllOrders();
+                break;
+            case 2:
+                searchOrderById();
+                break;
+            case 3:
+                sortOrdersByTotalAmount();
+                break;
+            case 4:
+                filterOrdersByStatus();
+                break;
+            case 5:
+                queryOrders();
+                break;
+            case 6:
+                itemPopularity();
+                break;
+            case 7:
+                distinctCustomers();
+                break;
+            case 8:
+                findCustomerOrders();
+                break;
+            default:
+                cout << "Invalid choice. Please try again." << endl;
+        }
+    }   
+    // Cooks up to `limit` queued orders, highest priority first.
+    void cookQueuedOrders(size_t limit = SIZE_MAX) {
+        vector<string> records;   // journaled as one batch
+        for (size_t cooked = 0; cooked < limit && !orderQueue.empty(); cooked++) {
+            OrderHandle handle = orderQueue.pop();
+            Order* order = orders.get(handle);
+            if (!order) continue;   // released while it waited
+            cout << "Processing order: " << order->getId() << endl;
+            cout << "Customer Name: " << order->getCustomerName() << endl;
+            cout << "Total Amount: $" << fixed << setprecision(2) << order->getTotal() << endl;
+            cout << "Status: " << order->getStatus() << endl;
+            cout << "--------------------------" << endl;
+            order->setStatus("Completed");
+            if (journalOrders) records.push_back(order->serialize());
+            cout << "Order completed: " << order->getId() << endl;
+            readyOrders.push_back(handle);
+            cout << "--------------------------" << endl;
+        }
+        journalRecords(records);
+    }
+    
+    // Plans multi-drop routes for the orders waiting for pickup, then assigns
+    // the routes to drivers in one batch, minimizing the total travel to each
+    // route's first drop instead of taking orders one by one. Only the oldest
+    // dispatchWindow orders are planned each round: drivers take a few routes
+    // at a time, and planning a server-sized backlog would hold up intake.
+    void dispatchReadyOrders() {
+        vector<OrderHandle> handles;
+        vector<Order*> ready;
+        size_t window = min(readyOrders.size(), dispatchWindow);
+        for (size_t i = 0; i < window; i++) {
+            if (Order* order = orders.get(readyOrders[i])) {
+                handles.push_back(readyOrders[i]);
+                ready.push_back(order);
+            }
+        }
+        vector<OrderHandle> later(readyOrders.begin() + window, readyOrders.end());
+        readyOrders.clear();
+        if (ready.empty()) {
+            readyOrders.swap(later);
+            return;
+        }
+        vector<RoutePlanner::Stop> stops;
+        vector<int> nodes;
+        for (const Order* order : ready) {
+            const Address* address = order->getAddress();
+            string area = address ? (address->getCity().empty() ? address->getZipCode() : address->getCity()) : "";
+            transform(area.begin(), area.end(), area.begin(), ::tolower);
+            stops.push_back({locateOrder(order), area,
+                             static_cast<long long>(chrono::system_clock::to_time_t(order->getOrderTime()))});
+            if (roads.isBuilt()) nodes.push_back(roadNodeForOrder(order));
+        }
+        int restaurantNode = roads.isBuilt() ? roads.nearestNode(GeoPoint()) : -1;
+        RoutePlanner::TravelTableFunction travel = [&](const vector<int>& from, const vector<int>& to) {
+            vector<vector<int>> table;
+            if (roads.isBuilt()) {
+                vector<int> sources, targets;
+                for (int s : from) sources.push_back(s < 0 ? restaurantNode : nodes[s]);
+                for (int s : to) targets.push_back(s < 0 ? restaurantNode : nodes[s]);
+                table = roads.travelTimeTable(sources, targets);
+                for (vector<int>& row : table) {
+                    for (int& t : row) if (t == RoadNetwork::unreachable) t = -1;
+                }
+                return table;
+            }
+            // Without a road graph assume 25 km/h through town.
+            table.assign(from.size(), vector<int>(to.size()));
+            for (size_t i = 0; i < from.size(); i++) {
+                GeoPoint a = from[i] < 0 ? GeoPoint() : stops[from[i]].point;
+                for (size_t j = 0; j < to.size(); j++) {
+                    GeoPoint b = to[j] < 0 ? GeoPoint() : stops[to[j]].point;
+                    table[i][j] = static_cast<int>(a.distanceTo(b) / 25.0 * 3600.0);
+                }
+            }
+            return table;
+        };
+        RoutePlanner planner(3);
+        RoutePlanner::Plan plan = planner.plan(stops, static_cast<long long>(time(nullptr)), travel);
+
+        vector<GeoPoint> firstDrops;
+        vector<int> seats;
+        for (const RoutePlanner::Route& route : plan.routes) {
+            firstDrops.push_back(stops[route.stops[0]].point);
+            seats.push_back(static_cast<int>(route.stops.size()));
+        }
+        BatchDispatcher::CostFunction roadTime = nullptr;
+        if (roads.isBuilt()) {
+            // Rank the nearby drivers by driving time over the road graph.
+            roadTime = [&](size_t r, const vector<DeliveryDriver*>& candidates) {
+                vector<int> sources;
+                for (const DeliveryDriver* d : candidates) sources.push_back(roads.nearestNode(d->getPosition()));
+                vector<int> seconds = roads.travelTimesTo(sources, nodes[plan.routes[r].stops[0]]);
+                vector<long long> costs;
+                for (int t : seconds) costs.push_back(t == RoadNetwork::unreachable ? -1 : t);
+                return costs;
+            };
+        }
+        BatchDispatcher::Result result = BatchDispatcher::assign(firstDrops, availableDrivers, 16, 30.0,
+                                                                 roadTime, &seats);
+        vector<OrderHandle> stillWaiting;
+        for (size_t r = 0; r < plan.routes.size(); r++) {
+            const RoutePlanner::Route& route = plan.routes[r];
+            DeliveryDriver* driver = result.driverFor[r];
+            if (!driver) {
+                for (int s : route.stops) {
+                    stillWaiting.push_back(handles[s]);
+                    setcolor(12);
+                    cout << "No driver available for " << ready[s]->getId() << ", waiting for pickup" << endl;
+                }
+                continue;
+            }
+            // Drop-offs follow the route leg by leg from the restaurant.
+            vector<int> ends = {-1};
+            ends.insert(ends.end(), route.stops.begin(), route.stops.end());
+            vector<vector<int>> legs = travel(ends, ends);
+            long long seconds = 0;
+            auto departed = chrono::steady_clock::now();
+            for (size_t i = 0; i < route.stops.size(); i++) {
+                int leg = legs[i][i + 1];
+                if (leg < 0) {
+                    GeoPoint from = i == 0 ? GeoPoint() : stops[route.stops[i - 1]].point;
+                    leg = static_cast<int>(from.distanceTo(stops[route.stops[i]].point) / 25.0 * 3600.0);
+                }
+                seconds += leg;
+                Order* order = ready[route.stops[i]];
+                driver->assignOrder(order);
+                order->setDriver(driver);
+                order->setStatus("Out for Delivery");
+                recordOrder(order);
+                auto due = departed + chrono::duration_cast<chrono::steady_clock::duration>(
+                                          chrono::duration<double>(seconds / deliverySpeedup));
+                dropOffs.push({due, handles[route.stops[i]]});
+            }
+            if (!driver->isAvailable()) availableDrivers.remove(driver);
+            setcolor(10);
+            cout << driver->getName() << " (" << fixed << setprecision(1)
+                 << driver->getPosition().distanceTo(firstDrops[r]) << " km away), "
+                 << (route.seconds + 59) / 60 << " min route: ";
+            for (size_t i = 0; i < route.stops.size(); i++) {
+                cout << (i ? " -> " : "") << ready[route.stops[i]]->getId();
+            }
+            cout << endl;
+        }
+        setcolor(7);
+        cout << "Orders per driver-hour: " << fixed << setprecision(1)
+             << RoutePlanner::ordersPerHour(ready.size(), plan.routeSeconds) << " multi-drop vs "
+             << RoutePlanner::ordersPerHour(ready.size(), plan.singleDropSeconds) << " single-drop" << endl;
+        stillWaiting.insert(stillWaiting.end(), later.begin(), later.end());
+        readyOrders.swap(stillWaiting);
+    }
+    // Hands over every order whose drop-off time has passed, freeing its
+    // driver's seat; returns how many.
+    size_t completeDueDeliveries() {
+        auto now = chrono::steady_clock::now();
+        size_t delivered = 0;
+        while (!dropOffs.empty() && dropOffs.top().due <= now) {
+            OrderHandle handle = dropOffs.top().handle;
+            dropOffs.pop();
+            Order* order = orders.get(handle);
+            if (!order || order->getStatus() != "Out for Delivery") continue;
+            completeDelivery(order);
+            delivered++;
+        }
+        return delivered;
+    }
+    void processOrders(size_t cookLimit = SIZE_MAX) {
+        completeDueDeliveries();
+        cookQueuedOrders(cookLimit);
+        dispatchReadyOrders();
+    }
+    // Kitchen and dispatch as a background task: same work in slices of
+    // kitchenSlice orders, no narration, and the colour of whatever screen is
+    // open is left alone.
+    void processOrdersQuietly() {
+        if (orderQueue.empty() && readyOrders.empty() && dropOffs.empty()) return;
+        ConsoleRenderer* screen = ConsoleRenderer::attached();
+        int color = screen ? screen->getAttribute() : 7;
+        streambuf* console = cout.rdbuf(nullptr);
+        processOrders(kitchenSlice);
+        cout.rdbuf(console);
+        cout.clear();
+        if (screen) screen->setAttribute(color);
+    }
+    // Writes out the deliveries waiting for the archive.
+    void flushArchive() {
+        if (archive.stagedCount() == 0) return;
+        archive.flush();
+        customerCounts.flush();
+    }
+    // Plays deliveries `speedup` times faster than the road times, for demos.
+    void setDeliverySpeedup(double speedup) { deliverySpeedup = max(1.0, speedup); }
+    string statusLine() const {
+        size_t delivering = 0;
+        for (const DeliveryDriver* driver : drivers) delivering += driver->getAssignedOrders().size();
+        time_t now = time(nullptr);
+        char clock[16];
+        strftime(clock, sizeof(clock), "%H:%M:%S", localtime(&now));
+        stringstream line;
+        line << " " << clock << "  kitchen " << orderQueue.size() << " queued, " << readyOrders.size()
+             << " ready  |  " << delivering << " out for delivery, " << availableDrivers.size()
+             << " drivers free  |  " << deliveredCount << " delivered, " << archive.stagedCount() << " to archive";
+        return line.str();
+    }
+    // Work the interactive session does while it waits for the user.
+    void scheduleBackgroundWork(EventLoop& loop) {
+        loop.every(chrono::seconds(5), [this]() { processOrdersQuietly(); });
+        loop.every(chrono::seconds(30), [this]() { flushArchive(); });
+        auto showStatus = [this]() {
+            if (ConsoleRenderer* screen = ConsoleRenderer::attached()) screen->setStatus(statusLine());
+        };
+        showStatus();
+        loop.every(chrono::seconds(1), showStatus);
+    }
+    
+    ~Restaurant() {
+        // Orders are deleted by the OrderStore
+        archive.flush();
+        customerCounts.flush();
+        // Clean up drivers
+        for (auto driver : drivers) {
+            delete driver;
+        }
+    }
+};
+
+// Bucketed event list for the kitchen simulator. Events within `slots` ticks of
+// the current time go straight into their bucket (O(1) schedule and pop); events
+// further out wait in an overflow heap until the wheel turns close enough.
+template<typename T>
+class TimingWheel {
+private:
+    struct Entry {
+        long long time;
+        T data;
+        bool operator>(const Entry& other) const { return time > other.time; }
+    };
+    vector<vector<Entry>> buckets;
+    priority_queue<Entry, vector<Entry>, greater<Entry>> overflow;
+    long long slots;
+    long long now;
+    size_t cursor;
+    size_t wheelCount;
+
+    void pullOverflow() {
+        while (!overflow.empty() && overflow.top().time < now + slots) {
+            buckets[overflow.top().time & (slots - 1)].push_back(overflow.top());
+            overflow.pop();
+            wheelCount++;
+        }
+    }
+public:
+    TimingWheel(int slotBits = 12)
+        : buckets(1LL << slotBits), slots(1LL << slotBits), now(0), cursor(0), wheelCount(0) {}
+
+    void schedule(long long time, const T& data) {
+        if (time < now) time = now;
+        if (time - now < slots) {
+            buckets[time & (slots - 1)].push_back({time, data});
+            wheelCount++;
+        } else {
+            overflow.push({time, data});
+        }
+    }
+    bool next(long long& time, T& data) {
+        while (true) {
+            vector<Entry>& bucket = buckets[now & (slots - 1)];
+            if (cursor < bucket.size()) {
+                time = now;
+                data = bucket[cursor++].data;
+                wheelCount--;
+                return true;
+            }
+            bucket.clear();
+            cursor = 0;
+            if (wheelCount == 0) {
+                if (overflow.empty()) return false;
+                now = overflow.top().time;
+            } else {
+                now++;
+            }
+            pullOverflow();
+        }
+    }
+    bool empty() const { return wheelCount == 0 && overflow.empty(); }
+};
+
+// Discrete-event replay of an order stream against N kitchen stations.
+// A station cooks one order at a time; the items of an order are prepared
+// together, so the order takes as long as its slowest item. Waiting orders are
+// picked by the same priority placeOrder uses (total * 10), FIFO on ties.
+class KitchenSimulator {
+private:
+    struct SimOrder {
+        long long arrival;   // seconds since start
+        int serviceTime;     // seconds
+        int priority;
+    };
+    struct Event {
+        int type;            // 0 = arrival, 1 = station done
+        int index;           // order index or station index
+    };
+    struct Waiting {
+        int priority;
+        int order;
+        bool operator<(const Waiting& other) const {
+            if (priority != other.priority) return priority < other.priority;
+            return order > other.order;
+        }
+    };
+    struct DepthWindow {
+        int maxDepth = 0;
+        double area = 0.0;
+    };
+
+    const Restaurant& restaurant;
+    int stationCount;
+    vector<SimOrder> orders;
+
+    // results
+    vector<long long> stationBusy;
+    vector<int> stationJobs;
+    vector<DepthWindow> depthWindows;
+    long long windowLength = 60;
+    vector<long long> latencyHist;   // 1 second buckets
+    long long latencyOverflow = 0;
+    long long latencyMax = 0;
+    double latencySum = 0.0;
+    long long completed = 0;
+    long long makespan = 0;
+    double wallSeconds = 0.0;
+
+    int serviceTimeOf(const Order* order) const {
+        int longest = 0;
+        for (const OrderLine& line : order->getLines()) {
+            longest = max(longest, restaurant.menuCatalog[line.menuIndex]->getPrepTime());
+        }
+        return longest * 60;
+    }
+    void recordDepth(long long from, long long to, int depth) {
+        while (from < to) {
+            size_t w = static_cast<size_t>(from / windowLength);
+            if (w >= depthWindows.size()) depthWindows.resize(w + 1);
+            long long windowEnd = (w + 1) * windowLength;
+            long long segment = min(to, windowEnd) - from;
+            depthWindows[w].area += static_cast<double>(depth) * segment;
+            depthWindows[w].maxDepth = max(depthWindows[w].maxDepth, depth);
+            from += segment;
+        }
+    }
+    long long percentile(double p) const {
+        long long target = static_cast<long long>(p * completed);
+        long long seen = 0;
+        for (size_t i = 0; i < latencyHist.size(); i++) {
+            seen += latencyHist[i];
+            if (seen > target) return static_cast<long long>(i);
+        }
+        return latencyMax;
+    }
+    static string minutes(long long seconds) {
+        stringstream ss;
+        ss << fixed << setprecision(1) << seconds / 60.0 << " min";
+        return ss.str();
+    }
+public:
+    KitchenSimulator(const Restaurant& r, int stations)
+        : restaurant(r), stationCount(max(1, stations)) {}
+
+    // Replays orders.txt in file order, one order every `gapSeconds`. Orders the
+    // file holds more than once (every save appends) are replayed only once.
+    int loadFromFile(const string& filename, int gapSeconds) {
+        ifstream inFile(filename);
+        if (!inFile) return 0;
+        unordered_map<string, bool> seen;
+        string line;
+        long long clock = 0;
+        while (getline(inFile, line)) {
+            if (line.empty()) continue;
+            Order* order = Order::deserialize(line, restaurant.menuCatalog);
+            if (order && order->getItemCount() > 0 && !seen[order->getId()]) {
+                seen[order->getId()] = true;
+                orders.push_back({clock, serviceTimeOf(order),
+                                  static_cast<int>(order->getTotal() * 10)});
+                clock += gapSeconds;
+            }
+            delete order;
+        }
+        return static_cast<int>(orders.size());
+    }
+
+    // Poisson arrivals of random 1-4 item orders drawn from the menu.
+    void generate(long long count, double ordersPerHour, unsigned int seed) {
+        MenuCatalog::View view = restaurant.menuCatalog.current();
+        const vector<MenuItem*>& menu = view->items;
+        if (menu.empty() || ordersPerHour <= 0) return;
+        mt19937 rng(seed);
+        exponential_distribution<double> gap(ordersPerHour / 3600.0);
+        uniform_int_distribution<int> itemCount(1, 4);
+        uniform_int_distribution<size_t> pick(0, menu.size() - 1);
+        orders.reserve(orders.size() + count);
+        double clock = 0.0;
+        for (long long i = 0; i < count; i++) {
+            clock += gap(rng);
+            int n = itemCount(rng);
+            int longest = 0;
+            double total = 0.0;
+            for (int k = 0; k < n; k++) {
+                const MenuItem* item = menu[pick(rng)];
+                longest = max(longest, item->getPrepTime());
+                total += item->getPrice();
+            }
+            orders.push_back({static_cast<long long>(clock), longest * 60,
+                              static_cast<int>(total * 10)});
+        }
+    }
+
+    void run() {
+        stationBusy.assign(stationCount, 0);
+        stationJobs.assign(stationCount, 0);
+        depthWindows.clear();
+        latencyHist.assign(4 * 3600, 0);
+        latencyOverflow = latencyMax = 0;
+        latencySum = 0.0;
+        completed = makespan = 0;
+        if (orders.empty()) return;
+        windowLength = max(60LL, (orders.back().arrival + 23) / 24);
+
+        auto start = chrono::steady_clock::now();
+        TimingWheel<Event> events;
+        priority_queue<Waiting> waiting;
+        vector<int> idle;
+        vector<int> stationOrder(stationCount, -1);
+        for (int s = stationCount - 1; s >= 0; s--) idle.push_back(s);
+
+        auto startOrder = [&](int o, int s, long long now) {
+            stationOrder[s] = o;
+            stationBusy[s] += orders[o].serviceTime;
+            stationJobs[s]++;
+            events.schedule(now + orders[o].serviceTime, {1, s});
+        };
+
+        // Arrivals are scheduled one at a time so the event list stays small.
+        events.schedule(orders[0].arrival, {0, 0});
+        long long now = 0, last = 0;
+        Event ev;
+        while (events.next(now, ev)) {
+            recordDepth(last, now, static_cast<int>(waiting.size()));
+            last = now;
+            if (ev.type == 0) {
+                int o = ev.index;
+                if (o + 1 < static_cast<int>(orders.size()))
+                    events.schedule(orders[o + 1].arrival, {0, o + 1});
+                if (!idle.empty()) {
+                    int s = idle.back();
+                    idle.pop_back();
+                    startOrder(o, s, now);
+                } else {
+                    waiting.push({orders[o].priority, o});
+                }
+            } else {
+                int s = ev.index;
+                long long latency = now - orders[stationOrder[s]].arrival;
+                if (latency < static_cast<long long>(latencyHist.size())) latencyHist[latency]++;
+                else latencyOverflow++;
+                latencyMax = max(latencyMax, latency);
+                latencySum += latency;
+                completed++;
+                if (!waiting.empty()) {
+                    int o = waiting.top().order;
+                    waiting.pop();
+                    startOrder(o, s, now);
+                } else {
+                    stationOrder[s] = -1;
+                    idle.push_back(s);
+                }
+            }
+        }
+        makespan = max(now, 1LL);
+        wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    void printReport() const {
+        setcolor(14);
+        cout << "\nKitchen Simulation Report" << endl;
+        setcolor(7);
+        cout << string(50, '-') << endl;
+        cout << "Stations: " << stationCount << endl;
+        cout << "Orders simulated: " << completed << endl;
+        cout << "Simulated time: " << minutes(makespan) << endl;
+        if (wallSeconds > 0) {
+            cout << "Simulation speed: " << fixed << setprecision(0)
+                 << completed / wallSeconds << " orders/sec" << endl;
+        }
+        if (completed == 0) return;
+
+        setcolor(11);
+        cout << "\nQueue depth (window of " << minutes(windowLength) << "):" << endl;
+        setcolor(7);
+        cout << setw(12) << "From" << setw(12) << "Avg" << setw(12) << "Max" << endl;
+        size_t step = max<size_t>(1, (depthWindows.size() + 47) / 48);
+        for (size_t w = 0; w < depthWindows.size(); w += step) {
+            cout << setw(12) << minutes(w * windowLength)
+                 << setw(12) << fixed << setprecision(2) << depthWindows[w].area / windowLength
+                 << setw(12) << depthWindows[w].maxDepth << endl;
+        }
+
+        setcolor(11);
+        cout << "\nStation utilization:" << endl;
+        setcolor(7);
+        double totalBusy = 0.0;
+        for (int s = 0; s < stationCount; s++) {
+            double util = 100.0 * stationBusy[s] / makespan;
+            totalBusy += stationBusy[s];
+            cout << "Station " << setw(3) << s + 1 << ": " << setw(6) << fixed << setprecision(1)
+                 << util << "%  (" << stationJobs[s] << " orders)" << endl;
+        }
+        cout << "Average: " << fixed << setprecision(1)
+             << 100.0 * totalBusy / (static_cast<double>(makespan) * stationCount) << "%" << endl;
+
+        setcolor(11);
+        cout << "\nOrder-to-completion latency:" << endl;
+        setcolor(7);
+        cout << "Mean: " << minutes(static_cast<long long>(latencySum / completed)) << endl;
+        cout << "p50:  " << minutes(percentile(0.50)) << endl;
+        cout << "p90:  " << minutes(percentile(0.90)) << endl;
+        cout << "p99:  " << minutes(percentile(0.99)) << endl;
+        cout << "Max:  " << minutes(latencyMax) << endl;
+        const int binMinutes = 10;
+        vector<long long> bins(13, 0);
+        for (size_t i = 0; i < latencyHist.size(); i++) {
+            bins[min<size_t>(12, i / (binMinutes * 60))] += latencyHist[i];
+        }
+        bins[12] += latencyOverflow;
+        for (size_t b = 0; b < bins.size(); b++) {
+            if (bins[b] == 0) continue;
+            string label = b < 12 ? to_string(b * binMinutes) + "-" + to_string((b + 1) * binMinutes) + " min"
+                                  : to_string(12 * binMinutes) + "+ min";
+            double share = 100.0 * bins[b] / completed;
+            cout << setw(12) << label << setw(8) << fixed << setprecision(1) << share << "% "
+                 << string(static_cast<size_t>(share / 2), '#') << endl;
+        }
+    }
+};
+
+// Wire format shared by the intake server and its load client. An order is
+// either an Order::serialize line or a binary frame: 0xFD, a little-endian
+// u16 payload length, then id, customer, phone, street, city, zip, card,
+// expiry, cvv and instructions as u8-length strings, a u8 line count and
+// per line a u16 menu index and a u8 quantity.
+struct IntakeFrame {
+    static constexpr unsigned char marker = 0xFD;
+
+    static void putString(string& out, const string& value) {
+        out += static_cast<char>(min<size_t>(value.size(), 255));
+        out.append(value, 0, 255);
+    }
+    static string encode(const Order& order) {
+        string payload;
+        const Address* address = order.getAddress();
+        const Payment* payment = order.getPayment();
+        for (const string& field : {order.getId(), order.getCustomerName(), order.getPhoneNumber(),
+                                    address->getStreet(), address->getCity(), address->getZipCode(),
+                                    payment->getCardNumber(), payment->getExpiryDate(), payment->getCvv(),
+                                    order.getSpecialInstructions()}) {
+            putString(payload, field);
+        }
+        payload += static_cast<char>(order.getLines().size());
+        for (const OrderLine& line : order.getLines()) {
+            payload += static_cast<char>(line.menuIndex & 0xFF);
+            payload += static_cast<char>(line.menuIndex >> 8);
+            payload += static_cast<char>(min<int>(line.quantity, 255));
+        }
+        string frame(1, static_cast<char>(marker));
+        frame += static_cast<char>(payload.size() & 0xFF);
+        frame += static_cast<char>(payload.size() >> 8);
+        return frame + payload;
+    }
+    // nullptr for a malformed payload or an unknown menu index.
+    static Order* decode(const char* data, size_t length, const MenuCatalog& menu) {
+        const char* end = data + length;
+        string fields[10];
+        for (string& field : fields) {
+            if (data >= end || static_cast<size_t>(end - data) < 1u + static_cast<unsigned char>(*data)) return nullptr;
+            size_t size = static_cast<unsigned char>(*data++);
+            field.assign(data, size);
+            data += size;
+        }
+        if (data >= end) return nullptr;
+        size_t lines = static_cast<unsigned char>(*data++);
+        if (static_cast<size_t>(end - data) != lines * 3) return nullptr;
+        Order* order = new Order(fields[0], fields[1], new Address(fields[3], fields[4], fields[5]),
+                                 new Payment(fields[6], Payment::detectCardType(fields[6]), fields[7], fields[8]),
+                                 fields[2]);
+        order->setSpecialInstructions(fields[9]);
+        for (size_t i = 0; i < lines; i++, data += 3) {
+            uint16_t index = static_cast<uint16_t>(static_cast<unsigned char>(data[0]) |
+                                                   static_cast<unsigned char>(data[1]) << 8);
+            int quantity = static_cast<unsigned char>(data[2]);
+            if (index >= menu.size() || quantity == 0 || quantity > Order::maxQuantity) {
+                delete order;
+                return nullptr;
+            }
+            order->addItem(menu[index], quantity);
+        }
+        return order;
+    }
+};
+
+// "1234" is a TCP port on loopback, anything else a UNIX socket path.
+// False for a port outside 1-65535 or a path too long for the socket.
+bool intakeAddress(const string& address, sockaddr_storage& storage, socklen_t& length, int& family) {
+    memset(&storage, 0, sizeof(storage));
+    if (!address.empty() && all_of(address.begin(), address.end(), ::isdigit)) {
+        if (address.size() > 5) return false;
+        int port = stoi(address);
+        if (port < 1 || port > 65535) return false;
+        sockaddr_in* inet = reinterpret_cast<sockaddr_in*>(&storage);
+        inet->sin_family = AF_INET;
+        inet->sin_port = htons(static_cast<uint16_t>(port));
+        inet->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        length = sizeof(sockaddr_in);
+        family = AF_INET;
+        return true;
+    }
+    sockaddr_un* local = reinterpret_cast<sockaddr_un*>(&storage);
+    if (address.empty() || address.size() >= sizeof(local->sun_path)) return false;
+    local->sun_family = AF_UNIX;
+    memcpy(local->sun_path, address.c_str(), address.size() + 1);
+    length = sizeof(sockaddr_un);
+    family = AF_UNIX;
+    return true;
+}
+
+// A fixed set of threads taking turns at resuming coroutines. A coroutine
+// parked on a channel holds no thread; whoever makes it runnable posts it.
+class CoroutinePool {
+private:
+    mutex lock;
+    condition_variable wake;
+    deque<coroutine_handle<>> ready;
+    vector<thread> threads;
+    bool stopping = false;
+
+    void work() {
+        while (true) {
+            coroutine_handle<> next;
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [this]() { return stopping || !ready.empty(); });
+                if (ready.empty()) return;
+                next = ready.front();
+                ready.pop_front();
+            }
+            next.resume();
+        }
+    }
+public:
+    explicit CoroutinePool(int count) {
+        for (int i = 0; i < max(1, count); i++) threads.emplace_back([this]() { work(); });
+    }
+    ~CoroutinePool() { stop(); }
+    CoroutinePool(const CoroutinePool&) = delete;
+    CoroutinePool& operator=(const CoroutinePool&) = delete;
+
+    void post(coroutine_handle<> handle) {
+        {
+            lock_guard<mutex> guard(lock);
+            ready.push_back(handle);
+        }
+        wake.notify_one();
+    }
+    // Runs whatever is ready, then joins the threads.
+    void stop() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& t : threads) t.join();
+        threads.clear();
+    }
+};
+
+// A coroutine nobody waits for: it starts when its handle is first posted to
+// a pool and frees its frame when it returns.
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {coroutine_handle<promise_type>::from_promise(*this)}; }
+        suspend_always initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+    coroutine_handle<promise_type> handle;
+};
+
+// Queue with a fixed capacity. Coroutines co_await push and pop and are
+// parked, holding no thread, while it is full or empty; that is how a slow
+// stage holds back the ones before it. Plain threads put, and block.
+template<typename T>
+class BoundedChannel {
+private:
+    struct Pusher {
+        coroutine_handle<> handle;
+        CoroutinePool* pool;
+        T item;
+        bool* result;
+        chrono::steady_clock::time_point since;
+    };
+    struct Popper {
+        coroutine_handle<> handle;
+        CoroutinePool* pool;
+        vector<T>* out;
+        size_t most;
+        bool* result;
+    };
+    typedef vector<pair<CoroutinePool*, coroutine_handle<>>> Wakeups;
+    mutex lock;
+    condition_variable notFull;
+    deque<T> items;
+    deque<Pusher> pushers;          // parked while full
+    deque<Popper> poppers;          // parked while empty
+    size_t capacity;
+    bool closed = false;
+    size_t highWater = 0;
+    atomic<uint64_t> blockedMicros{0};
+
+    // Caller holds `lock`.
+    void append(T item) {
+        items.push_back(move(item));
+        highWater = max(highWater, items.size());
+    }
+    void take(vector<T>& out, size_t most) {
+        while (!items.empty() && out.size() < most) {
+            out.push_back(move(items.front()));
+            items.pop_front();
+        }
+    }
+    // Caller holds `lock`. Lets parked pushers in and hands items to parked
+    // poppers while either can go on; the coroutines to resume go in `wake`.
+    void settle(Wakeups& wake) {
+        while (true) {
+            if (!pushers.empty() && items.size() < capacity) {
+                Pusher& pusher = pushers.front();
+                append(move(pusher.item));
+                blockedMicros += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - pusher.since).count();
+                *pusher.result = true;
+                wake.emplace_back(pusher.pool, pusher.handle);
+                pushers.pop_front();
+            } else if (!poppers.empty() && !items.empty()) {
+                Popper& popper = poppers.front();
+                take(*popper.out, popper.most);
+                *popper.result = true;
+                wake.emplace_back(popper.pool, popper.handle);
+                poppers.pop_front();
+            } else {
+                break;
+            }
+        }
+        if (items.size() < capacity) notFull.notify_all();
+    }
+    static void resume(const Wakeups& wake) {
+        for (const auto& entry : wake) entry.first->post(entry.second);
+    }
+public:
+    explicit BoundedChannel(size_t capacity) : capacity(max<size_t>(capacity, 1)) {}
+
+    // co_await push(item, pool): parks while full; false once closed.
+    struct PushAwaiter {
+        BoundedChannel& channel;
+        CoroutinePool& pool;
+        T item;
+        bool result = false;
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(coroutine_handle<> handle) {
+            Wakeups wake;
+            {
+                lock_guard<mutex> guard(channel.lock);
+                if (channel.closed) return false;
+                if (channel.items.size() >= channel.capacity || !channel.pushers.empty()) {
+                    channel.pushers.push_back({handle, &pool, move(item), &result, chrono::steady_clock::now()});
+                    return true;
+                }
+                channel.append(move(item));
+                result = true;
+                channel.settle(wake);
+            }
+            resume(wake);
+            return false;
+        }
+        bool await_resume() const noexcept { return result; }
+    };
+    // co_await pop(out, most, pool): parks until there is an item, then
+    // takes up to `most`; false once closed and empty.
+    struct PopAwaiter {
+        BoundedChannel& channel;
+        CoroutinePool& pool;
+        vector<T>& out;
+        size_t most;
+        bool result = false;
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(coroutine_handle<> handle) {
+            Wakeups wake;
+            {
+                lock_guard<mutex> guard(channel.lock);
+                if (channel.items.empty()) {
+                    if (channel.closed) return false;
+                    channel.poppers.push_back({handle, &pool, &out, most, &result});
+                    return true;
+                }
+                channel.take(out, most);
+                result = true;
+                channel.settle(wake);
+            }
+            resume(wake);
+            return false;
+        }
+        bool await_resume() const noexcept { return result; }
+    };
+    PushAwaiter push(T item, CoroutinePool& pool) { return PushAwaiter{*this, pool, move(item)}; }
+    PopAwaiter pop(vector<T>& out, size_t most, CoroutinePool& pool) { return PopAwaiter{*this, pool, out, max<size_t>(most, 1)}; }
+
+    // From a plain thread: blocks while full; false once closed.
+    bool put(T item) {
+        Wakeups wake;
+        {
+            unique_lock<mutex> guard(lock);
+            if ((items.size() >= capacity || !pushers.empty()) && !closed) {
+                auto start = chrono::steady_clock::now();
+                notFull.wait(guard, [this]() { return (items.size() < capacity && pushers.empty()) || closed; });
+                blockedMicros += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+            }
+            if (closed) return false;
+            append(move(item));
+            settle(wake);
+        }
+        resume(wake);
+        return true;
+    }
+    // Parked poppers get false; nothing more goes in.
+    void close() {
+        Wakeups wake;
+        {
+            lock_guard<mutex> guard(lock);
+            closed = true;
+            for (Popper& popper : poppers) wake.emplace_back(popper.pool, popper.handle);
+            for (Pusher& pusher : pushers) wake.emplace_back(pusher.pool, pusher.handle);
+            poppers.clear();
+            pushers.clear();
+            notFull.notify_all();
+        }
+        resume(wake);
+    }
+    size_t depth() {
+        lock_guard<mutex> guard(lock);
+        return items.size();
+    }
+    size_t maxDepth() {
+        lock_guard<mutex> guard(lock);
+        return highWater;
+    }
+    size_t limit() const { return capacity; }
+    uint64_t pushWaitMicros() const { return blockedMicros.load(); }
+};
+
+// Order intake as stages joined by bounded channels:
+//   parse -> validate -> price -> enqueue -> persist -> notify
+// Each stage runs as its own number of coroutines on a shared pool of
+// threads and takes jobs in batches. Only the single enqueue coroutine admits
+// orders, so nothing else may while a pipeline runs. When persistence falls
+// behind its channel fills, the stages before it are parked in turn and in
+// the end submit() blocks the caller.
+class OrderPipeline {
+public:
+    using Notify = function<void(uint64_t tag, const string& reply)>;
+    struct Config {
+        int parsers = 2;
+        int validators = 2;
+        int pricers = 1;
+        size_t capacity = 1024;                      // per channel
+        int threads = 0;                             // pool size; 0 for one per core, up to one per worker
+        chrono::microseconds persistDelay{0};        // added per journal write, to play a slow disk
+    };
+    struct StageStats {
+        string name;
+        int workers;
+        size_t depth;
+        size_t maxDepth;
+        size_t capacity;
+        uint64_t items;
+        double busyMillis;
+        double p50Micros;                            // waiting in the channel plus the work
+        double p99Micros;
+        double blockedMillis;                        // waiting to get into this stage's channel
+    };
+private:
+    struct Job {
+        uint64_t tag;
+        string record;                  // text line or binary frame payload
+        bool binary;
+        string id;
+        Order* order = nullptr;
+        string problem;                 // why it was turned down, if it was
+        string journal;                 // serialized once priced
+        chrono::steady_clock::time_point entered;   // into the current stage's channel
+    };
+    // Quarter-octave buckets of microseconds.
+    struct Latencies {
+        atomic<uint64_t> buckets[128] = {};
+        void add(double micros) {
+            int bucket = micros < 1 ? 0 : min(127, static_cast<int>(log2(micros) * 4) + 1);
+            buckets[bucket]++;
+        }
+        double percentile(double q) const {
+            uint64_t total = 0, seen = 0;
+            for (const auto& bucket : buckets) total += bucket.load();
+            for (int i = 0; i < 128 && total; i++) {
+                seen += buckets[i].load();
+                if (seen >= q * total) return exp2(i / 4.0);
+            }
+            return 0;
+        }
+    };
+    struct Stage {
+        string name;
+        int workers = 1;
+        size_t batch = 64;
+        function<void(vector<Job*>&)> work;
+        unique_ptr<BoundedChannel<Job*>> input;
+        atomic<int> running{0};
+        atomic<uint64_t> items{0};
+        atomic<uint64_t> busyMicros{0};
+        Latencies latency;
+    };
+
+    Restaurant& restaurant;
+    Notify notify;
+    Config config;
+    vector<unique_ptr<Stage>> stages;
+    unique_ptr<CoroutinePool> pool;
+    mutex doneLock;
+    condition_variable done;
+    int active = 0;                 // stage coroutines still running
+    mutex admitting;                // held by the enqueue coroutine per batch
+
+    // One worker of a stage: runs the work on batches from its channel and
+    // hands the jobs on, parked whenever its channel is empty or the next
+    // one is full.
+    DetachedTask runStage(size_t index) {
+        Stage& stage = *stages[index];
+        BoundedChannel<Job*>* next = index + 1 < stages.size() ? stages[index + 1]->input.get() : nullptr;
+        vector<Job*> jobs;
+        while (co_await stage.input->pop(jobs, stage.batch, *pool)) {
+            auto start = chrono::steady_clock::now();
+            stage.work(jobs);
+            auto end = chrono::steady_clock::now();
+            stage.busyMicros += chrono::duration_cast<chrono::microseconds>(end - start).count();
+            stage.items += jobs.size();
+            for (Job* job : jobs) {
+                stage.latency.add(chrono::duration<double, micro>(end - job->entered).count());
+                if (next) {
+                    job->entered = chrono::steady_clock::now();
+                    co_await next->push(job, *pool);
+                } else {
+                    delete job;
+                }
+            }
+            jobs.clear();
+        }
+        if (--stage.running == 0 && next) next->close();
+        {
+            lock_guard<mutex> guard(doneLock);
+            active--;
+        }
+        done.notify_all();
+    }
+    void addStage(const string& name, int workers, size_t batch, function<void(vector<Job*>&)> work) {
+        unique_ptr<Stage> stage(new Stage());
+        stage->name = name;
+        stage->workers = max(1, workers);
+        stage->input.reset(new BoundedChannel<Job*>(config.capacity));
+        stage->batch = batch;
+        stage->work = move(work);
+        stage->running = stage->workers;
+        stages.push_back(move(stage));
+    }
+    const MenuCatalog& menu() const { return restaurant.menuCatalog; }
+
+public:
+    OrderPipeline(Restaurant& restaurant, Notify notify, const Config& config)
+        : restaurant(restaurant), notify(move(notify)), config(config) {
+        addStage("parse", config.parsers, 64, [this](vector<Job*>& jobs) {
+            for (Job* job : jobs) {
+                job->order = job->binary ? IntakeFrame::decode(job->record.data(), job->record.size(), menu())
+                                         : Order::deserialize(job->record, menu());
+                if (job->order) job->id = job->order->getId();
+                else job->problem = "malformed";
+            }
+        });
+        addStage("validate", config.validators, 64, [this](vector<Job*>& jobs) {
+            for (Job* job : jobs) {
+                if (job->problem.empty()) job->problem = this->restaurant.checkIncomingOrder(*job->order);
+            }
+        });
+        addStage("price", config.pricers, 64, [this](vector<Job*>& jobs) {
+            auto now = chrono::system_clock::now();
+            for (Job* job : jobs) {
+                if (!job->problem.empty()) continue;
+                job->order->setStatus("Pending");
+                job->order->setOrderTime(now);
+                this->restaurant.priceOrder(*job->order);
+                job->journal = job->order->serialize();
+            }
+        });
+        addStage("enqueue", 1, 256, [this](vector<Job*>& jobs) {
+            lock_guard<mutex> guard(this->admitting);
+            for (Job* job : jobs) {
+                // The validate check can't see another copy still in flight.
+                if (job->problem.empty() && this->restaurant.orderHistory.contains(job->id)) job->problem = "duplicate id";
+                if (job->problem.empty()) this->restaurant.admitOrder(job->order);
+                else delete job->order;
+                job->order = nullptr;
+            }
+        });
+        addStage("persist", 1, 1024, [this](vector<Job*>& jobs) {
+            vector<string> records;
+            for (Job* job : jobs) {
+                if (job->problem.empty()) records.push_back(move(job->journal));
+            }
+            this->restaurant.journalRecords(records);
+            if (this->config.persistDelay.count() > 0) this_thread::sleep_for(this->config.persistDelay);
+        });
+        addStage("notify", 1, 256, [this](vector<Job*>& jobs) {
+            for (Job* job : jobs) {
+                string id = job->id.empty() ? "-" : job->id;
+                this->notify(job->tag, job->problem.empty() ? "OK " + id + "\n" : "ERR " + id + " " + job->problem + "\n");
+            }
+        });
+        // Workers start once every stage exists, so each can see the next.
+        int workers = 0;
+        for (const unique_ptr<Stage>& stage : stages) workers += stage->workers;
+        int threads = config.threads > 0 ? config.threads
+                                         : min(workers, static_cast<int>(max(2u, thread::hardware_concurrency())));
+        pool.reset(new CoroutinePool(threads));
+        active = workers;
+        for (size_t index = 0; index < stages.size(); index++) {
+            for (int i = 0; i < stages[index]->workers; i++) pool->post(runStage(index).handle);
+        }
+    }
+    ~OrderPipeline() { finish(); }
+    OrderPipeline(const OrderPipeline&) = delete;
+    OrderPipeline& operator=(const OrderPipeline&) = delete;
+
+    // Blocks while the parse channel is full.
+    void submit(uint64_t tag, string record, bool binary) {
+        Job* job = new Job();
+        job->tag = tag;
+        job->record = move(record);
+        job->binary = binary;
+        job->entered = chrono::steady_clock::now();
+        if (!stages[0]->input->put(job)) delete job;
+    }
+    // Runs `task` on the calling thread between admitted batches, for
+    // restaurant work that must not overlap admission.
+    void exclusive(const function<void()>& task) {
+        lock_guard<mutex> guard(admitting);
+        task();
+    }
+    // Lets everything submitted so far through, then stops the workers.
+    void finish() {
+        if (!pool) return;
+        stages[0]->input->close();
+        {
+            unique_lock<mutex> guard(doneLock);
+            done.wait(guard, [this]() { return active == 0; });
+        }
+        pool->stop();
+        pool.reset();
+    }
+    vector<StageStats> statistics() const {
+        vector<StageStats> result;
+        for (const unique_ptr<Stage>& stage : stages) {
+            result.push_back({stage->name, stage->workers, stage->input->depth(), stage->input->maxDepth(),
+                              stage->input->limit(), stage->items.load(), stage->busyMicros.load() / 1000.0,
+                              stage->latency.percentile(0.5), stage->latency.percentile(0.99),
+                              stage->input->pushWaitMicros() / 1000.0});
+        }
+        return result;
+    }
+    static void printStatistics(const vector<StageStats>& stats) {
+        cout << left << setw(10) << "Stage" << right << setw(8) << "Workers" << setw(10) << "Items" << setw(12)
+             << "Busy ms" << setw(11) << "Max depth" << setw(11) << "p50 us" << setw(11) << "p99 us" << setw(13)
+             << "Blocked ms" << endl;
+        for (const StageStats& stage : stats) {
+            cout << left << setw(10) << stage.name << right << setw(8) << stage.workers << setw(10) << stage.items
+                 << setw(12) << fixed << setprecision(1) << stage.busyMillis << setw(6) << stage.maxDepth << "/"
+                 << left << setw(4) << stage.capacity << right << setw(11) << setprecision(0) << stage.p50Micros
+                 << setw(11) << stage.p99Micros << setw(13) << setprecision(1) << stage.blockedMillis << endl;
+        }
+    }
+};
+
+#if defined(__linux__)
+// Takes orders from other programs over a local socket. One thread owns the
+// restaurant: an edge-triggered epoll loop drains every readable socket,
+// parses all the complete orders in the buffers, checks them, admits the
+// accepted ones as one batch and only then writes the replies. Each order
+// is answered with "OK <id>" or "ERR <id> <reason>" on a line of its own;
+// rejections can overtake acceptances that arrived in the same read.
+// With usePipeline the loop only frames records and hands them to an
+// OrderPipeline; the replies come back through an eventfd.
+class IntakeServer {
+public:
+    struct Stats {
+        uint64_t accepted = 0;
+        uint64_t rejected = 0;
+        uint64_t batches = 0;
+        uint64_t reads = 0;
+        uint64_t connections = 0;
+    };
+private:
+    static constexpr size_t maxLine = 4096;
+    struct Connection {
+        uint64_t serial = 0;        // fds are reused, serials are not
+        string in;                  // bytes not yet parsed start at inStart
+        size_t inStart = 0;
+        string out;                 // replies not yet written
+        size_t inFlight = 0;        // in the pipeline, reply still to come
+        bool peerClosed = false;
+    };
+    Restaurant& restaurant;
+    size_t maxBatch;
+    int listener = -1;
+    int events = -1;
+    string socketPath;              // removed again on shutdown
+    unordered_map<int, Connection> connections;
+    vector<pair<int, Order*>> batch;
+    unordered_set<string> batchIds;
+    vector<int> dirty;              // connections with replies to write
+    Stats stats;
+    uint64_t nextSerial = 1;
+    unordered_map<uint64_t, int> bySerial;
+    unique_ptr<OrderPipeline> pipeline;
+    int wakeFd = -1;                // the pipeline has replies
+    function<void()> chore;         // restaurant work between reads
+    chrono::steady_clock::duration chorePeriod{};
+    chrono::steady_clock::time_point choreDue;
+    mutex outboxLock;
+    vector<pair<uint64_t, string>> outbox;
+
+    static void setNonBlocking(int fd) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+    void reply(int fd, Connection& connection, const string& text) {
+        if (connection.out.empty()) dirty.push_back(fd);
+        connection.out += text;
+    }
+    void take(int fd, Connection& connection, Order* order) {
+        if (!order) {
+            reply(fd, connection, "ERR - malformed\n");
+            stats.rejected++;
+            return;
+        }
+        string problem = restaurant.checkIncomingOrder(*order);
+        if (problem.empty() && !batchIds.insert(order->getId()).second) problem = "duplicate id";
+        if (!problem.empty()) {
+            reply(fd, connection, "ERR " + order->getId() + " " + problem + "\n");
+            stats.rejected++;
+            delete order;
+            return;
+        }
+        order->setStatus("Pending");
+        order->setOrderTime(chrono::system_clock::now());
+        restaurant.priceOrder(*order);
+        batch.emplace_back(fd, order);
+        if (batch.size() >= maxBatch) admit();
+    }
+    // Every complete order in the connection's buffer.
+    void parse(int fd, Connection& connection) {
+        const string& in = connection.in;
+        size_t at = connection.inStart;
+        while (at < in.size()) {
+            if (static_cast<unsigned char>(in[at]) == IntakeFrame::marker) {
+                if (in.size() - at < 3) break;
+                size_t length = static_cast<unsigned char>(in[at + 1]) | static_cast<unsigned char>(in[at + 2]) << 8;
+                if (in.size() - at < 3 + length) break;
+                if (pipeline) {
+                    pipeline->submit(connection.serial, in.substr(at + 3, length), true);
+                    connection.inFlight++;
+                } else {
+                    take(fd, connection, IntakeFrame::decode(in.data() + at + 3, length, restaurant.menuCatalog));
+                }
+                at += 3 + length;
+                continue;
+            }
+            size_t end = in.find('\n', at);
+            if (end == string::npos) {
+                if (in.size() - at > maxLine) {
+                    reply(fd, connection, "ERR - line too long\n");
+                    connection.peerClosed = true;
+                    at = in.size();
+                }
+                break;
+            }
+            size_t length = end - at;
+            if (length && in[end - 1] == '\r') length--;
+            if (length && pipeline) {
+                pipeline->submit(connection.serial, in.substr(at, length), false);
+                connection.inFlight++;
+            } else if (length) {
+                take(fd, connection, Order::deserialize(in.substr(at, length), restaurant.menuCatalog));
+            }
+            at = end + 1;
+        }
+        connection.inStart = at;
+        if (connection.inStart == connection.in.size()) {
+            connection.in.clear();
+            connection.inStart = 0;
+        } else if (connection.inStart > connection.in.size() / 2) {
+            connection.in.erase(0, connection.inStart);
+            connection.inStart = 0;
+        }
+    }
+    void readAll(int fd, Connection& connection) {
+        char buffer[65536];
+        while (true) {
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                stats.reads++;
+                connection.in.append(buffer, static_cast<size_t>(n));
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) connection.peerClosed = true;
+            if (n < 0 && errno == EINTR) continue;
+            break;
+        }
+        parse(fd, connection);
+    }
+    void admit() {
+        if (batch.empty()) return;
+        vector<Order*> orders;
+        orders.reserve(batch.size());
+        for (const pair<int, Order*>& entry : batch) orders.push_back(entry.second);
+        restaurant.intakeOrders(orders);
+        for (const pair<int, Order*>& entry : batch) {
+            auto it = connections.find(entry.first);
+            if (it != connections.end()) reply(entry.first, it->second, "OK " + entry.second->getId() + "\n");
+        }
+        stats.accepted += batch.size();
+        stats.batches++;
+        batch.clear();
+        batchIds.clear();
+    }
+    void flush(int fd) {
+        auto it = connections.find(fd);
+        if (it == connections.end()) return;
+        Connection& connection = it->second;
+        size_t written = 0;
+        while (written < connection.out.size()) {
+            ssize_t n = send(fd, connection.out.data() + written, connection.out.size() - written, MSG_NOSIGNAL);
+            if (n > 0) {
+                written += static_cast<size_t>(n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    connection.peerClosed = true;      // nobody to tell any more
+                    written = connection.out.size();
+                }
+                break;   // otherwise EPOLLOUT says when there is room again
+            }
+        }
+        connection.out.erase(0, written);
+    }
+    void closeConnection(int fd) {
+        epoll_ctl(events, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        bySerial.erase(connections[fd].serial);
+        connections.erase(fd);
+    }
+    void deliverReplies() {
+        uint64_t count;
+        ssize_t drained = read(wakeFd, &count, sizeof(count));
+        (void)drained;
+        vector<pair<uint64_t, string>> replies;
+        {
+            lock_guard<mutex> guard(outboxLock);
+            replies.swap(outbox);
+        }
+        for (const pair<uint64_t, string>& entry : replies) {
+            (entry.second.compare(0, 3, "OK ") == 0 ? stats.accepted : stats.rejected)++;
+            auto serial = bySerial.find(entry.first);
+            if (serial == bySerial.end()) continue;     // gone already
+            Connection& connection = connections[serial->second];
+            connection.inFlight--;
+            reply(serial->second, connection, entry.second);
+        }
+    }
+    void acceptAll() {
+        while (true) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            setNonBlocking(fd);
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // fails harmlessly on UNIX sockets
+            epoll_event event = {};
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.fd = fd;
+            epoll_ctl(events, EPOLL_CTL_ADD, fd, &event);
+            connections[fd].serial = nextSerial;
+            bySerial[nextSerial++] = fd;
+            stats.connections++;
+        }
+    }
+
+public:
+    explicit IntakeServer(Restaurant& restaurant, size_t maxBatch = 4096)
+        : restaurant(restaurant), maxBatch(maxBatch) {}
+    ~IntakeServer() {
+        pipeline.reset();
+        if (wakeFd >= 0) close(wakeFd);
+        admit();
+        for (auto& entry : connections) close(entry.first);
+        if (listener >= 0) close(listener);
+        if (events >= 0) close(events);
+        if (!socketPath.empty()) unlink(socketPath.c_str());
+    }
+    IntakeServer(const IntakeServer&) = delete;
+    IntakeServer& operator=(const IntakeServer&) = delete;
+
+    bool listen(const string& address, string& error) {
+        sockaddr_storage storage;
+        socklen_t length;
+        int family;
+        if (!intakeAddress(address, storage, length, family)) {
+            error = "bad address " + address;
+            return false;
+        }
+        listener = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (family == AF_UNIX) {
+            unlink(address.c_str());     // left by a server that didn't shut down
+        } else {
+            setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&storage), length) != 0 ||
+            ::listen(listener, 128) != 0) {
+            error = "cannot listen on " + address + ": " + strerror(errno);
+            return false;
+        }
+        if (family == AF_UNIX) socketPath = address;
+        events = epoll_create1(EPOLL_CLOEXEC);
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLET;
+        event.data.fd = listener;
+        epoll_ctl(events, EPOLL_CTL_ADD, listener, &event);
+        return true;
+    }
+    // Hands orders to a pipeline instead of admitting them on this thread.
+    // Call after listen.
+    void usePipeline(const OrderPipeline::Config& config) {
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = wakeFd;
+        epoll_ctl(events, EPOLL_CTL_ADD, wakeFd, &event);
+        pipeline.reset(new OrderPipeline(restaurant, [this](uint64_t tag, const string& text) {
+            bool first;
+            {
+                lock_guard<mutex> guard(outboxLock);
+                first = outbox.empty();
+                outbox.emplace_back(tag, text);
+            }
+            uint64_t one = 1;
+            if (first) {
+                ssize_t written = write(wakeFd, &one, sizeof(one));
+                (void)written;
+            }
+        }, config));
+    }
+    const OrderPipeline* orderPipeline() const { return pipeline.get(); }
+    // Runs `task` on the loop every `period` (kitchen, drivers, archive),
+    // kept clear of admission when a pipeline is admitting.
+    void every(chrono::milliseconds period, function<void()> task) {
+        chore = move(task);
+        chorePeriod = period;
+        choreDue = chrono::steady_clock::now() + period;
+    }
+    // Serves until `stop` is set, looking at it at least every 100 ms.
+    void run(const atomic<bool>& stop) {
+        epoll_event ready[256];
+        while (!stop.load()) {
+            int n = epoll_wait(events, ready, 256, 100);
+            if (n < 0 && errno != EINTR) break;
+            for (int i = 0; i < n; i++) {
+                int fd = ready[i].data.fd;
+                if (fd == listener) {
+                    acceptAll();
+                    continue;
+                }
+                if (fd == wakeFd) {
+                    deliverReplies();
+                    continue;
+                }
+                auto it = connections.find(fd);
+                if (it == connections.end()) continue;
+                if (ready[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) readAll(fd, it->second);
+                if ((ready[i].events & EPOLLOUT) && !it->second.out.empty()) dirty.push_back(fd);
+            }
+            admit();
+            if (chore && chrono::steady_clock::now() >= choreDue) {
+                if (pipeline) pipeline->exclusive(chore);
+                else chore();
+                choreDue = chrono::steady_clock::now() + chorePeriod;
+            }
+            vector<int> writing;
+            writing.swap(dirty);
+            sort(writing.begin(), writing.end());
+            writing.erase(unique(writing.begin(), writing.end()), writing.end());
+            for (int fd : writing) flush(fd);
+            for (int fd : writing) {
+                auto it = connections.find(fd);
+                if (it != connections.end() && it->second.peerClosed && it->second.out.empty() && !it->second.inFlight) {
+                    closeConnection(fd);
+                }
+            }
+            for (int i = 0; i < n; i++) {
+                auto it = connections.find(ready[i].data.fd);
+                if (it != connections.end() && it->second.peerClosed && it->second.out.empty() && !it->second.inFlight) {
+                    closeConnection(ready[i].data.fd);
+                }
+            }
+        }
+        admit();
+        if (pipeline) {
+            pipeline->finish();
+            deliverReplies();
+            for (auto& entry : connections) flush(entry.first);
+        }
+    }
+    const Stats& statistics() const { return stats; }
+};
+#endif
+
+// Load generator for the intake server: `connections` threads each keep up
+// to `window` orders in flight and time every order from its write to its
+// reply.
+struct IntakeLoad {
+    uint64_t sent = 0;
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+    double seconds = 0;
+    vector<double> latencies;       // microseconds, sorted
+    string error;
+};
+IntakeLoad runIntakeLoad(const string& address, const MenuCatalog& menu, int orderCount, int connectionCount,
+                         int window, bool binary) {
+    IntakeLoad load;
+    connectionCount = max(1, connectionCount);
+    const char* names[] = {"Ali Khan", "Sara Malik", "Usman Butt", "Ayesha Raza", "Bilal Shah", "Hina Iqbal"};
+    const char* cities[] = {"Islamabad", "Rawalpindi", "Lahore"};
+    string run = to_string(chrono::steady_clock::now().time_since_epoch().count() % 1000000007);
+    // Orders are encoded up front so the timed part is only socket traffic.
+    vector<vector<string>> payloads(connectionCount);
+    mt19937 rng(11);
+    for (int i = 0; i < orderCount; i++) {
+        int c = i % connectionCount;
+        string id = "L" + run + "-" + to_string(c) + "-" + to_string(payloads[c].size());
+        Order order(id, names[rng() % 6], new Address(to_string(1 + rng() % 200) + " Main Road", cities[rng() % 3], "44000"),
+                    new Payment("4111111111111111", "Visa", "12/29", "123"), "300-555-0101");
+        MenuCatalog::View view = menu.current();
+        int items = 1 + static_cast<int>(rng() % 4);
+        for (int k = 0; k < items; k++) order.addItem(view->items[rng() % view->items.size()]);
+        payloads[c].push_back(binary ? IntakeFrame::encode(order) : order.serialize() + "\n");
+    }
+    sockaddr_storage storage;
+    socklen_t length;
+    int family;
+    if (!intakeAddress(address, storage, length, family)) {
+        load.error = "bad address " + address;
+        return load;
+    }
+    vector<vector<double>> latencies(connectionCount);
+    vector<uint64_t> accepted(connectionCount), rejected(connectionCount);
+    vector<string> errors(connectionCount);
+    auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int c = 0; c < connectionCount; c++) {
+        threads.emplace_back([&, c]() {
+            int fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&storage), length) != 0) {
+                errors[c] = string("cannot connect: ") + strerror(errno);
+                if (fd >= 0) close(fd);
+                return;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            const vector<string>& mine = payloads[c];
+            vector<chrono::steady_clock::time_point> sentAt(mine.size());
+            size_t sent = 0, answered = 0;
+            string chunk, replies;
+            char buffer[65536];
+            while (answered < mine.size()) {
+                if (sent < mine.size() && sent - answered < static_cast<size_t>(window)) {
+                    chunk.clear();
+                    size_t first = sent;
+                    while (sent < mine.size() && sent - answered < static_cast<size_t>(window) && chunk.size() < 60000) {
+                        chunk += mine[sent++];
+                    }
+                    auto now = chrono::steady_clock::now();
+                    for (size_t i = first; i < sent; i++) sentAt[i] = now;
+                    for (size_t written = 0; written < chunk.size();) {
+                        ssize_t n = send(fd, chunk.data() + written, chunk.size() - written, MSG_NOSIGNAL);
+                        if (n <= 0) {
+                            errors[c] = "connection lost";
+                            close(fd);
+                            return;
+                        }
+                        written += static_cast<size_t>(n);
+                    }
+                }
+                ssize_t n = read(fd, buffer, sizeof(buffer));
+                if (n <= 0) {
+                    errors[c] = "connection closed after " + to_string(answered) + " replies";
+                    break;
+                }
+                auto now = chrono::steady_clock::now();
+                replies.append(buffer, static_cast<size_t>(n));
+                size_t at = 0, end;
+                while ((end = replies.find('\n', at)) != string::npos) {
+                    // "OK L<run>-<connection>-<n>" or "ERR <id> <reason>"
+                    bool ok = replies.compare(at, 3, "OK ") == 0;
+                    size_t idEnd = replies.find(' ', at + (ok ? 3 : 4));
+                    if (idEnd == string::npos || idEnd > end) idEnd = end;
+                    size_t dash = replies.rfind('-', idEnd);
+                    size_t index = dash != string::npos && dash > at + 4 ? strtoull(replies.c_str() + dash + 1, nullptr, 10)
+                                                                    : mine.size();
+                    if (index < mine.size()) {
+                        latencies[c].push_back(chrono::duration<double, micro>(now - sentAt[index]).count());
+                    }
+                    (ok ? accepted[c] : rejected[c])++;
+                    answered++;
+                    at = end + 1;
+                }
+                replies.erase(0, at);
+            }
+            close(fd);
+        });
+    }
+    for (thread& t : threads) t.join();
+    load.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    load.sent = orderCount;
+    for (int c = 0; c < connectionCount; c++) {
+        load.accepted += accepted[c];
+        load.rejected += rejected[c];
+        load.latencies.insert(load.latencies.end(), latencies[c].begin(), latencies[c].end());
+        if (load.error.empty()) load.error = errors[c];
+    }
+    sort(load.latencies.begin(), load.latencies.end());
+    return load;
+}
+
+void printIntakeLoad(const IntakeLoad& load) {
+    if (!load.error.empty()) cout << "Client error: " << load.error << endl;
+    cout << load.accepted << " accepted, " << load.rejected << " rejected of " << load.sent << " in " << fixed
+         << setprecision(2) << load.seconds << " s: " << setprecision(0)
+         << (load.accepted + load.rejected) / max(load.seconds, 1e-9) << " orders/s" << endl;
+    if (load.latencies.empty()) return;
+    auto at = [&](double q) { return load.latencies[min(load.latencies.size() - 1, static_cast<size_t>(q * load.latencies.size()))]; };
+    cout << "Admission latency (us): p50 " << setprecision(0) << at(0.5) << ", p90 " << at(0.9) << ", p99 " << at(0.99)
+         << ", max " << load.latencies.back() << endl;
+}
+
+// Nearest-available-driver lookups through the grid against a linear scan
+// over every driver, plus the cost of moving drivers around the grid.
+void benchmarkDriverLookup(int driverCount, int queries) {
+    mt19937 rng(7);
+    uniform_real_distribution<double> coord(-25.0, 25.0);
+    vector<DeliveryDriver*> drivers;
+    DriverGrid grid;
+    for (int i = 0; i < driverCount; i++) {
+        drivers.push_back(new DeliveryDriver("DRV" + to_string(i), "Driver", {coord(rng), coord(rng)}));
+        grid.insert(drivers.back());
+    }
+    vector<GeoPoint> points(queries);
+    for (GeoPoint& p : points) p = {coord(rng), coord(rng)};
+
+    auto start = chrono::steady_clock::now();
+    vector<double> gridBest(queries);
+    for (int q = 0; q < queries; q++) {
+        gridBest[q] = grid.nearest(points[q], 1)[0]->getPosition().distanceTo(points[q]);
+    }
+    double gridTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    int mismatches = 0;
+    for (int q = 0; q < queries; q++) {
+        double best = numeric_limits<double>::infinity();
+        for (const DeliveryDriver* d : drivers) {
+            if (d->isAvailable()) best = min(best, d->getPosition().distanceTo(points[q]));
+        }
+        if (best != gridBest[q]) mismatches++;
+    }
+    double scanTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++) {
+        grid.update(drivers[q % driverCount], points[q]);
+    }
+    double moveTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "Drivers: " << driverCount << ", queries: " << queries << endl;
+    cout << "Grid nearest:    " << fixed << setprecision(2) << gridTime * 1e6 / queries << " us/query" << endl;
+    cout << "Linear scan:     " << scanTime * 1e6 / queries << " us/query" << endl;
+    cout << "Position update: " << moveTime * 1e6 / queries << " us/update" << endl;
+    cout << "Results differing from scan: " << mismatches << endl;
+    for (DeliveryDriver* d : drivers) delete d;
+}
+
+// Batched auction assignment against one-at-a-time greedy dispatch on
+// random orders and drivers, one seat per driver.
+void benchmarkDispatch(int size) {
+    mt19937 rng(11);
+    double side = sqrt(static_cast<double>(size)) * 1.5;   // keeps driver density constant
+    uniform_real_distribution<double> coord(0.0, side);
+    vector<DeliveryDriver*> drivers;
+    DriverGrid grid, greedyGrid;
+    for (int i = 0; i < size; i++) {
+        drivers.push_back(new DeliveryDriver("DRV" + to_string(i), "Driver", {coord(rng), coord(rng)}, 1));
+        grid.insert(drivers.back());
+    }
+    vector<GeoPoint> dropoffs(size);
+    for (GeoPoint& p : dropoffs) p = {coord(rng), coord(rng)};
+
+    auto start = chrono::steady_clock::now();
+    BatchDispatcher::Result batch = BatchDispatcher::assign(dropoffs, grid);
+    double batchTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    for (DeliveryDriver* d : drivers) {
+        grid.remove(d);
+        greedyGrid.insert(d);
+    }
+    start = chrono::steady_clock::now();
+    BatchDispatcher::Result greedy = BatchDispatcher::assignGreedy(dropoffs, greedyGrid);
+    double greedyTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << size << " orders x " << size << " drivers" << endl;
+    auto report = [](const string& label, const BatchDispatcher::Result& r, double seconds) {
+        cout << "  " << label << setw(6) << r.assigned << " assigned, " << fixed << setprecision(1)
+             << setw(10) << r.totalKm << " km total, " << setprecision(2)
+             << setw(6) << (r.assigned ? r.totalKm / r.assigned : 0.0) << " km/order, "
+             << setprecision(3) << seconds * 1000 << " ms" << endl;
+    };
+    report("Auction: ", batch, batchTime);
+    report("Greedy:  ", greedy, greedyTime);
+    if (greedy.assigned > 0 && batch.assigned > 0) {
+        double greedyPer = greedy.totalKm / greedy.assigned, batchPer = batch.totalKm / batch.assigned;
+        cout << "  Distance per order saved: " << setprecision(1)
+             << 100.0 * (greedyPer - batchPer) / greedyPer << "%" << endl;
+    }
+    for (DeliveryDriver* d : drivers) delete d;
+}
+
+// Contraction hierarchy against plain Dijkstra on a synthetic side x side
+// street grid with random travel times.
+void benchmarkRoutes(int side, int queries) {
+    mt19937 rng(5);
+    uniform_int_distribution<int> seconds(30, 120);
+    RoadNetwork roads;
+    for (int y = 0; y < side; y++) {
+        for (int x = 0; x < side; x++) roads.addNode(y * side + x, {x * 0.2, y * 0.2});
+    }
+    for (int y = 0; y < side; y++) {
+        for (int x = 0; x < side; x++) {
+            if (x + 1 < side) roads.addRoad(y * side + x, y * side + x + 1, seconds(rng));
+            if (y + 1 < side) roads.addRoad(y * side + x, (y + 1) * side + x, seconds(rng));
+        }
+    }
+    auto start = chrono::steady_clock::now();
+    roads.buildHierarchy();
+    double buildTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int n = side * side;
+    uniform_int_distribution<int> node(0, n - 1);
+    vector<pair<int, int>> pairs(queries);
+    for (auto& q : pairs) q = {node(rng), node(rng)};
+
+    vector<int> fast(queries);
+    start = chrono::steady_clock::now();
+    for (int q = 0; q < queries; q++) fast[q] = roads.travelTime(pairs[q].first, pairs[q].second);
+    double chTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int checked = min(queries, 200), mismatches = 0;
+    start = chrono::steady_clock::now();
+    for (int q = 0; q < checked; q++) {
+        if (roads.dijkstra(pairs[q].first, pairs[q].second) != fast[q]) mismatches++;
+    }
+    double dijkstraTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<int> targets(100), sources(100);
+    for (int& t : targets) t = node(rng);
+    for (int& v : sources) v = node(rng);
+    start = chrono::steady_clock::now();
+    roads.travelTimes(pairs[0].first, targets);
+    double manyTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    vector<vector<int>> table = roads.travelTimeTable(sources, targets);
+    double tableTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    int tableMismatches = 0;
+    for (size_t i = 0; i < sources.size(); i++) {
+        for (size_t j = 0; j < targets.size(); j++) {
+            if (roads.travelTime(sources[i], targets[j]) != table[i][j]) tableMismatches++;
+        }
+    }
+    double pairwiseTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "Road grid: " << n << " nodes, " << roads.arcCount() << " hierarchy arcs" << endl;
+    cout << "Preprocessing:     " << fixed << setprecision(2) << buildTime << " s" << endl;
+    cout << "CH query:          " << chTime * 1e6 / queries << " us" << endl;
+    cout << "Dijkstra query:    " << dijkstraTime * 1e6 / checked << " us" << endl;
+    cout << "One-to-100 ETAs:   " << manyTime * 1e6 << " us" << endl;
+    cout << "100x100 table:     " << tableTime * 1e3 << " ms with buckets, " << pairwiseTime * 1e3
+         << " ms as 10000 queries (" << tableMismatches << " differ)" << endl;
+    cout << "Mismatches in " << checked << " checked queries: " << mismatches << endl;
+}
+
+// Multi-drop routes against one round trip per order, on random orders
+// clustered around a few delivery areas, travelling at 25 km/h.
+void benchmarkRouting(int orderCount, int budgetMs) {
+    mt19937 rng(3);
+    const GeoPoint areas[] = {{4, 3}, {-6, 2}, {1, -8}, {9, -4}, {-3, -5}};
+    const char* names[] = {"north", "west", "south", "east", "centre"};
+    normal_distribution<double> spread(0.0, 1.2);
+    uniform_int_distribution<int> area(0, 4), age(0, 40 * 60);
+    long long now = 1000000;
+    vector<RoutePlanner::Stop> stops;
+    for (int i = 0; i < orderCount; i++) {
+        int a = area(rng);
+        stops.push_back({{areas[a].x + spread(rng), areas[a].y + spread(rng)}, names[a], now - age(rng)});
+    }
+    RoutePlanner::TravelFunction travel = [&](int from, int to) {
+        GeoPoint p = from < 0 ? GeoPoint() : stops[from].point;
+        GeoPoint q = to < 0 ? GeoPoint() : stops[to].point;
+        return static_cast<int>(p.distanceTo(q) / 25.0 * 3600.0);
+    };
+    RoutePlanner planner(3, 15, 60, budgetMs);
+    auto start = chrono::steady_clock::now();
+    RoutePlanner::Plan plan = planner.plan(stops, now, travel);
+    double planTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << orderCount << " orders -> " << plan.routes.size() << " routes in " << fixed << setprecision(1)
+         << planTime * 1000 << " ms (budget " << budgetMs << " ms" << (plan.outOfTime ? ", used up" : "") << ")" << endl;
+    cout << "Driver hours: " << setprecision(1) << plan.routeSeconds / 3600.0 << " multi-drop vs "
+         << plan.singleDropSeconds / 3600.0 << " single-drop" << endl;
+    cout << "Orders per driver-hour: " << RoutePlanner::ordersPerHour(orderCount, plan.routeSeconds)
+         << " multi-drop vs " << RoutePlanner::ordersPerHour(orderCount, plan.singleDropSeconds)
+         << " single-drop" << endl;
+}
+
+// Order item storage: one MenuItem pointer per unit in a std::vector (the old
+// layout) against merged (index, quantity) lines kept inline, for memory and
+// for a scan counting how often each menu item was ordered.
+void benchmarkOrderItems(const Restaurant& restaurant, int orderCount) {
+    mt19937 rng(9);
+    MenuCatalog::View view = restaurant.menuCatalog.current();
+    const vector<MenuItem*>& menu = view->items;
+    uniform_int_distribution<int> units(1, 5);
+    uniform_int_distribution<size_t> pick(0, menu.size() - 1);
+    vector<vector<MenuItem*>> pointerOrders(orderCount);
+    vector<SmallVector<OrderLine, 4>> lineOrders(orderCount);
+    size_t pointerBytes = 0, lineBytes = 0;
+    for (int o = 0; o < orderCount; o++) {
+        int n = units(rng);
+        for (int u = 0; u < n; u++) {
+            // Repeat the previous item now and then, like "3 x Nihari".
+            MenuItem* item = u > 0 && rng() % 3 == 0 ? pointerOrders[o].back() : menu[pick(rng)];
+            pointerOrders[o].push_back(item);
+            bool merged = false;
+            for (OrderLine& line : lineOrders[o]) {
+                if (line.menuIndex == item->getIndex()) {
+                    line.quantity++;
+                    merged = true;
+                }
+            }
+            if (!merged) lineOrders[o].push_back({static_cast<uint16_t>(item->getIndex()), 1});
         }
+        pointerBytes += sizeof(vector<MenuItem*>) + pointerOrders[o].capacity() * sizeof(MenuItem*);
+        lineBytes += sizeof(SmallVector<OrderLine, 4>);
+        if (lineOrders[o].onHeap()) lineBytes += lineOrders[o].size() * 2 * sizeof(OrderLine);
     }
 
-    void mergeSort(vector<Order*>& orders, int left, int right) {
-        if (left < right) {
-            int mid = left + (right - left) / 2;
-            mergeSort(orders, left, mid);
-            mergeSort(orders, mid + 1, right);
-            merge(orders, left, mid, right);
+    vector<long long> counts(restaurant.menuCatalog.size(), 0);
+    auto start = chrono::steady_clock::now();
+    for (const auto& items : pointerOrders) {
+        for (const MenuItem* item : items) counts[item->getIndex()]++;
+    }
+    double pointerTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    long long pointerCheck = counts[0];
+    fill(counts.begin(), counts.end(), 0);
+    start = chrono::steady_clock::now();
+    for (const auto& lines : lineOrders) {
+        for (const OrderLine& line : lines) counts[line.menuIndex] += line.quantity;
+    }
+    double lineTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << orderCount << " orders" << endl;
+    cout << "Item storage per order: " << fixed << setprecision(1)
+         << static_cast<double>(pointerBytes) / orderCount << " bytes (pointers) vs "
+         << static_cast<double>(lineBytes) / orderCount << " bytes (inline lines)" << endl;
+    cout << "Popularity scan: " << setprecision(2) << pointerTime * 1000 << " ms (pointers) vs "
+         << lineTime * 1000 << " ms (inline lines)" << (pointerCheck == counts[0] ? "" : "  MISMATCH") << endl;
+}
+
+// Item id lookups through the perfect-hash catalogue against the
+// map<string, MenuItem*> it replaced. One lookup in eight is a miss.
+void benchmarkMenuLookup(const Restaurant& restaurant, int lookupCount) {
+    MenuCatalog::View view = restaurant.menuCatalog.current();
+    const vector<MenuItem*>& menu = view->items;
+    map<string, MenuItem*> menuMap;
+    for (MenuItem* item : menu) menuMap[item->getId()] = item;
+    mt19937 rng(5);
+    uniform_int_distribution<size_t> pick(0, menu.size() - 1);
+    vector<string> ids(lookupCount);
+    for (int i = 0; i < lookupCount; i++) {
+        ids[i] = rng() % 8 == 0 ? "X" + to_string(rng() % 100) : menu[pick(rng)]->getId();
+    }
+
+    long long mapSum = 0, hashSum = 0, guardedSum = 0;
+    auto start = chrono::steady_clock::now();
+    for (const string& id : ids) {
+        auto it = menuMap.find(id);
+        if (it != menuMap.end()) mapSum += it->second->getIndex();
+    }
+    double mapTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for (const string& id : ids) {
+        if (MenuItem* item = view->find(id)) hashSum += item->getIndex();
+    }
+    double hashTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for (const string& id : ids) {
+        if (MenuItem* item = restaurant.findMenuItem(id)) guardedSum += item->getIndex();
+    }
+    double guardedTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << lookupCount << " lookups over " << menu.size() << " items (seed "
+         << menuHash.seed << ")" << endl;
+    cout << "std::map:                 " << fixed << setprecision(1) << mapTime * 1e9 / lookupCount << " ns/lookup" << endl;
+    cout << "perfect hash:             " << hashTime * 1e9 / lookupCount << " ns/lookup"
+         << (mapSum == hashSum ? "" : "  MISMATCH") << endl;
+    cout << "perfect hash + snapshot:  " << guardedTime * 1e9 / lookupCount << " ns/lookup"
+         << (mapSum == guardedSum ? "" : "  MISMATCH") << endl;
+}
+
+// Reader threads price random items while the main thread hot-reloads the
+// menu, alternating between the current prices and the same menu one dollar
+// dearer. A reader seeing both price sets in one snapshot counts as torn.
+void benchmarkMenuReload(Restaurant& restaurant, int readers, int reloads) {
+    vector<MenuItem*> original = restaurant.menuCatalog.current()->items;
+    const string files[2] = {"menu_reload_a.tmp", "menu_reload_b.tmp"};
+    for (int f = 0; f < 2; f++) {
+        ofstream out(files[f]);
+        for (const MenuItem* item : original) {
+            out << item->getId() << "," << item->getName() << "," << fixed << setprecision(2)
+                << item->getPrice() + f << "," << item->getCategory() << "," << item->getPrepTime() << "\n";
         }
     }
-    void merge(vector<Order*>& orders, int left, int mid, int right) {
-        vector<Order*> temp(right - left + 1);
-        int i = left, j = mid + 1, k = 0;
-        while (i <= mid && j <= right) {
-            if (orders[i]->getTotal() <= orders[j]->getTotal())
-                temp[k++] = orders[i++];
-            else
-                temp[k++] = orders[j++];
-        }      
-        while (i <= mid) temp[k++] = orders[i++];
-        while (j <= right) temp[k++] = orders[j++];      
-        for (i = 0; i < k; i++)
-            orders[left + i] = temp[i];
+
+    atomic<bool> done(false);
+    atomic<long long> reads(0), torn(0);
+    vector<thread> pool;
+    for (int r = 0; r < readers; r++) {
+        pool.emplace_back([&, r]() {
+            mt19937 rng(r + 1);
+            uniform_int_distribution<size_t> pick(0, original.size() - 1);
+            long long local = 0, localTorn = 0;
+            while (!done.load()) {
+                MenuCatalog::View menu = restaurant.menuCatalog.current();
+                size_t i = pick(rng), j = pick(rng);
+                const MenuItem* a = menu->find(original[i]->getId());
+                const MenuItem* b = menu->find(original[j]->getId());
+                if (!a || !b) continue;
+                double raiseA = a->getPrice() - original[i]->getPrice();
+                double raiseB = b->getPrice() - original[j]->getPrice();
+                if (fabs(raiseA - raiseB) > 0.001) localTorn++;
+                local++;
+            }
+            reads += local;
+            torn += localTorn;
+        });
     }
-    Order* binarySearch(const vector<Order*>& orders, const string& id) {
-        int left = 0, right = orders.size() - 1;       
-        while (left <= right) {
-            int mid = left + (right - left) / 2;
-            if (orders[mid]->getId() == id)
-                return orders[mid];
-            if (orders[mid]->getId() < id)
-                left = mid + 1;
-            else
-                right = mid - 1;
+
+    string error;
+    int applied = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < reloads; i++) {
+        if (restaurant.menuCatalog.reload(files[(i + 1) % 2], error) < 0) {
+            cerr << "Reload stopped: " << error << endl;
+            break;
         }
-        return nullptr;
-    }  
-    Order* linearSearch(const vector<Order*>& orders, const string& id) {
-        for (Order* order : orders) {
-            if (order->getId() == id)
-                return order;
+        applied++;
+    }
+    this_thread::sleep_for(chrono::milliseconds(50));
+    done = true;
+    for (thread& t : pool) t.join();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    for (const string& f : files) remove(f.c_str());
+
+    cout << readers << " reader threads, " << applied << " reloads in "
+         << fixed << setprecision(1) << elapsed * 1000 << " ms" << endl;
+    cout << "Snapshot reads: " << reads.load() << " (" << setprecision(2)
+         << reads.load() / elapsed / 1e6 << " M/s), torn: " << torn.load() << endl;
+    cout << "Item versions kept for existing orders: " << restaurant.menuCatalog.size() << endl;
+}
+
+// Mixed tracking/intake load on the order history: each thread does 19
+// lookups of existing orders per new order inserted. Compares the sharded
+// map with one unordered_map behind a single reader-writer lock, at 1, 2,
+// 4 ... maxThreads threads.
+void benchmarkOrderHistory(int maxThreads, int opsPerThread) {
+    const int preload = 200000;
+    vector<string> ids(preload);
+    for (int i = 0; i < preload; i++) ids[i] = "ORD" + to_string(i);
+
+    cout << "Order history, " << preload << " orders preloaded, "
+         << opsPerThread << " ops per thread (95% lookups)" << endl;
+    cout << setw(8) << "Threads" << setw(18) << "single lock M/s" << setw(14) << "sharded M/s" << endl;
+    for (int threads = 1; threads <= maxThreads; threads *= 2) {
+        ShardedMap<string, Order*> sharded;
+        unordered_map<string, Order*> single;
+        shared_mutex singleLock;
+        for (const string& id : ids) {
+            sharded.insert(id, nullptr);
+            single[id] = nullptr;
         }
-        return nullptr;
+
+        auto run = [&](bool useSharded) {
+            atomic<long long> found(0);
+            vector<thread> pool;
+            auto start = chrono::steady_clock::now();
+            for (int t = 0; t < threads; t++) {
+                pool.emplace_back([&, t]() {
+                    mt19937 rng(t + 1);
+                    uniform_int_distribution<int> pick(0, preload - 1);
+                    long long hits = 0;
+                    for (int op = 0; op < opsPerThread; op++) {
+                        if (op % 20 == 19) {
+                            string id = (useSharded ? "S" : "U") + to_string(t) + "-" + to_string(op);
+                            if (useSharded) {
+                                sharded.insert(id, nullptr);
+                            } else {
+                                unique_lock<shared_mutex> lock(singleLock);
+                                single.emplace(id, nullptr);
+                            }
+                        } else if (useSharded) {
+                            hits += sharded.contains(ids[pick(rng)]);
+                        } else {
+                            shared_lock<shared_mutex> lock(singleLock);
+                            hits += single.count(ids[pick(rng)]);
+                        }
+                    }
+                    found += hits;
+                });
+            }
+            for (thread& th : pool) th.join();
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            return static_cast<double>(threads) * opsPerThread / seconds / 1e6;
+        };
+        double singleRate = run(false);
+        double shardedRate = run(true);
+        cout << setw(8) << threads << fixed << setprecision(2) << setw(18) << singleRate
+             << setw(14) << shardedRate << endl;
     }
+    cout << "(hardware threads: " << thread::hardware_concurrency() << ")" << endl;
+}
 
-    void saveOrdersToFile(const string& filename) {
-        ofstream outFile(filename, ios::app); 
-        if (!outFile) {
-            cerr << "Error opening file for writing: " << filename << endl;
-            return;
+// Flat order-id table against std::unordered_map: insert throughput from
+// empty, hit and miss lookups in random order, and memory. unordered_map
+// memory is estimated as one 16-byte-rounded node (next pointer, key,
+// value, cached hash) plus one bucket pointer per bucket.
+void benchmarkOrderTable(const vector<size_t>& sizes) {
+    cout << setw(11) << "Entries" << setw(10) << "Table" << setw(12) << "insert ns"
+         << setw(10) << "hit ns" << setw(10) << "miss ns" << setw(14) << "bytes/entry" << endl;
+    for (size_t n : sizes) {
+        vector<string> keys(n), hits, misses;
+        for (size_t i = 0; i < n; i++) keys[i] = "ORD" + to_string(i);
+        // Probe keys are laid out in probe order so only the table is random access.
+        size_t probes = min<size_t>(n, 5000000);
+        mt19937 rng(17);
+        uniform_int_distribution<size_t> pick(0, n - 1);
+        hits.reserve(probes);
+        for (size_t i = 0; i < probes; i++) hits.push_back(keys[pick(rng)]);
+        misses.reserve(probes);
+        for (size_t i = 0; i < probes; i++) misses.push_back("MISS" + to_string(i));
+
+        auto report = [&](const char* name, double insertS, double hitS, double missS,
+                          size_t bytes, size_t found) {
+            cout << setw(11) << n << setw(10) << name << fixed << setprecision(1)
+                 << setw(12) << insertS * 1e9 / n << setw(10) << hitS * 1e9 / probes
+                 << setw(10) << missS * 1e9 / probes << setw(14) << static_cast<double>(bytes) / n
+                 << (found == probes ? "" : "  MISMATCH") << endl;
+        };
+        {
+            unordered_map<string, Order*> table;
+            auto start = chrono::steady_clock::now();
+            for (const string& key : keys) table.emplace(key, nullptr);
+            double insertS = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            size_t found = 0;
+            start = chrono::steady_clock::now();
+            for (const string& key : hits) found += table.find(key) != table.end();
+            double hitS = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            start = chrono::steady_clock::now();
+            for (const string& key : misses) found += table.find(key) != table.end();
+            double missS = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            size_t node = (sizeof(void*) + sizeof(pair<const string, Order*>) + sizeof(size_t) + 15) / 16 * 16;
+            report("std", insertS, hitS, missS, n * node + table.bucket_count() * sizeof(void*), found);
         }
-        try {
-            for (const auto& pair : orderHistory) {
-                outFile << pair.second->serialize() << "\n";
+        {
+            OrderIdTable<Order*> table;
+            auto start = chrono::steady_clock::now();
+            for (const string& key : keys) table.emplace(key, nullptr);
+            double insertS = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            size_t found = 0;
+            start = chrono::steady_clock::now();
+            for (const string& key : hits) found += table.find(key) != table.end();
+            double hitS = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            start = chrono::steady_clock::now();
+            for (const string& key : misses) found += table.find(key) != table.end();
+            double missS = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            report("flat", insertS, hitS, missS, table.memoryBytes(), found);
+        }
+    }
+}
+
+// Resident set size of this process in bytes, 0 where it can't be read.
+size_t residentMemoryBytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return counters.WorkingSetSize;
+    return 0;
+#else
+    ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    if (!(statm >> pages >> resident)) return 0;
+    return resident * 4096;
+#endif
+}
+
+// Replays `hours` of trading in fast-forward: orders to zip codes the
+// drivers cover arrive every minute, the kitchen and dispatch run every 5
+// minutes, drivers finish everything they carry, and every 30 minutes a
+// history screen reloads a 2000-order history file. Prints what is held in
+// memory for each simulated hour.
+void replayMemory(Restaurant& restaurant, int hours, int ordersPerHour) {
+    const string historyFile = "replay_history.tmp";
+    const char* zips[] = {"44000", "44010", "44020", "45710", "46000", "46300", "48800", "52250", "52000"};
+    mt19937 rng(3);
+    MenuCatalog::View menu = restaurant.menuCatalog.current();
+    uniform_int_distribution<size_t> pickItem(0, menu->items.size() - 1);
+    uniform_int_distribution<int> pickZip(0, 8);
+    long long serial = 0;
+    auto makeOrder = [&]() {
+        string zip = zips[pickZip(rng)];
+        string id = "RPL" + to_string(++serial);
+        Order* order = new Order(id, "Replay Customer",
+                                 new Address("Street " + to_string(serial % 97), "", zip),
+                                 new Payment("4111111111111111", "Visa", "12/30", "123"), "051-555-0101");
+        int items = 1 + static_cast<int>(rng() % 3);
+        for (int i = 0; i < items; i++) order->addItem(menu->items[pickItem(rng)]);
+        return order;
+    };
+    {
+        ofstream out(historyFile);
+        for (int i = 0; i < 2000; i++) {
+            Order* order = makeOrder();
+            out << order->serialize() << "\n";
+            delete order;
+        }
+    }
+
+    streambuf* console = cout.rdbuf(nullptr);   // the kitchen and dispatch narrate every order
+    bool journal = restaurant.journalOrders;
+    restaurant.journalOrders = false;
+    vector<string> lines;
+    double carry = 0.0;
+    long long placed = 0;
+    for (int minute = 1; minute <= hours * 60; minute++) {
+        carry += ordersPerHour / 60.0;
+        for (; carry >= 1.0; carry -= 1.0, placed++) restaurant.intakeOrder(makeOrder());
+        if (minute % 5 == 0) {
+            restaurant.processOrders();
+            for (DeliveryDriver* driver : restaurant.drivers) {
+                vector<Order*> carrying = driver->getAssignedOrders();
+                for (Order* order : carrying) restaurant.completeDelivery(order);
             }
-            outFile.close();
-            setcolor(10);
-            cout << "Orders saved to " << filename << endl;
-            setcolor(7);
-        } catch (const exception& e) {
-            cerr << "Error saving orders: " << e.what() << endl;
-            outFile.close();
+        }
+        if (minute % 30 == 0) restaurant.loadOrdersFromFile(historyFile);
+        if (minute % 60 == 0) {
+            stringstream row;
+            row << setw(6) << minute / 60 << setw(10) << placed << setw(12) << restaurant.orders.liveCount()
+                << setw(10) << restaurant.orders.slotCount() << setw(12) << fixed << setprecision(1)
+                << residentMemoryBytes() / 1048576.0;
+            lines.push_back(row.str());
         }
     }
-    void loadOrdersFromFile(const string& filename) {
-        ifstream inFile(filename);
-        if (!inFile) {
-            return;
+    cout.rdbuf(console);
+    cout.clear();
+    restaurant.journalOrders = journal;
+    remove(historyFile.c_str());
+
+    cout << setw(6) << "Hour" << setw(10) << "Placed" << setw(12) << "In memory"
+         << setw(10) << "Slots" << setw(12) << "RSS MB" << endl;
+    for (const string& line : lines) cout << line << endl;
+}
+
+// A long-running instance's history three ways: the old save path
+// (the whole history appended after every new order), the order log
+// without compaction, and the order log compacted in the background while
+// intake keeps writing. Each order is written when placed, cooked, sent
+// out and delivered. Reload = read every record, keep the last per id and
+// parse those.
+void benchmarkCompaction(const Restaurant& restaurant, int orderCount) {
+    MenuCatalog::View menu = restaurant.menuCatalog.current();
+    mt19937 rng(11);
+    uniform_int_distribution<size_t> pickItem(0, menu->items.size() - 1);
+    vector<Order*> orders;
+    for (int i = 0; i < orderCount; i++) {
+        Order* order = new Order("ORD" + to_string(100000 + i), "Compaction Customer",
+                                 new Address("Street " + to_string(i % 97), "islamabad", "44000"),
+                                 new Payment("4111111111111111", "Visa", "12/30", "123"), "051-555-0101");
+        for (int k = 1 + static_cast<int>(rng() % 3); k > 0; k--) order->addItem(menu->items[pickItem(rng)]);
+        orders.push_back(order);
+    }
+    const char* stages[] = {"Completed", "Out for Delivery", "Delivered"};
+    // Order i is placed at step i and moves one stage on at each of the next three steps.
+    auto replay = [&](const function<void(int step, const Order*)>& write) {
+        for (int step = 0; step < orderCount + 3; step++) {
+            if (step < orderCount) {
+                orders[step]->setStatus("Pending");
+                write(step, orders[step]);
+            }
+            for (int s = 0; s < 3; s++) {
+                int i = step - 1 - s;
+                if (i < 0 || i >= orderCount) continue;
+                orders[i]->setStatus(stages[s]);
+                write(step, orders[i]);
+            }
         }
+    };
+    auto reload = [&](const function<void(const function<void(const string&)>&)>& source, size_t& unique) {
+        auto start = chrono::steady_clock::now();
+        unordered_map<string, string> latest;
+        source([&](const string& line) { latest[line.substr(0, line.find(','))] = line; });
+        for (const auto& record : latest) delete Order::deserialize(record.second, restaurant.menuCatalog);
+        unique = latest.size();
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+    auto row = [](const char* name, size_t bytes, size_t segments, double seconds, size_t unique) {
+        cout << setw(22) << name << setw(12) << fixed << setprecision(2) << bytes / 1048576.0
+             << setw(10) << segments << setw(12) << seconds * 1000 << setw(9) << unique << endl;
+    };
+    cout << orderCount << " orders, 4 states each" << endl;
+    cout << setw(22) << "" << setw(12) << "MB on disk" << setw(10) << "files" << setw(12) << "reload ms"
+         << setw(9) << "orders" << endl;
 
-        try {
-            string line;
-            orderHistory.clear();
-            while (getline(inFile, line)) {
-                if (line.empty()) continue;
-                Order* order = Order::deserialize(line, menuMap);
-                if (order) {
-                    orderHistory[order->getId()] = order;
+    const string legacy = "compaction_legacy.tmp";
+    {
+        ofstream out(legacy, ios::trunc);
+        vector<const Order*> history;
+        replay([&](int, const Order* order) {
+            if (order->getStatus() != "Pending") return;   // the old path only saved on placement
+            history.push_back(order);
+            for (const Order* o : history) out << o->serialize() << "\n";
+        });
+    }
+    size_t unique = 0;
+    double seconds = reload([&](const function<void(const string&)>& visit) {
+        ifstream in(legacy);
+        string line;
+        while (getline(in, line)) visit(line);
+    }, unique);
+    row("full-history saves", static_cast<size_t>(filesystem::file_size(legacy)), 1, seconds, unique);
+    remove(legacy.c_str());
+
+    for (int compacting = 0; compacting < 2; compacting++) {
+        string prefix = compacting ? "compaction_on" : "compaction_off";
+        size_t compactions = 0;
+        {
+            OrderLog log(prefix, "", 64 * 1024, compacting == 1);
+            replay([&](int, const Order* order) { log.append(order->serialize()); });
+            if (compacting) {
+                log.seal();
+                while (log.segmentCount() > 1) {
+                    if (log.compact() == 0) this_thread::sleep_for(chrono::milliseconds(5));
                 }
             }
-            inFile.close();
-        } catch (const exception& e) {
-            cerr << "Error loading orders: " << e.what() << endl;
-            inFile.close();
+            seconds = reload([&](const function<void(const string&)>& visit) { log.forEachRecord(visit); }, unique);
+            row(compacting ? "log, compacted" : "log, no compaction", log.diskBytes(), log.segmentCount(),
+                seconds, unique);
+            compactions = log.compactionCount();
+        }
+        if (compacting) cout << "Compactions run: " << compactions << endl;
+        for (int n = 1; n < 100000; n++) {
+            stringstream path;
+            path << prefix << "." << setw(6) << setfill('0') << n << ".log";
+            remove(path.str().c_str());
         }
     }
+    for (Order* order : orders) delete order;
+}
 
-public:
-    bool validateInput(const string& input, const string& type) {
-        if (input.empty()) return false;
-        
-        if (type == "name") {
-            return all_of(input.begin(), input.end(), [](char c) {
-                return isalpha(c) || c == ' ' || c == '-';
+// Delivered orders from 500 repeat customers as journal text against the
+// compressed archive, then random single-order fetches (each usually in a
+// different block than the last, so the block cache rarely helps).
+void benchmarkArchive(const Restaurant& restaurant, int orderCount) {
+    MenuCatalog::View menu = restaurant.menuCatalog.current();
+    const char* cities[] = {"islamabad", "rawalpindi", "chakwal", "gujranwala", "wazirabad"};
+    const char* zips[] = {"44000", "46000", "48800", "52250", "52000"};
+    const char* notes[] = {"", "", "", "Ring the bell", "Extra spicy\\, no onions"};
+    mt19937 rng(21);
+    uniform_int_distribution<size_t> pickItem(0, menu->items.size() - 1);
+    vector<Order*> orders;
+    size_t textBytes = 0;
+    for (int i = 0; i < orderCount; i++) {
+        int customer = static_cast<int>(rng() % 500);
+        int place = customer % 5;
+        string card = "4111" + to_string(10000000 + customer * 7919 % 9000000) + "0042";
+        Order* order = new Order("ORD" + to_string(100000 + i), "Customer " + to_string(customer),
+                                 new Address("House " + to_string(customer) + " Street " + to_string(customer % 40),
+                                             cities[place], zips[place]),
+                                 new Payment(card.substr(0, 16), "Visa", "0" + to_string(1 + customer % 9) + "/29", "123"),
+                                 "051-555-" + to_string(1000 + customer));
+        for (int k = 1 + static_cast<int>(rng() % 4); k > 0; k--) order->addItem(menu->items[pickItem(rng)]);
+        order->setSpecialInstructions(notes[rng() % 5]);
+        order->setStatus("Delivered");
+        textBytes += order->serialize().size() + 1;
+        orders.push_back(order);
+    }
+
+    const string path = "bench_orders.archive.tmp";
+    double flushSeconds, fetchSeconds;
+    size_t archiveBytes, mismatches = 0;
+    int fetches = min(orderCount, 20000);
+    {
+        OrderArchive archive(path);
+        for (const Order* order : orders) archive.stage(*order);
+        auto start = chrono::steady_clock::now();
+        archive.flush();
+        flushSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        archiveBytes = archive.fileBytes();
+
+        uniform_int_distribution<int> pickOrder(0, orderCount - 1);
+        vector<int> picks(fetches);
+        for (int& p : picks) p = pickOrder(rng);
+        start = chrono::steady_clock::now();
+        for (int p : picks) {
+            Order* fetched = archive.fetch(orders[p]->getId());
+            if (!fetched || fabs(fetched->getTotal() - orders[p]->getTotal()) > 0.005 ||
+                fetched->getItemCount() != orders[p]->getItemCount() ||
+                fetched->getPaymentInfo() != orders[p]->getPaymentInfo()) mismatches++;
+            delete fetched;
+        }
+        fetchSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    remove(path.c_str());
+    for (Order* order : orders) delete order;
+
+    cout << orderCount << " delivered orders" << endl;
+    cout << "Journal text: " << fixed << setprecision(2) << textBytes / 1048576.0 << " MB" << endl;
+    cout << "Archive:      " << archiveBytes / 1048576.0 << " MB (" << setprecision(1)
+         << static_cast<double>(textBytes) / max<size_t>(archiveBytes, 1) << "x smaller), written in "
+         << flushSeconds * 1000 << " ms" << endl;
+    cout << "Fetch by id:  " << setprecision(1) << fetchSeconds * 1e6 / fetches << " us per order over "
+         << fetches << " random ids" << (mismatches ? "  MISMATCH " + to_string(mismatches) : "") << endl;
+}
+
+// Builds a `days`-long archive, one partition per day, beside a single-file
+// archive of the same orders, and times the history queries against both.
+// The "Refunded" status only appears in the last 30 days.
+void benchmarkPartitions(const Restaurant& restaurant, int days, int ordersPerDay) {
+    MenuCatalog::View menu = restaurant.menuCatalog.current();
+    const string directory = "bench_partitions.tmp";
+    const string single = "bench_single.archive.tmp";
+    error_code error;
+    filesystem::remove_all(directory, error);
+    remove(single.c_str());
+    mt19937 rng(39);
+    uniform_int_distribution<size_t> pickItem(0, menu->items.size() - 1);
+    int64_t now = static_cast<int64_t>(time(nullptr));
+    int64_t firstDay = (now / 86400 - days + 1) * 86400;
+    string middleId;
+    {
+        PartitionedArchive partitioned(directory);
+        OrderArchive whole(single);
+        auto start = chrono::steady_clock::now();
+        int serial = 0;
+        for (int day = 0; day < days; day++) {
+            for (int i = 0; i < ordersPerDay; i++) {
+                int customer = static_cast<int>(rng() % 500);
+                string id = "ORD" + to_string(1000000 + serial++);
+                Order order(id, "Customer " + to_string(customer),
+                            new Address("House " + to_string(customer), "islamabad", "44000"),
+                            new Payment("4111111111111111", "Visa", "12/29", "123"), "051-555-0000");
+                for (int k = 1 + static_cast<int>(rng() % 4); k > 0; k--) order.addItem(menu->items[pickItem(rng)]);
+                order.setOrderTime(chrono::system_clock::from_time_t(
+                    static_cast<time_t>(firstDay + day * 86400LL + static_cast<int64_t>(rng() % 86400))));
+                order.setStatus(day >= days - 30 && rng() % 50 == 0 ? "Refunded" : "Delivered");
+                if (day == days / 2 && i == ordersPerDay / 2) middleId = id;
+                partitioned.stage(order);
+                whole.stage(order);
+            }
+            partitioned.flush();
+        }
+        whole.flush();
+        cout << static_cast<long long>(days) * ordersPerDay << " orders over " << days << " days, "
+             << partitioned.partitionCount() << " partitions, built in " << fixed << setprecision(1)
+             << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " s" << endl;
+    }
+
+    struct Case {
+        const char* name;
+        HistoryQuery query;
+    };
+    vector<Case> cases(3);
+    cases[0].name = "Last 7 days";
+    cases[0].query.from = now - 7 * 86400;
+    cases[1].name = "Status Refunded";
+    cases[1].query.status = "Refunded";
+    cases[2].name = "Order id";
+    cases[2].query.id = middleId;
+
+    PartitionedArchive partitioned(directory);
+    OrderArchive whole(single);
+    cout << left << setw(18) << "Query" << right << setw(10) << "Matches" << setw(14) << "Partitions"
+         << setw(16) << "Zone maps ms" << setw(16) << "One file ms" << endl;
+    for (const Case& c : cases) {
+        size_t matches = 0, wholeMatches = 0;
+        auto start = chrono::steady_clock::now();
+        size_t read = partitioned.query(c.query, [&](Order* order) {
+            matches++;
+            delete order;
+        });
+        double partitionedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        start = chrono::steady_clock::now();
+        whole.scan(c.query, [&](Order* order) {
+            wholeMatches++;
+            delete order;
+        });
+        double wholeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << left << setw(18) << c.name << right << setw(10) << matches << setw(14)
+             << (to_string(read) + "/" + to_string(partitioned.partitionCount())) << setw(16) << setprecision(2)
+             << partitionedMs << setw(16) << wholeMs << (matches != wholeMatches ? "  MISMATCH" : "") << endl;
+    }
+    filesystem::remove_all(directory, error);
+    remove(single.c_str());
+}
+
+// Fills a HistoryColumns with `rowCount` made-up orders over the last year
+// and times a few queries through QueryPlan::filter (best of five runs).
+void benchmarkQuery(const Restaurant& restaurant, size_t rowCount) {
+    MenuCatalog::View menu = restaurant.menuCatalog.current();
+    const char* cities[] = {"islamabad", "rawalpindi", "lahore", "karachi", "peshawar", "quetta", "multan",
+                            "faisalabad", "sialkot", "gujranwala", "chakwal", "wazirabad", "hyderabad", "abbottabad",
+                            "sargodha", "bahawalpur", "sukkur", "mardan", "jhelum", "gujrat"};
+    const char* statuses[] = {"Delivered", "Delivered", "Delivered", "Delivered", "Delivered", "Delivered",
+                              "Delivered", "Delivered", "Delivered", "Delivered", "Delivered", "Delivered",
+                              "Delivered", "Delivered", "Delivered", "Delivered", "Cancelled", "Pending",
+                              "Preparing", "Out for Delivery"};
+    const size_t customerCount = 200000;
+    vector<string> customers(customerCount);
+    for (size_t i = 0; i < customerCount; i++) customers[i] = "Customer " + to_string(i);
+    mt19937 rng(40);
+    uniform_int_distribution<size_t> pickItem(0, menu->items.size() - 1);
+    int64_t now = static_cast<int64_t>(time(nullptr));
+
+    HistoryColumns history;
+    history.reserve(rowCount);
+    auto start = chrono::steady_clock::now();
+    for (size_t r = 0; r < rowCount; r++) {
+        SmallVector<OrderLine, 4> lines;
+        uint64_t cents = 0;
+        for (int k = 1 + static_cast<int>(rng() % 4); k > 0; k--) {
+            const MenuItem* item = menu->items[pickItem(rng)];
+            lines.push_back({static_cast<uint16_t>(item->getIndex()), 1});
+            cents += static_cast<uint64_t>(llround(item->getPrice() * 100));
+        }
+        history.addRow("ORD" + to_string(1000000 + r), now - static_cast<int64_t>(rng() % (365 * 86400)), cents,
+                       statuses[rng() % 20], cities[rng() % 20], customers[rng() % customerCount], lines);
+    }
+    double buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << rowCount << " orders in columns: " << fixed << setprecision(1) << history.memoryBytes() / 1048576.0
+         << " MB, built in " << buildSeconds << " s" << endl;
+
+    string item = menu->items[3]->getId();
+    const string queries[] = {"status=Cancelled", "city=rawalpindi total=50..80", "days=7 status=Delivered",
+                              "customer=\"Customer 4242\"", "item=" + item + " total=40..", "total=0.."};
+    cout << left << setw(36) << "Query" << right << setw(12) << "Matches" << setw(12) << "ms" << setw(16)
+         << "M rows/s" << endl;
+    for (const string& text : queries) {
+        OrderQuery query;
+        string error;
+        OrderQuery::parse(text, query, error);
+        double best = 1e18;
+        size_t matches = 0;
+        for (int run = 0; run < 5; run++) {
+            start = chrono::steady_clock::now();
+            QueryPlan plan(query, history, restaurant.menuCatalog);
+            matches = plan.filter().size();
+            best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        }
+        cout << left << setw(36) << text << right << setw(12) << matches << setw(12) << setprecision(2) << best
+             << setw(16) << setprecision(0) << rowCount / best / 1000 << endl;
+    }
+}
+
+// Records `orderCount` made-up orders into ItemAnalytics from `threads`
+// threads and checks the answers against exact counts. Item popularity is
+// skewed (weight 1/rank) and each item's "partner" is added half the time.
+void benchmarkItemStats(const Restaurant& restaurant, int orderCount, int threads) {
+    MenuCatalog::View menu = restaurant.menuCatalog.current();
+    const vector<MenuItem*>& items = menu->items;
+    size_t n = items.size();
+    vector<double> weights(n);
+    for (size_t i = 0; i < n; i++) weights[i] = 1.0 / (i + 1);
+    mt19937 rng(41);
+    discrete_distribution<size_t> pickPopular(weights.begin(), weights.end());
+    uniform_int_distribution<size_t> pickAny(0, n - 1);
+    vector<SmallVector<OrderLine, 4>> baskets(orderCount);
+    for (SmallVector<OrderLine, 4>& basket : baskets) {
+        size_t first = pickPopular(rng);
+        basket.push_back({static_cast<uint16_t>(items[first]->getIndex()), 1});
+        if (rng() % 2) basket.push_back({static_cast<uint16_t>(items[(first * 7 + 3) % n]->getIndex()), 1});
+        for (int k = static_cast<int>(rng() % 3); k > 0; k--) {
+            basket.push_back({static_cast<uint16_t>(items[pickAny(rng)]->getIndex()), 1});
+        }
+    }
+
+    ItemAnalytics stats;
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            for (size_t i = t; i < baskets.size(); i += threads) stats.record(baskets[i], restaurant.menuCatalog);
+        });
+    }
+    for (thread& worker : workers) worker.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    unordered_map<string, uint64_t> exactItems, exactPairs;
+    for (const SmallVector<OrderLine, 4>& basket : baskets) {
+        vector<string> ids;
+        for (const OrderLine& line : basket) {
+            string id = restaurant.menuCatalog[line.menuIndex]->getId();
+            if (find(ids.begin(), ids.end(), id) == ids.end()) ids.push_back(id);
+        }
+        for (size_t i = 0; i < ids.size(); i++) {
+            exactItems[ids[i]]++;
+            for (size_t j = i + 1; j < ids.size(); j++) {
+                exactPairs[ids[i] < ids[j] ? ids[i] + "+" + ids[j] : ids[j] + "+" + ids[i]]++;
+            }
+        }
+    }
+    auto check = [](const char* name, const vector<ItemAnalytics::Estimate>& reported,
+                    const unordered_map<string, uint64_t>& exact, uint64_t bound) {
+        vector<pair<uint64_t, string>> truth;
+        for (const auto& entry : exact) truth.push_back({entry.second, entry.first});
+        sort(truth.rbegin(), truth.rend());
+        size_t hits = 0, outside = 0;
+        uint64_t worst = 0;
+        for (const ItemAnalytics::Estimate& e : reported) {
+            uint64_t actual = exact.count(e.key) ? exact.at(e.key) : 0;
+            outside += actual < e.low || actual > e.count;
+            worst = max(worst, e.count - actual);
+            for (size_t i = 0; i < reported.size() && i < truth.size(); i++) hits += truth[i].second == e.key;
+        }
+        cout << name << ": top-" << reported.size() << " recall " << hits << "/" << reported.size()
+             << ", worst overcount " << worst << " (sketch bound " << bound << "), " << outside
+             << " outside their range; " << exact.size() << " distinct" << endl;
+    };
+    cout << orderCount << " orders from " << threads << " threads in " << fixed << setprecision(2) << seconds
+         << " s (" << setprecision(0) << orderCount / seconds / 1000 << "k orders/s); sketches "
+         << stats.memoryBytes() / 1024 << " KB" << endl;
+    check("Items", stats.topItems(10), exactItems, stats.itemErrorBound());
+    check("Pairs", stats.topPairs(10), exactPairs, stats.pairErrorBound());
+    string probe = items[0]->getId(), partner = items[3 % n]->getId();
+    uint64_t together = exactPairs[probe < partner ? probe + "+" + partner : partner + "+" + probe];
+    vector<ItemAnalytics::Estimate> also = stats.alsoBought(probe, restaurant.menuCatalog, 1);
+    cout << "Also ordered with " << probe << ": " << (also.empty() ? "-" : also[0].key) << " ~"
+         << (also.empty() ? 0 : also[0].count) << " (exact partner " << partner << ": " << together << ")" << endl;
+}
+
+// Records `orderCount` orders from `customerCount` customers over 30 days
+// and 10 cities into a scratch CustomerCardinality, and compares its
+// estimates with exact sets, before and after a flush and reload.
+void benchmarkDistinct(int customerCount, int orderCount) {
+    const char* cities[] = {"islamabad", "rawalpindi", "lahore", "karachi", "peshawar",
+                            "quetta", "multan", "faisalabad", "sialkot", "gujranwala"};
+    const string directory = "bench_customers.tmp";
+    error_code error;
+    filesystem::remove_all(directory, error);
+    filesystem::create_directories(directory, error);
+    mt19937 rng(42);
+    int64_t today = CustomerCardinality::dayOf(chrono::system_clock::now());
+
+    set<string> allCustomers, allPhones, lahoreCustomers, todayCustomers, lahoreToday;
+    double recordSeconds;
+    {
+        CustomerCardinality counts(directory);
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < orderCount; i++) {
+            int customer = static_cast<int>(rng() % customerCount);
+            int city = customer % 10;
+            int daysAgo = static_cast<int>(rng() % 30);
+            string name = "Customer " + to_string(customer);
+            string phone = "0300" + to_string(1000000 + customer);
+            Order order("ORD" + to_string(i), name, new Address("1 Street", cities[city], "44000"),
+                        new Payment("4111111111111111", "Visa", "12/29", "123"), phone);
+            order.setOrderTime(chrono::system_clock::from_time_t(static_cast<time_t>((today - daysAgo) * 86400 + 43200)));
+            counts.record(order);
+            allCustomers.insert(name);
+            allPhones.insert(phone);
+            if (city == 2) lahoreCustomers.insert(name);
+            if (daysAgo == 0) todayCustomers.insert(name);
+            if (city == 2 && daysAgo == 0) lahoreToday.insert(name);
+        }
+        recordSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        counts.flush();
+    }
+    CustomerCardinality counts(directory);
+    auto row = [&](const char* name, int64_t fromDay, const string& city, size_t exact, bool phones) {
+        CustomerCardinality::Count c = counts.count(fromDay, today, city);
+        double estimate = phones ? c.phones : c.customers;
+        cout << left << setw(28) << name << right << setw(10) << exact << setw(12) << fixed << setprecision(0)
+             << estimate << setw(9) << setprecision(2) << 100.0 * (estimate - exact) / max<size_t>(exact, 1) << "%"
+             << setw(9) << c.buckets << setw(11) << setprecision(1) << c.bytes / 1024.0 / max<size_t>(c.buckets, 1)
+             << endl;
+    };
+    cout << orderCount << " orders from " << customerCount << " customers recorded in " << fixed << setprecision(2)
+         << recordSeconds << " s" << endl;
+    cout << left << setw(28) << "Count" << right << setw(10) << "Exact" << setw(12) << "Estimate" << setw(10)
+         << "Error" << setw(9) << "Buckets" << setw(11) << "KB/bucket" << endl;
+    row("Customers, 30 days", INT64_MIN, "", allCustomers.size(), false);
+    row("Phones, 30 days", INT64_MIN, "", allPhones.size(), true);
+    row("Customers, lahore", INT64_MIN, "lahore", lahoreCustomers.size(), false);
+    row("Customers, today", today, "", todayCustomers.size(), false);
+    row("Customers, lahore today", today, "Lahore", lahoreToday.size(), false);
+    uintmax_t diskBytes = 0;
+    for (filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+        diskBytes += filesystem::file_size(it->path(), error);
+    }
+    cout << "On disk: " << setprecision(1) << diskBytes / 1024.0 << " KB for 30 days x 10 cities" << endl;
+    filesystem::remove_all(directory, error);
+}
+
+// Synthetic customer names with skewed popularity; times prefix completion
+// and one-typo fuzzy search, and checks the intended name is in the top 10.
+void benchmarkSearch(int nameCount) {
+    const char* first[] = {"ali", "ahmed", "sara", "fatima", "usman", "ayesha", "bilal", "hina", "hamza", "zainab",
+                           "omar", "maryam", "faisal", "noor", "imran", "sana", "kamran", "rabia", "tariq", "amna"};
+    const char* last[] = {"khan", "malik", "sheikh", "qureshi", "butt", "chaudhry", "raza", "hussain", "iqbal",
+                          "siddiqui", "mirza", "abbasi", "javed", "aslam", "farooq", "nawaz", "rehman", "shah"};
+    mt19937 rng(7);
+    NameIndex index;
+    vector<string> names;
+    names.reserve(nameCount);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < nameCount; i++) {
+        string name = string(first[rng() % 20]) + " " + last[rng() % 18] + " " + to_string(i);
+        name[0] = static_cast<char>(toupper(name[0]));
+        index.add(to_string(i), name, rng() % 1000 < 990 ? rng() % 20 : rng() % 5000);
+        names.push_back(name);
+    }
+    double buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    const int queries = 2000;
+    vector<string> prefixes, typos;
+    vector<string> expected;
+    for (int i = 0; i < queries; i++) {
+        const string& name = names[rng() % names.size()];
+        prefixes.push_back(name.substr(0, 3));
+        string typo = name;
+        size_t at = 1 + rng() % (name.find(' ') - 1);
+        switch (rng() % 3) {
+        case 0: typo[at] = static_cast<char>('a' + rng() % 26); break;   // substitution
+        case 1: typo.erase(at, 1); break;                                // deletion
+        default: typo.insert(at, 1, static_cast<char>('a' + rng() % 26)); break;   // insertion
+        }
+        typos.push_back(typo);
+        expected.push_back(name);
+    }
+    size_t sink = 0;
+    start = chrono::steady_clock::now();
+    for (const string& prefix : prefixes) sink += index.complete(prefix, 10).size();
+    double completeMicros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / queries;
+    int found = 0;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < queries; i++) {
+        vector<NameIndex::Match> matches = index.search(typos[i], 10);
+        sink += matches.size();
+        for (const NameIndex::Match& match : matches) {
+            if (match.name == expected[i]) {
+                found++;
+                break;
+            }
+        }
+    }
+    double searchMicros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / queries;
+
+    cout << index.size() << " names indexed in " << fixed << setprecision(2) << buildSeconds << " s, "
+         << setprecision(1) << index.memoryBytes() / 1048576.0 << " MB" << endl;
+    cout << left << setw(30) << "Prefix completion, top 10" << right << setw(10) << setprecision(1)
+         << completeMicros << " us/query" << endl;
+    cout << left << setw(30) << "One-typo search, top 10" << right << setw(10) << searchMicros << " us/query" << endl;
+    cout << "Typo queries with the intended name in the top 10: " << found << "/" << queries << " ("
+         << setprecision(1) << 100.0 * found / queries << "%)" << (sink ? "" : " ") << endl;
+}
+
+// Draws real screens into an off-screen renderer and reports the time and
+// bytes per frame, against the cost of the shell that system("cls") starts.
+void benchmarkRender(Restaurant& restaurant, int frames) {
+    size_t bytes = 0, writes = 0;
+    ConsoleRenderer screen(120, 60, [&](const string& out) {
+        bytes += out.size();
+        writes++;
+    });
+    Order order("ORD4242", "Ayesha Khan", new Address("12 Jinnah Avenue", "Islamabad", "44000"),
+                new Payment("4111111111111111", "Visa", "12/29", "123"), "300-555-0101");
+    for (const char* id : {"DF1", "DF6", "BV1", "D2"}) {
+        if (MenuItem* item = restaurant.findMenuItem(id)) order.addItem(item);
+    }
+    screen.attach();
+    screen.clear();
+    restaurant.displayMenu();
+    size_t firstBytes = screen.present();
+    auto run = [&](const function<void(int)>& draw) {
+        bytes = writes = 0;
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < frames; i++) {
+            draw(i);
+            screen.present();
+        }
+        return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / frames;
+    };
+    struct Row { const char* name; double micros; size_t bytes; };
+    vector<Row> rows;
+    double micros = run([&](int) { restaurant.displayMenu(); });
+    rows.push_back({"Menu, unchanged", micros, bytes});
+    micros = run([&](int i) {
+        order.setStatus(i % 2 ? "Preparing" : "Out for Delivery");
+        restaurant.displayOrderDetails(&order);
+    });
+    rows.push_back({"Order details, status changes", micros, bytes});
+    micros = run([&](int i) {
+        if (i % 2) restaurant.displayMenu();
+        else restaurant.displayOrderDetails(&order);
+    });
+    rows.push_back({"Menu <-> order details", micros, bytes});
+    screen.detach();
+
+    const int spawns = 20;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < spawns; i++) {
+        if (system("exit 0") != 0) break;
+    }
+    double spawnMicros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / spawns;
+
+    cout << "First frame of the menu: " << firstBytes << " bytes" << endl;
+    cout << left << setw(32) << "Screen" << right << setw(12) << "us/frame" << setw(14) << "bytes/frame" << endl;
+    for (const Row& row : rows) {
+        cout << left << setw(32) << row.name << right << setw(12) << fixed << setprecision(1) << row.micros
+             << setw(14) << setprecision(0) << static_cast<double>(row.bytes) / frames << endl;
+    }
+    cout << left << setw(32) << "Shell spawn (system)" << right << setw(12) << setprecision(1) << spawnMicros << endl;
+}
+
+// Wake-up latency for tasks posted from another thread, and how late a
+// 10 ms timer fires, with the loop otherwise idle.
+void benchmarkEventLoop(int posts) {
+    EventLoop loop;
+    vector<double> wakeups;
+    atomic<int> handled{0};
+    thread poster([&]() {
+        for (int i = 0; i < posts; i++) {
+            auto sent = chrono::steady_clock::now();
+            loop.post([&, sent]() {
+                wakeups.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - sent).count());
+                handled++;
             });
+            while (handled.load() <= i) this_thread::sleep_for(chrono::microseconds(50));
+            this_thread::sleep_for(chrono::microseconds(200));
         }
-        else if (type == "zip") {
-            return all_of(input.begin(), input.end(), ::isdigit) && input.length() == 5;
+    });
+    while (handled.load() < posts) loop.runFor(chrono::milliseconds(10));
+    poster.join();
+
+    vector<double> lateness;
+    auto expected = chrono::steady_clock::now() + chrono::milliseconds(10);
+    loop.every(chrono::milliseconds(10), [&]() {
+        auto now = chrono::steady_clock::now();
+        lateness.push_back(chrono::duration<double, micro>(now - expected).count());
+        expected += chrono::milliseconds(10);
+    });
+    loop.runFor(chrono::seconds(2));
+
+    auto report = [](const char* name, vector<double>& samples) {
+        sort(samples.begin(), samples.end());
+        double sum = 0;
+        for (double sample : samples) sum += sample;
+        cout << left << setw(30) << name << right << setw(8) << samples.size() << setw(10) << fixed
+             << setprecision(1) << sum / max<size_t>(samples.size(), 1) << setw(10)
+             << samples[samples.size() / 2] << setw(10) << samples[samples.size() * 99 / 100] << setw(10)
+             << samples.back() << endl;
+    };
+    cout << left << setw(30) << "us" << right << setw(8) << "Count" << setw(10) << "Mean" << setw(10) << "p50"
+         << setw(10) << "p99" << setw(10) << "Max" << endl;
+    report("Task posted from a thread", wakeups);
+    report("10 ms timer, lateness", lateness);
+}
+
+// The intake server on a thread of its own and the load client against it
+// over a UNIX socket. The journal is off so the run leaves no order files.
+void benchmarkIntake(Restaurant& restaurant, int orderCount, int connections, bool binary, bool pipelined) {
+#if defined(__linux__)
+    const string address = "bench_intake.sock";
+    bool journal = restaurant.journalOrders;
+    restaurant.journalOrders = false;
+    IntakeServer server(restaurant);
+    string error;
+    if (!server.listen(address, error)) {
+        cout << error << endl;
+        restaurant.journalOrders = journal;
+        return;
+    }
+    if (pipelined) server.usePipeline(OrderPipeline::Config());
+    atomic<bool> stop{false};
+    thread serving([&]() { server.run(stop); });
+    IntakeLoad load = runIntakeLoad(address, restaurant.menuCatalog, orderCount, connections, 256, binary);
+    stop = true;
+    serving.join();
+    restaurant.journalOrders = journal;
+    const IntakeServer::Stats& stats = server.statistics();
+    cout << (binary ? "Binary frames" : "Text lines") << ", " << connections << " connections, 256 in flight each"
+         << (pipelined ? ", through the pipeline" : "") << endl;
+    printIntakeLoad(load);
+    if (pipelined) {
+        OrderPipeline::printStatistics(server.orderPipeline()->statistics());
+        return;
+    }
+    cout << "Server: " << stats.batches << " batches (" << fixed << setprecision(0)
+         << static_cast<double>(stats.accepted) / max<uint64_t>(stats.batches, 1) << " orders each), " << stats.reads
+         << " reads (" << static_cast<double>(stats.accepted + stats.rejected) / max<uint64_t>(stats.reads, 1)
+         << " orders each)" << endl;
+#else
+    (void)restaurant; (void)orderCount; (void)connections; (void)binary; (void)pipelined;
+    cout << "The intake server needs Linux (epoll)." << endl;
+#endif
+}
+
+// Binary orders pushed straight into an OrderPipeline, once with an
+// ordinary disk and once with every journal write made slow, to show the
+// backpressure reaching the producer. The journal itself is off.
+void benchmarkPipeline(Restaurant& restaurant, int orderCount, int slowDiskMicros) {
+    bool journal = restaurant.journalOrders;
+    restaurant.journalOrders = false;
+    MenuCatalog::View menu = restaurant.menuCatalog.current();
+    mt19937 rng(5);
+    for (int round = 0; round < 2; round++) {
+        vector<string> frames;
+        frames.reserve(orderCount);
+        string prefix = "P" + to_string(chrono::steady_clock::now().time_since_epoch().count() % 1000000) + "-";
+        for (int i = 0; i < orderCount; i++) {
+            Order order(prefix + to_string(i), "Hina Iqbal", new Address("7 Mall Road", "Lahore", "54000"),
+                        new Payment("4111111111111111", "Visa", "12/29", "123"), "300-555-0101");
+            for (int k = 1 + static_cast<int>(rng() % 3); k > 0; k--) order.addItem(menu->items[rng() % menu->items.size()]);
+            frames.push_back(IntakeFrame::encode(order).substr(3));
         }
-        else if (type == "expiry") {
-            regex pattern("^(0[1-9]|1[0-2])/([0-9]{2})$");
-            return regex_match(input, pattern);
+        OrderPipeline::Config config;
+        config.persistDelay = chrono::microseconds(round == 0 ? 0 : slowDiskMicros);
+        vector<chrono::steady_clock::time_point> submitted(orderCount);
+        vector<double> latencies(orderCount);
+        atomic<int> accepted{0};
+        double submitMillis, seconds;
+        vector<OrderPipeline::StageStats> stats;
+        {
+            OrderPipeline pipeline(restaurant, [&](uint64_t tag, const string& reply) {
+                latencies[tag] = chrono::duration<double, micro>(chrono::steady_clock::now() - submitted[tag]).count();
+                if (reply.compare(0, 3, "OK ") == 0) accepted++;
+            }, config);
+            auto start = chrono::steady_clock::now();
+            double blocked = 0;
+            for (int i = 0; i < orderCount; i++) {
+                submitted[i] = chrono::steady_clock::now();
+                pipeline.submit(static_cast<uint64_t>(i), move(frames[i]), true);
+                blocked += chrono::duration<double, milli>(chrono::steady_clock::now() - submitted[i]).count();
+            }
+            submitMillis = blocked;
+            pipeline.finish();
+            seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            stats = pipeline.statistics();
         }
-        else if (type == "cvv") {
-            return all_of(input.begin(), input.end(), ::isdigit) && input.length() == 3;
+        sort(latencies.begin(), latencies.end());
+        cout << (round == 0 ? "Journal writes as they come" : "Every journal write takes another ")
+             << (round == 0 ? "" : to_string(slowDiskMicros) + " us") << ":" << endl;
+        cout << "  " << accepted.load() << " of " << orderCount << " admitted in " << fixed << setprecision(2) << seconds
+             << " s, " << setprecision(0) << orderCount / seconds << " orders/s; end to end p50 "
+             << latencies[orderCount / 2] << " us, p99 " << latencies[orderCount * 99 / 100]
+             << " us; submit() blocked " << setprecision(1) << submitMillis << " ms" << endl;
+        OrderPipeline::printStatistics(stats);
+        cout << endl;
+    }
+    restaurant.journalOrders = journal;
+}
+
+// Orders from 500 repeat customers: how many address and payment copies
+// the shared stores hold against one per order, and the journal with
+// per-segment value definitions against plain records.
+void benchmarkSharedValues(const Restaurant& restaurant, int orderCount) {
+    MenuCatalog::View menu = restaurant.menuCatalog.current();
+    const char* cities[] = {"islamabad", "rawalpindi", "chakwal", "gujranwala", "wazirabad"};
+    const char* zips[] = {"44000", "46000", "48800", "52250", "52000"};
+    ValueStore<Address>& addresses = ValueStore<Address>::shared();
+    ValueStore<Payment>& payments = ValueStore<Payment>::shared();
+    size_t addressesBefore = addresses.size(), paymentsBefore = payments.size();
+    size_t storeBytesBefore = addresses.memoryBytes() + payments.memoryBytes();
+    mt19937 rng(48);
+    vector<Order*> orders;
+    size_t copyBytes = 0, textBytes = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < orderCount; i++) {
+        int customer = static_cast<int>(rng() % 500);
+        int place = customer % 5;
+        string card = "4111" + to_string(10000000 + customer * 7919 % 9000000) + "0042";
+        Order* order = new Order("ORD" + to_string(100000 + i), "Customer " + to_string(customer),
+                                 new Address("House " + to_string(customer) + " Street " + to_string(customer % 40),
+                                             cities[place], zips[place]),
+                                 new Payment(card.substr(0, 16), "Visa", "0" + to_string(1 + customer % 9) + "/29", "123"),
+                                 "051-555-" + to_string(1000 + customer));
+        order->addItem(menu->items[rng() % menu->items.size()]);
+        copyBytes += order->getAddress()->memoryBytes() + order->getPayment()->memoryBytes();
+        orders.push_back(order);
+    }
+    double buildSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    size_t storeBytes = addresses.memoryBytes() + payments.memoryBytes() - storeBytesBefore;
+    cout << orderCount << " orders from 500 customers, built in " << fixed << setprecision(0) << buildSeconds * 1000
+         << " ms" << endl;
+    cout << "  addresses held: " << addresses.size() - addressesBefore << ", payments held: "
+         << payments.size() - paymentsBefore << endl;
+    cout << "  address and payment memory: " << setprecision(1) << storeBytes / 1024.0 << " KB shared, "
+         << copyBytes / 1048576.0 << " MB as one copy per order (" << setprecision(2)
+         << 8.0 * 2 * orderCount / 1048576.0 << " MB of pointers either way)" << endl;
+
+    const string prefix = "values_bench";
+    size_t mismatches = 0, logBytes;
+    double reloadSeconds;
+    {
+        OrderLog log(prefix, "", 1 << 20, false);
+        vector<string> records;
+        for (const Order* order : orders) {
+            records.push_back(order->serialize());
+            textBytes += records.back().size() + 1;
+        }
+        log.appendBatch(records);
+        log.seal();
+        logBytes = log.diskBytes();
+        size_t next = 0;
+        start = chrono::steady_clock::now();
+        log.forEachRecord([&](const string& record) {
+            if (next >= records.size() || record != records[next]) mismatches++;
+            next++;
+        });
+        reloadSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "  journal: " << setprecision(2) << logBytes / 1048576.0 << " MB in " << log.segmentCount()
+             << " segments against " << textBytes / 1048576.0 << " MB of plain records ("
+             << setprecision(1) << (textBytes - logBytes) * 1.0 / orderCount << " bytes less per order), read back in "
+             << setprecision(0) << reloadSeconds * 1000 << " ms, " << mismatches << " records differ" << endl;
+    }
+    for (int n = 1; n < 1000; n++) {
+        stringstream path;
+        path << prefix << "." << setw(6) << setfill('0') << n << ".log";
+        remove(path.str().c_str());
+    }
+    for (Order* order : orders) delete order;
+    cout << "  after deleting them the stores hold " << addresses.size() - addressesBefore << " addresses and "
+         << payments.size() - paymentsBefore << " payments more than before" << endl;
+}
+
+// Generated rules over a menu grown by 2000 items in 200 categories, with
+// orders going to 200 cities at all hours: quoted one at a time, then in
+// bulk on one thread and on all of them, against finding each order's
+// rules by scanning the whole list.
+void benchmarkPricing(Restaurant& restaurant, int orderCount, int ruleCount) {
+    mt19937 rng(49);
+    for (int i = 0; i < 2000; i++) {
+        restaurant.addMenuItem(new MenuItem("PX" + to_string(i), "Generated " + to_string(i),
+                                            3.0 + (rng() % 2000) / 100.0, "Category " + to_string(i % 200), 10));
+    }
+    MenuCatalog::View menu = restaurant.menuCatalog.current();
+    auto randomItem = [&]() { return menu->items[rng() % menu->items.size()]; };
+    auto effect = [&]() { return rng() % 2 ? to_string(5 + rng() % 26) + "%" : to_string(rng() % 300 / 100.0); };
+    auto hours = [&]() {
+        if (rng() % 10 >= 3) return string();
+        int from = static_cast<int>(rng() % 24);
+        return to_string(from) + "-" + to_string((from + 1 + rng() % 6) % 24 + 1);
+    };
+    vector<PricingRule> rules;
+    while (static_cast<int>(rules.size()) < ruleCount) {
+        int pick = static_cast<int>(rng() % 20);
+        string line;
+        if (pick < 10) {
+            line = "item,Item deal,"  + randomItem()->getId() + "," + effect() + "," + hours() + ",";
+        } else if (pick < 14) {
+            line = "category,Category deal,Category " + to_string(rng() % 200) + "," + effect() + "," + hours() + ",";
+        } else if (pick < 19) {
+            line = "combo,Combo," + randomItem()->getId() + "+" + randomItem()->getId() +
+                   (rng() % 2 ? "+" + randomItem()->getId() : "") + "," + effect() + "," + hours() + ",";
+        } else {
+            line = "fee,Delivery,city" + to_string(rng() % 200) + "," + to_string(1 + rng() % 5) + ".99," + hours() +
+                   "," + (rng() % 3 ? "" : "40");
+        }
+        PricingRule rule;
+        if (PricingRule::parse(line, rule)) rules.push_back(rule);
+    }
+    auto start = chrono::steady_clock::now();
+    PricingPlan plan(rules, restaurant.menuCatalog);
+    double compileMillis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    vector<Order*> orders;
+    auto now = chrono::system_clock::now();
+    for (int i = 0; i < orderCount; i++) {
+        Order* order = new Order("ORD" + to_string(i), "Customer", new Address("1 Street", "city" + to_string(rng() % 220), "44000"),
+                                 new Payment("4111111111111111", "Visa", "12/29", "123"), "051-555-0101");
+        for (int k = 1 + static_cast<int>(rng() % 5); k > 0; k--) order->addItem(randomItem(), 1 + static_cast<int>(rng() % 2));
+        order->setOrderTime(now + chrono::hours(rng() % 24));
+        orders.push_back(order);
+    }
+    vector<const Order*> view(orders.begin(), orders.end());
+
+    start = chrono::steady_clock::now();
+    double sum = 0.0;
+    size_t applied = 0;
+    for (const Order* order : orders) {
+        PriceQuote quote = plan.quote(*order);
+        sum += quote.total();
+        applied += quote.applied.size();
+    }
+    double quoteSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    size_t scanned = min<size_t>(orders.size(), 20000), matches = 0;
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < scanned; i++) {
+        const Order* order = orders[i];
+        for (const PricingRule& rule : rules) {
+            for (const OrderLine& line : order->getLines()) {
+                const MenuItem* item = restaurant.menuCatalog[line.menuIndex];
+                if ((rule.kind == PricingRule::Item && rule.target == item->getId()) ||
+                    (rule.kind == PricingRule::Category && rule.target == item->getCategory()) ||
+                    (rule.kind == PricingRule::Combo &&
+                     find(rule.comboItems.begin(), rule.comboItems.end(), item->getId()) != rule.comboItems.end())) {
+                    matches++;
+                }
+            }
+            if (rule.kind == PricingRule::Fee && (rule.target == "*" || rule.target == order->getAddress()->getCity())) matches++;
         }
-        return true;
     }
+    double scanSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    BST<MenuItem*> menuTree;
-    OrderQueue<Order*> orderQueue;
-    unordered_map<string, Order*> orderHistory;
-    list<DeliveryDriver*> availableDrivers;
-    map<string, MenuItem*> menuMap; // id -> MenuItem
-    bool running = true;
+    start = chrono::steady_clock::now();
+    vector<double> oneThread = plan.totals(view, 1);
+    double oneSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    unsigned threads = 0;
+    start = chrono::steady_clock::now();
+    vector<double> allThreads = plan.totals(view, 0, &threads);
+    double allSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    size_t mismatches = 0;
+    for (size_t i = 0; i < orders.size(); i++) {
+        if (oneThread[i] != allThreads[i] || fabs(oneThread[i] - plan.quote(*orders[i]).total()) > 1e-9) mismatches++;
+    }
 
-    Restaurant() {
-        // Initialize RNG for generating order ids
-        srand(static_cast<unsigned int>(time(nullptr)));
+    cout << rules.size() << " rules over " << menu->items.size() << " items, compiled in " << fixed << setprecision(1)
+         << compileMillis << " ms" << endl;
+    cout << "Quote, one order at a time: " << setprecision(2) << quoteSeconds * 1e6 / orderCount << " us/order ("
+         << setprecision(1) << applied * 1.0 / orderCount << " rules applied per order, revenue $" << setprecision(0)
+         << sum << ")" << endl;
+    cout << "Scanning every rule just to find the matches: " << setprecision(2) << scanSeconds * 1e6 / scanned
+         << " us/order (" << setprecision(1) << matches * 1.0 / scanned << " matches per order)" << endl;
+    cout << "Bulk reprice of " << orderCount << " orders: " << setprecision(0) << orderCount / oneSeconds
+         << " orders/s on 1 thread, " << orderCount / allSeconds << " orders/s on " << threads << " chosen (hardware threads: "
+         << thread::hardware_concurrency() << "); " << mismatches << " totals differ" << endl;
+    for (Order* order : orders) delete order;
+}
+
+// Meal suggestions over a menu grown by `extraItems` generated dishes:
+// the first query for each filter builds its table, the rest reuse it.
+void benchmarkRecommend(Restaurant& restaurant, int extraItems, int queries) {
+    mt19937 rng(50);
+    const char* categories[] = {"Pizza", "Burger", "Dessert", "Beverage", "Salad", "Desi Food", "Seafood"};
+    for (int i = 0; i < extraItems; i++) {
+        restaurant.addMenuItem(new MenuItem("MR" + to_string(i), "Generated " + to_string(i), 1.0 + (rng() % 2400) / 100.0,
+                                            categories[rng() % 7], 5 * (1 + static_cast<int>(rng() % 12))));
     }
-    void addMenuItem(MenuItem* item) {
-        menuTree.insert(item);
-        menuMap[item->getId()] = item;
-    }  
-    void displayMenu() const {
-        system("cls");
-        vector<MenuItem*> items = menuTree.getInorder();
-        setcolor(14); // Yellow
-        cout << "\nMenu Items (Sorted by Price):" << endl;
-        setcolor(11); // Light cyan
-        cout << setw(5) << "ID" 
-             << setw(20) << "Name"
-             << setw(10) << "Price"
-             << setw(15) << "Category"
-             << setw(15) << "Prep Time" << endl;
-        setcolor(7); // White
-        cout << string(65, '-') << endl;       
-        for (const MenuItem* item : items) {
-            cout << setw(5) << item->getId()
-                 << setw(20) << item->getName()
-                 << setw(10) << fixed << setprecision(2) << item->getPrice()
-                 << setw(15) << item->getCategory()
-                 << setw(15) << item->getPrepTime() << " mins" << endl;
-        }
+    vector<vector<string>> filters = {{}, {"Pizza", "Beverage"}, {"Burger", "Beverage", "Dessert"}, {"Desi Food"}, {"Salad"}};
+    vector<double> cold, warm;
+    size_t options = 0;
+    for (const vector<string>& filter : filters) {
+        auto start = chrono::steady_clock::now();
+        options += restaurant.recommendMeals(60.0, filter, 3).size();
+        cold.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
     }
-    void placeOrder(Order* order) {
-        if (!order) return;
-        
-        system("cls");
-        int priority = static_cast<int>(order->getTotal() * 10);
-        orderQueue.push(order, priority);
-        orderHistory[order->getId()] = order;
+    for (int q = 0; q < queries; q++) {
+        double budget = 5.0 + (rng() % 5500) / 100.0;
+        auto start = chrono::steady_clock::now();
+        options += restaurant.recommendMeals(budget, filters[rng() % filters.size()], 3).size();
+        warm.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+    }
+    sort(cold.begin(), cold.end());
+    sort(warm.begin(), warm.end());
+    MenuCatalog::View menu = restaurant.menuCatalog.current();
+    cout << menu->items.size() << " items on the menu, " << filters.size() << " category filters, budgets $5 to $60"
+         << endl;
+    cout << "Table builds: " << restaurant.meals.tableBuilds() << ", " << fixed << setprecision(1) << cold.front()
+         << " to " << cold.back() << " ms each" << endl;
+    cout << queries << " queries from cached tables: p50 " << setprecision(1) << warm[warm.size() / 2] << " us, p99 "
+         << warm[warm.size() * 99 / 100] << " us, max " << warm.back() << " us (" << options << " options returned)"
+         << endl;
+}
 
-        setcolor(10);
-        cout << "Order placed successfully. Order ID: " << order->getId() << endl;
-        setcolor(7);
+bool isNumber(const string& s) {
+    return !s.empty() && all_of(s.begin(), s.end(), ::isdigit);
+}
 
-        saveOrdersToFile("orders.txt");
-    }   
-    void displayOrderDetails(const Order* order) {
-        system("cls");
-        setcolor(11);
-        cout << "\nOrder Details:" << endl;
-        cout << string(50, '-') << endl;
-        cout << "Order ID: " << order->getId() << endl;
-        cout << "Customer Name: " << order->getCustomerName() << endl;
-        cout << "Phone Number: " << order->getPhoneNumber() << endl;
-        cout << "Delivery Address: " << order->getDeliveryAddress() << endl;
-        cout << "Payment Method: " << order->getPaymentInfo() << endl;
-        setcolor(7);      
-        if (!order->getSpecialInstructions().empty()) {
-            cout << "Special Instructions: " << order->getSpecialInstructions() << endl;
-        }      
-        cout << "\nOrdered Items:" << endl;
-        for (const MenuItem* item : order->getItems()) {
-            cout << "- " << item->getName() << " ($" 
-                 << fixed << setprecision(2) << item->getPrice() << ")" << endl;
-        }      
-        cout << "\nTotal Amount: $" << order->getTotal() << endl;
-        cout << "Status: " << order->getStatus() << endl;
-    }    
-    bool validatePhoneNumber(const string& phone) {
-        regex phonePattern(R"(\d{3}-\d{3}-\d{4})");
-        return regex_match(phone, phonePattern);
+// A command-line argument that can't be used; main prints it and exits with 1.
+struct ArgumentError : runtime_error {
+    using runtime_error::runtime_error;
+};
+
+// argv[index] as a whole number from `low` to `high`, or `fallback` when it
+// wasn't given. Digits are counted before parsing, so no length overflows.
+long long numberArgument(int argc, char* argv[], int index, long long fallback, long long low, long long high,
+                         const string& what) {
+    if (index >= argc) return fallback;
+    string text = argv[index];
+    size_t first = text.find_first_not_of('0');
+    string digits = first == string::npos ? "0" : text.substr(first);
+    if (!isNumber(text) || digits.size() > to_string(high).size() || stoll(digits) < low || stoll(digits) > high) {
+        throw ArgumentError(what + " must be a whole number from " + to_string(low) + " to " + to_string(high) +
+                            ", not " + text);
     }
-    void trackOrder(const string& orderId) {
-        auto it = orderHistory.find(orderId);
-        if (it != orderHistory.end()) {
-            Order* order = it->second;
-            system("cls");
-            setcolor(11);
-            cout << "\nOrder Tracking Information" << endl; 
-            cout << string(50, '-') << endl;
-            cout << "Order ID: " << order->getId() << endl;
-            cout << "Customer Name: " << order->getCustomerName() << endl;
-            cout << "Status: " << order->getStatus() << endl;
-            cout << "Delivery Address: " << order->getDeliveryAddress() << endl;
-            setcolor(7);
-            if (!order->getSpecialInstructions().empty()) {
-                cout << "\nSpecial Instructions: " << order->getSpecialInstructions() << endl;
-            }
-            cout << "\nPress ESC to return to main menu..." << endl;
-            int key = _getch();
-            if (key == 27) {
-                system("cls");
-                setcolor(2);
-                cout << "Returning to main menu..." << endl;
-                setcolor(7);
-            }
+    return stoll(digits);
+}
+
+void printUsage() {
+    cout << "Usage:" << endl;
+    cout << "  fooddeliverysystemdsaproject --simulate <stations> [orders.txt [gapSeconds]]" << endl;
+    cout << "  fooddeliverysystemdsaproject --simulate <stations> <orderCount> [ordersPerHour]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-drivers [driverCount]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-dispatch [size]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-routes [gridSide]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-routing [orderCount] [budgetMs]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-items [orderCount]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-menu [lookupCount]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-menu-reload [readers] [reloads]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-history [maxThreads] [opsPerThread]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-order-table [entries ...]" << endl;
+    cout << "  fooddeliverysystemdsaproject --replay-memory [hours] [ordersPerHour]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-compaction [orderCount]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-archive [orderCount]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-values [orderCount]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-pricing [orderCount] [ruleCount]" << endl;
+    cout << "  fooddeliverysystemdsaproject --reprice [threads] [apply]" << endl;
+    cout << "  fooddeliverysystemdsaproject --recommend <budget> [count] [category ...]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-recommend [extraItems] [queries]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-partitions [days] [ordersPerDay]" << endl;
+    cout << "  fooddeliverysystemdsaproject --query \"status=Delivered total=10..50 order=-total\"" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-query [rowCount]" << endl;
+    cout << "  fooddeliverysystemdsaproject --item-stats [itemId]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-item-stats [orderCount] [threads]" << endl;
+    cout << "  fooddeliverysystemdsaproject --distinct [days] [city]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-distinct [customerCount] [orderCount]" << endl;
+    cout << "  fooddeliverysystemdsaproject --search-menu <text ...>" << endl;
+    cout << "  fooddeliverysystemdsaproject --search-customers <text ...>" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-search [nameCount]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-render [frames]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-loop [posts]" << endl;
+    cout << "  fooddeliverysystemdsaproject --serve [socketPath | tcpPort] [pipeline] [speedup]" << endl;
+    cout << "  fooddeliverysystemdsaproject --intake-client <socketPath | tcpPort> [orderCount] [connections] [text|binary]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-intake [orderCount] [connections] [text|binary] [pipeline]" << endl;
+    cout << "  fooddeliverysystemdsaproject --bench-pipeline [orderCount] [slowDiskMicros]" << endl;
+}
+
+// Runs one command from the command line instead of the interactive menu.
+int runHeadless(Restaurant& restaurant, int argc, char* argv[]) {
+    string command = argv[1];
+    if (command == "--simulate" && argc >= 3) {
+        KitchenSimulator sim(restaurant, numberArgument(argc, argv, 2, 1, 1, 9999, "Stations"));
+        string source = argc >= 4 ? argv[3] : "orders.txt";
+        if (isNumber(source)) {
+            long long count = numberArgument(argc, argv, 3, 0, 1, 999999999, "Order count");
+            long long rate = numberArgument(argc, argv, 4, 600, 1, 999999999, "Orders per hour");
+            sim.generate(count, rate, 42);
         } else {
-            setcolor(12);
-            cout << "\nOrder not found!" << endl;
-            cout << "Press ESC to return to main menu or SPACE to try again..." << endl;
-            setcolor(7);           
-            int key = _getch();
-            if (key == 27) {
-                system("cls");
-                setcolor(2);
-                cout << "Returning to main menu..." << endl; 
-                setcolor(7);
-            } else if (key == 32) {
-                system("cls");
-                string newOrderId;
-                setcolor(15);
-                cout << "Enter order ID to track: ";
-                setcolor(7);
-                cin >> newOrderId;
-                trackOrder(newOrderId);
+            int gap = numberArgument(argc, argv, 4, 120, 0, 999999999, "Gap seconds");
+            if (sim.loadFromFile(source, gap) == 0) {
+                cerr << "No orders with items found in " << source << endl;
+                return 1;
             }
         }
+        sim.run();
+        sim.printReport();
+        return 0;
     }
-    void displayAllOrders() {
-        system("cls");
-        loadOrdersFromFile("orders.txt"); // Auto load before displaying
-        if(orderHistory.empty()){
-            setcolor(12);
-            cout << "No orders in history" << endl;
-            cout<<"Press ESC to return to main menu."<<endl;
-            setcolor(7);
-            int key = _getch();
-            if(key == 27){
-                setcolor(2);
-                cout << "Returning to main menu..." << endl;
-                setcolor(7);
-                running = false;
-            } else {
-                setcolor(12);
-                cout << "Invalid input" << endl;
-            }
+    if (command == "--bench-drivers") {
+        int count = numberArgument(argc, argv, 2, 10000, 1, 10000000, "Driver count");
+        benchmarkDriverLookup(count, 20000);
+        return 0;
+    }
+    if (command == "--bench-dispatch") {
+        if (argc >= 3) {
+            benchmarkDispatch(numberArgument(argc, argv, 2, 0, 1, 1000000, "Order count"));
         } else {
-            setcolor(11);
-            cout << "Displaying all orders..." << endl;
-            setcolor(7);
-            for (const auto& pair : orderHistory) {
-                cout << "Order ID: " << pair.first << endl;
-                cout << "Customer Name: " << pair.second->getCustomerName() << endl;
-                cout << "Total Amount: $" << fixed << setprecision(2) << pair.second->getTotal() << endl;
-                cout << "Status: " << pair.second->getStatus() << endl;
-                cout << "-------------------------------" << endl;
-            }
+            benchmarkDispatch(1000);
+            benchmarkDispatch(10000);
         }
+        return 0;
     }
-    void searchOrderById() {   
-        system("cls");
-        loadOrdersFromFile("orders.txt"); // Auto load before searching
-        cout << "Searching for order by ID..." << endl;
-        string orderId;
-        cout << "Enter order ID: ";
-        cin >> orderId;
-        auto it = orderHistory.find(orderId);
-        if (it != orderHistory.end()) {
-            displayOrderDetails(it->second);
-        }
-        else{
-            setcolor(12);
-            cout << "Order not found, try again." << endl;
-            cout << "\nEscape to return to main menu, Space to try again" << endl;
-            setcolor(7);
-            int key = _getch();
-            if(key == 27){
-                setcolor(2);
-                cout << "Returning to main menu..." << endl;
-                setcolor(7);
-                running = false;
-            }
-            else if(key == 32){
-                searchOrderById();
-            }
-            else{
-                setcolor(12);
-                cout << "Invalid input" << endl;
-            }   
-        }
+    if (command == "--bench-routes") {
+        int side = numberArgument(argc, argv, 2, 200, 2, 2000, "Grid side");
+        benchmarkRoutes(side, 10000);
+        return 0;
     }
-    vector<Order*> getOrders() {
-        vector<Order*> orders;
-        for (const auto& pair : orderHistory) {
-            orders.push_back(pair.second);
-        }
-        return orders;
+    if (command == "--bench-routing") {
+        int count = numberArgument(argc, argv, 2, 2000, 1, 1000000, "Order count");
+        int budget = numberArgument(argc, argv, 3, 50, 1, 600000, "Budget milliseconds");
+        benchmarkRouting(count, budget);
+        return 0;
     }
-    void sortOrdersByTotalAmount() {
-        system("cls");
-        loadOrdersFromFile("orders.txt"); // Auto load before sorting
-        cout << "Sorting orders by total amount..." << endl;
-        vector<Order*> orders = getOrders();
-        sort(orders.begin(), orders.end(), [](Order* a, Order* b) {
-            return a->getTotal() < b->getTotal();
-        });
-        for (Order* order : orders) {
-            cout << "Order ID: " << order->getId() << endl;
-            cout << "Customer Name: " << order->getCustomerName() << endl;
-            cout << "Total Amount: $" << fixed << setprecision(2) << order->getTotal() << endl;
-            cout << "Status: " << order->getStatus() << endl;
-            cout << "--------------------------" << endl;
-        }
-    }   
-    void viewOrderHistory() {
-        system("cls");
-        cout << "Order History:" << endl;
-        cout << "1. Display all orders" << endl;
-        cout << "2. Search for an order by ID" << endl;
-        cout << "3. Sort orders by total amount" << endl;
-        cout << "Enter your choice: ";
-        int choice;
-        cin >> choice;
-        switch (choice) {
-            case 1:
-                displayAllOrders();
-                break;
-            case 2:
-                searchOrderById();
-                break;
-            case 3:
-                sortOrdersByTotalAmount();
-                break;
-            default:
-                cout << "Invalid choice. Please try again." << endl;
-        }
-    }   
-    void processOrders() {
-        while (!orderQueue.empty()) {
-            Order* order = orderQueue.pop();
-            processOrders();
-            cout << "Processing order: " << order->getId() << endl;
-            cout << "Customer Name: " << order->getCustomerName() << endl;
-            cout << "Total Amount: $" << fixed << setprecision(2) << order->getTotal() << endl;
-            cout << "Status: " << order->getStatus() << endl;
-            cout << "--------------------------" << endl;
-            order->setStatus("Completed");
-            cout << "Order completed: " << order->getId() << endl;
-            cout << "--------------------------" << endl;
+    if (command == "--bench-items") {
+        int count = numberArgument(argc, argv, 2, 2000000, 1, 100000000, "Order count");
+        benchmarkOrderItems(restaurant, count);
+        return 0;
+    }
+    if (command == "--bench-menu") {
+        int count = numberArgument(argc, argv, 2, 5000000, 1, 1000000000, "Lookup count");
+        benchmarkMenuLookup(restaurant, count);
+        return 0;
+    }
+    if (command == "--bench-menu-reload") {
+        int readers = numberArgument(argc, argv, 2, 4, 1, 64, "Readers");
+        int reloads = numberArgument(argc, argv, 3, 500, 1, 1000000, "Reloads");
+        benchmarkMenuReload(restaurant, readers, reloads);
+        return 0;
+    }
+    if (command == "--bench-history") {
+        int threads = numberArgument(argc, argv, 2, 8, 1, 64, "Threads");
+        int ops = numberArgument(argc, argv, 3, 500000, 1, 100000000, "Operations");
+        benchmarkOrderHistory(threads, ops);
+        return 0;
+    }
+    if (command == "--bench-order-table") {
+        vector<size_t> sizes;
+        for (int i = 2; i < argc; i++) sizes.push_back(numberArgument(argc, argv, i, 0, 1, 100000000, "Order count"));
+        if (sizes.empty()) sizes = {1000000, 10000000};
+        benchmarkOrderTable(sizes);
+        return 0;
+    }
+    if (command == "--replay-memory") {
+        int hours = numberArgument(argc, argv, 2, 24, 1, 8760, "Hours");
+        int rate = numberArgument(argc, argv, 3, 120, 1, 100000, "Orders per hour");
+        replayMemory(restaurant, hours, rate);
+        return 0;
+    }
+    if (command == "--bench-compaction") {
+        int count = numberArgument(argc, argv, 2, 1000, 1, 10000000, "Order count");
+        benchmarkCompaction(restaurant, count);
+        return 0;
+    }
+    if (command == "--bench-archive") {
+        int count = numberArgument(argc, argv, 2, 200000, 1, 10000000, "Order count");
+        benchmarkArchive(restaurant, count);
+        return 0;
+    }
+    if (command == "--bench-values") {
+        int count = numberArgument(argc, argv, 2, 200000, 1, 10000000, "Order count");
+        benchmarkSharedValues(restaurant, count);
+        return 0;
+    }
+    if (command == "--bench-pricing") {
+        int count = numberArgument(argc, argv, 2, 200000, 1, 10000000, "Order count");
+        int rules = numberArgument(argc, argv, 3, 5000, 1, 1000000, "Rule count");
+        benchmarkPricing(restaurant, count, rules);
+        return 0;
+    }
+    if (command == "--recommend" && argc >= 3) {
+        double budget = 0.0;
+        try {
+            budget = stod(argv[2]);
+        } catch (...) {}
+        if (!isfinite(budget) || budget <= 0 || budget > MealRecommender::maxBudget) {
+            cout << "Budget must be a positive amount up to $" << fixed << setprecision(2)
+                 << MealRecommender::maxBudget << "." << endl;
+            return 1;
         }
+        int count = numberArgument(argc, argv, 3, 3, 1, 100, "Option count");
+        vector<string> categories(argv + min(argc, 4), argv + argc);
+        restaurant.displayMealOptions(restaurant.recommendMeals(budget, categories, count));
+        return 0;
     }
-    
-    ~Restaurant() {
-        // Clean up menu items
-        for (const auto& pair : menuMap) {
-            delete pair.second;
+    if (command == "--bench-recommend") {
+        int items = numberArgument(argc, argv, 2, 2000, 0, 100000, "Extra items");
+        int queries = numberArgument(argc, argv, 3, 10000, 1, 10000000, "Queries");
+        benchmarkRecommend(restaurant, items, queries);
+        return 0;
+    }
+    if (command == "--reprice") {
+        unsigned threads = numberArgument(argc, argv, 2, 0, 0, 1024, "Threads");
+        bool apply = argc >= 4 && string(argv[3]) == "apply";
+        restaurant.loadOrderHistory();
+        Restaurant::RepriceSummary summary = restaurant.repriceHistory(threads, apply);
+        cout << summary.orders << " orders quoted in " << fixed << setprecision(1) << summary.seconds * 1000 << " ms on "
+             << summary.threads << (summary.threads == 1 ? " thread; " : " threads; ") << summary.changed << " would cost something else now" << endl;
+        cout << "Charged $" << setprecision(2) << summary.before << ", current rules give $" << summary.after << endl;
+        if (apply) cout << summary.applied << " pending orders took the new total" << endl;
+        return 0;
+    }
+    if (command == "--bench-partitions") {
+        int days = numberArgument(argc, argv, 2, 365, 1, 3650, "Days");
+        int perDay = numberArgument(argc, argv, 3, 500, 1, 1000000, "Orders per day");
+        benchmarkPartitions(restaurant, days, perDay);
+        return 0;
+    }
+    if (command == "--query") {
+        string text;
+        for (int i = 2; i < argc; i++) text += (i > 2 ? " " : "") + string(argv[i]);
+        restaurant.runQuery(text);
+        return 0;
+    }
+    if (command == "--bench-query") {
+        long long rows = numberArgument(argc, argv, 2, 10000000, 1, 1000000000, "Row count");
+        benchmarkQuery(restaurant, static_cast<size_t>(rows));
+        return 0;
+    }
+    if (command == "--item-stats") {
+        restaurant.showItemStats(argc >= 3 ? argv[2] : "");
+        return 0;
+    }
+    if (command == "--bench-item-stats") {
+        int count = numberArgument(argc, argv, 2, 1000000, 1, 100000000, "Order count");
+        int threads = numberArgument(argc, argv, 3, 4, 1, 256, "Threads");
+        benchmarkItemStats(restaurant, count, threads);
+        return 0;
+    }
+    if (command == "--distinct") {
+        int days = numberArgument(argc, argv, 2, 0, 0, 3650, "Days");
+        restaurant.showDistinctCustomers(days, argc >= 4 ? argv[3] : "");
+        return 0;
+    }
+    if (command == "--bench-distinct") {
+        int customers = numberArgument(argc, argv, 2, 200000, 1, 100000000, "Customer count");
+        int count = numberArgument(argc, argv, 3, 1000000, 1, 1000000000, "Order count");
+        benchmarkDistinct(customers, count);
+        return 0;
+    }
+    if (command == "--search-menu" || command == "--search-customers") {
+        string text;
+        for (int i = 2; i < argc; i++) text += (i > 2 ? " " : "") + string(argv[i]);
+        bool menu = command == "--search-menu";
+        vector<NameIndex::Match> matches = menu ? restaurant.searchMenu(text, 10) : restaurant.searchCustomers(text, 10);
+        for (const NameIndex::Match& match : matches) {
+            cout << left << setw(30) << match.name << setw(8) << (menu ? match.key : "") << right << setw(8)
+                 << match.popularity << (match.distance ? "  (" + to_string(match.distance) + " edit)" : "") << endl;
         }
-        // Clean up orders
-        for (const auto& pair : orderHistory) {
-            delete pair.second;
+        if (matches.empty()) cout << "No matches." << endl;
+        return 0;
+    }
+    if (command == "--bench-search") {
+        int count = numberArgument(argc, argv, 2, 100000, 1, 10000000, "Name count");
+        benchmarkSearch(count);
+        return 0;
+    }
+    if (command == "--bench-render") {
+        int frames = numberArgument(argc, argv, 2, 10000, 1, 10000000, "Frames");
+        benchmarkRender(restaurant, frames);
+        return 0;
+    }
+    if (command == "--bench-loop") {
+        int posts = numberArgument(argc, argv, 2, 2000, 1, 10000000, "Posts");
+        benchmarkEventLoop(posts);
+        return 0;
+    }
+    if (command == "--serve") {
+#if defined(__linux__)
+        string address = argc >= 3 ? argv[2] : "intake.sock";
+        IntakeServer server(restaurant);
+        string error;
+        if (!server.listen(address, error)) {
+            cout << error << endl;
+            return 1;
         }
-        // Clean up drivers
-        for (auto driver : availableDrivers) {
-            delete driver;
+        for (int i = 3; i < argc; i++) {
+            string option = argv[i];
+            if (option == "pipeline") {
+                server.usePipeline(OrderPipeline::Config());
+            } else if (isNumber(option)) {
+                restaurant.setDeliverySpeedup(numberArgument(argc, argv, i, 1, 1, 999999, "Speedup"));
+            } else {
+                cerr << "Unknown --serve option: " << option << endl;
+                return 1;
+            }
         }
+        // The kitchen and drivers work between reads, as the timers do in
+        // the interactive session.
+        auto lastFlush = chrono::steady_clock::now();
+        server.every(chrono::seconds(1), [&restaurant, &lastFlush]() {
+            restaurant.processOrdersQuietly();
+            if (chrono::steady_clock::now() - lastFlush >= chrono::seconds(30)) {
+                restaurant.flushArchive();
+                lastFlush = chrono::steady_clock::now();
+            }
+        });
+        static atomic<bool> stop{false};
+        signal(SIGINT, [](int) { stop = true; });
+        signal(SIGTERM, [](int) { stop = true; });
+        cout << "Taking orders on " << address << " (Ctrl+C to stop)" << endl;
+        server.run(stop);
+        const IntakeServer::Stats& stats = server.statistics();
+        cout << stats.accepted << " orders accepted, " << stats.rejected << " rejected, over "
+             << stats.connections << " connections" << endl;
+        cout << restaurant.statusLine() << endl;
+        return 0;
+#else
+        cout << "The intake server needs Linux (epoll)." << endl;
+        return 1;
+#endif
     }
-};
+    if (command == "--intake-client" && argc >= 3) {
+        int count = numberArgument(argc, argv, 3, 100000, 1, 100000000, "Order count");
+        int connections = numberArgument(argc, argv, 4, 4, 1, 1024, "Connections");
+        bool binary = argc >= 6 && string(argv[5]) == "binary";
+        printIntakeLoad(runIntakeLoad(argv[2], restaurant.menuCatalog, count, connections, 256, binary));
+        return 0;
+    }
+    if (command == "--bench-intake") {
+        int count = numberArgument(argc, argv, 2, 500000, 1, 100000000, "Order count");
+        int connections = numberArgument(argc, argv, 3, 4, 1, 1024, "Connections");
+        bool binary = argc >= 5 && string(argv[4]) == "binary";
+        bool pipelined = argc >= 6 && string(argv[5]) == "pipeline";
+        benchmarkIntake(restaurant, count, connections, binary, pipelined);
+        return 0;
+    }
+    if (command == "--bench-pipeline") {
+        int count = numberArgument(argc, argv, 2, 200000, 1, 100000000, "Order count");
+        int slowDisk = numberArgument(argc, argv, 3, 20000, 0, 10000000, "Slow disk microseconds");
+        benchmarkPipeline(restaurant, count, slowDisk);
+        return 0;
+    }
+    printUsage();
+    return 1;
+}
 
 void showtitle(){
     setcolor(7);
@@ -728,7 +10975,7 @@ void showtitle(){
     cout<<"====================================="<<endl;
 }
 void showmenu(){
-    system("cls");
+    clearScreen();
     
     cout << "\n=== Food Delivery System Menu ===" << endl;
     setcolor(14);
@@ -737,7 +10984,8 @@ void showmenu(){
     cout << "3. Track Order" << endl;
     cout << "4. View Order History" << endl;
     cout << "5. Process Orders" << endl;
-    cout << "6. Exit" << endl;
+    cout << "6. Reload Menu and Pricing" << endl;
+    cout << "7. Exit" << endl;
     setcolor(7);
     cout << "-------------------------------------" << endl;
 }
@@ -754,63 +11002,33 @@ void handleInvalidInput() {
     cin.ignore(numeric_limits<streamsize>::max(), '\n');
 }
 
-int main() {
-    showtitle();
+int main(int argc, char* argv[]) {
     Restaurant restaurant;
     
-    // Initialize menu items
-    vector<MenuItem*> menuItems = {
-        new MenuItem("CH1", "Kung Pao Chicken", 15.99, "Chinese Food", 25),
-        new MenuItem("CH2", "Sweet & Sour Pork", 16.99, "Chinese Food", 25),
-        new MenuItem("CH3", "Chow Mein", 13.99, "Chinese Food", 20),
-        new MenuItem("CH4", "Spring Rolls", 7.99, "Chinese Food", 15),
-        new MenuItem("CH5", "Fried Rice", 11.99, "Chinese Food", 20),
-        new MenuItem("IT1", "Spaghetti Carbonara", 14.99, "Italian Food", 25),
-        new MenuItem("IT2", "Fettuccine Alfredo", 15.99, "Italian Food", 25),
-        new MenuItem("IT3", "Lasagna", 16.99, "Italian Food", 30),
-        new MenuItem("IT4", "Risotto", 17.99, "Italian Food", 30),
-        new MenuItem("IT5", "Tiramisu", 8.99, "Italian Dessert", 10),
-        new MenuItem("MX1", "Beef Tacos", 12.99, "Mexican Food", 20),
-        new MenuItem("MX2", "Chicken Quesadilla", 13.99, "Mexican Food", 20),
-        new MenuItem("MX3", "Beef Burrito", 14.99, "Mexican Food", 25),
-        new MenuItem("MX4", "Nachos Supreme", 11.99, "Mexican Food", 15),
-        new MenuItem("MX5", "Guacamole & Chips", 8.99, "Mexican Food", 10),
-        new MenuItem("SF1", "Grilled Salmon", 19.99, "Seafood", 25),
-        new MenuItem("SF2", "Fish & Chips", 16.99, "Seafood", 20),
-        new MenuItem("SF3", "Shrimp Scampi", 18.99, "Seafood", 25),
-        new MenuItem("SF4", "Lobster Tail", 29.99, "Seafood", 35),
-        new MenuItem("SF5", "Calamari", 13.99, "Seafood", 20),
-        new MenuItem("DF1", "Chicken Biryani", 16.99, "Desi Food", 25),
-        new MenuItem("DF2", "Beef Karahi", 18.99, "Desi Food", 30),
-        new MenuItem("DF3", "Chicken Tikka", 14.99, "Desi Food", 20),
-        new MenuItem("DF4", "Seekh Kabab", 12.99, "Desi Food", 15),
-        new MenuItem("DF5", "Nihari", 17.99, "Desi Food", 35),
-        new MenuItem("DF6", "Butter Naan", 2.99, "Desi Food", 10),
-        new MenuItem("DFD1", "Gulab Jamun", 5.99, "Desi Food Dessert", 5),
-        new MenuItem("DFD2", "Kheer", 6.99, "Desi Food Dessert", 15),
-        new MenuItem("DFB1", "Lassi", 4.99, "Desi Food Beverage", 5),
-        new MenuItem("DFB2", "Chai", 2.99, "Desi Food Beverage", 5),
-        new MenuItem("P1", "Margherita Pizza", 12.99, "Pizza", 20),
-        new MenuItem("P2", "Pepperoni Pizza", 14.99, "Pizza", 20),
-        new MenuItem("P3", "BBQ Chicken Pizza", 15.99, "Pizza", 20),
-        new MenuItem("P4", "Vegetarian Pizza", 13.99, "Pizza", 20),
-        new MenuItem("B1", "Classic Burger", 9.99, "Burger", 15),
-        new MenuItem("B2", "Cheese Burger", 11.99, "Burger", 15),
-        new MenuItem("B3", "Veggie Burger", 10.99, "Burger", 15),
-        new MenuItem("S1", "Caesar Salad", 8.99, "Salad", 10),
-        new MenuItem("S2", "Greek Salad", 9.99, "Salad", 10),
-        new MenuItem("D1", "Chocolate Cake", 6.99, "Dessert", 5),
-        new MenuItem("D2", "Ice Cream", 4.99, "Dessert", 5),
-        new MenuItem("D3", "Apple Pie", 5.99, "Dessert", 5),  
-        new MenuItem("BV1", "Mango Juice", 6.99, "Beverage", 5),
-        new MenuItem("BV2", "Lemonade", 4.99, "Beverage", 5),
-        new MenuItem("BV3", "Water", 2.99, "Beverage", 5),
-        new MenuItem("BV4", "Soda", 3.99, "Beverage", 5)
-    };
-    
-    for (auto item : menuItems) {
-        restaurant.addMenuItem(item);
+    // Initialize delivery drivers at their home zip codes
+    restaurant.addDriver(new DeliveryDriver("DRV1", "Imran", restaurant.geocoder.locate("44000")));
+    restaurant.addDriver(new DeliveryDriver("DRV2", "Bilal", restaurant.geocoder.locate("44020")));
+    restaurant.addDriver(new DeliveryDriver("DRV3", "Usman", restaurant.geocoder.locate("46000")));
+    restaurant.addDriver(new DeliveryDriver("DRV4", "Hamza", restaurant.geocoder.locate("46300")));
+    restaurant.addDriver(new DeliveryDriver("DRV5", "Zain", restaurant.geocoder.locate("48800")));
+    restaurant.addDriver(new DeliveryDriver("DRV6", "Saad", restaurant.geocoder.locate("52250")));
+
+    if (argc > 1) {
+        try {
+            return runHeadless(restaurant, argc, argv);
+        } catch (const ArgumentError& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+    }
+    ConsoleRenderer screen;
+    EventLoop loop;
+    if (ConsoleRenderer::enableAnsi()) {
+        screen.attach();
+        restaurant.scheduleBackgroundWork(loop);
+        loop.attach();
     }
+    showtitle();
     
     int choice;
     while (true) {
@@ -823,11 +11041,41 @@ int main() {
         }
         
         switch (choice) {
-            case 1:
+            case 1: {
                 restaurant.displayMenu();
+                string budget, categoryList;
+                cout << "\nBudget for a meal suggestion (press Enter to skip): $";
+                cin.ignore();
+                getline(cin, budget);
+                if (!budget.empty()) {
+                    double amount = 0.0;
+                    try {
+                        amount = stod(budget);
+                    } catch (...) {}
+                    if (!isfinite(amount) || amount <= 0 || amount > MealRecommender::maxBudget) {
+                        setcolor(12);
+                        cout << "Budget must be a positive amount up to $" << fixed << setprecision(2)
+                             << MealRecommender::maxBudget << "." << endl;
+                        setcolor(7);
+                        cout << "\nPress any key to return to main menu...";
+                        readKey();
+                        break;
+                    }
+                    cout << "Categories, comma separated (press Enter for any): ";
+                    getline(cin, categoryList);
+                    vector<string> categories;
+                    stringstream ss(categoryList);
+                    string category;
+                    while (getline(ss, category, ',')) {
+                        size_t b = category.find_first_not_of(' '), e = category.find_last_not_of(' ');
+                        if (b != string::npos) categories.push_back(category.substr(b, e - b + 1));
+                    }
+                    restaurant.displayMealOptions(restaurant.recommendMeals(amount, categories, 3));
+                }
                 cout << "\nPress any key to return to main menu...";
-                _getch();
+                readKey();
                 break;
+            }
             case 2: {
                 string customerName, phoneNumber;
                 cout << "Enter customer name: ";
@@ -875,22 +11123,30 @@ int main() {
                 if (!specialInstructions.empty()) {
                     order->setSpecialInstructions(specialInstructions);
                 }
+                restaurant.displayMenu();
                 while (true) {
-                    restaurant.displayMenu();
-                    string itemId;
-                    cout << "\nEnter item ID (or 'done' to finish): ";
-                    cin >> itemId;                 
-                    if (itemId == "done") break;
-                    // lookup item in menu
-                    if(restaurant.menuMap.find(itemId) != restaurant.menuMap.end()) {
-                        order->addItem(restaurant.menuMap[itemId]);
-                    } else {
-                        cout << "Invalid item ID, try again." << endl;
+                    string itemText;
+                    cout << "\nEnter item ID or name ('menu' to list, 'done' to finish): ";
+                    if (!getline(cin, itemText) || itemText == "done") break;
+                    if (itemText.empty()) continue;
+                    if (itemText == "menu") {
+                        restaurant.displayMenu();
+                        continue;
+                    }
+                    if (MenuItem* item = restaurant.pickMenuItem(itemText)) {
+                        order->addItem(item);
+                        setcolor(10);
+                        cout << "Added " << item->getName() << " (" << order->getItemCount() << " items, $"
+                             << fixed << setprecision(2) << order->getTotal() << ")" << endl;
+                        setcolor(7);
                     }
                 } 
+                PriceQuote quote = restaurant.priceOrder(*order);
                 restaurant.displayOrderDetails(order); 
+                cout << endl;
+                restaurant.displayPriceBreakdown(quote);
                 cout << "\nPress any key to continue...";
-                _getch();          
+                readKey();          
                 restaurant.placeOrder(order);
                 
                 break;
@@ -907,14 +11163,27 @@ int main() {
             case 4:
                 restaurant.viewOrderHistory();
                 cout << "\nPress any key to return to main menu...";
-                _getch();
+                readKey();
                 break;
             case 5:
                 restaurant.processOrders();
                 cout << "\nPress any key to return to main menu...";
-                _getch();
+                readKey();
                 break;
-            case 6:
+            case 6: {
+                string filename;
+                setcolor(15);
+                cout << "Menu file (press Enter for menu.txt): ";
+                setcolor(7);
+                cin.ignore();
+                getline(cin, filename);
+                restaurant.reloadMenu(filename.empty() ? "menu.txt" : filename);
+                restaurant.reloadPricing("pricing.txt");
+                cout << "\nPress any key to return to main menu...";
+                readKey();
+                break;
+            }
+            case 7:
                 setcolor(5);
                 cout << "Thank you for using the Food Ordering System!" << endl;
                 setcolor(7);